@@ -0,0 +1,124 @@
+#include "cpu.h"
+#include "memory_map.h"
+#include "opcode_array.h"
+#include "opcode_size.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/* Measures what dirty page tracking (see memory_map.h) costs the opcodes that
+ * store to memory.  A store-heavy loop is run for the same number of
+ * instructions with tracking off, which is what everything pays whether it
+ * uses it or not, and on.  The resulting states are checked against each
+ * other.
+ *
+ * Usage: dirty_benchmark [millions of instructions per run]
+ */
+
+// Every kind of store, to a spread of pages.
+static const uint8_t store_loop[] = {
+		0x31, 0x00, 0x80, // 0x00	LXI SP, 0x8000
+		0x21, 0x00, 0x40, // 0x03	LXI H, 0x4000
+		0x77,		  // 0x06	MOV M, A
+		0x23,		  // 0x07	INX H
+		0x75,		  // 0x08	MOV M, L
+		0x23,		  // 0x09	INX H
+		0x22, 0x00, 0x50, // 0x0a	SHLD 0x5000
+		0x32, 0x00, 0x51, // 0x0d	STA 0x5100
+		0xe5,		  // 0x10	PUSH H
+		0xd1,		  // 0x11	POP D
+		0xcd, 0x20, 0x00, // 0x12	CALL 0x0020
+		0x7c,		  // 0x15	MOV A, H
+		0xfe, 0x60,	  // 0x16	CPI 0x60
+		0xda, 0x06, 0x00, // 0x18	JC 0x0006
+		0xc3, 0x03, 0x00, // 0x1b	JMP 0x0003
+		0x00,		  // 0x1e	NOP
+		0x00,		  // 0x1f	NOP
+		0x3c,		  // 0x20	INR A
+		0xc9,		  // 0x21	RET
+};
+
+struct result
+{
+	double seconds;
+	int dirty; // Pages taken from the bitmap afterwards.
+	uint16_t psw, bc, de, hl, sp;
+	uint32_t memory_hash;
+};
+
+static struct result run(int track, long count)
+{
+	static uint8_t memory[MAX_MEMORY + 2];
+	static struct memory_map map;
+	memset(memory, 0, sizeof(memory));
+	memcpy(memory, store_loop, sizeof(store_loop));
+	memory_map_init(&map, memory);
+	memory_map_set(&map, 0x0000, PAGE_SIZE, PAGE_ROM);
+	memory_map_track_dirty(&map, track);
+	struct cpu_state cpu = {.memory = memory,
+			.rom_mask	     = map.type,
+			.mask_shift	     = PAGE_SHIFT,
+			.memory_map	     = &map};
+
+	struct timespec start, end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (long i = 0; i < count; ++i)
+	{
+		const uint8_t* opcode = cpu.memory + cpu.pc;
+		cpu.pc += get_opcode_size(*opcode);
+		opcodes[*opcode](opcode, &cpu);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	uint32_t hash = 2166136261u;
+	for (uint32_t address = 0; address < MAX_MEMORY; ++address)
+		hash = (hash ^ memory[address]) * 16777619u;
+	return (struct result){
+			.seconds = (end.tv_sec - start.tv_sec)
+				   + (end.tv_nsec - start.tv_nsec) / 1e9,
+			.dirty	     = memory_map_take_dirty(&map, NULL),
+			.psw	     = cpu.psw,
+			.bc	     = cpu.bc,
+			.de	     = cpu.de,
+			.hl	     = cpu.hl,
+			.sp	     = cpu.sp,
+			.memory_hash = hash};
+}
+
+static int same(const struct result* a, const struct result* b)
+{
+	return a->psw == b->psw && a->bc == b->bc && a->de == b->de
+	       && a->hl == b->hl && a->sp == b->sp
+	       && a->memory_hash == b->memory_hash;
+}
+
+int main(int argc, char** argv)
+{
+	long count = (argc > 1 ? atol(argv[1]) : 100) * 1000000;
+	if (count <= 0)
+	{
+		fprintf(stderr, "Usage: %s [millions of instructions]\n", *argv);
+		return 1;
+	}
+
+	printf("%ld instructions per run; positive is a slowdown for "
+	       "tracking.\n",
+			count);
+	struct result off = run(0, count);
+	struct result on  = run(1, count);
+	printf("stores   off: %6.2f ns/op   on: %6.2f ns/op   (%+.1f%%), "
+	       "%d dirty pages\n",
+			off.seconds * 1e9 / count,
+			on.seconds * 1e9 / count,
+			(on.seconds / off.seconds - 1) * 100,
+			on.dirty);
+	if (!same(&off, &on) || off.dirty || !on.dirty)
+	{
+		fprintf(stderr, "Tracking changed the results!\n");
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,162 @@
+#include "cpu.h"
+#include "lazy_flags.h"
+#include "opcode_array.h"
+#include "opcode_size.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/* Compares eager and lazy flag evaluation on a couple of small 8080 loops.
+ * Each loop is run for the same number of instructions with both sets of
+ * handlers, and the resulting CPU states are checked against each other.
+ *
+ * Usage: flag_benchmark [millions of instructions per run]
+ */
+
+// Mostly ALU work, with the flags only read once per trip around the loop.
+static const uint8_t alu_loop[] = {
+		0x06, 0x00,	  // 0x00	MVI B, 0
+		0x0e, 0x01,	  // 0x02	MVI C, 1
+		0x78,		  // 0x04	MOV A, B
+		0x81,		  // 0x05	ADD C
+		0x4f,		  // 0x06	MOV C, A
+		0xaa,		  // 0x07	XRA D
+		0x57,		  // 0x08	MOV D, A
+		0xc6, 0x35,	  // 0x09	ADI 0x35
+		0xe6, 0x7f,	  // 0x0b	ANI 0x7f
+		0xb3,		  // 0x0d	ORA E
+		0x5f,		  // 0x0e	MOV E, A
+		0x95,		  // 0x0f	SUB L
+		0x47,		  // 0x10	MOV B, A
+		0x24,		  // 0x11	INR H
+		0x2d,		  // 0x12	DCR L
+		0xc2, 0x04, 0x00, // 0x13	JNZ 0x0004
+		0xc3, 0x04, 0x00, // 0x16	JMP 0x0004
+};
+
+// A counting loop which reads the flags every few instructions.
+static const uint8_t compare_loop[] = {
+		0x2c,		  // 0x00	INR L
+		0x7d,		  // 0x01	MOV A, L
+		0xfe, 0x80,	  // 0x02	CPI 0x80
+		0xda, 0x00, 0x00, // 0x04	JC 0x0000
+		0x2e, 0x00,	  // 0x07	MVI L, 0
+		0xc3, 0x00, 0x00, // 0x09	JMP 0x0000
+};
+
+// ALU work on a 4KB buffer of pseudo-random bytes, so the operands are all
+// over the place.  The flags are read once per trip, and only for the carry.
+static const uint8_t data_loop[] = {
+		0x21, 0x00, 0x10, // 0x00	LXI H, 0x1000
+		0x7e,		  // 0x03	MOV A, M
+		0x23,		  // 0x04	INX H
+		0x86,		  // 0x05	ADD M
+		0x23,		  // 0x06	INX H
+		0x96,		  // 0x07	SUB M
+		0x23,		  // 0x08	INX H
+		0xae,		  // 0x09	XRA M
+		0x4f,		  // 0x0a	MOV C, A
+		0x7c,		  // 0x0b	MOV A, H
+		0xfe, 0x20,	  // 0x0c	CPI 0x20
+		0xda, 0x03, 0x00, // 0x0e	JC 0x0003
+		0xc3, 0x00, 0x00, // 0x11	JMP 0x0000
+};
+
+struct result
+{
+	double seconds;
+	uint16_t psw, bc, de, hl;
+};
+
+static struct result run(const uint8_t* program,
+		size_t size,
+		int (*table[256])(const uint8_t*, struct cpu_state*),
+		long count)
+{
+	static uint8_t memory[MAX_MEMORY + 2];
+	static const uint8_t rom_mask[1];
+	memset(memory, 0, sizeof(memory));
+	memcpy(memory, program, size);
+	srand(8080);
+	for (int i = 0x1000; i < 0x2000; ++i) memory[i] = rand();
+	struct cpu_state cpu = {.memory = memory,
+			.rom_mask	     = rom_mask,
+			.mask_shift	     = 16};
+
+	struct timespec start, end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (long i = 0; i < count; ++i)
+	{
+		const uint8_t* opcode = cpu.memory + cpu.pc;
+		cpu.pc += get_opcode_size(*opcode);
+		table[*opcode](opcode, &cpu);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	materialize_flags(&cpu);
+	return (struct result){
+			.seconds = (end.tv_sec - start.tv_sec)
+				   + (end.tv_nsec - start.tv_nsec) / 1e9,
+			.psw = cpu.psw,
+			.bc  = cpu.bc,
+			.de  = cpu.de,
+			.hl  = cpu.hl};
+}
+
+static int compare(const char* name,
+		const uint8_t* program,
+		size_t size,
+		int (*lazy_opcodes[256])(const uint8_t*, struct cpu_state*),
+		long count)
+{
+	struct result eager = run(program, size, opcodes, count);
+	struct result lazy  = run(program, size, lazy_opcodes, count);
+	printf("%-8s eager: %6.2f ns/op   lazy: %6.2f ns/op   (%+.1f%%)\n",
+			name,
+			eager.seconds * 1e9 / count,
+			lazy.seconds * 1e9 / count,
+			(eager.seconds / lazy.seconds - 1) * 100);
+	if (eager.psw != lazy.psw || eager.bc != lazy.bc
+			|| eager.de != lazy.de || eager.hl != lazy.hl)
+	{
+		fprintf(stderr, "%s: eager and lazy results differ!\n", name);
+		return 1;
+	}
+	return 0;
+}
+
+int main(int argc, char** argv)
+{
+	long count = (argc > 1 ? atol(argv[1]) : 100) * 1000000;
+	if (count <= 0)
+	{
+		fprintf(stderr, "Usage: %s [millions of instructions]\n", *argv);
+		return 1;
+	}
+
+	int (*lazy_opcodes[256])(const uint8_t*, struct cpu_state*);
+	memcpy(lazy_opcodes, opcodes, sizeof(lazy_opcodes));
+	install_lazy_flag_opcodes(lazy_opcodes);
+
+	printf("%ld instructions per run; positive is a speedup for lazy.\n",
+			count);
+	int failed = compare("alu",
+			alu_loop,
+			sizeof(alu_loop),
+			lazy_opcodes,
+			count);
+	failed |= compare("compare",
+			compare_loop,
+			sizeof(compare_loop),
+			lazy_opcodes,
+			count);
+	failed |= compare("data",
+			data_loop,
+			sizeof(data_loop),
+			lazy_opcodes,
+			count);
+	return failed;
+}
@@ -1,3 +1,4 @@
+#include "control.h"
 #include "cpu.h"
 
 #include <assert.h>
@@ -43,9 +44,11 @@ int hw_in(const uint8_t* opcode, struct cpu_state* cpu)
 			// carriage return. We actually only need carriage 
 			// return, so we replace it.
 			case '\n': cpu->a = '\r'; break;
-			case 0x04:			       // FALLTHRU (^D)
-			case 0x1c:			       // FALLTHRU (^\)
-			case 0x1b: *cpu->quit_flag = 1; break; // ESC
+			case 0x04: // FALLTHRU (^D)
+			case 0x1c: // FALLTHRU (^\)
+			case 0x1b: // ESC
+				control_request(cpu->control, CONTROL_QUIT);
+				break;
 			default: cpu->a = input; break;
 			}
 		}
@@ -12,7 +12,9 @@ void update_keystates(void* t_struct, SDL_Event* event)
 	{
 		switch (event->key.keysym.scancode)
 		{
-		case SDL_SCANCODE_R: *(tStruct->reset_flag) = 1; break;
+		case SDL_SCANCODE_R:
+			control_request(tStruct->control, CONTROL_RESET);
+			break;
 		case SDL_SCANCODE_C: rStruct->coin = 0; break;
 		case SDL_SCANCODE_S: rStruct->p1_start = 1; break;
 		case SDL_SCANCODE_DOWN: rStruct->p2_start = 1; break;
@@ -1,6 +1,12 @@
 #ifndef SCREEN_TIMER_H
 #define SCREEN_TIMER_H
 
-void screen_timer();
+#include "scheduler.h"
+#include "taito_struct.h"
+
+// Adds the timed events which raise the video interrupts and hand finished
+// frames to the front end.  See scheduler.h.
+void screen_timer_start(
+		struct scheduler* scheduler, struct taito_struct* tstruct);
 
 #endif
@@ -4,7 +4,7 @@
 extern "C"
 {
 #include "cpu.h"
-#include "screen_timer.h"
+#include "cycle_timer.h"
 #include "taito_struct.h"
 }
 
@@ -14,9 +14,6 @@ extern "C"
 #include <SDL2/SDL_image.h>
 #include <SDL2/SDL_mixer.h>
 
-#define RST1 (0xcf)
-#define RST2 (0xd7)
-
 #define TAITO_SCREEN_WIDTH  256
 #define TAITO_SCREEN_HEIGHT 224
 #define WINDOW_SCALE_FACTOR 3
@@ -41,6 +38,14 @@ extern "C"
 // beginning of the second half of the screen, as it pertains to interrupts.
 #define SCREEN_DIVIDE_ROW 97
 
+// Without vsync, the longest the front end waits for the CPU to finish a frame,
+// in nanoseconds, before it handles input and redraws the last one anyway.
+#define FRAME_WAIT_LIMIT (50000000l)
+
+// The time between frames at the Taito hardware's 60Hz, in nanoseconds.  Fast-
+// forwarding without vsync, we draw a frame no more often than this.
+#define FRAME_PERIOD (16683350l)
+
 enum sideOfScreen
 {
 	TOP,
@@ -52,13 +57,12 @@ class TaitoScreen
       private:
 	struct taito_struct* const tStruct;
 
-	pthread_mutex_t* const interruptLock;
-	pthread_cond_t* const interruptCond;
-	Uint8* const interruptBuffer;
+	struct interrupt_controller* const interrupts;
 
-	// A pointer to the beginning of the video buffer that the
-	// 8080 thread will write taito video data to
-	const Uint8* const taitoVideoBuffer;
+	// The vbuffer we're drawing from, which the 8080 thread finished
+	// writing taito video data to (see taito_struct.h), and its index.
+	const Uint8* taitoVideoBuffer;
+	uint8_t reading;
 	// The translated version of the taitoVideoBuffer. Expanded to 1 byte
 	// per pixel
 	Uint16* displayBuffer;
@@ -66,7 +70,13 @@ class TaitoScreen
 	pthread_mutex_t* const vidBufferLock;
 	pthread_cond_t* const vidBufferCond;
 	pthread_mutex_t* const keystateLock;
-	pthread_mutex_t* const resetQuitLock;
+	// The last frame we took from the video buffer.
+	uint64_t frame;
+	// Whether SDL_RenderPresent() waits for the display's refresh.
+	int vsync;
+	// Without vsync, the earliest we draw another frame while
+	// fast-forwarding.
+	struct timespec nextDraw;
 
 	// SDL objects used to create a window and render graphics to it
 	SDL_Window* window;
@@ -89,6 +99,9 @@ class TaitoScreen
 	int getCurrColorMask();
 
 	// managing frame renders
+	int fastForward();
+	int frameReady();
+	int takeFrame();
 	void videoRamToTaitoBuffer(sideOfScreen);
 	void renderFrame();
 	void renderSurface(SDL_Surface*);
@@ -99,7 +112,6 @@ class TaitoScreen
 	void configureDisplayRect();
 
 	// other
-	void sendInterrupt(Uint8 interruptCode);
 	Uint8* getColorMaskFromProm(const unsigned char* const);
 };
 
@@ -1,29 +1,95 @@
 #ifndef TAITO_STRUCT
 #define TAITO_STRUCT
 
+#include "control.h"
+#include "interrupts.h"
+#include "metrics.h"
+
 #include <pthread.h>
 #include <stdint.h>
 
+struct cycle_timer;
+
+// The size of one copy of video memory.
+#ifndef VBUFFER_SIZE
+#	define VBUFFER_SIZE (1024 * 7)
+#endif
+
+/* Finished frames go from the CPU thread to the front end through three
+ * buffers, so that neither ever waits for the other: the CPU thread copies
+ * video memory into one, the front end draws from another, and the third
+ * holds the latest finished frame.  Finishing a frame swaps the CPU thread's
+ * buffer for the latest one; taking a frame swaps the front end's buffer for
+ * the latest one, if that's newer.  Either way it's a single atomic exchange,
+ * so a front end that's stuck in SDL_RenderPresent() holds nothing up: the
+ * CPU thread just carries on overwriting the frames it isn't drawing.
+ */
+#define VBUFFERS      (3)
+#define VBUFFER_FRESH (0x80) // Set in vbuffer_latest until it's been taken.
+
 struct taito_struct
 {
+	// Only a front end waiting for a frame takes the lock, to sleep on
+	// vbuffer_cond until there's a new one.
 	pthread_mutex_t* const vbuffer_lock;
 	pthread_cond_t* const vbuffer_cond;
-	uint8_t* const vbuffer;
+	uint8_t* const vbuffer; // VBUFFERS of VBUFFER_SIZE bytes.
+	uint8_t vbuffer_write;	// The CPU thread's buffer.
+	uint8_t vbuffer_latest; // The latest frame's, maybe with VBUFFER_FRESH.
+	// The number of the frame in each buffer, and of the last finished.
+	uint64_t vbuffer_frame[VBUFFERS];
+	uint64_t frames;
+	// The front end's metrics (see metrics.h): frames it drew, frames it
+	// never got to because a newer one came first, and how often it and
+	// the CPU thread got in each other's way over vbuffer_lock.
+	uint64_t* const frames_rendered;
+	uint64_t* const frames_dropped;
+	struct lock_metrics vbuffer_waits;
 	void* const rom_struct;
-	uint8_t* const interrupt_buffer;
-	pthread_mutex_t* const interrupt_lock;
-	pthread_cond_t* const interrupt_cond;
+	struct interrupt_controller* const interrupts;
 	pthread_mutex_t* const keystate_lock;
 	pthread_mutex_t* const sound_lock;
-	pthread_mutex_t* const reset_quit_lock;
-	uint8_t* const reset_flag;
-	uint8_t* const quit_flag;
+	uint8_t* const control;
+	// For fast-forward and slow motion (see cycle_timer_set_rate()).
+	struct cycle_timer* const timer;
 	uint8_t const (*const proms)[896];
 	uint8_t const num_proms;
 };
 
 struct taito_struct* create_taito_struct(struct system_resources*, void*);
 
+// The CPU thread's buffer, to copy video memory into.
+static inline uint8_t* vbuffer_for_writing(struct taito_struct* tstruct)
+{
+	return tstruct->vbuffer + tstruct->vbuffer_write * VBUFFER_SIZE;
+}
+
+// Hands the CPU thread's buffer to the front end, as the latest frame.
+static inline void vbuffer_publish(struct taito_struct* tstruct)
+{
+	const uint8_t written		= tstruct->vbuffer_write;
+	tstruct->vbuffer_frame[written] = ++tstruct->frames;
+	const uint8_t latest		= __atomic_exchange_n(
+			   &tstruct->vbuffer_latest,
+			   written | VBUFFER_FRESH,
+			   __ATOMIC_ACQ_REL);
+	tstruct->vbuffer_write = latest & ~VBUFFER_FRESH;
+}
+
+/* Swaps the front end's buffer, at *reading, for the latest frame, if there's
+ * been one since it last looked.  Returns whether there was.
+ */
+static inline int vbuffer_take(struct taito_struct* tstruct, uint8_t* reading)
+{
+	if (!(__atomic_load_n(&tstruct->vbuffer_latest, __ATOMIC_ACQUIRE)
+			    & VBUFFER_FRESH))
+		return 0;
+	const uint8_t latest = __atomic_exchange_n(
+			&tstruct->vbuffer_latest, *reading, __ATOMIC_ACQ_REL);
+	*reading = latest & ~VBUFFER_FRESH;
+	return 1;
+}
+
 void destroy_taito_struct(struct taito_struct*);
 
 #endif
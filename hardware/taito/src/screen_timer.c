@@ -1,57 +1,80 @@
-#include <errno.h>
+#include "screen_timer.h"
+
+#include "cpu.h"
+#include "interrupts.h"
+#include "metrics.h"
+#include "scheduler.h"
+#include "taito_struct.h"
+
+#include <pthread.h>
 #include <stdint.h>
-#include <time.h>
+#include <string.h>
 
 /* The Taito screen has 262 'lines'.  These do not translate 1:1 into
  * real TV scanlines (there are 525 of those,) but that's fine.  We're
  * only interested in the timing, here.
  *
- * NTSC color screens run at 59.94Hz.  That means that each frame
- * will take 16,183,350.02 nanoseconds.  Divided by our 262 lines,
- * that gives us a time of 63,676.908 nanoseconds per line.
- * Now the interrupt timing.
+ * NTSC color screens run at 59.94Hz, so at 2MHz, each frame takes
+ * 33,367 cycles: 127.35 cycles per line.  Now the interrupt timing.
  *
  * According to the MAME people (in the comments of mw8080bw.cpp),
  * The first interrupt (0xcf) is sent after line 96.  The second interrupt
- * is sent after line 224.  That leaves the 38 line VBLANK period counting
- * as effectively part of the the first interval.  So we have 134 line
- * intervals for the top half (96 + 38) and 128 for the second.
+ * is sent after line 224.  The remaining 38 lines are the VBLANK period.
  *
- * This works out to roughly 8 milliseconds for each half, but there's a
- * ~5% difference, which seems too large to handwave, so we'll use
- * nanosleep() to at least aim for the exact target time.
+ * These are timed events on the CPU's own clock (see scheduler.h), rather than
+ * sleeps on the wall clock in the front end.  So the interrupts come at the
+ * same point in the program however fast the CPU is running, and the front
+ * end has nothing to do with timing: it just draws whichever frame was
+ * finished last (see taito_struct.h).
  */
-#define NS_PER_LINE 63677
+#define CYCLES_PER_FRAME (33367)
+#define FRAME_LINES	 (262)
+#define TOP_CYCLES	 (96 * CYCLES_PER_FRAME / FRAME_LINES)
+#define BOTTOM_CYCLES	 (224 * CYCLES_PER_FRAME / FRAME_LINES)
+
+#define VIDEO_MEMORY_OFFSET	 0x2400
+#define VIDEO_MEMORY_TOP_SIZE	 0xC00
+#define VIDEO_MEMORY_BOTTOM_SIZE 0x1000
 
-#define TOP_LINES    134
-#define BOTTOM_LINES 128
+#define LINE_96_INTERRUPT  0xcf
+#define LINE_224_INTERRUPT 0xd7
+
+/* After line 96, the top of the screen has been drawn, so we copy the top of
+ * video memory into our vbuffer.  It's ours alone until it's published, so
+ * there's no need for a lock.
+ */
+static uint64_t line_96(struct cpu_state* cpu, void* data, uint64_t when)
+{
+	struct taito_struct* tstruct = (struct taito_struct*) data;
+	memcpy(vbuffer_for_writing(tstruct),
+			cpu->memory + VIDEO_MEMORY_OFFSET,
+			VIDEO_MEMORY_TOP_SIZE);
+	interrupt_raise_opcode(cpu->interrupts, LINE_96_INTERRUPT);
+	return when + CYCLES_PER_FRAME;
+}
+
+/* And after line 224, the rest of it, which makes a whole frame for the front
+ * end to draw.  If it's waiting for one, we wake it up: it only ever holds the
+ * lock for long enough to look at vbuffer_latest.
+ */
+static uint64_t line_224(struct cpu_state* cpu, void* data, uint64_t when)
+{
+	struct taito_struct* tstruct = (struct taito_struct*) data;
+	memcpy(vbuffer_for_writing(tstruct) + VIDEO_MEMORY_TOP_SIZE,
+			cpu->memory + VIDEO_MEMORY_OFFSET
+					+ VIDEO_MEMORY_TOP_SIZE,
+			VIDEO_MEMORY_BOTTOM_SIZE);
+	vbuffer_publish(tstruct);
+	metrics_lock(tstruct->vbuffer_lock, &tstruct->vbuffer_waits);
+	pthread_cond_broadcast(tstruct->vbuffer_cond);
+	pthread_mutex_unlock(tstruct->vbuffer_lock);
+	interrupt_raise_opcode(cpu->interrupts, LINE_224_INTERRUPT);
+	return when + CYCLES_PER_FRAME;
+}
 
-void screen_timer()
+void screen_timer_start(
+		struct scheduler* scheduler, struct taito_struct* tstruct)
 {
-	static uint8_t is_bottom;
-	static struct timespec target;
-
-	// Initialize the timer on first call.
-	if (target.tv_sec == 0 && target.tv_nsec == 0)
-	{
-		clock_gettime(CLOCK_MONOTONIC, &target);
-		// If this is the first call, then there's no need to sleep.
-		// This is simply the baseline time on which all future calls
-		// will increment.
-		is_bottom = 1;
-		return;
-	}
-
-	target.tv_nsec += is_bottom ? BOTTOM_LINES * NS_PER_LINE
-				    : TOP_LINES * NS_PER_LINE;
-
-	if (target.tv_nsec >= 1000000000)
-	{
-		++target.tv_sec;
-		target.tv_nsec -= 1000000000;
-	}
-	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &target, NULL)
-			&& errno == EINTR)
-		;
-	is_bottom = !is_bottom;
+	scheduler_add(scheduler, TOP_CYCLES, line_96, tstruct);
+	scheduler_add(scheduler, BOTTOM_CYCLES, line_224, tstruct);
 }
@@ -3,18 +3,16 @@
 #include "hw_lib_imports.h"
 
 #include <iostream>
+#include <time.h>
 
 TaitoScreen::TaitoScreen(struct taito_struct* tStruct)
-    : tStruct(tStruct), interruptLock(tStruct->interrupt_lock),
-      interruptCond(tStruct->interrupt_cond),
-      interruptBuffer(tStruct->interrupt_buffer),
-      taitoVideoBuffer(tStruct->vbuffer), vidBufferLock(tStruct->vbuffer_lock),
+    : tStruct(tStruct), interrupts(tStruct->interrupts),
+      taitoVideoBuffer(tStruct->vbuffer + VBUFFER_SIZE), reading(1),
+      vidBufferLock(tStruct->vbuffer_lock),
       vidBufferCond(tStruct->vbuffer_cond),
-      keystateLock(tStruct->keystate_lock),
-      resetQuitLock(tStruct->reset_quit_lock), numColorMasks(tStruct->num_proms)
+      keystateLock(tStruct->keystate_lock), frame(0), vsync(0),
+      nextDraw(), numColorMasks(tStruct->num_proms)
 {
-	pthread_mutex_lock(this->vidBufferLock);
-
 	/* this displayBuffer will contain a translation of the space invader's
 	 * video RAM. The video RAM is one bit per pixel, but this buffer
 	 * will contain one byte per pixel. This will allow us to impart some
@@ -64,15 +62,22 @@ TaitoScreen::TaitoScreen(struct taito_struct* tStruct)
 	Mix_ReserveChannels(9);
 
 	// An SDL renderer is associated with a window. It is the object that
-	// refreshes the window or sections of the window
-	this->renderer = SDL_CreateRenderer(
-			this->window, -1, SDL_RENDERER_ACCELERATED);
+	// refreshes the window or sections of the window.  We ask for vsync,
+	// which SDL_RENDER_VSYNC=0 in the environment turns off, and then see
+	// whether we got it.
+	this->renderer = SDL_CreateRenderer(this->window,
+			-1,
+			SDL_RENDERER_ACCELERATED | SDL_RENDERER_PRESENTVSYNC);
 	if (renderer == NULL)
 	{
 		std::cout << "Could not load SDL renderer. " << SDL_GetError()
 			  << std::endl;
 		exit(1);
 	}
+	SDL_RendererInfo rendererInfo;
+	if (SDL_GetRendererInfo(this->renderer, &rendererInfo) == 0)
+		this->vsync = !!(rendererInfo.flags
+				 & SDL_RENDERER_PRESENTVSYNC);
 
 	/* An SDL surface is needed to manage memory-mapped pixel data. When
 	 * a screen refresh is needed, the surface object is used in conjunction
@@ -184,14 +189,83 @@ void TaitoScreen::setCurrColorMask(int maskIndex)
 	// return a status success/fail value?
 }
 
-void TaitoScreen::sendInterrupt(Uint8 interruptCode)
+int TaitoScreen::fastForward()
+{
+	// Unthrottled, or in turbo, the CPU runs as fast as it can.
+	return !this->tStruct->timer->throttled
+	       || (control_pending(this->tStruct->control) & CONTROL_TURBO)
+	       || cycle_timer_rate(this->tStruct->timer) > RATE_NORMAL;
+}
+
+int TaitoScreen::frameReady()
+{
+	return __atomic_load_n(&this->tStruct->vbuffer_latest, __ATOMIC_ACQUIRE)
+	       & VBUFFER_FRESH;
+}
+
+int TaitoScreen::takeFrame()
 {
-	pthread_mutex_lock(this->interruptLock);
-	if (*this->interruptBuffer)
-		pthread_cond_wait(this->interruptCond, this->interruptLock);
-	*this->interruptBuffer = interruptCode;
-	pthread_mutex_unlock(this->interruptLock);
-	pthread_cond_wait(this->vidBufferCond, this->vidBufferLock);
+	/* Take the latest frame the CPU thread has finished (see
+	 * taito_struct.h), if it's new, and translate it.  If it's finished
+	 * several since we last looked, because it's running unthrottled or
+	 * we've been held up, we only draw the latest.
+	 *
+	 * With vsync, SDL_RenderPresent() paces us at the display's refresh
+	 * rate, whatever the emulated one, so we never wait here: without a
+	 * new frame, we draw the last one again.  Without it, we wait for the
+	 * next frame, but not for more than a couple of frames' time, so that
+	 * there's still input handling if the CPU stops producing them.
+	 *
+	 * Fast-forwarding, the CPU finishes frames faster than a display
+	 * could show them.  With vsync, we draw the latest a refresh, as
+	 * ever; without, we wait a frame's time before taking another, so
+	 * that we draw every Nth frame at N times the speed, rather than
+	 * spending the time the CPU could use drawing them all.
+	 *
+	 * Returns whether there was a new frame to take.
+	 */
+	if (!this->vsync && this->fastForward())
+		clock_nanosleep(CLOCK_MONOTONIC,
+				TIMER_ABSTIME,
+				&this->nextDraw,
+				NULL);
+	if (!this->vsync && !this->frameReady())
+	{
+		struct timespec deadline;
+		clock_gettime(CLOCK_REALTIME, &deadline);
+		deadline.tv_nsec += FRAME_WAIT_LIMIT;
+		if (deadline.tv_nsec >= 1000000000)
+		{
+			deadline.tv_nsec -= 1000000000;
+			++deadline.tv_sec;
+		}
+		metrics_lock(this->vidBufferLock,
+				&this->tStruct->vbuffer_waits);
+		while (!this->frameReady())
+			if (pthread_cond_timedwait(this->vidBufferCond,
+					    this->vidBufferLock,
+					    &deadline))
+				break;
+		pthread_mutex_unlock(this->vidBufferLock);
+	}
+	if (!vbuffer_take(this->tStruct, &this->reading)) return 0;
+	clock_gettime(CLOCK_MONOTONIC, &this->nextDraw);
+	this->nextDraw.tv_nsec += FRAME_PERIOD;
+	if (this->nextDraw.tv_nsec >= 1000000000)
+	{
+		this->nextDraw.tv_nsec -= 1000000000;
+		++this->nextDraw.tv_sec;
+	}
+
+	const uint64_t taken = this->tStruct->vbuffer_frame[this->reading];
+	metric_count(this->tStruct->frames_dropped, taken - this->frame - 1);
+	metric_count(this->tStruct->frames_rendered, 1);
+	this->frame = taken;
+	this->taitoVideoBuffer =
+			this->tStruct->vbuffer + this->reading * VBUFFER_SIZE;
+	this->videoRamToTaitoBuffer(TOP);
+	this->videoRamToTaitoBuffer(BOTTOM);
+	return 1;
 }
 
 void TaitoScreen::applyBlur()
@@ -522,13 +596,9 @@ void TaitoScreen::videoRamToTaitoBuffer(sideOfScreen screenHalf)
 
 int TaitoScreen::handleInput()
 {
-	// Take control of the keystate and reset/quit mutexes to avoid
-	// both threads attempting to read/write at the same time
-	pthread_mutex_lock(this->keystateLock);
-	pthread_mutex_lock(this->resetQuitLock);
-
 	int quit = 0;
 	SDL_Event event;
+	struct cycle_timer* const timer = this->tStruct->timer;
 	/* poll all SDL events until there are no more in the buffer. For
 	 * each event, the taitoSCreen will determine whether it cares about
 	 * the input, and will take whichever action is appropriate if it does.
@@ -539,16 +609,27 @@ int TaitoScreen::handleInput()
 	{
 		switch (event.type)
 		{
-		case SDL_QUIT:
-			*(this->tStruct->quit_flag) = 1;
-			quit			    = 1;
-			break;
+		case SDL_QUIT: quit = 1; break;
 		case SDL_KEYDOWN:
 			switch (event.key.keysym.scancode)
 			{
-			case SDL_SCANCODE_ESCAPE:
-				*(this->tStruct->quit_flag) = 1;
-				quit			    = 1;
+			case SDL_SCANCODE_ESCAPE: quit = 1; break;
+			case SDL_SCANCODE_TAB:
+				control_toggle(this->tStruct->control,
+						CONTROL_TURBO);
+				break;
+			// Slow motion and fast-forward, by halves and
+			// doubles, and back to normal.
+			case SDL_SCANCODE_MINUS:
+				cycle_timer_set_rate(timer,
+						cycle_timer_rate(timer) / 2);
+				break;
+			case SDL_SCANCODE_EQUALS:
+				cycle_timer_set_rate(timer,
+						cycle_timer_rate(timer) * 2);
+				break;
+			case SDL_SCANCODE_BACKSPACE:
+				cycle_timer_set_rate(timer, RATE_NORMAL);
 				break;
 			default: goto rom_handler;
 			};
@@ -563,12 +644,20 @@ int TaitoScreen::handleInput()
 			};
 			break;
 rom_handler:
-		default: update_keystates(this->tStruct, &event);
+		default:
+			// Only the keystates need the lock: the CPU thread
+			// reads them in hw_in, so we hold it as briefly as we
+			// can rather than across the whole event queue.
+			pthread_mutex_lock(this->keystateLock);
+			update_keystates(this->tStruct, &event);
+			pthread_mutex_unlock(this->keystateLock);
 		};
 	}
 
-	pthread_mutex_unlock(this->resetQuitLock);
-	pthread_mutex_unlock(this->keystateLock);
+	if (quit) control_request(this->tStruct->control, CONTROL_QUIT);
+	// A halted CPU sleeps until there's something to wake it.
+	if (control_pending(this->tStruct->control) & CONTROL_REQUESTS)
+		interrupt_wake(this->interrupts);
 	return quit;
 }
 
@@ -13,20 +13,26 @@ extern "C" int taito_start(struct taito_struct* tStruct)
 
 	for (;;)
 	{
-
-		screen.videoRamToTaitoBuffer(TOP);
-		screen_timer();
-		screen.sendInterrupt(RST1);
-
-		screen.videoRamToTaitoBuffer(BOTTOM);
+		// The CPU thread finishes frames in its own time, and never
+		// waits for us: we draw the latest, at the display's refresh
+		// rate with vsync, or whenever there's a new one without.
+		const int fresh = screen.takeFrame();
 		if (screen.handleInput()) return 0;
 
-		pthread_mutex_lock(tStruct->sound_lock);
-		play_sound(sound_effects, tStruct->rom_struct);
-		pthread_mutex_unlock(tStruct->sound_lock);
+		// Fast-forwarding, the sound effects would only be a
+		// stuttering mess, so we leave them out until it's over.
+		// Otherwise we look at what the game wants playing when
+		// there's a new frame, not every time vsync has us draw the
+		// last one again.
+		if (screen.fastForward())
+			Mix_HaltChannel(-1);
+		else if (fresh)
+		{
+			pthread_mutex_lock(tStruct->sound_lock);
+			play_sound(sound_effects, tStruct->rom_struct);
+			pthread_mutex_unlock(tStruct->sound_lock);
+		}
 
-		screen_timer();
-		screen.sendInterrupt(RST2);
 		screen.renderFrame();
 	}
 }
@@ -1,10 +1,8 @@
 
-#ifndef VBUFFER_SIZE
-#	define VBUFFER_SIZE (1024 * 7)
-#endif
-
 #include "cpu.h"
+#include "metrics.h"
 #include "proms.h"
+#include "screen_timer.h"
 #include "taito_struct.h"
 
 #include <pthread.h>
@@ -23,14 +21,26 @@ struct taito_struct* create_taito_struct(
 {
 	struct taito_struct* new_struct = malloc(sizeof(struct taito_struct));
 
-	pthread_mutex_t* keystate_lock	 = create_mutex();
-	pthread_mutex_t* sound_lock	 = create_mutex();
-	pthread_mutex_t* reset_quit_lock = create_mutex();
-	pthread_mutex_t* vbuffer_lock	 = create_mutex();
-	pthread_cond_t* vbuffer_cond	 = malloc(sizeof(pthread_cond_t));
+	pthread_mutex_t* keystate_lock = create_mutex();
+	pthread_mutex_t* sound_lock    = create_mutex();
+	pthread_mutex_t* vbuffer_lock  = create_mutex();
+	pthread_cond_t* vbuffer_cond   = malloc(sizeof(pthread_cond_t));
 	pthread_cond_init(vbuffer_cond, NULL);
-	uint8_t* vbuffer = malloc(VBUFFER_SIZE);
-	memset(vbuffer, 0, VBUFFER_SIZE);
+	uint8_t* vbuffer = malloc(VBUFFERS * VBUFFER_SIZE);
+	memset(vbuffer, 0, VBUFFERS * VBUFFER_SIZE);
+
+	// The front end's metrics, if there's a registry: see metrics.h.
+	uint64_t* frames_rendered = metrics_add(res->metrics,
+			"taito_frames_rendered_total",
+			"Frames the front end drew.",
+			METRIC_COUNTER);
+	uint64_t* frames_dropped = metrics_add(res->metrics,
+			"taito_frames_dropped_total",
+			"Frames replaced by newer ones before being drawn.",
+			METRIC_COUNTER);
+	const struct lock_metrics vbuffer_waits = metrics_add_lock(res->metrics,
+			"taito_vbuffer_lock",
+			"video buffer lock");
 
 	// We use a temp struct here because the members of new_struct
 	// are all const, and can't be assigned to. Nor can we use a braced
@@ -40,19 +50,26 @@ struct taito_struct* create_taito_struct(
 			.vbuffer_lock	  = vbuffer_lock,
 			.vbuffer_cond	  = vbuffer_cond,
 			.vbuffer	  = vbuffer,
+			// The front end starts with buffer 1: see
+			// TaitoScreen.
+			.vbuffer_write	  = 0,
+			.vbuffer_latest	  = 2,
+			.vbuffer_frame	  = {0},
+			.frames		  = 0,
+			.frames_rendered  = frames_rendered,
+			.frames_dropped	  = frames_dropped,
+			.vbuffer_waits	  = vbuffer_waits,
 			.rom_struct	  = rstruct,
-			.interrupt_buffer = res->interrupt_buffer,
-			.interrupt_lock	  = res->interrupt_lock,
-			.interrupt_cond	  = res->interrupt_cond,
+			.interrupts	  = res->interrupts,
 			.keystate_lock	  = keystate_lock,
 			.sound_lock	  = sound_lock,
-			.reset_quit_lock  = reset_quit_lock,
-			.quit_flag	  = res->quit_flag,
-			.reset_flag	  = res->reset_flag,
+			.control	  = res->control,
+			.timer		  = res->timer,
 			.proms		  = proms,
 			.num_proms	  = num_proms,
 	};
 	memcpy(new_struct, &temp, sizeof(struct taito_struct));
+	screen_timer_start(res->scheduler, new_struct);
 	return new_struct;
 }
 
@@ -0,0 +1,48 @@
+#ifndef ALU_TABLES
+#define ALU_TABLES
+
+#include "cpu.h"
+
+#include <stdint.h>
+
+/* Precomputed results for the arithmetic and logical opcodes.  Rather than
+ * working out each flag one at a time after every operation, the handlers
+ * look the whole answer up.  The tables are built once at program load (see
+ * alu_tables.c) from the same helpers in opcode_helpers.h that the handlers
+ * used to call directly, so the two can't drift apart.
+ */
+
+// Every flag an ALU operation can affect.  The remaining bits of the flag
+// byte (1, 3 and 5) are left untouched by the handlers.
+#define ALU_FLAGS \
+	(SIGN_FLAG | ZERO_FLAG | AUX_CARRY_FLAG | PARITY_FLAG | CARRY_FLAG)
+
+// The sign, zero and parity flags for every possible result byte.
+extern uint8_t zsp_table[256];
+
+/* Addition and subtraction tables, indexed by [carry][accumulator][operand].
+ * Each entry is laid out like the PSW register: the result in the high byte
+ * and its flags (only the bits in ALU_FLAGS) in the low byte.  That means a
+ * handler can update A and the flags in a single store:
+ *
+ * 	cpu->psw = add_table[0][cpu->a][operand] | (cpu->flags & ~ALU_FLAGS);
+ *
+ * For subtraction the first index is the borrow (i.e. the carry flag going
+ * in, for SBB/SBI), and the carry flag coming out is set on a borrow.
+ */
+extern uint16_t add_table[2][256][256];
+extern uint16_t sub_table[2][256][256];
+
+/* DAA, indexed by [aux carry and carry flags][accumulator].  The first index
+ * is built with DAA_INDEX() from the flag byte.  Entries are PSW-shaped, like
+ * the add and sub tables.
+ */
+#define DAA_INDEX(flags) \
+	(((flags) & AUX_CARRY_FLAG) >> 3 | ((flags) & CARRY_FLAG))
+extern uint16_t daa_table[4][256];
+
+// Whether each of the eight branch conditions (see GET_CONDITION()) holds,
+// indexed by [condition][flag byte].
+extern uint8_t condition_table[8][256];
+
+#endif
@@ -0,0 +1,140 @@
+#ifndef BLOCK_CACHE
+#define BLOCK_CACHE
+
+#include "cpu.h"
+
+#include <stdint.h>
+
+/* The block cache.
+ *
+ * The block core doesn't decode opcodes as it goes.  Instead it decodes a
+ * straight-line run of code (a block) once, into an array of micro-ops which
+ * already know their handler, their length and their cycle count, and keeps
+ * the block around, keyed by its start address, for the next time execution
+ * gets there.  A block ends at anything that can change the flow of control
+ * (jumps, calls, returns, and EI, DI and HLT), or after BLOCK_MAX_OPS opcodes.
+ *
+ * Since the 8080 happily runs code out of RAM, the cache has to notice when
+ * that code is overwritten.  It keeps one byte per 256-byte page of memory,
+ * set when a block has been decoded from that page, and write8() checks it.
+ * Programs keep their variables right next to their code, though, so for a
+ * write to a code page we also check a bitmap of which bytes are actually
+ * code.  A write to code throws away every block which might overlap its
+ * page.
+ */
+
+// The longest block we'll decode, in opcodes.
+#ifndef BLOCK_MAX_OPS
+#	define BLOCK_MAX_OPS (32)
+#endif
+
+// Space for decoded blocks.  When it fills up, the whole cache is flushed.
+#ifndef BLOCK_CACHE_SIZE
+#	define BLOCK_CACHE_SIZE (1 << 20)
+#endif
+
+#define CODE_PAGE_SHIFT (8)
+
+// One opcode, or with fusion on, a short sequence of them.
+struct micro_op
+{
+	int (*handler)(const uint8_t* opcode, struct cpu_state* cpu);
+	const uint8_t* opcode; // Where the opcode lives in memory.
+	uint16_t next_pc;      // The PC to set before calling the handler.
+	uint8_t cycles;	       // Not counting a condition being met.
+	uint8_t writes_memory; // Or talks to the hardware, which may too.
+};
+
+struct block
+{
+	uint16_t start;
+	uint16_t count; // The number of micro-ops.
+	uint16_t last_opcode; // Where the block's last opcode is.
+	// The cycles taken by the whole block, except that if the last opcode
+	// is a conditional call or return, its cycles are left out: they have
+	// to come from the handler.
+	int cycles;
+	uint8_t variable_cycles; // Whether the last opcode's are left out.
+	// The dynarec's: how often the block has been run without a
+	// translation, and the translation, once it's hot enough to get one.
+	uint8_t runs;
+	void* native;
+	struct micro_op ops[];
+};
+
+struct block_cache_stats
+{
+	uint64_t hits;		// Blocks run straight from the cache.
+	uint64_t misses;	// Blocks which had to be decoded first.
+	uint64_t invalidations; // Writes to code.
+	uint64_t flushes;	// Times the cache filled up.
+	uint64_t fused;		// Fused micro-ops decoded.
+};
+
+struct block_cache
+{
+	// Every block in the cache, by start address.
+	struct block* blocks[MAX_MEMORY];
+	// Whether any block has been decoded from each page.
+	uint8_t code_pages[MAX_MEMORY >> CODE_PAGE_SHIFT];
+	// One bit for every byte of memory which is part of a decoded block.
+	uint8_t code_bytes[MAX_MEMORY / 8];
+	// Bumped whenever blocks are thrown away, so that a block can tell if
+	// it's been overwritten while it was running.
+	uint64_t generation;
+	// Whether to decode superinstructions: see fused_opcodes.h.
+	uint8_t fuse;
+	struct block_cache_stats stats;
+	size_t used;
+	uint8_t storage[BLOCK_CACHE_SIZE] __attribute__((aligned(16)));
+};
+
+/* Allocates an empty cache, with fusion off.  Returns NULL if the allocation
+ * fails.
+ */
+struct block_cache* block_cache_create(void);
+
+void block_cache_destroy(struct block_cache* cache);
+
+/* Returns the block starting at pc, decoding it first if need be.  The
+ * pointer is good until the next call, which may flush the cache.
+ */
+struct block* block_cache_get(struct block_cache* cache,
+		const struct cpu_state* cpu,
+		uint16_t pc);
+
+/* Runs the block at the CPU's PC, decoding it first if need be, and returns
+ * the number of cycles it took.  If the block overwrites itself, it stops
+ * after the opcode which did the overwriting.
+ */
+int block_cache_run(struct block_cache* cache, struct cpu_state* cpu);
+
+/* As block_cache_run(), for a block already looked up. */
+int block_cache_execute(struct block_cache* cache,
+		struct cpu_state* cpu,
+		const struct block* block);
+
+/* Throws away every block. */
+void block_cache_flush(struct block_cache* cache);
+
+/* Throws away every block which might contain code from the given page.
+ * Called by write8().
+ */
+void block_cache_invalidate(struct block_cache* cache, uint8_t page);
+
+/* Throws away every block with code from the given range, which the memory
+ * map has just switched to another bank.  A memory_remapped callback (see
+ * memory_map.h), so cache has to be the block cache.
+ */
+void block_cache_remapped(void* cache, uint16_t start, uint32_t length);
+
+/* To be called on every write to memory the CPU makes. */
+static inline void block_cache_note_write(
+		struct block_cache* cache, uint16_t address)
+{
+	if (cache->code_pages[address >> CODE_PAGE_SHIFT]
+			&& cache->code_bytes[address / 8] & 1 << address % 8)
+		block_cache_invalidate(cache, address >> CODE_PAGE_SHIFT);
+}
+
+#endif
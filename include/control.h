@@ -0,0 +1,53 @@
+#ifndef CONTROL
+#define CONTROL
+
+#include <stdint.h>
+
+/* Reset and quit requests, and the turbo switch.
+ *
+ * These used to be a pair of flags behind a mutex, which the CPU thread took
+ * every chunk just to look at them, and which the front end held for as long
+ * as it took to drain SDL's event queue.  Now they're bits in a single control
+ * word, which anyone may set with an atomic OR.  The CPU thread looks at it
+ * with a relaxed load whenever it settles up with the timer, and takes the
+ * bits it acts on with an atomic AND.
+ *
+ * Anything that might be requesting a reset or quit of a halted CPU should
+ * follow the request with interrupt_wake(), so that it notices.
+ *
+ * CONTROL_TURBO isn't a request but a switch, flipped with control_toggle():
+ * while it's on, a throttled CPU runs flat out, as if started with --speed max.
+ */
+
+#define CONTROL_RESET    (1u)
+#define CONTROL_QUIT     (1u << 1)
+#define CONTROL_TURBO    (1u << 2)
+#define CONTROL_REQUESTS (CONTROL_RESET | CONTROL_QUIT)
+
+static inline void control_request(uint8_t* control, uint8_t bits)
+{
+	__atomic_fetch_or(control, bits, __ATOMIC_RELEASE);
+}
+
+static inline void control_toggle(uint8_t* control, uint8_t bits)
+{
+	__atomic_fetch_xor(control, bits, __ATOMIC_RELEASE);
+}
+
+// The requests waiting, without taking any of them: the CPU's fast path.
+static inline uint8_t control_pending(const uint8_t* control)
+{
+	return __atomic_load_n(control, __ATOMIC_RELAXED);
+}
+
+/* Takes whichever of the given requests are waiting, and returns them.  A
+ * quit is never taken: once asked for, it stays asked for.
+ */
+static inline uint8_t control_take(uint8_t* control, uint8_t bits)
+{
+	bits &= ~CONTROL_QUIT;
+	return __atomic_fetch_and(control, (uint8_t) ~bits, __ATOMIC_ACQUIRE)
+	       & bits;
+}
+
+#endif
@@ -1,6 +1,8 @@
 #ifndef CPU
 #define CPU
 
+#include "interrupts.h"
+
 #include <pthread.h>
 #include <stdint.h>
 
@@ -41,37 +43,17 @@
 struct cpu_state
 {
 
-	/* For interrupts, rather than use the actual 'pins',
-	 * we can just use a mutex and an additional little buffer
-	 * in which pending interrupts can be stored.
-	 * We can use a condition flag to allow multiple threads
-	 * to set interrupts without interfering with each other.
-	 * The procedure is: a thread wishing to set an interrupt
-	 * acquires the lock.  If the interrupt buffer is not zeroed,
-	 * it calls pthread_cond_wait() to release the lock and wait
-	 * its turn.  If the buffer is zeroed, it will set the desired
-	 * interrupt value and release the lock.
-	 * The CPU function will, at the correct point in
-	 * its fake cycles, acquire the lock and, if it finds an interrupt
-	 * waiting, will act on it and zero the buffer.
-	 * In either case, the CPU will call pthread_cond_signal()
-	 * prior to releasing the mutex, so that anyone waiting
-	 * to write an interrupt to the buffer may do so.
-	 * Since each fake CPU cycle ends with a sleep, we don't need to
-	 * actively yield control; even if we're on the same core as the
-	 * thread that wants to interrupt, it will get a chance to do so.
-	 * For Space Invaders, there's only one thread that might signal
-	 * an interrupt, but this is extensible.
+	/* For interrupts, rather than use the actual 'pins', we have an
+	 * interrupt controller (see interrupts.h) which any thread can
+	 * raise interrupts on without waiting for the CPU.  At the
+	 * correct point in its fake cycles, the CPU takes the highest
+	 * priority one waiting and runs its RST opcode.
 	 */
-	pthread_cond_t* const int_cond;
-	pthread_mutex_t* const int_lock;
-	pthread_mutex_t* const reset_quit_lock;
+	struct interrupt_controller* const interrupts;
+	// Reset and quit requests: see control.h.
+	uint8_t* const control;
 
 	uint8_t* const memory; // Points to an array containing the memory.
-	uint8_t* const interrupt_buffer; // Points to the buffer where pending
-	// interrupts are stored.
-	uint8_t* const reset_flag;
-	uint8_t* const quit_flag;
 	void* hw_struct;
 	const uint8_t* const rom_mask;
 	// Registers!
@@ -132,6 +114,46 @@ struct cpu_state
 	 */
 	uint8_t interrupt_enable_flag;
 	const uint8_t mask_shift;
+	/* When running with lazy flags (see lazy_flags.h), the ALU opcodes
+	 * don't work out the flags at all: they just record what they did
+	 * here, and the flag byte is only brought up to date when something
+	 * needs to read it.  lazy_op is zero whenever the flag byte is
+	 * current, which is always the case with the regular handlers.
+	 */
+	union
+	{
+		uint32_t lazy_record; // All four, so they can be set at once.
+		struct
+		{
+			uint8_t lazy_op;
+			uint8_t lazy_left;
+			uint8_t lazy_right;
+			uint8_t lazy_carry;
+		};
+	};
+	/* Set only when running on the block core (see block_cache.h), which
+	 * needs to hear about every write to memory in case it's to code.
+	 */
+	struct block_cache* block_cache;
+	// Timed events for the hardware: see scheduler.h.
+	struct scheduler* const scheduler;
+	/* Cycles run since power on, which keep counting over a reset: the
+	 * clock the scheduler runs on.  It's up to date whenever the hardware
+	 * is called back (for a timed event, or by the interrupt hook), and in
+	 * IN and OUT on the switch and threaded cores.  The block cores only
+	 * bring it up to date between runs of blocks, so there, IN and OUT see
+	 * the time the run started.
+	 */
+	uint64_t cycles;
+	// This machine's timing: see cycle_timer.h.
+	struct cycle_timer* const timer;
+	// Where the CPU publishes its counters: see metrics.h.
+	struct metrics* const metrics;
+	/* What's at each page of memory: see memory_map.h.  rom_mask is its
+	 * page table, with a mask_shift of PAGE_SHIFT.  Without a map, memory
+	 * is just RAM and ROM, as rom_mask says.
+	 */
+	struct memory_map* const memory_map;
 };
 
 // The system resources struct is just all the shared pointer members
@@ -141,20 +163,40 @@ struct cpu_state
 // by the hardware.
 struct system_resources
 {
-	pthread_cond_t* interrupt_cond;
-	pthread_mutex_t* interrupt_lock;
-	pthread_mutex_t* reset_quit_lock;
-	uint8_t* memory;	   // Points to an array containing the memory.
-	uint8_t* interrupt_buffer; // Points to the buffer where pending
+	struct interrupt_controller* interrupts;
+	uint8_t* control;
+	uint8_t* memory; // Points to an array containing the memory.
 	void* hw_struct;
-	uint8_t* reset_flag;
-	uint8_t* quit_flag;
 	uint8_t* rom_mask;
 	uint8_t mask_shift;
+	struct scheduler* scheduler;
+	struct cycle_timer* timer;
+	struct metrics* metrics;
+	struct memory_map* memory_map;
 };
 
-// Declaration of the CPU thread.
+// Declarations of the CPU threads.  Which one is used is selected at startup.
 
+// The original core: a switch on the interrupt/halt state, then an indirect
+// call through the opcode array, for every single instruction.
 void* cpu_thread_routine(void*);
 
+// Direct-threaded core: each opcode gets its own label, and execution jumps
+// from label to label without returning to a central loop.  Interrupt and
+// halt state is only re-examined when an opcode changes it, or when a chunk's
+// worth of cycles has elapsed.  Requires GCC's labels-as-values extension.
+void* threaded_cpu_thread_routine(void*);
+
+// Block core: decodes straight-line runs of code once, into arrays of
+// micro-ops which it keeps in a cache, and runs those.  See block_cache.h.
+void* block_cpu_thread_routine(void*);
+
+// Dynarec core: the block core, with the blocks translated to x86-64 code.
+// See dynarec.h.  Falls back to the block core on other hosts.
+void* dynarec_cpu_thread_routine(void*);
+
+// Native core: the block core, running a ROM recompiled to C at build time.
+// See recompiled.h.  main() has to have loaded the translation first.
+void* native_cpu_thread_routine(void*);
+
 #endif
@@ -0,0 +1,120 @@
+#ifndef CPU_CORE
+#define CPU_CORE
+
+#include "cpu.h"
+#include "lazy_flags.h"
+#include "metrics.h"
+#include "opcode_info.h"
+
+#include <stdint.h>
+#include <stdio.h>
+
+/* Helpers shared by the interpreter cores.  Each core is a thread routine
+ * (declared in cpu.h) which takes a pointer to the system_resources struct and
+ * runs until a quit is requested; they differ only in how they get from one
+ * opcode to the next.
+ */
+
+// A shallow copy is fine, since we actually DO want to simply duplicate the
+// pointers verbatim.
+static inline struct cpu_state cpu_state_from_resources(
+		const struct system_resources* res)
+{
+	return (struct cpu_state){.memory = res->memory,
+			.interrupts	  = res->interrupts,
+			.control	  = res->control,
+			.hw_struct	  = res->hw_struct,
+			.rom_mask	  = res->rom_mask,
+			.mask_shift	  = res->mask_shift,
+			.scheduler	  = res->scheduler,
+			.timer		  = res->timer,
+			.metrics	  = res->metrics,
+			.memory_map	  = res->memory_map};
+}
+
+/* The counters every core keeps for the metrics registry.  They count in
+ * locals, and publish their totals with core_metrics_publish() each time they
+ * settle up with cycle_wait, so the registry is never more than a chunk
+ * behind, and the hot path never touches it.  Only the switch and threaded
+ * cores count instructions: the block cores would have to count them in every
+ * block, so they leave instructions NULL.  Idle loops skipped over (see
+ * idle_loop.h) count their cycles, but not their instructions.
+ */
+struct core_metrics
+{
+	uint64_t* cycles;
+	uint64_t* instructions;
+	uint64_t* interrupts;
+};
+
+static inline struct core_metrics core_metrics_add(
+		struct metrics* metrics, int instructions)
+{
+	struct core_metrics core = {0};
+	core.cycles		 = metrics_add(metrics,
+			"i8080_cycles_total",
+			"Cycles run since power on.",
+			METRIC_COUNTER);
+	core.interrupts		 = metrics_add(metrics,
+			"i8080_interrupts_total",
+			"Interrupts taken.",
+			METRIC_COUNTER);
+	if (instructions)
+	{
+		core.instructions = metrics_add(metrics,
+				"i8080_instructions_total",
+				"Instructions retired.",
+				METRIC_COUNTER);
+	}
+	return core;
+}
+
+static inline void core_metrics_publish(const struct core_metrics* core,
+		const struct cpu_state* cpu,
+		uint64_t instructions,
+		uint64_t interrupts)
+{
+	metric_set(core->cycles, cpu->cycles);
+	if (core->instructions) metric_set(core->instructions, instructions);
+	metric_set(core->interrupts, interrupts);
+}
+
+#ifdef VERBOSE
+// Diagnostic print function to dump the CPU's state to stderr.
+static inline void print_registers(const struct cpu_state* cpu)
+{
+	// With lazy flags, the flag byte may not be up to date yet.
+	uint8_t flag_byte = lazy_flags_value(cpu);
+	uint8_t flags[9];
+	uint8_t* f = flags;
+	for (uint8_t mask = 0x80; mask; mask >>= 1, ++f)
+		*f = mask & flag_byte ? '1' : '0';
+	*f = 0;
+	char next[16];
+	disassemble(cpu->memory + cpu->pc, next, sizeof(next));
+	fprintf(stderr,
+			"\tPC:  0x%4.4x -> 0x%2.2x (%s)\n"
+			"\tBC:  0x%4.4x -> 0x%2.2x\n"
+			"\tDE:  0x%4.4x -> 0x%2.2x\n"
+			"\tHL:  0x%4.4x -> 0x%2.2x\n"
+			"\tPSW: 0x%4.4x\n"
+			"\tSP:  0x%4.4x -> 0x%2.2x\n"
+			"\tFlags: %s\n"
+			"\t       SZ-A-P-C\n",
+			cpu->pc,
+			cpu->memory[cpu->pc],
+			next,
+			cpu->bc,
+			cpu->memory[cpu->bc],
+			cpu->de,
+			cpu->memory[cpu->de],
+			cpu->hl,
+			cpu->memory[cpu->hl],
+			cpu->a << 8 | flag_byte,
+			cpu->sp,
+			cpu->memory[cpu->sp],
+			flags);
+}
+#endif
+
+#endif
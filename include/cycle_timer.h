@@ -2,11 +2,18 @@
 #define CYCLE_TIMER
 
 #include "cpu.h"
+#include "histogram.h"
+#include "metrics.h"
+#include "pacer.h"
+
+#include <stdint.h>
+#include <time.h>
 
 // Because we're using the monotonic high-resolution clock, which
 // measures time in nanoseconds, we define one clock pulse of the
 // CPU in number of nanoseconds elapsed.  At 2MHz, one clock cycle
-// is .5 microseconds, which is 500 nanoseconds.
+// is .5 microseconds, which is 500 nanoseconds.  This is only the
+// default: --speed overrides it at runtime.
 #ifndef CYCLE_TIME
 #	define CYCLE_TIME (500l)
 #endif
@@ -15,23 +22,152 @@
 // we don't want to try to sleep after every opcode.  Instead, we'll
 // keep track of how many system cycles *should* have elapsed, and just
 // rest in chunks.  A chunk here is how many clock cycles we're allowing
-// to elapse before we force a sleep.
+// to elapse before we force a sleep.  Again, this is the default for
+// --chunk.
 #ifndef CYCLE_CHUNK
 #	define CYCLE_CHUNK (512)
 #endif
 
 // BENCH_INTERVAL determines, when benchmarking, what periodicity the
 // benchmarking reports should have.  By default, it will calculate effective
-// speed every ~8 million cycles.  Override it during compilation if needed.
+// speed every ~8 million cycles.  Override it during compilation if needed,
+// or at runtime with --bench-interval.
 #ifndef BENCH_INTERVAL
 #	define BENCH_INTERVAL (1 << 23)
 #endif
 
+// Fast-forward and slow motion: the rate a throttled CPU runs at, as a
+// percentage of its set speed, and how far either way it can be taken.
+#define RATE_NORMAL (100)
+#define RATE_MIN    (25)
+#define RATE_MAX    (1600)
+
+// The longest a halted CPU sleeps at a time before looking around again, in
+// nanoseconds: a safety net for anything that sets the reset or quit flag
+// without signalling the interrupt condition.
+#ifndef HALT_WAIT_LIMIT
+#	define HALT_WAIT_LIMIT (100000000l)
+#endif
+
+/*
+ * Each machine keeps its timing in a struct cycle_timer of its own, which the
+ * CPU reaches through cpu->timer, so that any number of them can run in one
+ * process, each at its own pace.  main() sets one up from the command line
+ * before starting the CPU thread.
+ *
+ * The settings don't change after cycle_timer_init(): cycle_time is in
+ * nanoseconds, as above; chunk is how many cycles the cores run between calls
+ * to cycle_wait; and bench_interval is how many cycles go between effective
+ * speed reports, or 0 for none.  The rest is the timer's own state, except
+ * for rate, which anyone may change: see cycle_timer_set_rate().
+ */
+struct cycle_timer
+{
+	int throttled;
+	long cycle_time;
+	int chunk;
+	uint64_t bench_interval;
+	int rate;
+
+	// The throttled or unthrottled cycle_wait: see below.
+	int (*wait)(int cycles, struct cpu_state*);
+	struct pacer pacer; // Set up by the CPU thread, at its first wait.
+	int count;	    // Cycles owed since the last chunk.
+	int turbo;	    // Whether the last chunk was in turbo.
+	uint64_t bench_count;
+	struct timespec bench_last;
+	struct histogram stalls; // Time spent looking at the control word.
+
+	// The timer's metrics: see cycle_timer_add_metrics().
+	uint64_t* overshoot;
+	uint64_t* halted;
+	struct lock_metrics interrupt_lock;
+};
+
+void cycle_timer_init(struct cycle_timer* timer,
+		int throttled,
+		long cycle_time,
+		int chunk,
+		uint64_t bench_interval);
+
+/* Adds the timer's metrics to a registry: how late the pacer's sleeps have
+ * been waking up, how long the CPU has spent halted, and how often a halted
+ * CPU had to wait for the interrupt controller's lock.  Until then, they go
+ * nowhere.
+ */
+void cycle_timer_add_metrics(struct cycle_timer* timer, struct metrics*);
+
+/* Fast-forward and slow motion: from its next chunk, a throttled CPU runs at
+ * percent of its set speed (within RATE_MIN and RATE_MAX).  This may be
+ * called from any thread, and is how a front end's hotkeys change the speed.
+ * Timed events go by the CPU's own clock (see scheduler.h), so the hardware's
+ * interrupts keep their cadence in emulated time, and the program runs just
+ * as it would at full speed.  Unthrottled or in turbo, the rate is ignored.
+ */
+static inline void cycle_timer_set_rate(struct cycle_timer* timer, int percent)
+{
+	if (percent < RATE_MIN) percent = RATE_MIN;
+	if (percent > RATE_MAX) percent = RATE_MAX;
+	__atomic_store_n(&timer->rate, percent, __ATOMIC_RELAXED);
+}
+
+static inline int cycle_timer_rate(const struct cycle_timer* timer)
+{
+	return __atomic_load_n(&timer->rate, __ATOMIC_RELAXED);
+}
+
+// The nanoseconds a cycle takes at the current rate.
+static inline long cycle_timer_period(const struct cycle_timer* timer)
+{
+	const int rate	  = cycle_timer_rate(timer);
+	const long period = timer->cycle_time * RATE_NORMAL / rate;
+	return period > 0 ? period : 1;
+}
+
+/* Starts timing afresh from now, as if the CPU had only just started,
+ * forgetting any time it's ahead or behind.  A reset does this.
+ */
+void cycle_timer_rebase(struct cycle_timer* timer);
+
+/*
+ * cycle_wait takes the number of cycles run since it was last called, which
+ * the cores save up until they're owed a chunk.  Throttled, it hands them to
+ * a pacer (see pacer.h), which waits until the wall clock catches up with
+ * them.  Unthrottled, it only looks for reset
+ * and quit requests.  Either way, it returns 1 if a quit has been requested.
+ *
+ * Which of the two it is gets decided once, by cycle_timer_init(), so the
+ * unthrottled CPU pays nothing for the timer it isn't using.  A throttled CPU
+ * can still be let off the leash at runtime with CONTROL_TURBO (see
+ * control.h), which costs it one test a chunk.
+ */
+static inline int cycle_wait(int cycles, struct cpu_state* cpu)
+{
+	return cpu->timer->wait(cycles, cpu);
+}
+
+/* How many cycles a core may run, now, before it next has to stop: for the
+ * next timed event, due at deadline, or to settle up with cycle_wait after a
+ * chunk.
+ */
+static inline int cycles_until(uint64_t deadline, uint64_t now, int chunk)
+{
+	if (deadline <= now || chunk <= 0) return 0;
+	return deadline - now < (uint64_t) chunk ? (int) (deadline - now)
+						 : chunk;
+}
+
 /*
- * cycle_wait takes as its only argument the number of cycles to be waited.
- * It keeps a static internal count of the number of cycles that have elapsed,
- * and it exceeds its target, it will sleep until the correct wall time.
+ * halt_wait is for a halted CPU.  Rather than spinning, it sleeps on the
+ * interrupt condition until there's something to wake up for: an interrupt,
+ * if they're enabled, a reset or quit, or the next timed event, which is due
+ * in cycles_left cycles (about UINT64_MAX if none is; see scheduler.h).  It
+ * returns the number of cycles that went by in the meantime, which the core
+ * should pass on to cycle_wait so that emulated time keeps up with the wall
+ * clock.  After a reset or quit, that's at least a chunk's worth, so
+ * cycle_wait acts on it straight away.  Unthrottled or in turbo, a CPU halted
+ * until a timed event doesn't sleep at all, but skips straight to it.
  */
-int cycle_wait(int cycles, struct cpu_state*);
+int halt_wait(struct cpu_state*, uint64_t cycles_left);
 
 #endif
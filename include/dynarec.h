@@ -0,0 +1,94 @@
+#ifndef DYNAREC
+#define DYNAREC
+
+#include "block_cache.h"
+#include "cpu.h"
+
+#include <stdint.h>
+#include <stdio.h>
+
+/* The dynamic recompiler.
+ *
+ * Translates the hot blocks of the block cache (see block_cache.h) into
+ * x86-64 machine code, and runs that instead; blocks which haven't run
+ * DYNAREC_HOT_RUNS times yet are interpreted as on the block core.  The
+ * 8080's registers stay in the cpu_state struct; what the translation saves
+ * is the dispatch: the common register, immediate and ALU opcodes, and the
+ * jumps, are done inline, and everything else is a direct call to its
+ * handler.  Blocks whose successor is already translated jump straight to
+ * it, only returning to C when their cycle budget is spent, an opcode
+ * changes the interrupt or halt state, a successor hasn't been translated
+ * yet, an opcode talks to the hardware (IN and OUT), or a write has landed
+ * on code.
+ *
+ * Writes to memory always go through the handlers, and so through write8(),
+ * which invalidates the block cache as usual.  So do reads of M, if the
+ * memory map has any MMIO to read (see memory_map.h); otherwise they're done
+ * inline.  Translated code finds its successors through the block cache's
+ * table, so once a block is gone from there, nothing will jump to its
+ * translation again.  The same goes for blocks in a window the hardware has
+ * switched to another bank, since IN and OUT always return to C.
+ *
+ * With dynarec_perf_map set, every translation is listed in
+ * /tmp/perf-<pid>.map, so that perf can put names to the addresses it
+ * samples.
+ *
+ * Only available on x86-64 Linux: dynarec_create() returns NULL elsewhere.
+ */
+
+// Space for translations.  When it fills up, everything is thrown away.
+#ifndef DYNAREC_BUFFER_SIZE
+#	define DYNAREC_BUFFER_SIZE (16 << 20)
+#endif
+
+// How often a block is interpreted before it's translated, by default.
+#ifndef DYNAREC_HOT_RUNS
+#	define DYNAREC_HOT_RUNS (32)
+#endif
+
+/* Whether dynarec_create() writes the perf map.  main() sets it from
+ * --perf-map; it's off by default.
+ */
+extern uint8_t dynarec_perf_map;
+
+struct dynarec_stats
+{
+	uint64_t translations;
+	uint64_t entries; // Times we've gone from C into translated code.
+	uint64_t flushes; // Times the translation buffer filled up.
+};
+
+struct dynarec
+{
+	struct block_cache* cache;
+	// Translations are written to buffer, and run from code: the same
+	// memory, mapped twice, so that neither is writable and executable.
+	uint8_t* buffer;
+	uint8_t* code;
+	size_t used;
+	// Entry and exit stubs, at the start of the buffer.  enter is in code,
+	// to be called; exit is in buffer, as translations jump to it.
+	int64_t (*enter)(struct cpu_state* cpu,
+			int64_t budget,
+			struct block** blocks,
+			const uint64_t* generation,
+			void* code);
+	uint8_t* exit;
+	uint8_t hot_runs; // DYNAREC_HOT_RUNS, unless changed.
+	FILE* perf_map; // NULL unless dynarec_perf_map was set.
+	struct dynarec_stats stats;
+};
+
+/* Returns NULL if the host isn't supported, or on allocation failure. */
+struct dynarec* dynarec_create(void);
+
+void dynarec_destroy(struct dynarec* dynarec);
+
+/* Runs translated code from the CPU's PC, translating as needed, until the
+ * given number of cycles has been used up, or until an opcode changes the
+ * interrupt or halt state.  Returns the number of cycles used.  The CPU's
+ * block_cache member must point to the dynarec's cache.
+ */
+int dynarec_run(struct dynarec* dynarec, struct cpu_state* cpu, int budget);
+
+#endif
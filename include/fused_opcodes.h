@@ -0,0 +1,52 @@
+#ifndef FUSED_OPCODES
+#define FUSED_OPCODES
+
+#include "cpu.h"
+
+#include <stdint.h>
+
+/* Superinstructions.
+ *
+ * A handful of short opcode sequences turn up over and over in the tight
+ * loops of the ROMs we run:
+ *
+ * 	DCR r; JNZ			delay and counting loops
+ * 	MOV A,M; INX H			walking through a table
+ * 	LDAX D; MOV M,A; INX H; INX D	block copies
+ * 	CPI; JZ (or JNZ)		looking for a particular value
+ *
+ * When the block cache decodes one of these, it can give the whole sequence
+ * a single micro-op, whose handler does the work of all of its opcodes in one
+ * go.  That saves the dispatch between them, and the flags the first opcode
+ * works out are tested directly by the second rather than being stored away
+ * and read back.
+ *
+ * A fused handler leaves the CPU exactly as its opcodes would have done one
+ * after another, flags included, with either the eager or the lazy handlers
+ * installed (the branch at the end of the flag-setting sequences brings lazy
+ * flags up to date anyway).  It returns their combined cycle count, and
+ * expects the PC to have been set past the whole sequence.
+ */
+
+// The longest sequence we fuse, in bytes.
+#define FUSED_MAX_LENGTH (5)
+
+/* Whether the block core fuses opcodes.  main() sets it from --fusion; it's
+ * on by default.
+ */
+extern uint8_t fuse_opcodes;
+
+/* Nonzero for every opcode a sequence we can fuse starts with, so that the
+ * block cache needn't call match_fused_opcodes() for the rest.
+ */
+extern const uint8_t fused_opcode_starts[256];
+
+/* If a sequence we can fuse starts at the given opcode, and fits within the
+ * given number of bytes, sets *handler to its fused handler and returns the
+ * number of opcodes in it.  Otherwise returns 0.
+ */
+int match_fused_opcodes(const uint8_t* opcode,
+		uint32_t available,
+		int (**handler)(const uint8_t*, struct cpu_state*));
+
+#endif
@@ -0,0 +1,32 @@
+#ifndef HISTOGRAM
+#define HISTOGRAM
+
+#include <stdint.h>
+#include <stdio.h>
+
+/* A histogram of durations in nanoseconds, for benchmarking.  Bucket 0 counts
+ * zeroes, and bucket n (for n > 0) everything from 2^(n-1) up to 2^n - 1, so
+ * recording a sample is a count of leading zeroes and an increment.  The last
+ * bucket takes everything too long for the others.
+ */
+
+#define HISTOGRAM_BUCKETS (40)
+
+struct histogram
+{
+	uint64_t counts[HISTOGRAM_BUCKETS];
+};
+
+static inline void histogram_record(struct histogram* histogram, uint64_t ns)
+{
+	int bucket = ns ? 64 - __builtin_clzll(ns) : 0;
+	if (bucket >= HISTOGRAM_BUCKETS) bucket = HISTOGRAM_BUCKETS - 1;
+	++histogram->counts[bucket];
+}
+
+// Prints every bucket with anything in it, under the given title.
+void histogram_print(const struct histogram* histogram,
+		const char* title,
+		FILE* file);
+
+#endif
@@ -11,12 +11,12 @@
 
 /* interrupt_hook will be run whenever an interrupt is actually executed.  That
  * is to say, if enable_interrupt_flag is equal to 1 during instruction fetch,
- * and the interrupt_buffer is populated, actual execution will be deferred to
- * this function.  The function takes a pointer to the opcode, a pointer to the
- * cpu struct, and a pointer to the actual opcode function itself.  (Since it
- * can't see the opcode array.)  It may do whatever it needs to: in the case of
- * the taito games, we use this opportunity to refresh the video buffer.  Do
- * whatever you need to do.
+ * and an interrupt is pending on the interrupt controller, actual execution
+ * will be deferred to this function.  The function takes a pointer to the
+ * opcode (always an RST), a pointer to the cpu struct, and a pointer to the
+ * actual opcode function itself.  (Since it can't see the opcode array.)  It
+ * may do whatever it needs to: in the case of the taito games, we use this
+ * opportunity to refresh the video buffer.  Do whatever you need to do.
  */
 extern int (*interrupt_hook)(const uint8_t* opcode,
 		struct cpu_state* cpu,
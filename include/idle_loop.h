@@ -0,0 +1,77 @@
+#ifndef IDLE_LOOP
+#define IDLE_LOOP
+
+#include "cpu.h"
+
+#include <stdint.h>
+
+/* Idle loop detection.
+ *
+ * Arcade games spend most of every frame in a short loop like
+ *
+ * 	wait:	LDA 0x20c0
+ * 		ANA A
+ * 		JNZ wait
+ *
+ * waiting for an interrupt handler to change a variable.  Nothing in such a
+ * loop writes to memory, does IO, reads a device (see memory_map.h), or
+ * changes the interrupt state, so once a pass through it ends with the
+ * registers and flags just as they were at the end of the previous pass,
+ * every pass after that will do exactly the same, until an interrupt comes
+ * along and changes something.  There's no need to actually run those
+ * passes: the core can charge their cycles and skip ahead to the point where
+ * it next looks for interrupts.  (A loop polling a device's status register
+ * is another matter: the device may change it at any read.)
+ *
+ * The cores call idle_loop_pass() after every taken jump backwards, with the
+ * number of cycles they've run so far.  The loop's body (everything from the
+ * jump's target up to the jump) is checked when the loop is first seen, and
+ * after that each pass costs a comparison of the registers.  Two passes only
+ * count as consecutive if exactly one pass's worth of cycles went by between
+ * them, so nothing else (an interrupt, a reset, or a trip out of the loop and
+ * back in again) can have run in between.
+ */
+
+// The longest loop body we'll look at, in bytes.
+#ifndef IDLE_LOOP_MAX_BYTES
+#	define IDLE_LOOP_MAX_BYTES (16)
+#endif
+
+struct idle_loop
+{
+	uint16_t jump;	 // Of the loop we're watching.
+	uint16_t start;	 // Where it jumps back to.
+	uint16_t cycles; // For one pass, or 0 if it has side effects.
+	// The state at the end of the last pass, and when that was.
+	uint16_t bc, de, hl, sp, psw;
+	uint8_t interrupt_enable_flag;
+	uint64_t time;
+	// The total fast-forwarded, for benchmarking.
+	uint64_t skipped;
+};
+
+/* To be called after the jump at the given address has been taken back to
+ * the CPU's PC, the given number of cycles into the run.  If the loop is
+ * idle, returns the cycles one pass of it takes; otherwise returns 0.
+ */
+int idle_loop_pass(struct idle_loop* loop,
+		const struct cpu_state* cpu,
+		uint16_t jump,
+		uint64_t now);
+
+/* Once the loop is known to be idle, returns the cycles to charge for
+ * skipping at least the given number of cycles' worth of it: always a whole
+ * number of passes.
+ */
+static inline int idle_loop_skip(
+		struct idle_loop* loop, int pass_cycles, int cycles)
+{
+	if (cycles <= 0) return 0;
+	int skipped = (cycles + pass_cycles - 1) / pass_cycles * pass_cycles;
+	// Every pass we skipped ended just like the last one.
+	loop->time += skipped;
+	loop->skipped += skipped;
+	return skipped;
+}
+
+#endif
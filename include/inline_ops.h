@@ -0,0 +1,103 @@
+#ifndef INLINE_OPS
+#define INLINE_OPS
+
+#include "alu_tables.h"
+#include "cpu.h"
+#include "opcode_helpers.h"
+
+#include <stdint.h>
+
+/* The operations the specialized handlers (specialized_opcodes.c) and the
+ * recompiled modules (recompiled_ops.h) are built from: the ALU, done the
+ * same way as in arithmetic_opcodes.c and logical_opcodes.c, and the stack.
+ *
+ * The flags are worked out in full, as the eager handlers do.  ALU_DONE(cpu)
+ * runs after each operation which sets them, and does nothing unless the
+ * includer defines it first: the recompiled modules, which may be running
+ * alongside the lazy handlers (see lazy_flags.h), use it to clear whatever
+ * those left pending.
+ */
+
+#ifndef ALU_DONE
+#	define ALU_DONE(cpu)
+#endif
+
+static inline void alu_add(
+		struct cpu_state* cpu, uint8_t operand, uint8_t carry)
+{
+	cpu->psw = add_table[carry][cpu->a][operand]
+		   | (cpu->flags & ~ALU_FLAGS);
+	ALU_DONE(cpu);
+}
+
+static inline void alu_sub(
+		struct cpu_state* cpu, uint8_t operand, uint8_t borrow)
+{
+	cpu->psw = sub_table[borrow][cpu->a][operand]
+		   | (cpu->flags & ~ALU_FLAGS);
+	ALU_DONE(cpu);
+}
+
+static inline void alu_and(struct cpu_state* cpu, uint8_t operand)
+{
+	uint8_t aux_carry = ((cpu->a | operand) & (1 << 3)) << 1;
+	cpu->a &= operand;
+	cpu->flags = zsp_table[cpu->a] | aux_carry | (cpu->flags & ~ALU_FLAGS);
+	ALU_DONE(cpu);
+}
+
+static inline void alu_xor(struct cpu_state* cpu, uint8_t operand)
+{
+	cpu->a ^= operand;
+	cpu->flags = zsp_table[cpu->a] | (cpu->flags & ~ALU_FLAGS);
+	ALU_DONE(cpu);
+}
+
+static inline void alu_or(struct cpu_state* cpu, uint8_t operand)
+{
+	cpu->a |= operand;
+	cpu->flags = zsp_table[cpu->a] | (cpu->flags & ~ALU_FLAGS);
+	ALU_DONE(cpu);
+}
+
+static inline void alu_cmp(struct cpu_state* cpu, uint8_t operand)
+{
+	cpu->flags = (uint8_t) sub_table[0][cpu->a][operand]
+		     | (cpu->flags & ~ALU_FLAGS);
+	ALU_DONE(cpu);
+}
+
+#define ALU_ADD(operand) alu_add(cpu, operand, 0)
+#define ALU_ADC(operand) alu_add(cpu, operand, cpu->flags & CARRY_FLAG)
+#define ALU_SUB(operand) alu_sub(cpu, operand, 0)
+#define ALU_SBB(operand) alu_sub(cpu, operand, cpu->flags & CARRY_FLAG)
+#define ALU_ANA(operand) alu_and(cpu, operand)
+#define ALU_XRA(operand) alu_xor(cpu, operand)
+#define ALU_ORA(operand) alu_or(cpu, operand)
+#define ALU_CMP(operand) alu_cmp(cpu, operand)
+
+// INR and DCR: add 1 or 0xff, leaving the carry flag alone.
+static inline uint8_t inr_dcr(
+		struct cpu_state* cpu, uint8_t value, uint8_t addend)
+{
+	uint16_t entry = add_table[0][value][addend];
+	cpu->flags     = (entry & ALU_FLAGS & ~CARRY_FLAG)
+		     | (cpu->flags & (~ALU_FLAGS | CARRY_FLAG));
+	ALU_DONE(cpu);
+	return entry >> 8;
+}
+
+static inline void push16(struct cpu_state* cpu, uint16_t value)
+{
+	cpu->sp -= 2;
+	write16(cpu, cpu->sp, value);
+}
+
+static inline uint16_t pop16(struct cpu_state* cpu)
+{
+	uint16_t value = read16(cpu, cpu->sp);
+	cpu->sp += 2;
+	return value;
+}
+
+#endif
@@ -0,0 +1,110 @@
+#ifndef INTERRUPTS
+#define INTERRUPTS
+
+#include <pthread.h>
+#include <stdint.h>
+#include <time.h>
+
+/* The interrupt controller.
+ *
+ * On the real hardware, a device interrupts the 8080 by putting an RST opcode
+ * on the data bus when the CPU acknowledges the interrupt; systems with more
+ * than one device put an 8259 in between to choose which one goes first.  We
+ * do the same with a mask of pending requests, one bit for each of the eight
+ * RST vectors.  As with the 8259 in its fixed priority mode, RST 0 has the
+ * highest priority and RST 7 the lowest, and a request that's raised again
+ * before it's been taken is only taken once.
+ *
+ * Any number of threads may raise interrupts, and none of them ever waits for
+ * the CPU: raising one is an atomic OR on the mask.  The CPU thread is the
+ * only one that takes them, so it can clear its bit with an atomic AND.
+ * While interrupts are enabled, the cores look at the mask with a relaxed
+ * load before every opcode (or every chunk, for the faster cores), which is
+ * as cheap as reading any other variable.
+ *
+ * The lock and condition are only for waking a halted CPU (see halt_wait()
+ * in cycle_timer.h).  It sets sleeping under the lock before it looks at the
+ * mask, and a producer looks at sleeping after setting its bit, so one or the
+ * other will see what it needs to.
+ *
+ * The headers hardware libraries share with the emulator (this one,
+ * control.h, memory_map.h, metrics.h and scheduler.h) keep everything the
+ * libraries call static inline, using GCC's atomic builtins rather than C11's
+ * stdatomic.h, so that they can use it, from C or C++, without linking
+ * against the emulator.
+ */
+
+struct interrupt_controller
+{
+	uint8_t pending;  // Bit n is set while RST n is waiting to be taken.
+	uint8_t sleeping; // Set while a halted CPU is waiting on cond.
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+};
+
+static inline void interrupt_controller_init(struct interrupt_controller* ic)
+{
+	ic->pending  = 0;
+	ic->sleeping = 0;
+	pthread_mutex_init(&ic->lock, NULL);
+	// A halted CPU's timed waits go by the monotonic clock, as everything
+	// else does, so that changing the time of day doesn't stretch them.
+	pthread_condattr_t attr;
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&ic->cond, &attr);
+	pthread_condattr_destroy(&attr);
+}
+
+static inline void interrupt_controller_destroy(
+		struct interrupt_controller* ic)
+{
+	pthread_mutex_destroy(&ic->lock);
+	pthread_cond_destroy(&ic->cond);
+}
+
+/* Wakes the CPU if it's halted, so that it looks around again: for use after
+ * setting the reset or quit flag, as well as by interrupt_raise().
+ */
+static inline void interrupt_wake(struct interrupt_controller* ic)
+{
+	pthread_mutex_lock(&ic->lock);
+	pthread_cond_broadcast(&ic->cond);
+	pthread_mutex_unlock(&ic->lock);
+}
+
+// Requests RST vector (0 to 7).
+static inline void interrupt_raise(
+		struct interrupt_controller* ic, uint8_t vector)
+{
+	__atomic_fetch_or(&ic->pending, 1 << (vector & 7), __ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&ic->sleeping, __ATOMIC_SEQ_CST))
+		interrupt_wake(ic);
+}
+
+// As interrupt_raise(), with the RST opcode rather than its vector.
+static inline void interrupt_raise_opcode(
+		struct interrupt_controller* ic, uint8_t opcode)
+{
+	interrupt_raise(ic, opcode >> 3);
+}
+
+// Nonzero if any interrupt is waiting: the cores' fast path.
+static inline uint8_t interrupt_pending(const struct interrupt_controller* ic)
+{
+	return __atomic_load_n(&ic->pending, __ATOMIC_RELAXED);
+}
+
+/* Takes the highest priority interrupt waiting, and returns the RST opcode
+ * for it, or 0 if there's none.  Only the CPU thread may call this.
+ */
+static inline uint8_t interrupt_acknowledge(struct interrupt_controller* ic)
+{
+	uint8_t pending = __atomic_load_n(&ic->pending, __ATOMIC_ACQUIRE);
+	if (!pending) return 0;
+	const int vector = __builtin_ctz(pending);
+	__atomic_fetch_and(&ic->pending, ~(1 << vector), __ATOMIC_ACQ_REL);
+	return 0xc7 | vector << 3;
+}
+
+#endif
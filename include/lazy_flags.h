@@ -0,0 +1,85 @@
+#ifndef LAZY_FLAGS
+#define LAZY_FLAGS
+
+#include "alu_tables.h"
+#include "cpu.h"
+
+#include <stdint.h>
+
+/* Lazy flag evaluation.
+ *
+ * Most of the flags the ALU opcodes produce are never looked at: an ADD is
+ * usually followed by another ALU opcode, which replaces them wholesale,
+ * long before a conditional branch gets around to reading them.  So in lazy
+ * mode the ALU opcodes just record their operation and operands in the lazy_*
+ * members of the CPU state, and we only work out the sign, zero, parity and
+ * aux carry flags when something actually reads them: conditional jumps,
+ * calls and returns, PUSH PSW, DAA, and the register dump.
+ *
+ * The carry flag is the exception.  It's nearly free to compute (it's just
+ * bit 8 of the result), lots of opcodes read or update it on its own (ADC,
+ * the rotates, DAD, STC, CMC...), and keeping it current means all of those
+ * can run unchanged.  So the carry flag in the flag byte is always up to
+ * date, even in lazy mode.
+ *
+ * What's recorded for each operation:
+ *
+ * 	LAZY_ADD	left + right + carry (ADD, ADC, ADI, ACI, INR, DCR).
+ * 	LAZY_SUB	left - right - carry (SUB, SBB, SUI, SBI, CMP, CPI).
+ * 	LAZY_LOGIC	left is the result, right is the aux carry flag
+ * 			(ANA, ANI, XRA, XRI, ORA, ORI).
+ *
+ * The lazy handlers are swapped into an opcode table with
+ * install_lazy_flag_opcodes().  Everything else runs unchanged.
+ */
+
+enum lazy_flag_op
+{
+	LAZY_NONE = 0, // The flag byte is up to date.
+	LAZY_ADD,
+	LAZY_SUB,
+	LAZY_LOGIC
+};
+
+// The flags which may be out of date while lazy_op is set.
+#define LAZY_FLAG_MASK (ALU_FLAGS & ~CARRY_FLAG)
+
+// Returns what the flag byte would be, without touching the CPU state.
+__attribute__((pure)) static inline uint8_t lazy_flags_value(
+		const struct cpu_state* cpu)
+{
+	uint8_t flags;
+	switch (cpu->lazy_op)
+	{
+	case LAZY_ADD:
+		flags = add_table[cpu->lazy_carry][cpu->lazy_left]
+				 [cpu->lazy_right];
+		break;
+	case LAZY_SUB:
+		flags = sub_table[cpu->lazy_carry][cpu->lazy_left]
+				 [cpu->lazy_right];
+		break;
+	case LAZY_LOGIC:
+		flags = zsp_table[cpu->lazy_left] | cpu->lazy_right;
+		break;
+	default: return cpu->flags;
+	}
+	return (flags & LAZY_FLAG_MASK) | (cpu->flags & ~LAZY_FLAG_MASK);
+}
+
+// Brings the flag byte up to date.
+static inline void materialize_flags(struct cpu_state* cpu)
+{
+	cpu->flags   = lazy_flags_value(cpu);
+	cpu->lazy_op = LAZY_NONE;
+}
+
+/* Replaces every flag-affecting handler in the given opcode table with its
+ * lazy counterpart.  Which opcodes those are is worked out from
+ * generic_opcodes, so this works on the specialized table as well; main()
+ * calls this on the global opcode array.
+ */
+void install_lazy_flag_opcodes(
+		int (*table[256])(const uint8_t*, struct cpu_state*));
+
+#endif
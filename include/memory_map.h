@@ -0,0 +1,404 @@
+#ifndef MEMORY_MAP
+#define MEMORY_MAP
+
+#include "cpu.h"
+
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+/* The memory map: what's at each address, a 256-byte page at a time.
+ *
+ * Every page is one of four things.  RAM and ROM are the backing store,
+ * cpu->memory, read and (for RAM) written directly.  An unmapped page reads
+ * as 0xff, as the 8080's data bus floats high with nothing driving it, and
+ * ignores writes.  And an MMIO page belongs to a device in the hardware
+ * library, whose handlers are called for each read and write.
+ *
+ * The page table is the CPU's rom_mask, with a mask_shift of PAGE_SHIFT:
+ * write8() already looks there before every store, and only leaves the fast
+ * path, a plain store to memory, for a page that isn't RAM.  Reads look at it
+ * too (see read8()), but only to check for MMIO; the rest read memory as
+ * before.  The backing store of an unmapped page is filled with 0xff, so
+ * reading one needs no special case at all.
+ *
+ * Hardware libraries map their devices with memory_map_add_mmio(), through
+ * the map in struct system_resources, in hw_init_struct: the cores decide
+ * what they can do inline (see dynarec.h) when they start, so the page types
+ * mustn't change while the CPU's running.
+ *
+ * A few things still see the backing store, whatever the page: opcodes are
+ * always fetched from it (so running code from an MMIO page runs whatever's
+ * underneath), and so are the block cache's decoding and the debug output.
+ *
+ * Memory can also be banked.  The emulator keeps a physical store, which may
+ * be bigger than the 64 KB the CPU can address (see memory_map_load()), and
+ * the backing store is a view of it: at power on, of its first 64 KB.  A
+ * hardware library marks out windows, ranges of addresses which can show
+ * different parts of the store, with memory_map_add_window(), and switches
+ * banks, usually from its OUT handler, with memory_map_select_bank().  A
+ * window's banks are the store cut into pieces of the window's size: bank n
+ * starts n times the size into the store (and into the ROM file, which is
+ * loaded into the store from the start).  Nothing is copied: the window's
+ * part of the host's address space is simply mapped onto the bank, so that
+ * memory is still one flat array to the cores, and a switch costs the same
+ * whatever the window's size.  The page types belong to the addresses, not
+ * to the banks, and stay as they are.
+ *
+ * With no more than 64 KB there's nothing to switch in, and so no store: the
+ * ROM file is mapped straight into the backing store, copy-on-write.  Pages
+ * nothing writes to (the ROM, above all) stay shared with the file, and so
+ * with every other emulator running the same ROM, and the rest are copied the
+ * first time they're written.
+ *
+ * Finally, the map can keep track of which pages have been written, for
+ * whatever only wants what's changed: a snapshot that copies only the pages
+ * written since the last, say, or a front end that skips the parts of video
+ * memory that are as they were.  It's off unless something turns it on with
+ * memory_map_track_dirty(), and then write8() sets the page's bit in a bitmap
+ * on every store to RAM or MMIO, whichever opcode it's for.  Switching a bank
+ * dirties the whole window, as what the CPU sees there has changed.
+ * memory_map_take_dirty() reads and clears the bitmap, a word at a time,
+ * atomically, so any thread can take it.  It's only exact on the CPU thread,
+ * though (from a scheduler event, say, which is where a snapshot wants to
+ * copy pages anyway, so they're not changing under it): from another, a
+ * write racing the take can be missed until the page is written again, as
+ * write8() doesn't lock the bus for a page that's already marked.
+ */
+
+#define PAGE_SHIFT (8)
+#define PAGE_SIZE  (1 << PAGE_SHIFT)
+#define PAGES	   (MAX_MEMORY >> PAGE_SHIFT)
+
+// What reading an unmapped page gives.
+#define UNMAPPED_BYTE (0xff)
+
+enum page_type
+{
+	PAGE_RAM = 0, // So the table can be a rom_mask.
+	PAGE_ROM,
+	PAGE_UNMAPPED,
+	PAGE_MMIO
+};
+
+/* A device's handlers.  Either can be NULL: reads then come from the backing
+ * store, and writes go to it, so a device that only wants to see writes (to
+ * keep track of what's changed in video memory, say) costs reads nothing but
+ * the check.  A write handler that wants the byte kept has to store it itself.
+ */
+typedef uint8_t (*mmio_read)(void* device, uint16_t address);
+typedef void (*mmio_write)(void* device, uint16_t address, uint8_t value);
+
+struct mmio_handlers
+{
+	mmio_read read;
+	mmio_write write;
+	void* device;
+};
+
+// The dirty bitmap's size, in 64-page words.
+#define DIRTY_WORDS (PAGES / 64)
+
+// The biggest physical store the emulator will make: see memory_map_create().
+#define MAX_STORE (64 << 20)
+
+// The most windows a map can have.
+#ifndef BANK_WINDOWS
+#	define BANK_WINDOWS (16)
+#endif
+
+struct bank_window
+{
+	uint16_t start;
+	uint32_t length;
+	uint32_t bank; // The one it's showing.
+};
+
+/* Told of every bank switch, so that anything decoded from the window can be
+ * thrown away: see memory_map_on_remap().
+ */
+typedef void (*memory_remapped)(void* data, uint16_t start, uint32_t length);
+
+struct memory_map
+{
+	uint8_t* memory; // The backing store, MAX_MEMORY bytes.
+	uint8_t type[PAGES];
+	struct mmio_handlers mmio[PAGES];
+	int mmio_reads; // Pages with a read handler.
+	/* The physical store (see memory_map_load()): all of it, whatever the
+	 * windows are showing.  Without banking, it's the backing store, and
+	 * store_fd is -1.
+	 */
+	int store_fd;
+	uint8_t* store;
+	uint32_t store_size;
+	struct bank_window window[BANK_WINDOWS];
+	int windows;
+	memory_remapped remapped;
+	void* remapped_data;
+	// A bit for each page written since it was last taken, while tracking.
+	int track_dirty;
+	uint64_t dirty[DIRTY_WORDS];
+};
+
+/* Starts the map off as all RAM, in memory, with no physical store behind it,
+ * and so no banking.
+ */
+static inline void memory_map_init(struct memory_map* map, uint8_t* memory)
+{
+	memset(map, 0, sizeof(*map));
+	map->memory   = memory;
+	map->store_fd = -1;
+}
+
+/* Makes the pages covering length bytes from start RAM, ROM or unmapped.
+ * Both should be multiples of PAGE_SIZE; anything partly covered is taken in
+ * whole.
+ */
+static inline void memory_map_set(struct memory_map* map,
+		uint16_t start,
+		uint32_t length,
+		enum page_type type)
+{
+	if (!length) return;
+	const unsigned first = start >> PAGE_SHIFT;
+	unsigned last	     = (start + length - 1) >> PAGE_SHIFT;
+	if (last >= PAGES) last = PAGES - 1;
+	for (unsigned page = first; page <= last; ++page)
+	{
+		if (map->mmio[page].read) --map->mmio_reads;
+		memset(&map->mmio[page], 0, sizeof(map->mmio[page]));
+		map->type[page] = type;
+		if (type == PAGE_UNMAPPED)
+			memset(map->memory + (page << PAGE_SHIFT),
+					UNMAPPED_BYTE,
+					PAGE_SIZE);
+	}
+}
+
+// Hands the pages covering length bytes from start to a device.
+static inline void memory_map_add_mmio(struct memory_map* map,
+		uint16_t start,
+		uint32_t length,
+		mmio_read read,
+		mmio_write write,
+		void* device)
+{
+	if (!length) return;
+	memory_map_set(map, start, length, PAGE_MMIO);
+	const struct mmio_handlers handlers = {read, write, device};
+	const unsigned first = start >> PAGE_SHIFT;
+	unsigned last	     = (start + length - 1) >> PAGE_SHIFT;
+	if (last >= PAGES) last = PAGES - 1;
+	for (unsigned page = first; page <= last; ++page)
+	{
+		map->mmio[page] = handlers;
+		if (read) ++map->mmio_reads;
+	}
+}
+
+/* Marks ROM from a rom mask, as in a .mask file: a byte for each 1 << shift
+ * bytes of memory, nonzero for ROM.  Returns -1, having changed nothing, if
+ * the mask is finer-grained than a page.
+ */
+static inline int memory_map_add_mask(struct memory_map* map,
+		const uint8_t* mask,
+		uint8_t shift)
+{
+	if (shift < PAGE_SHIFT || shift > 16) return -1;
+	for (uint32_t block = 0; block < (uint32_t) MAX_MEMORY >> shift;
+			++block)
+		if (mask[block])
+			memory_map_set(map,
+					block << shift,
+					1u << shift,
+					PAGE_ROM);
+	return 0;
+}
+
+// Whether any page's reads need more than a look at the backing store.
+static inline int memory_map_mmio_reads(const struct memory_map* map)
+{
+	return map && map->mmio_reads;
+}
+
+/* Turns dirty page tracking (see above) on or off.  Turning it on doesn't
+ * touch the bitmap, so a consumer starting afresh should treat every page as
+ * dirty once, or take the bitmap first.  Any thread can do this at any time,
+ * though writes the CPU's in the middle of may or may not be seen.
+ */
+static inline void memory_map_track_dirty(struct memory_map* map, int on)
+{
+	__atomic_store_n(&map->track_dirty, on, __ATOMIC_RELAXED);
+}
+
+// Whether write8() has to mark the pages it writes.
+static inline int memory_map_tracking(const struct memory_map* map)
+{
+	return map && __atomic_load_n(&map->track_dirty, __ATOMIC_RELAXED);
+}
+
+/* Marks the page with address in it dirty, whether tracking or not: write8()
+ * has already looked.  Most writes are to pages that are already marked, so
+ * the atomic update is only paid for once per page per take.  The bit's set
+ * after the store it's for, so whatever takes it sees the page as written.
+ */
+static inline void memory_map_note_write(
+		struct memory_map* map, uint16_t address)
+{
+	const unsigned page = address >> PAGE_SHIFT;
+	uint64_t* word	    = &map->dirty[page / 64];
+	const uint64_t bit  = (uint64_t) 1 << page % 64;
+	if (!(__atomic_load_n(word, __ATOMIC_RELAXED) & bit))
+		__atomic_fetch_or(word, bit, __ATOMIC_RELEASE);
+}
+
+// Marks the pages covering length bytes from start dirty, if tracking.
+static inline void memory_map_mark_dirty(
+		struct memory_map* map, uint16_t start, uint32_t length)
+{
+	if (!length || !memory_map_tracking(map)) return;
+	const unsigned first = start >> PAGE_SHIFT;
+	unsigned last	     = (start + length - 1) >> PAGE_SHIFT;
+	if (last >= PAGES) last = PAGES - 1;
+	for (unsigned page = first; page <= last; ++page)
+		memory_map_note_write(map, page << PAGE_SHIFT);
+}
+
+// Whether a page has been written since the bitmap was last taken.
+static inline int memory_map_page_dirty(
+		const struct memory_map* map, unsigned page)
+{
+	const uint64_t bits = __atomic_load_n(
+			&map->dirty[page / 64], __ATOMIC_ACQUIRE);
+	return bits >> page % 64 & 1;
+}
+
+/* Copies the dirty bitmap into dirty (if it isn't NULL), a bit for each page,
+ * page 0 the lowest bit of dirty[0], and clears it.  Returns how many pages
+ * were dirty.
+ */
+static inline int memory_map_take_dirty(
+		struct memory_map* map, uint64_t dirty[DIRTY_WORDS])
+{
+	int pages = 0;
+	for (int word = 0; word < DIRTY_WORDS; ++word)
+	{
+		const uint64_t bits = __atomic_exchange_n(
+				&map->dirty[word], 0, __ATOMIC_ACQUIRE);
+		if (dirty) dirty[word] = bits;
+		pages += __builtin_popcountll(bits);
+	}
+	return pages;
+}
+
+/* Marks out a window of length bytes from start, which can be switched to
+ * any bank of the physical store.  It starts off showing the store at its own
+ * address, bank start / length.  Both have to be multiples of the host's page
+ * size (4 KB, usually), and start a multiple of length; windows shouldn't
+ * overlap.  Returns the window's number, or -1 if there's no store, it's
+ * misaligned, or there are already BANK_WINDOWS.
+ */
+static inline int memory_map_add_window(
+		struct memory_map* map, uint16_t start, uint32_t length)
+{
+	const long host_page = sysconf(_SC_PAGESIZE);
+	if (map->store_fd < 0 || map->windows == BANK_WINDOWS || !length
+			|| start + length > MAX_MEMORY || start % host_page
+			|| length % host_page || start % length)
+		return -1;
+	struct bank_window* window = &map->window[map->windows];
+	window->start		   = start;
+	window->length		   = length;
+	window->bank		   = start / length;
+	return map->windows++;
+}
+
+/* Switches a window to another bank.  Does nothing if it's already showing
+ * it.  Returns -1, leaving the window as it was, if there's no such window or
+ * bank.  Only call this from the CPU thread.
+ */
+static inline int memory_map_select_bank(
+		struct memory_map* map, int window, uint32_t bank)
+{
+	if (window < 0 || window >= map->windows) return -1;
+	struct bank_window* w = &map->window[window];
+	if (bank == w->bank) return 0;
+	if ((uint64_t) (bank + 1) * w->length > map->store_size) return -1;
+	if (mmap(map->memory + w->start,
+			    w->length,
+			    PROT_READ | PROT_WRITE,
+			    MAP_SHARED | MAP_FIXED,
+			    map->store_fd,
+			    (off_t) bank * w->length)
+			== MAP_FAILED)
+		return -1;
+	w->bank = bank;
+	memory_map_mark_dirty(map, w->start, w->length);
+	if (map->remapped)
+		map->remapped(map->remapped_data, w->start, w->length);
+	return 0;
+}
+
+// The bank a window is showing, or -1 if there's no such window.
+static inline int64_t memory_map_bank(
+		const struct memory_map* map, int window)
+{
+	if (window < 0 || window >= map->windows) return -1;
+	return map->window[window].bank;
+}
+
+/* Has remapped called after every bank switch, with data and the window's
+ * range; NULL stops it.  The block cores use this to throw away the code
+ * they've decoded from the window.
+ */
+static inline void memory_map_on_remap(
+		struct memory_map* map, memory_remapped remapped, void* data)
+{
+	map->remapped	   = remapped;
+	map->remapped_data = data;
+}
+
+// The slow paths of read8() and write8(), for MMIO pages.
+static inline uint8_t memory_map_read(
+		const struct memory_map* map, uint16_t address)
+{
+	const struct mmio_handlers* mmio = &map->mmio[address >> PAGE_SHIFT];
+	if (mmio->read) return mmio->read(mmio->device, address);
+	return map->memory[address];
+}
+
+static inline void memory_map_write(
+		struct memory_map* map, uint16_t address, uint8_t value)
+{
+	const struct mmio_handlers* mmio = &map->mmio[address >> PAGE_SHIFT];
+	if (mmio->write)
+		mmio->write(mmio->device, address, value);
+	else
+		map->memory[address] = value;
+}
+
+/* The emulator's side.  Creates a physical store of store_size bytes (at
+ * least MAX_MEMORY, and rounded up to a whole number of host pages), zeroed,
+ * and starts the map off as memory_map_init() does, with the backing store a
+ * view of the store's first 64 KB.  Returns the backing store, or NULL, having
+ * said why, on failure.
+ */
+uint8_t* memory_map_create(struct memory_map* map, uint32_t store_size);
+
+/* Loads the ROM from the open file rom, into store_size bytes of memory, or,
+ * if store_size is 0, as much as the ROM needs.  More than MAX_MEMORY, and
+ * it's read into a store from memory_map_create(), for banking; otherwise,
+ * the file is mapped in privately, as above, and no store is created.  (A
+ * file that can't be mapped, like a pipe, is read in instead.)  Either way,
+ * it's loaded from address zero, and anything it doesn't fill is zeroed.
+ * Returns the backing store, or NULL, having said why, on failure.
+ */
+uint8_t* memory_map_load(struct memory_map* map, int rom, uint32_t store_size);
+
+// Unmaps the backing store and the physical store, if they were mapped.
+void memory_map_destroy(struct memory_map* map);
+
+#endif
@@ -0,0 +1,178 @@
+#ifndef METRICS
+#define METRICS
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+/* Runtime metrics, for keeping an eye on long-running instances.
+ *
+ * The registry is a fixed table of named counters and gauges, each a single
+ * 64-bit value.  Whoever adds a metric gets back a pointer to its value, and
+ * updates it with a relaxed atomic store or add, which is as cheap as writing
+ * any other variable.  Even that isn't done on the hot path: the cores count
+ * in locals and publish their totals once a chunk, when they settle up with
+ * the timer.  Nothing reads the values but the exporter (see
+ * metrics_export_start()), which writes them out as JSON lines, to a file,
+ * and answers on a Unix-domain socket in Prometheus' text format.
+ *
+ * Hardware libraries add metrics of their own with metrics_add(), through
+ * the registry in struct system_resources, best in hw_init_struct.  Adding
+ * one is safe from any thread, but there are only METRICS_MAX, and they're
+ * never removed.  Given a NULL registry, or a full one, metrics_add() returns
+ * a value nobody reads, so there's no need to check.
+ */
+
+#ifndef METRICS_MAX
+#	define METRICS_MAX (64)
+#endif
+#define METRICS_NAME_LENGTH (48)
+// The default for --metrics-interval, in milliseconds.
+#ifndef METRICS_INTERVAL
+#	define METRICS_INTERVAL (1000l)
+#endif
+#define METRICS_HELP_LENGTH (96)
+
+enum metric_type
+{
+	METRIC_COUNTER, // Only goes up: a total.
+	METRIC_GAUGE	// Goes up and down.
+};
+
+struct metric
+{
+	char name[METRICS_NAME_LENGTH]; // Letters, digits and underscores.
+	char help[METRICS_HELP_LENGTH];
+	enum metric_type type;
+	double scale; // The value's exported multiplied by this.
+	uint64_t value;
+	uint8_t ready; // Set once the rest is filled in.
+};
+
+struct metrics
+{
+	struct metric metric[METRICS_MAX];
+	int count; // Slots taken, which may not all be ready yet.
+};
+
+static inline void metrics_init(struct metrics* metrics)
+{
+	memset(metrics, 0, sizeof(*metrics));
+}
+
+/* Adds a metric, which starts at 0, and returns a pointer to its value.  The
+ * exported value is the stored one times scale, so that, say, a speed kept
+ * in Hz can be shown in MHz.
+ */
+static inline uint64_t* metrics_add_scaled(struct metrics* metrics,
+		const char* name,
+		const char* help,
+		enum metric_type type,
+		double scale)
+{
+	static uint64_t discarded;
+	if (!metrics) return &discarded;
+	const int index = __atomic_fetch_add(
+			&metrics->count, 1, __ATOMIC_RELAXED);
+	if (index >= METRICS_MAX) return &discarded;
+	struct metric* metric = &metrics->metric[index];
+	snprintf(metric->name, sizeof(metric->name), "%s", name);
+	snprintf(metric->help, sizeof(metric->help), "%s", help);
+	metric->type  = type;
+	metric->scale = scale;
+	__atomic_store_n(&metric->ready, 1, __ATOMIC_RELEASE);
+	return &metric->value;
+}
+
+static inline uint64_t* metrics_add(struct metrics* metrics,
+		const char* name,
+		const char* help,
+		enum metric_type type)
+{
+	return metrics_add_scaled(metrics, name, help, type, 1.0);
+}
+
+static inline void metric_set(uint64_t* value, uint64_t to)
+{
+	__atomic_store_n(value, to, __ATOMIC_RELAXED);
+}
+
+static inline void metric_count(uint64_t* value, uint64_t by)
+{
+	__atomic_fetch_add(value, by, __ATOMIC_RELAXED);
+}
+
+static inline uint64_t metric_read(const uint64_t* value)
+{
+	return __atomic_load_n(value, __ATOMIC_RELAXED);
+}
+
+/* Lock waits: how often a lock was found taken, and how long, in all, was
+ * spent waiting for it.  metrics_lock() is pthread_mutex_lock() with the
+ * waits counted.  Uncontended, it costs a trylock and nothing else.
+ */
+struct lock_metrics
+{
+	uint64_t* waits;
+	uint64_t* nanoseconds;
+};
+
+// Adds <prefix>_waits_total and <prefix>_wait_ns_total for a lock.
+static inline struct lock_metrics metrics_add_lock(
+		struct metrics* metrics, const char* prefix, const char* lock)
+{
+	char name[METRICS_NAME_LENGTH], help[METRICS_HELP_LENGTH];
+	struct lock_metrics lock_metrics;
+	snprintf(name, sizeof(name), "%s_waits_total", prefix);
+	snprintf(help, sizeof(help), "Times the %s was found taken.", lock);
+	lock_metrics.waits =
+			metrics_add(metrics, name, help, METRIC_COUNTER);
+	snprintf(name, sizeof(name), "%s_wait_ns_total", prefix);
+	snprintf(help,
+			sizeof(help),
+			"Nanoseconds spent waiting for the %s.",
+			lock);
+	lock_metrics.nanoseconds =
+			metrics_add(metrics, name, help, METRIC_COUNTER);
+	return lock_metrics;
+}
+
+static inline void metrics_lock(
+		pthread_mutex_t* lock, const struct lock_metrics* metrics)
+{
+	if (pthread_mutex_trylock(lock) != EBUSY) return;
+	struct timespec start, end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	pthread_mutex_lock(lock);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	metric_count(metrics->waits, 1);
+	metric_count(metrics->nanoseconds,
+			(end.tv_sec - start.tv_sec) * 1000000000l
+					+ end.tv_nsec - start.tv_nsec);
+}
+
+/* The exporter runs in a thread of its own, sampling the registry every
+ * interval milliseconds.  If file isn't NULL, it appends a line of JSON to it
+ * each time, with the time and every metric; and if socket_path isn't, it
+ * listens there, and writes the metrics in Prometheus' text format to anyone
+ * who connects (as a bare HTTP response, if they ask with a GET).  It also
+ * keeps the emulated_mhz gauge, worked out from cycles_total between samples.
+ * Returns NULL, having said why, if it can't open either.
+ */
+struct metrics_exporter* metrics_export_start(struct metrics* metrics,
+		const char* file,
+		const char* socket_path,
+		long interval);
+
+// Writes a last sample, stops the thread, and removes the socket.
+void metrics_export_stop(struct metrics_exporter* exporter);
+
+// The two formats, for the exporter and for testing.  time is in seconds.
+void metrics_write_json(
+		const struct metrics* metrics, double time, FILE* file);
+void metrics_write_prometheus(const struct metrics* metrics, FILE* file);
+
+#endif
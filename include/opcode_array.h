@@ -10,4 +10,10 @@
 
 extern int (*opcodes[256])(const uint8_t* opcode, struct cpu_state* cpu);
 
+/* The generic handlers, one per opcode family, which opcodes[] was generated
+ * from.  Kept as a reference: see specialized_opcodes.c.
+ */
+extern int (*const generic_opcodes[256])(
+		const uint8_t* opcode, struct cpu_state* cpu);
+
 #endif
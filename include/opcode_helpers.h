@@ -1,7 +1,10 @@
 #ifndef OPCODES
 #define OPCODES
 
+#include "alu_tables.h"
+#include "block_cache.h"
 #include "cpu.h"
+#include "memory_map.h"
 
 #include <assert.h>
 #include <stdint.h>
@@ -109,6 +112,24 @@ __attribute__((const)) static inline uint8_t check_parity(uint8_t value)
 	(flags = (check_parity(value) ? flags | PARITY_FLAG \
 				      : flags & ~PARITY_FLAG))
 
+/* Reads memory.  Anything but MMIO comes straight from the backing store; only
+ * with a memory map (see memory_map.h) is there any MMIO to look for.
+ */
+static inline uint8_t read8(const struct cpu_state* cpu, uint16_t address)
+{
+	const struct memory_map* map = cpu->memory_map;
+	const int page		     = address >> PAGE_SHIFT;
+	if (__builtin_expect(map && map->type[page] == PAGE_MMIO, 0))
+		return memory_map_read(map, address);
+	return cpu->memory[address];
+}
+
+// Little-endian, wrapping around at the top of memory as the 8080 does.
+static inline uint16_t read16(const struct cpu_state* cpu, uint16_t address)
+{
+	return read8(cpu, address) | read8(cpu, (uint16_t) (address + 1)) << 8;
+}
+
 /* fetch_operand() is a helper function, which takes as its first argument
  * a copy of JUST the three bits representing a source or destination
  * code, shifted right in the case of a source code. Its second
@@ -144,7 +165,7 @@ __attribute__((pure)) static inline uint8_t* fetch_operand_ptr(
 	}
 }
 
-__attribute__((pure)) static inline uint8_t fetch_operand_val(
+static inline uint8_t fetch_operand_val(
 		uint8_t operand_field, struct cpu_state const* cpu)
 {
 	switch (operand_field)
@@ -155,7 +176,7 @@ __attribute__((pure)) static inline uint8_t fetch_operand_val(
 	case OPERAND_REG_E: return cpu->e;
 	case OPERAND_REG_H: return cpu->h;
 	case OPERAND_REG_L: return cpu->l;
-	case OPERAND_MEM: return cpu->memory[cpu->hl];
+	case OPERAND_MEM: return read8(cpu, cpu->hl);
 	case OPERAND_REG_A: return cpu->a;
 	default:
 		fprintf(stderr,
@@ -214,32 +235,13 @@ __attribute__((const)) static inline char* get_condition_name(
 
 /* evaluate_condition is a helper function that takes an opcode and the contents
  * of the flags register as arguments. It determines which condition the opcode
- * indicates, switches on the condition, and returns the results of the
- * evaluated condition*/
-__attribute__((const)) static inline uint8_t evaluate_condition(
+ * indicates, and looks up whether the flags satisfy it in condition_table
+ * (see alu_tables.h).  Returns nonzero if the condition is met.
+ */
+__attribute__((pure)) static inline uint8_t evaluate_condition(
 		const uint8_t opcode, const uint16_t psw)
 {
-	switch (GET_CONDITION(opcode))
-	{
-	case CONDITION_NOT_ZERO: return !(psw & ZERO_FLAG);
-	case CONDITION_ZERO: return psw & ZERO_FLAG;
-	case CONDITION_NO_CARRY: return !(psw & CARRY_FLAG);
-	case CONDITION_CARRY: return psw & CARRY_FLAG;
-	// Parity bit is set when parity is even
-	case CONDITION_PARITY_ODD: return !(psw & PARITY_FLAG);
-	// Parity bit is set when parity is even
-	case CONDITION_PARITY_EVEN: return psw & PARITY_FLAG;
-	case CONDITION_SIGN: return psw & SIGN_FLAG;
-	case CONDITION_NO_SIGN: return !(psw & SIGN_FLAG);
-	default:
-		fprintf(stderr,
-				"ERROR: evaluate_condition()"
-				"was passed 0x%4.4x, which did"
-				"not evaluate to any condition!",
-				opcode);
-		exit(1);
-	}
-	return 0;
+	return condition_table[GET_CONDITION(opcode)][(uint8_t) psw];
 }
 
 __attribute__((pure)) static inline uint16_t* get_register_pair_pushpop(
@@ -308,7 +310,24 @@ static inline uint16_t _add(
 static inline void write8(struct cpu_state* cpu, uint16_t offset, uint8_t value)
 {
 	if (!cpu->rom_mask[offset >> cpu->mask_shift])
+	{
 		cpu->memory[offset] = value;
+		if (cpu->block_cache)
+			block_cache_note_write(cpu->block_cache, offset);
+		if (__builtin_expect(memory_map_tracking(cpu->memory_map), 0))
+			memory_map_note_write(cpu->memory_map, offset);
+	}
+	else if (cpu->memory_map
+			&& cpu->memory_map->type[offset >> PAGE_SHIFT]
+					   == PAGE_MMIO)
+	{
+		// The device may well keep the byte, and it may be code.
+		memory_map_write(cpu->memory_map, offset, value);
+		if (cpu->block_cache)
+			block_cache_note_write(cpu->block_cache, offset);
+		if (memory_map_tracking(cpu->memory_map))
+			memory_map_note_write(cpu->memory_map, offset);
+	}
 #ifdef VERBOSE
 	else
 		fprintf(stderr,
@@ -0,0 +1,357 @@
+#ifndef OPCODE_INFO
+#define OPCODE_INFO
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Static facts about every opcode, worked out at compile time: how long it
+ * is, how many cycles it takes, what it does to memory and to the flow of
+ * control, and what it's called.  The cores use this to step over opcodes and
+ * to count cycles, the disassembler to print them, and the tests to check the
+ * handlers.  opcode_info.c checks every entry against the datasheet's timing
+ * rules at compile time.
+ */
+
+// How an opcode touches memory, apart from being fetched.
+enum opcode_access
+{
+	MEM_NONE = 0,
+	MEM_READ,     // Reads memory: MOV r,M, LDAX, LDA, LHLD, ALU ops on M.
+	MEM_WRITE,    // Writes memory: MOV M,r, MVI M, STAX, STA, SHLD.
+	MEM_MODIFY,   // Reads and writes the same byte: INR M, DCR M.
+	MEM_POP,      // Reads through SP: POP, RET and conditional returns.
+	MEM_PUSH,     // Writes through SP: PUSH, CALL, conditional calls, RST.
+	MEM_EXCHANGE, // Reads and writes through SP: XTHL.
+	MEM_IO	      // Talks to the hardware instead: IN, OUT.
+};
+
+// Where execution goes after an opcode.
+enum opcode_flow
+{
+	FLOW_NEXT = 0, // Straight on to the next opcode.
+	FLOW_JUMP,     // Unconditionally somewhere else: JMP, PCHL.
+	FLOW_BRANCH,   // Conditional jumps.
+	FLOW_CALL,     // CALL, conditional calls and RST.
+	FLOW_RETURN,   // RET and conditional returns.
+	FLOW_SYNC      // Changes the interrupt or halt state: EI, DI, HLT.
+};
+
+struct opcode_info
+{
+	const char* mnemonic;
+	uint8_t length;
+	/* The cycle count.  Conditional calls and returns take longer when the
+	 * condition is met: cycles is the cost when it isn't, and cycles_taken
+	 * the cost when it is.  For every other opcode the two are the same.
+	 */
+	uint8_t cycles;
+	uint8_t cycles_taken;
+	uint8_t access; // enum opcode_access
+	uint8_t flow;	// enum opcode_flow
+};
+
+/* The table itself, as an X-macro: X(opcode, mnemonic, length, cycles,
+ * cycles_taken, access, flow).  Unused opcodes are listed as the opcodes
+ * they behave as.  IN and OUT are handled by the hardware library, which is
+ * expected to charge 10 cycles for them.
+ */
+// clang-format off
+#define OPCODE_INFO_TABLE(X) \
+	X(0x00, "NOP",      1,  4,  4, MEM_NONE,     FLOW_NEXT) \
+	X(0x01, "LXI B",    3, 10, 10, MEM_NONE,     FLOW_NEXT) \
+	X(0x02, "STAX B",   1,  7,  7, MEM_WRITE,    FLOW_NEXT) \
+	X(0x03, "INX B",    1,  5,  5, MEM_NONE,     FLOW_NEXT) \
+	X(0x04, "INR B",    1,  5,  5, MEM_NONE,     FLOW_NEXT) \
+	X(0x05, "DCR B",    1,  5,  5, MEM_NONE,     FLOW_NEXT) \
+	X(0x06, "MVI B",    2,  7,  7, MEM_NONE,     FLOW_NEXT) \
+	X(0x07, "RLC",      1,  4,  4, MEM_NONE,     FLOW_NEXT) \
+	X(0x08, "NOP",      1,  4,  4, MEM_NONE,     FLOW_NEXT) \
+	X(0x09, "DAD B",    1, 10, 10, MEM_NONE,     FLOW_NEXT) \
+	X(0x0a, "LDAX B",   1,  7,  7, MEM_READ,     FLOW_NEXT) \
+	X(0x0b, "DCX B",    1,  5,  5, MEM_NONE,     FLOW_NEXT) \
+	X(0x0c, "INR C",    1,  5,  5, MEM_NONE,     FLOW_NEXT) \
+	X(0x0d, "DCR C",    1,  5,  5, MEM_NONE,     FLOW_NEXT) \
+	X(0x0e, "MVI C",    2,  7,  7, MEM_NONE,     FLOW_NEXT) \
+	X(0x0f, "RRC",      1,  4,  4, MEM_NONE,     FLOW_NEXT) \
+	X(0x10, "NOP",      1,  4,  4, MEM_NONE,     FLOW_NEXT) \
+	X(0x11, "LXI D",    3, 10, 10, MEM_NONE,     FLOW_NEXT) \
+	X(0x12, "STAX D",   1,  7,  7, MEM_WRITE,    FLOW_NEXT) \
+	X(0x13, "INX D",    1,  5,  5, MEM_NONE,     FLOW_NEXT) \
+	X(0x14, "INR D",    1,  5,  5, MEM_NONE,     FLOW_NEXT) \
+	X(0x15, "DCR D",    1,  5,  5, MEM_NONE,     FLOW_NEXT) \
+	X(0x16, "MVI D",    2,  7,  7, MEM_NONE,     FLOW_NEXT) \
+	X(0x17, "RAL",      1,  4,  4, MEM_NONE,     FLOW_NEXT) \
+	X(0x18, "NOP",      1,  4,  4, MEM_NONE,     FLOW_NEXT) \
+	X(0x19, "DAD D",    1, 10, 10, MEM_NONE,     FLOW_NEXT) \
+	X(0x1a, "LDAX D",   1,  7,  7, MEM_READ,     FLOW_NEXT) \
+	X(0x1b, "DCX D",    1,  5,  5, MEM_NONE,     FLOW_NEXT) \
+	X(0x1c, "INR E",    1,  5,  5, MEM_NONE,     FLOW_NEXT) \
+	X(0x1d, "DCR E",    1,  5,  5, MEM_NONE,     FLOW_NEXT) \
+	X(0x1e, "MVI E",    2,  7,  7, MEM_NONE,     FLOW_NEXT) \
+	X(0x1f, "RAR",      1,  4,  4, MEM_NONE,     FLOW_NEXT) \
+	X(0x20, "NOP",      1,  4,  4, MEM_NONE,     FLOW_NEXT) \
+	X(0x21, "LXI H",    3, 10, 10, MEM_NONE,     FLOW_NEXT) \
+	X(0x22, "SHLD",     3, 16, 16, MEM_WRITE,    FLOW_NEXT) \
+	X(0x23, "INX H",    1,  5,  5, MEM_NONE,     FLOW_NEXT) \
+	X(0x24, "INR H",    1,  5,  5, MEM_NONE,     FLOW_NEXT) \
+	X(0x25, "DCR H",    1,  5,  5, MEM_NONE,     FLOW_NEXT) \
+	X(0x26, "MVI H",    2,  7,  7, MEM_NONE,     FLOW_NEXT) \
+	X(0x27, "DAA",      1,  4,  4, MEM_NONE,     FLOW_NEXT) \
+	X(0x28, "NOP",      1,  4,  4, MEM_NONE,     FLOW_NEXT) \
+	X(0x29, "DAD H",    1, 10, 10, MEM_NONE,     FLOW_NEXT) \
+	X(0x2a, "LHLD",     3, 16, 16, MEM_READ,     FLOW_NEXT) \
+	X(0x2b, "DCX H",    1,  5,  5, MEM_NONE,     FLOW_NEXT) \
+	X(0x2c, "INR L",    1,  5,  5, MEM_NONE,     FLOW_NEXT) \
+	X(0x2d, "DCR L",    1,  5,  5, MEM_NONE,     FLOW_NEXT) \
+	X(0x2e, "MVI L",    2,  7,  7, MEM_NONE,     FLOW_NEXT) \
+	X(0x2f, "CMA",      1,  4,  4, MEM_NONE,     FLOW_NEXT) \
+	X(0x30, "NOP",      1,  4,  4, MEM_NONE,     FLOW_NEXT) \
+	X(0x31, "LXI SP",   3, 10, 10, MEM_NONE,     FLOW_NEXT) \
+	X(0x32, "STA",      3, 13, 13, MEM_WRITE,    FLOW_NEXT) \
+	X(0x33, "INX SP",   1,  5,  5, MEM_NONE,     FLOW_NEXT) \
+	X(0x34, "INR M",    1, 10, 10, MEM_MODIFY,   FLOW_NEXT) \
+	X(0x35, "DCR M",    1, 10, 10, MEM_MODIFY,   FLOW_NEXT) \
+	X(0x36, "MVI M",    2, 10, 10, MEM_WRITE,    FLOW_NEXT) \
+	X(0x37, "STC",      1,  4,  4, MEM_NONE,     FLOW_NEXT) \
+	X(0x38, "NOP",      1,  4,  4, MEM_NONE,     FLOW_NEXT) \
+	X(0x39, "DAD SP",   1, 10, 10, MEM_NONE,     FLOW_NEXT) \
+	X(0x3a, "LDA",      3, 13, 13, MEM_READ,     FLOW_NEXT) \
+	X(0x3b, "DCX SP",   1,  5,  5, MEM_NONE,     FLOW_NEXT) \
+	X(0x3c, "INR A",    1,  5,  5, MEM_NONE,     FLOW_NEXT) \
+	X(0x3d, "DCR A",    1,  5,  5, MEM_NONE,     FLOW_NEXT) \
+	X(0x3e, "MVI A",    2,  7,  7, MEM_NONE,     FLOW_NEXT) \
+	X(0x3f, "CMC",      1,  4,  4, MEM_NONE,     FLOW_NEXT) \
+	X(0x40, "MOV B,B",  1,  5,  5, MEM_NONE,     FLOW_NEXT) \
+	X(0x41, "MOV B,C",  1,  5,  5, MEM_NONE,     FLOW_NEXT) \
+	X(0x42, "MOV B,D",  1,  5,  5, MEM_NONE,     FLOW_NEXT) \
+	X(0x43, "MOV B,E",  1,  5,  5, MEM_NONE,     FLOW_NEXT) \
+	X(0x44, "MOV B,H",  1,  5,  5, MEM_NONE,     FLOW_NEXT) \
+	X(0x45, "MOV B,L",  1,  5,  5, MEM_NONE,     FLOW_NEXT) \
+	X(0x46, "MOV B,M",  1,  7,  7, MEM_READ,     FLOW_NEXT) \
+	X(0x47, "MOV B,A",  1,  5,  5, MEM_NONE,     FLOW_NEXT) \
+	X(0x48, "MOV C,B",  1,  5,  5, MEM_NONE,     FLOW_NEXT) \
+	X(0x49, "MOV C,C",  1,  5,  5, MEM_NONE,     FLOW_NEXT) \
+	X(0x4a, "MOV C,D",  1,  5,  5, MEM_NONE,     FLOW_NEXT) \
+	X(0x4b, "MOV C,E",  1,  5,  5, MEM_NONE,     FLOW_NEXT) \
+	X(0x4c, "MOV C,H",  1,  5,  5, MEM_NONE,     FLOW_NEXT) \
+	X(0x4d, "MOV C,L",  1,  5,  5, MEM_NONE,     FLOW_NEXT) \
+	X(0x4e, "MOV C,M",  1,  7,  7, MEM_READ,     FLOW_NEXT) \
+	X(0x4f, "MOV C,A",  1,  5,  5, MEM_NONE,     FLOW_NEXT) \
+	X(0x50, "MOV D,B",  1,  5,  5, MEM_NONE,     FLOW_NEXT) \
+	X(0x51, "MOV D,C",  1,  5,  5, MEM_NONE,     FLOW_NEXT) \
+	X(0x52, "MOV D,D",  1,  5,  5, MEM_NONE,     FLOW_NEXT) \
+	X(0x53, "MOV D,E",  1,  5,  5, MEM_NONE,     FLOW_NEXT) \
+	X(0x54, "MOV D,H",  1,  5,  5, MEM_NONE,     FLOW_NEXT) \
+	X(0x55, "MOV D,L",  1,  5,  5, MEM_NONE,     FLOW_NEXT) \
+	X(0x56, "MOV D,M",  1,  7,  7, MEM_READ,     FLOW_NEXT) \
+	X(0x57, "MOV D,A",  1,  5,  5, MEM_NONE,     FLOW_NEXT) \
+	X(0x58, "MOV E,B",  1,  5,  5, MEM_NONE,     FLOW_NEXT) \
+	X(0x59, "MOV E,C",  1,  5,  5, MEM_NONE,     FLOW_NEXT) \
+	X(0x5a, "MOV E,D",  1,  5,  5, MEM_NONE,     FLOW_NEXT) \
+	X(0x5b, "MOV E,E",  1,  5,  5, MEM_NONE,     FLOW_NEXT) \
+	X(0x5c, "MOV E,H",  1,  5,  5, MEM_NONE,     FLOW_NEXT) \
+	X(0x5d, "MOV E,L",  1,  5,  5, MEM_NONE,     FLOW_NEXT) \
+	X(0x5e, "MOV E,M",  1,  7,  7, MEM_READ,     FLOW_NEXT) \
+	X(0x5f, "MOV E,A",  1,  5,  5, MEM_NONE,     FLOW_NEXT) \
+	X(0x60, "MOV H,B",  1,  5,  5, MEM_NONE,     FLOW_NEXT) \
+	X(0x61, "MOV H,C",  1,  5,  5, MEM_NONE,     FLOW_NEXT) \
+	X(0x62, "MOV H,D",  1,  5,  5, MEM_NONE,     FLOW_NEXT) \
+	X(0x63, "MOV H,E",  1,  5,  5, MEM_NONE,     FLOW_NEXT) \
+	X(0x64, "MOV H,H",  1,  5,  5, MEM_NONE,     FLOW_NEXT) \
+	X(0x65, "MOV H,L",  1,  5,  5, MEM_NONE,     FLOW_NEXT) \
+	X(0x66, "MOV H,M",  1,  7,  7, MEM_READ,     FLOW_NEXT) \
+	X(0x67, "MOV H,A",  1,  5,  5, MEM_NONE,     FLOW_NEXT) \
+	X(0x68, "MOV L,B",  1,  5,  5, MEM_NONE,     FLOW_NEXT) \
+	X(0x69, "MOV L,C",  1,  5,  5, MEM_NONE,     FLOW_NEXT) \
+	X(0x6a, "MOV L,D",  1,  5,  5, MEM_NONE,     FLOW_NEXT) \
+	X(0x6b, "MOV L,E",  1,  5,  5, MEM_NONE,     FLOW_NEXT) \
+	X(0x6c, "MOV L,H",  1,  5,  5, MEM_NONE,     FLOW_NEXT) \
+	X(0x6d, "MOV L,L",  1,  5,  5, MEM_NONE,     FLOW_NEXT) \
+	X(0x6e, "MOV L,M",  1,  7,  7, MEM_READ,     FLOW_NEXT) \
+	X(0x6f, "MOV L,A",  1,  5,  5, MEM_NONE,     FLOW_NEXT) \
+	X(0x70, "MOV M,B",  1,  7,  7, MEM_WRITE,    FLOW_NEXT) \
+	X(0x71, "MOV M,C",  1,  7,  7, MEM_WRITE,    FLOW_NEXT) \
+	X(0x72, "MOV M,D",  1,  7,  7, MEM_WRITE,    FLOW_NEXT) \
+	X(0x73, "MOV M,E",  1,  7,  7, MEM_WRITE,    FLOW_NEXT) \
+	X(0x74, "MOV M,H",  1,  7,  7, MEM_WRITE,    FLOW_NEXT) \
+	X(0x75, "MOV M,L",  1,  7,  7, MEM_WRITE,    FLOW_NEXT) \
+	X(0x76, "HLT",      1,  7,  7, MEM_NONE,     FLOW_SYNC) \
+	X(0x77, "MOV M,A",  1,  7,  7, MEM_WRITE,    FLOW_NEXT) \
+	X(0x78, "MOV A,B",  1,  5,  5, MEM_NONE,     FLOW_NEXT) \
+	X(0x79, "MOV A,C",  1,  5,  5, MEM_NONE,     FLOW_NEXT) \
+	X(0x7a, "MOV A,D",  1,  5,  5, MEM_NONE,     FLOW_NEXT) \
+	X(0x7b, "MOV A,E",  1,  5,  5, MEM_NONE,     FLOW_NEXT) \
+	X(0x7c, "MOV A,H",  1,  5,  5, MEM_NONE,     FLOW_NEXT) \
+	X(0x7d, "MOV A,L",  1,  5,  5, MEM_NONE,     FLOW_NEXT) \
+	X(0x7e, "MOV A,M",  1,  7,  7, MEM_READ,     FLOW_NEXT) \
+	X(0x7f, "MOV A,A",  1,  5,  5, MEM_NONE,     FLOW_NEXT) \
+	X(0x80, "ADD B",    1,  4,  4, MEM_NONE,     FLOW_NEXT) \
+	X(0x81, "ADD C",    1,  4,  4, MEM_NONE,     FLOW_NEXT) \
+	X(0x82, "ADD D",    1,  4,  4, MEM_NONE,     FLOW_NEXT) \
+	X(0x83, "ADD E",    1,  4,  4, MEM_NONE,     FLOW_NEXT) \
+	X(0x84, "ADD H",    1,  4,  4, MEM_NONE,     FLOW_NEXT) \
+	X(0x85, "ADD L",    1,  4,  4, MEM_NONE,     FLOW_NEXT) \
+	X(0x86, "ADD M",    1,  7,  7, MEM_READ,     FLOW_NEXT) \
+	X(0x87, "ADD A",    1,  4,  4, MEM_NONE,     FLOW_NEXT) \
+	X(0x88, "ADC B",    1,  4,  4, MEM_NONE,     FLOW_NEXT) \
+	X(0x89, "ADC C",    1,  4,  4, MEM_NONE,     FLOW_NEXT) \
+	X(0x8a, "ADC D",    1,  4,  4, MEM_NONE,     FLOW_NEXT) \
+	X(0x8b, "ADC E",    1,  4,  4, MEM_NONE,     FLOW_NEXT) \
+	X(0x8c, "ADC H",    1,  4,  4, MEM_NONE,     FLOW_NEXT) \
+	X(0x8d, "ADC L",    1,  4,  4, MEM_NONE,     FLOW_NEXT) \
+	X(0x8e, "ADC M",    1,  7,  7, MEM_READ,     FLOW_NEXT) \
+	X(0x8f, "ADC A",    1,  4,  4, MEM_NONE,     FLOW_NEXT) \
+	X(0x90, "SUB B",    1,  4,  4, MEM_NONE,     FLOW_NEXT) \
+	X(0x91, "SUB C",    1,  4,  4, MEM_NONE,     FLOW_NEXT) \
+	X(0x92, "SUB D",    1,  4,  4, MEM_NONE,     FLOW_NEXT) \
+	X(0x93, "SUB E",    1,  4,  4, MEM_NONE,     FLOW_NEXT) \
+	X(0x94, "SUB H",    1,  4,  4, MEM_NONE,     FLOW_NEXT) \
+	X(0x95, "SUB L",    1,  4,  4, MEM_NONE,     FLOW_NEXT) \
+	X(0x96, "SUB M",    1,  7,  7, MEM_READ,     FLOW_NEXT) \
+	X(0x97, "SUB A",    1,  4,  4, MEM_NONE,     FLOW_NEXT) \
+	X(0x98, "SBB B",    1,  4,  4, MEM_NONE,     FLOW_NEXT) \
+	X(0x99, "SBB C",    1,  4,  4, MEM_NONE,     FLOW_NEXT) \
+	X(0x9a, "SBB D",    1,  4,  4, MEM_NONE,     FLOW_NEXT) \
+	X(0x9b, "SBB E",    1,  4,  4, MEM_NONE,     FLOW_NEXT) \
+	X(0x9c, "SBB H",    1,  4,  4, MEM_NONE,     FLOW_NEXT) \
+	X(0x9d, "SBB L",    1,  4,  4, MEM_NONE,     FLOW_NEXT) \
+	X(0x9e, "SBB M",    1,  7,  7, MEM_READ,     FLOW_NEXT) \
+	X(0x9f, "SBB A",    1,  4,  4, MEM_NONE,     FLOW_NEXT) \
+	X(0xa0, "ANA B",    1,  4,  4, MEM_NONE,     FLOW_NEXT) \
+	X(0xa1, "ANA C",    1,  4,  4, MEM_NONE,     FLOW_NEXT) \
+	X(0xa2, "ANA D",    1,  4,  4, MEM_NONE,     FLOW_NEXT) \
+	X(0xa3, "ANA E",    1,  4,  4, MEM_NONE,     FLOW_NEXT) \
+	X(0xa4, "ANA H",    1,  4,  4, MEM_NONE,     FLOW_NEXT) \
+	X(0xa5, "ANA L",    1,  4,  4, MEM_NONE,     FLOW_NEXT) \
+	X(0xa6, "ANA M",    1,  7,  7, MEM_READ,     FLOW_NEXT) \
+	X(0xa7, "ANA A",    1,  4,  4, MEM_NONE,     FLOW_NEXT) \
+	X(0xa8, "XRA B",    1,  4,  4, MEM_NONE,     FLOW_NEXT) \
+	X(0xa9, "XRA C",    1,  4,  4, MEM_NONE,     FLOW_NEXT) \
+	X(0xaa, "XRA D",    1,  4,  4, MEM_NONE,     FLOW_NEXT) \
+	X(0xab, "XRA E",    1,  4,  4, MEM_NONE,     FLOW_NEXT) \
+	X(0xac, "XRA H",    1,  4,  4, MEM_NONE,     FLOW_NEXT) \
+	X(0xad, "XRA L",    1,  4,  4, MEM_NONE,     FLOW_NEXT) \
+	X(0xae, "XRA M",    1,  7,  7, MEM_READ,     FLOW_NEXT) \
+	X(0xaf, "XRA A",    1,  4,  4, MEM_NONE,     FLOW_NEXT) \
+	X(0xb0, "ORA B",    1,  4,  4, MEM_NONE,     FLOW_NEXT) \
+	X(0xb1, "ORA C",    1,  4,  4, MEM_NONE,     FLOW_NEXT) \
+	X(0xb2, "ORA D",    1,  4,  4, MEM_NONE,     FLOW_NEXT) \
+	X(0xb3, "ORA E",    1,  4,  4, MEM_NONE,     FLOW_NEXT) \
+	X(0xb4, "ORA H",    1,  4,  4, MEM_NONE,     FLOW_NEXT) \
+	X(0xb5, "ORA L",    1,  4,  4, MEM_NONE,     FLOW_NEXT) \
+	X(0xb6, "ORA M",    1,  7,  7, MEM_READ,     FLOW_NEXT) \
+	X(0xb7, "ORA A",    1,  4,  4, MEM_NONE,     FLOW_NEXT) \
+	X(0xb8, "CMP B",    1,  4,  4, MEM_NONE,     FLOW_NEXT) \
+	X(0xb9, "CMP C",    1,  4,  4, MEM_NONE,     FLOW_NEXT) \
+	X(0xba, "CMP D",    1,  4,  4, MEM_NONE,     FLOW_NEXT) \
+	X(0xbb, "CMP E",    1,  4,  4, MEM_NONE,     FLOW_NEXT) \
+	X(0xbc, "CMP H",    1,  4,  4, MEM_NONE,     FLOW_NEXT) \
+	X(0xbd, "CMP L",    1,  4,  4, MEM_NONE,     FLOW_NEXT) \
+	X(0xbe, "CMP M",    1,  7,  7, MEM_READ,     FLOW_NEXT) \
+	X(0xbf, "CMP A",    1,  4,  4, MEM_NONE,     FLOW_NEXT) \
+	X(0xc0, "RNZ",      1,  5, 11, MEM_POP,      FLOW_RETURN) \
+	X(0xc1, "POP B",    1, 10, 10, MEM_POP,      FLOW_NEXT) \
+	X(0xc2, "JNZ",      3, 10, 10, MEM_NONE,     FLOW_BRANCH) \
+	X(0xc3, "JMP",      3, 10, 10, MEM_NONE,     FLOW_JUMP) \
+	X(0xc4, "CNZ",      3, 11, 17, MEM_PUSH,     FLOW_CALL) \
+	X(0xc5, "PUSH B",   1, 11, 11, MEM_PUSH,     FLOW_NEXT) \
+	X(0xc6, "ADI",      2,  7,  7, MEM_NONE,     FLOW_NEXT) \
+	X(0xc7, "RST 0",    1, 11, 11, MEM_PUSH,     FLOW_CALL) \
+	X(0xc8, "RZ",       1,  5, 11, MEM_POP,      FLOW_RETURN) \
+	X(0xc9, "RET",      1, 10, 10, MEM_POP,      FLOW_RETURN) \
+	X(0xca, "JZ",       3, 10, 10, MEM_NONE,     FLOW_BRANCH) \
+	X(0xcb, "JMP",      3, 10, 10, MEM_NONE,     FLOW_JUMP) \
+	X(0xcc, "CZ",       3, 11, 17, MEM_PUSH,     FLOW_CALL) \
+	X(0xcd, "CALL",     3, 17, 17, MEM_PUSH,     FLOW_CALL) \
+	X(0xce, "ACI",      2,  7,  7, MEM_NONE,     FLOW_NEXT) \
+	X(0xcf, "RST 1",    1, 11, 11, MEM_PUSH,     FLOW_CALL) \
+	X(0xd0, "RNC",      1,  5, 11, MEM_POP,      FLOW_RETURN) \
+	X(0xd1, "POP D",    1, 10, 10, MEM_POP,      FLOW_NEXT) \
+	X(0xd2, "JNC",      3, 10, 10, MEM_NONE,     FLOW_BRANCH) \
+	X(0xd3, "OUT",      2, 10, 10, MEM_IO,       FLOW_NEXT) \
+	X(0xd4, "CNC",      3, 11, 17, MEM_PUSH,     FLOW_CALL) \
+	X(0xd5, "PUSH D",   1, 11, 11, MEM_PUSH,     FLOW_NEXT) \
+	X(0xd6, "SUI",      2,  7,  7, MEM_NONE,     FLOW_NEXT) \
+	X(0xd7, "RST 2",    1, 11, 11, MEM_PUSH,     FLOW_CALL) \
+	X(0xd8, "RC",       1,  5, 11, MEM_POP,      FLOW_RETURN) \
+	X(0xd9, "RET",      1, 10, 10, MEM_POP,      FLOW_RETURN) \
+	X(0xda, "JC",       3, 10, 10, MEM_NONE,     FLOW_BRANCH) \
+	X(0xdb, "IN",       2, 10, 10, MEM_IO,       FLOW_NEXT) \
+	X(0xdc, "CC",       3, 11, 17, MEM_PUSH,     FLOW_CALL) \
+	X(0xdd, "CALL",     3, 17, 17, MEM_PUSH,     FLOW_CALL) \
+	X(0xde, "SBI",      2,  7,  7, MEM_NONE,     FLOW_NEXT) \
+	X(0xdf, "RST 3",    1, 11, 11, MEM_PUSH,     FLOW_CALL) \
+	X(0xe0, "RPO",      1,  5, 11, MEM_POP,      FLOW_RETURN) \
+	X(0xe1, "POP H",    1, 10, 10, MEM_POP,      FLOW_NEXT) \
+	X(0xe2, "JPO",      3, 10, 10, MEM_NONE,     FLOW_BRANCH) \
+	X(0xe3, "XTHL",     1, 18, 18, MEM_EXCHANGE, FLOW_NEXT) \
+	X(0xe4, "CPO",      3, 11, 17, MEM_PUSH,     FLOW_CALL) \
+	X(0xe5, "PUSH H",   1, 11, 11, MEM_PUSH,     FLOW_NEXT) \
+	X(0xe6, "ANI",      2,  7,  7, MEM_NONE,     FLOW_NEXT) \
+	X(0xe7, "RST 4",    1, 11, 11, MEM_PUSH,     FLOW_CALL) \
+	X(0xe8, "RPE",      1,  5, 11, MEM_POP,      FLOW_RETURN) \
+	X(0xe9, "PCHL",     1,  5,  5, MEM_NONE,     FLOW_JUMP) \
+	X(0xea, "JPE",      3, 10, 10, MEM_NONE,     FLOW_BRANCH) \
+	X(0xeb, "XCHG",     1,  4,  4, MEM_NONE,     FLOW_NEXT) \
+	X(0xec, "CPE",      3, 11, 17, MEM_PUSH,     FLOW_CALL) \
+	X(0xed, "CALL",     3, 17, 17, MEM_PUSH,     FLOW_CALL) \
+	X(0xee, "XRI",      2,  7,  7, MEM_NONE,     FLOW_NEXT) \
+	X(0xef, "RST 5",    1, 11, 11, MEM_PUSH,     FLOW_CALL) \
+	X(0xf0, "RP",       1,  5, 11, MEM_POP,      FLOW_RETURN) \
+	X(0xf1, "POP PSW",  1, 10, 10, MEM_POP,      FLOW_NEXT) \
+	X(0xf2, "JP",       3, 10, 10, MEM_NONE,     FLOW_BRANCH) \
+	X(0xf3, "DI",       1,  4,  4, MEM_NONE,     FLOW_SYNC) \
+	X(0xf4, "CP",       3, 11, 17, MEM_PUSH,     FLOW_CALL) \
+	X(0xf5, "PUSH PSW", 1, 11, 11, MEM_PUSH,     FLOW_NEXT) \
+	X(0xf6, "ORI",      2,  7,  7, MEM_NONE,     FLOW_NEXT) \
+	X(0xf7, "RST 6",    1, 11, 11, MEM_PUSH,     FLOW_CALL) \
+	X(0xf8, "RM",       1,  5, 11, MEM_POP,      FLOW_RETURN) \
+	X(0xf9, "SPHL",     1,  5,  5, MEM_NONE,     FLOW_NEXT) \
+	X(0xfa, "JM",       3, 10, 10, MEM_NONE,     FLOW_BRANCH) \
+	X(0xfb, "EI",       1,  4,  4, MEM_NONE,     FLOW_SYNC) \
+	X(0xfc, "CM",       3, 11, 17, MEM_PUSH,     FLOW_CALL) \
+	X(0xfd, "CALL",     3, 17, 17, MEM_PUSH,     FLOW_CALL) \
+	X(0xfe, "CPI",      2,  7,  7, MEM_NONE,     FLOW_NEXT) \
+	X(0xff, "RST 7",    1, 11, 11, MEM_PUSH,     FLOW_CALL)
+// clang-format on
+
+#define OPCODE_INFO_ENTRY(op, mnemonic, length, cycles, taken, access, flow) \
+	[op] = {mnemonic, length, cycles, taken, access, flow},
+#define OPCODE_LENGTH_ENTRY(op, mnemonic, length, cycles, taken, access, flow) \
+	[op] = length,
+
+static const struct opcode_info opcode_info[256] = {
+		OPCODE_INFO_TABLE(OPCODE_INFO_ENTRY)};
+
+// The lengths again on their own, since every fetch needs one: this way they
+// fit in four cache lines.
+static const uint8_t opcode_lengths[256] = {
+		OPCODE_INFO_TABLE(OPCODE_LENGTH_ENTRY)};
+
+// Whether the opcode's cost depends on the flags.
+__attribute__((const)) static inline int opcode_has_fixed_cycles(
+		uint8_t opcode)
+{
+	return opcode_info[opcode].cycles == opcode_info[opcode].cycles_taken;
+}
+
+// Whether the opcode may change memory.
+__attribute__((const)) static inline int opcode_writes_memory(uint8_t opcode)
+{
+	switch (opcode_info[opcode].access)
+	{
+	case MEM_WRITE:
+	case MEM_MODIFY:
+	case MEM_PUSH:
+	case MEM_EXCHANGE: return 1;
+	default: return 0;
+	}
+}
+
+/* Writes the disassembly of the opcode at the given address (e.g.
+ * "MVI A,0x3f" or "JMP 0x18d4") into buffer, truncating it if it doesn't
+ * fit.  Returns the opcode's length.
+ */
+int disassemble(const uint8_t* opcode, char* buffer, size_t size);
+
+#endif
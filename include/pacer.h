@@ -0,0 +1,96 @@
+#ifndef PACER
+#define PACER
+
+#include "histogram.h"
+
+#include <stdint.h>
+#include <time.h>
+
+/* Keeping a throttled CPU in step with the wall clock.
+ *
+ * The CPU runs a chunk of cycles as fast as it can, and then waits for the
+ * wall clock to catch up with it.  Waiting with clock_nanosleep() alone is
+ * coarse: the kernel is free to wake us up to the thread's timer slack late
+ * (50us by default, which is a fifth of a 512 cycle chunk at 2MHz), and
+ * usually takes some of it.  So the pacer turns the slack right down, sleeps
+ * until a little short of the target, and spins on the clock for the rest.
+ *
+ * How far short is worked out from how late the sleeps have been waking up,
+ * and so is the chunk: if sleeping can't be trusted to better than some tens
+ * of microseconds, the pacer saves cycles up for longer between sleeps, so
+ * that it spends less of its time spinning.  The chunk the cores run between
+ * calls to cycle_wait (and so between looking for reset and quit requests)
+ * doesn't change; they just don't sleep every time.
+ *
+ * Every wait records how far from its target it finished in a histogram, so
+ * that benchmarking can show how closely the pacing holds.
+ */
+
+// The timer slack the pacer asks for, in nanoseconds.
+#ifndef PACER_TIMER_SLACK
+#	define PACER_TIMER_SLACK (1l)
+#endif
+
+// The least and most time to spend spinning before a target, in nanoseconds.
+#ifndef PACER_SPIN_MIN
+#	define PACER_SPIN_MIN (2000l)
+#endif
+#ifndef PACER_SPIN_MAX
+#	define PACER_SPIN_MAX (50000l)
+#endif
+
+// A sleep should be at least this many times as long as sleeps overshoot...
+#ifndef PACER_SLEEP_RATIO
+#	define PACER_SLEEP_RATIO (16)
+#endif
+// ...but the pacer won't go more than this long, in nanoseconds, between them.
+#ifndef PACER_SLEEP_MAX
+#	define PACER_SLEEP_MAX (2000000l)
+#endif
+
+// The nanoseconds from start to end.
+static inline long nanoseconds(
+		const struct timespec* start, const struct timespec* end)
+{
+	return (end->tv_sec - start->tv_sec) * 1000000000l + end->tv_nsec
+	       - start->tv_nsec;
+}
+
+struct pacer
+{
+	struct timespec target; // When the cycles paced so far are due.
+	long cycle_time;	// Nanoseconds per cycle.
+	int min_chunk;		// Cycles to save up between sleeps, at least.
+	int chunk;		// Cycles to save up between sleeps, for now.
+	int count;		// Cycles saved up since the last sleep.
+	long overshoot;		// Moving average of how late sleeps wake.
+	struct histogram error; // How late each wait finished, in ns.
+};
+
+/* Starts pacing from now.  This lowers the calling thread's timer slack, so
+ * it should be called from the thread that's going to wait.
+ */
+void pacer_init(struct pacer*, long cycle_time, int min_chunk);
+
+// Starts again from now, forgetting any time the CPU is ahead or behind.
+void pacer_rebase(struct pacer*);
+
+// Changes the speed, and starts again from now at the new one.
+void pacer_set_cycle_time(struct pacer*, long cycle_time);
+
+/* Counts the given cycles, and once there's a chunk of them, waits until
+ * they're due.  If they're already overdue, it returns straight away, so that
+ * a CPU that's fallen behind catches up.
+ */
+void pacer_wait(struct pacer*, int cycles);
+
+// The chunk for sleeps that overshoot by the given number of nanoseconds.
+static inline int pacer_chunk(long overshoot, long cycle_time, int min_chunk)
+{
+	long sleep = overshoot * PACER_SLEEP_RATIO;
+	if (sleep > PACER_SLEEP_MAX) sleep = PACER_SLEEP_MAX;
+	const long chunk = sleep / cycle_time;
+	return chunk > min_chunk ? chunk : min_chunk;
+}
+
+#endif
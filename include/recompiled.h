@@ -0,0 +1,86 @@
+#ifndef RECOMPILED
+#define RECOMPILED
+
+#include "block_cache.h"
+#include "cpu.h"
+#include "idle_loop.h"
+
+#include <stdint.h>
+
+/* Ahead-of-time recompiled ROMs.
+ *
+ * The arcade ROMs are write-protected by their masks, so their code can never
+ * change, and can be translated to C once, at build time.  tools/recompile.c
+ * does that: it follows the control flow from the reset and RST vectors,
+ * splits what it finds into basic blocks, and writes out one C function per
+ * block, with the opcodes' operands, lengths and cycle counts all folded in.
+ * Each ROM's functions are built into a module, native/lib<rom>.so, which
+ * the native core loads in place of the interpreter.
+ *
+ * A block function runs its block and returns the cycles taken, leaving the
+ * PC at whatever comes next.  Anything without a block of its own (code in
+ * RAM, and whatever PCHL or a RET with an unexpected return address leads to)
+ * is left to the block cache, as on the block core.
+ */
+
+typedef int (*recompiled_block)(struct cpu_state* cpu);
+
+struct recompiled_rom
+{
+	// Of the write-protected memory the ROM was translated from: see
+	// recompiled_checksum().
+	uint32_t checksum;
+	uint32_t block_count;
+	// A block for every address where one starts; NULL elsewhere.
+	const recompiled_block* blocks;
+};
+
+// The name of the recompiled_rom each module exports.
+#define RECOMPILED_ROM_SYMBOL "recompiled_rom_translation"
+
+/* FNV-1a over every write-protected byte of memory, so we can tell whether
+ * a module was built from the ROM we've loaded.
+ */
+__attribute__((pure)) static inline uint32_t recompiled_checksum(
+		const uint8_t* memory,
+		const uint8_t* rom_mask,
+		uint8_t mask_shift)
+{
+	uint32_t hash = 2166136261u;
+	for (uint32_t address = 0; address < MAX_MEMORY; ++address)
+	{
+		if (!rom_mask[address >> mask_shift]) continue;
+		hash = (hash ^ memory[address]) * 16777619u;
+	}
+	return hash;
+}
+
+/* The translation the native core runs.  main() loads it before starting the
+ * CPU thread.
+ */
+extern const struct recompiled_rom* native_rom;
+
+/* Loads native/lib<rom>.so, for the ROM file of the given name, and checks
+ * it against the ROM in memory.  Returns NULL, having said why, if there's no
+ * module or it doesn't match.
+ */
+const struct recompiled_rom* recompiled_load(const char* rom_name,
+		const uint8_t* memory,
+		const uint8_t* rom_mask,
+		uint8_t mask_shift);
+
+/* Runs blocks from the CPU's PC until the given number of cycles has been
+ * used up, or until an opcode changes the interrupt or halt state.  Returns
+ * the number of cycles used.  Blocks with no translation are run from the
+ * block cache, which must be the CPU's.  Idle loops (see idle_loop.h) are
+ * skipped through to the end of the budget; now is the time, in cycles, when
+ * we start.
+ */
+int recompiled_run(const struct recompiled_rom* rom,
+		struct block_cache* cache,
+		struct cpu_state* cpu,
+		struct idle_loop* idle,
+		uint64_t now,
+		int budget);
+
+#endif
@@ -0,0 +1,48 @@
+#ifndef RECOMPILED_OPS
+#define RECOMPILED_OPS
+
+#include "alu_tables.h"
+#include "cpu.h"
+#include "lazy_flags.h"
+#include "opcode_array.h"
+#include "opcode_helpers.h"
+#include "recompiled.h"
+
+#include <stdint.h>
+
+/* What the C written by tools/recompile.c is made of.  Only the generated
+ * modules include this.
+ *
+ * The operations are the ones specialized_opcodes.c uses, from inline_ops.h.
+ * The difference is the flags: a module doesn't know whether it's being run
+ * with eager or lazy flags (see lazy_flags.h), so the ALU operations here
+ * clear anything the lazy handlers left pending, and the conditions read the
+ * flags through lazy_flags_value().
+ */
+
+// So before including inline_ops.h, we have it leave nothing pending.
+#define ALU_DONE(cpu) ((cpu)->lazy_op = LAZY_NONE)
+#include "inline_ops.h"
+
+// Whether the branch condition (as in GET_CONDITION()) holds.
+#define MET(condition) condition_table[condition][lazy_flags_value(cpu)]
+
+static inline void dad(struct cpu_state* cpu, uint16_t value)
+{
+	uint32_t result = cpu->hl + value;
+	cpu->flags = (cpu->flags & ~CARRY_FLAG) | ((result >> 16) & CARRY_FLAG);
+	cpu->hl	   = result;
+}
+
+static inline void xchg_de_hl(struct cpu_state* cpu)
+{
+	uint16_t de = cpu->de;
+	cpu->de	    = cpu->hl;
+	cpu->hl	    = de;
+}
+
+// Anything not done inline goes through the opcode array, so it gets the
+// hardware library's IN and OUT, and the lazy handlers if they're installed.
+#define CALL_HANDLER(op, address) opcodes[op](cpu->memory + (address), cpu)
+
+#endif
@@ -0,0 +1,183 @@
+#ifndef SCHEDULER
+#define SCHEDULER
+
+#include "cpu.h"
+
+#include <stdint.h>
+
+/* Timed events for the hardware, on the CPU's own clock.
+ *
+ * Anything a real machine does on a timer (the taito video interrupts, a
+ * serial port clocking out its next bit, a sound finishing) is an event: a
+ * callback, due once cpu->cycles reaches a given count.  The CPU thread calls
+ * each one back when it's due.  The cores don't look for events opcode by
+ * opcode: they only ever run straight-line code up to the earliest deadline
+ * (or the end of their chunk), and call scheduler_run() when they stop, so an
+ * event runs within an opcode or two of its time, and costs nothing until
+ * then.
+ *
+ * The events are kept in a binary min-heap on their time.  There are only
+ * ever a handful, so the heap is a fixed array and adding an event never
+ * allocates.  Events due at the same time run in the order they were added.
+ *
+ * The scheduler belongs to the CPU thread: events may only be added or
+ * cancelled there (from callbacks, the interrupt hook, or IN and OUT), or in
+ * hw_init_struct, before the thread starts.  (The block cores only notice
+ * one added from IN or OUT the next time they stop, which is at most a chunk
+ * later.)
+ */
+
+#ifndef SCHEDULER_EVENTS
+#	define SCHEDULER_EVENTS (32)
+#endif
+
+/* An event's callback gets the data it was added with, and the time it was
+ * due, which cpu->cycles may be slightly past.  It returns the time it next
+ * wants calling, or 0 if it's finished: returning when plus a period makes a
+ * periodic event that never drifts.
+ */
+typedef uint64_t (*scheduler_callback)(
+		struct cpu_state* cpu, void* data, uint64_t when);
+
+struct scheduled_event
+{
+	uint64_t when;
+	scheduler_callback callback;
+	void* data;
+	int id;
+};
+
+struct scheduler
+{
+	struct scheduled_event heap[SCHEDULER_EVENTS];
+	int count;
+	int next_id; // The id the next event added gets.
+	int running; // The id of the event being called back, or -1.
+};
+
+static inline void scheduler_init(struct scheduler* scheduler)
+{
+	scheduler->count   = 0;
+	scheduler->next_id = 0;
+	scheduler->running = -1;
+}
+
+// When the earliest event is due, or UINT64_MAX if there aren't any.
+static inline uint64_t scheduler_next(const struct scheduler* scheduler)
+{
+	return scheduler->count ? scheduler->heap[0].when : UINT64_MAX;
+}
+
+// Whether a runs before b.  Ids only go up, so ties go to the older event.
+static inline int scheduler_before(
+		const struct scheduled_event* a, const struct scheduled_event* b)
+{
+	return a->when < b->when
+	       || (a->when == b->when && a->id < b->id);
+}
+
+// Puts event in the heap's hole at index, and moves it up to its place.
+static inline void scheduler_sift_up(struct scheduler* scheduler,
+		int index,
+		struct scheduled_event event)
+{
+	while (index)
+	{
+		const int parent = (index - 1) / 2;
+		if (!scheduler_before(&event, &scheduler->heap[parent])) break;
+		scheduler->heap[index] = scheduler->heap[parent];
+		index		       = parent;
+	}
+	scheduler->heap[index] = event;
+}
+
+// Puts event in the heap's hole at index, and moves it down to its place.
+static inline void scheduler_sift_down(struct scheduler* scheduler,
+		int index,
+		struct scheduled_event event)
+{
+	for (;;)
+	{
+		int child = 2 * index + 1;
+		if (child >= scheduler->count) break;
+		if (child + 1 < scheduler->count
+				&& scheduler_before(&scheduler->heap[child + 1],
+						&scheduler->heap[child]))
+			++child;
+		if (!scheduler_before(&scheduler->heap[child], &event)) break;
+		scheduler->heap[index] = scheduler->heap[child];
+		index		       = child;
+	}
+	scheduler->heap[index] = event;
+}
+
+static inline void scheduler_remove(struct scheduler* scheduler, int index)
+{
+	const struct scheduled_event last = scheduler->heap[--scheduler->count];
+	if (index == scheduler->count) return;
+	if (index && scheduler_before(&last, &scheduler->heap[(index - 1) / 2]))
+		scheduler_sift_up(scheduler, index, last);
+	else
+		scheduler_sift_down(scheduler, index, last);
+}
+
+/* Adds an event, due at cycle when, and returns an id to cancel it with, or
+ * -1 if there are already SCHEDULER_EVENTS of them.
+ */
+static inline int scheduler_add(struct scheduler* scheduler,
+		uint64_t when,
+		scheduler_callback callback,
+		void* data)
+{
+	if (scheduler->count == SCHEDULER_EVENTS) return -1;
+	const struct scheduled_event event = {.when = when,
+			.callback		    = callback,
+			.data			    = data,
+			.id			    = scheduler->next_id++};
+	scheduler_sift_up(scheduler, scheduler->count++, event);
+	return event.id;
+}
+
+/* Cancels an event, if it hasn't run yet, or, called from its own callback,
+ * stops it from being called again.  Returns 1 if there was anything to
+ * cancel, and 0 if not.
+ */
+static inline int scheduler_cancel(struct scheduler* scheduler, int id)
+{
+	if (id < 0) return 0;
+	if (id == scheduler->running)
+	{
+		scheduler->running = -1;
+		return 1;
+	}
+	for (int index = 0; index < scheduler->count; ++index)
+	{
+		if (scheduler->heap[index].id != id) continue;
+		scheduler_remove(scheduler, index);
+		return 1;
+	}
+	return 0;
+}
+
+/* The cores call this whenever they stop: it calls back every event that's
+ * due by cpu->cycles, in order, and returns when the next one's due, which is
+ * how far they may run before calling it again.
+ */
+static inline uint64_t scheduler_run(struct cpu_state* cpu)
+{
+	struct scheduler* const scheduler = cpu->scheduler;
+	while (scheduler->count && scheduler->heap[0].when <= cpu->cycles)
+	{
+		struct scheduled_event event = scheduler->heap[0];
+		scheduler_remove(scheduler, 0);
+		scheduler->running = event.id;
+		event.when = event.callback(cpu, event.data, event.when);
+		if (event.when && scheduler->running == event.id
+				&& scheduler->count < SCHEDULER_EVENTS)
+			scheduler_sift_up(scheduler, scheduler->count++, event);
+		scheduler->running = -1;
+	}
+	return scheduler_next(scheduler);
+}
+
+#endif
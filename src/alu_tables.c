@@ -0,0 +1,115 @@
+#include "alu_tables.h"
+
+#include "cpu.h"
+#include "opcode_helpers.h"
+
+#include <stdint.h>
+
+uint8_t zsp_table[256];
+uint16_t add_table[2][256][256];
+uint16_t sub_table[2][256][256];
+uint16_t daa_table[4][256];
+uint8_t condition_table[8][256];
+
+/* Every entry is worked out with _add() and the APPLY_*_FLAG() macros, i.e.
+ * exactly the way the handlers used to do it on each instruction.  Flag
+ * bytes start out zeroed and are masked with ALU_FLAGS at the end, so only
+ * the flags the operation is responsible for end up in the table.
+ */
+
+static uint16_t build_add_entry(uint8_t left, uint8_t right, uint8_t carry)
+{
+	uint8_t flags	= 0;
+	uint16_t result = _add(left, right, carry, &flags);
+	APPLY_CARRY_FLAG(result, flags);
+	return (uint8_t) result << 8 | (flags & ALU_FLAGS);
+}
+
+static uint16_t build_sub_entry(uint8_t left, uint8_t right, uint8_t borrow)
+{
+	// Subtraction is addition of the two's complement: invert the operand
+	// and carry in a 1, unless there's a borrow.  The carry out is then
+	// inverted to give the borrow.
+	uint8_t flags	= 0;
+	uint16_t result = _add(left, (uint8_t) ~right, !borrow, &flags);
+	APPLY_CARRY_FLAG_INVERTED(result, flags);
+	return (uint8_t) result << 8 | (flags & ALU_FLAGS);
+}
+
+static uint16_t build_daa_entry(uint8_t a, uint8_t in_flags)
+{
+	uint8_t flags	= in_flags & CARRY_FLAG;
+	uint8_t working = 0;
+	// If the low nibble > 9, OR aux carry is set, add six to the low
+	// nibble.
+	if ((a & 0x0f) > 9 || (in_flags & AUX_CARRY_FLAG)) working += 0x06;
+	// If the carry flag is set, OR if the high nibble is above 9, OR
+	// if the high nibble is equal to nine AND the low nibble is ABOVE
+	// nine, then we add six to the high nibble and set the carry flag.
+	//
+	// Note that we can SET the CF here, but never clear it.  The exerciser
+	// ROM gets cranky if we ever clear it.
+	if (((a & 0xf0) >= 0x90 && (a & 0x0f) > 9) || (a & 0xf0) > 0x90
+			|| (in_flags & CARRY_FLAG))
+	{
+		working += 0x60;
+		flags |= CARRY_FLAG;
+	}
+	uint8_t result = _add(a, working, 0, &flags);
+	return result << 8 | (flags & ALU_FLAGS);
+}
+
+static uint8_t build_condition_entry(uint8_t condition, uint8_t flags)
+{
+	switch (condition)
+	{
+	case CONDITION_NOT_ZERO: return !(flags & ZERO_FLAG);
+	case CONDITION_ZERO: return !!(flags & ZERO_FLAG);
+	case CONDITION_NO_CARRY: return !(flags & CARRY_FLAG);
+	case CONDITION_CARRY: return !!(flags & CARRY_FLAG);
+	// Parity bit is set when parity is even
+	case CONDITION_PARITY_ODD: return !(flags & PARITY_FLAG);
+	case CONDITION_PARITY_EVEN: return !!(flags & PARITY_FLAG);
+	case CONDITION_NO_SIGN: return !(flags & SIGN_FLAG);
+	case CONDITION_SIGN: return !!(flags & SIGN_FLAG);
+	}
+	return 0;
+}
+
+// Runs before main(), so the tables are ready before any CPU thread (or
+// test) could touch them.
+__attribute__((constructor)) static void build_alu_tables(void)
+{
+	for (int value = 0; value < 256; ++value)
+	{
+		uint8_t flags = 0;
+		APPLY_ZERO_FLAG(value, flags);
+		APPLY_SIGN_FLAG(value, flags);
+		APPLY_PARITY_FLAG(value, flags);
+		zsp_table[value] = flags;
+	}
+
+	for (int carry = 0; carry < 2; ++carry)
+		for (int left = 0; left < 256; ++left)
+			for (int right = 0; right < 256; ++right)
+			{
+				add_table[carry][left][right] = build_add_entry(
+						left, right, carry);
+				sub_table[carry][left][right] = build_sub_entry(
+						left, right, carry);
+			}
+
+	for (int index = 0; index < 4; ++index)
+		for (int a = 0; a < 256; ++a)
+		{
+			// Undo DAA_INDEX() to get back a flag byte.
+			uint8_t flags = (index & 2 ? AUX_CARRY_FLAG : 0)
+					| (index & 1 ? CARRY_FLAG : 0);
+			daa_table[index][a] = build_daa_entry(a, flags);
+		}
+
+	for (int condition = 0; condition < 8; ++condition)
+		for (int flags = 0; flags < 256; ++flags)
+			condition_table[condition][flags] =
+					build_condition_entry(condition, flags);
+}
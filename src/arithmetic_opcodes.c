@@ -18,16 +18,15 @@ int add_adc(const uint8_t* opcode, struct cpu_state* cpu)
 			!(opcode[0] & (1 << 3)) + 'C',
 			get_operand_name(GET_SOURCE_OPERAND(opcode[0])));
 #endif
-	uint16_t operand =
+	uint8_t operand =
 			fetch_operand_val(GET_SOURCE_OPERAND(opcode[0]), cpu);
-	// if (opcode & (1 << 3) && cpu->flags & CARRY_FLAG) ++operand;
-	uint16_t result = _add(cpu->a,
-			operand,
-			(opcode[0] & (1 << 3) && cpu->flags & CARRY_FLAG),
-			&cpu->flags);
-	APPLY_CARRY_FLAG(result, cpu->flags);
-	cpu->a = result;
-	return 4;
+	uint8_t carry = opcode[0] & (1 << 3) && cpu->flags & CARRY_FLAG;
+	// The table entry holds both the new accumulator and the new flags;
+	// see alu_tables.h.
+	cpu->psw = add_table[carry][cpu->a][operand]
+			| (cpu->flags & ~ALU_FLAGS);
+	// Memory operands take 7 cycles.
+	return GET_SOURCE_OPERAND(opcode[0]) == OPERAND_MEM ? 7 : 4;
 }
 
 int adi(const uint8_t* opcode, struct cpu_state* cpu)
@@ -42,10 +41,7 @@ int adi(const uint8_t* opcode, struct cpu_state* cpu)
 	// Add immediate
 	// The content of the second byte of the instruction is added to
 	// the content of the accumulator.
-	uint16_t operand = opcode[1];
-	uint16_t result	 = _add(cpu->a, operand, 0, &cpu->flags);
-	APPLY_CARRY_FLAG(result, cpu->flags);
-	cpu->a = result;
+	cpu->psw = add_table[0][cpu->a][opcode[1]] | (cpu->flags & ~ALU_FLAGS);
 
 	return 7;
 }
@@ -63,11 +59,8 @@ int aci(const uint8_t* opcode, struct cpu_state* cpu)
 	// The content of the second byte of the instruction and the
 	// content of the carry flag are added to the contents of the
 	// accumulator.
-	uint16_t operand = opcode[1];
-	uint16_t result	 = _add(
-			 cpu->a, operand, cpu->flags & CARRY_FLAG, &cpu->flags);
-	APPLY_CARRY_FLAG(result, cpu->flags);
-	cpu->a = result;
+	cpu->psw = add_table[cpu->flags & CARRY_FLAG][cpu->a][opcode[1]]
+			| (cpu->flags & ~ALU_FLAGS);
 
 	return 7;
 }
@@ -81,31 +74,14 @@ int sub_sbb(const uint8_t* opcode, struct cpu_state* cpu)
 			(opcode[0] & 0b00001000 ? 'B' : 'U'),
 			get_operand_name(GET_SOURCE_OPERAND(opcode[0])));
 #endif
-	uint16_t operand =
+	uint8_t operand =
 			fetch_operand_val(GET_SOURCE_OPERAND(opcode[0]), cpu);
-	/* Find two's complement.  This is a little hairy: first we need
-	 * to invert the bits, and cast the inverted version to char length.
-	 * The reason is that without the cast, we'd get all the high bits,
-	 * which will be flipped to 1s, and we don't want that.
-	 * If we cast and then invert, we end up with an all-1 high byte,
-	 * since I suppose the compiler is doing everything in a short,
-	 * meaning that we'd cast away the high byte, store the result in an
-	 * unsigned short, and _then_ invert.
-	 * So we need to invert and cast, in that specific order.
-	 *
-	 * We can't just do all of this in a char-sized package to begin with
-	 * because we need to be able to roll over into the ninth bit
-	 * when we do the +1, otherwise 0 becomes -1, which is ungood.
-	 */
-	operand		= (uint8_t) ~operand;
-	uint16_t result = _add(cpu->a,
-			operand,
-			!(opcode[0] & (1 << 3) && cpu->flags & CARRY_FLAG),
-			&cpu->flags);
-	APPLY_CARRY_FLAG_INVERTED(result, cpu->flags);
-	cpu->a = result;
+	uint8_t borrow = opcode[0] & (1 << 3) && cpu->flags & CARRY_FLAG;
+	cpu->psw = sub_table[borrow][cpu->a][operand]
+			| (cpu->flags & ~ALU_FLAGS);
 
-	return 4;
+	// Memory operands take 7 cycles.
+	return GET_SOURCE_OPERAND(opcode[0]) == OPERAND_MEM ? 7 : 4;
 }
 
 int sui_sbi(const uint8_t* opcode, struct cpu_state* cpu)
@@ -118,20 +94,9 @@ int sui_sbi(const uint8_t* opcode, struct cpu_state* cpu)
 			(opcode[0] & 0b00001000 ? 'B' : 'U'),
 			opcode[1]);
 #endif
-	uint16_t operand = opcode[1];
-	/* Find two's complement.  See sub_sbb() function comments for a
-	 * detailed description about the nit-picky and many-faceted details
-	 * of this process in C that result in the following two lines of code.
-	 */
-	operand		= (uint8_t) ~operand;
-	uint16_t result = _add(cpu->a,
-			operand,
-			!(opcode[0] & (1 << 3) && cpu->flags & CARRY_FLAG),
-			&cpu->flags);
-	APPLY_CARRY_FLAG_INVERTED(result, cpu->flags);
-
-	// apply the lower 8-bits of result to register A
-	cpu->a = result;
+	uint8_t borrow = opcode[0] & (1 << 3) && cpu->flags & CARRY_FLAG;
+	cpu->psw = sub_table[borrow][cpu->a][opcode[1]]
+			| (cpu->flags & ~ALU_FLAGS);
 
 	return 7;
 }
@@ -146,18 +111,23 @@ int inr(const uint8_t* opcode, struct cpu_state* cpu)
 			"INR %c\n",
 			get_operand_name(GET_DESTINATION_OPERAND(opcode[0])));
 #endif
-	uint8_t* op_ptr = fetch_operand_ptr(
+	const uint8_t operand = fetch_operand_val(
 			GET_DESTINATION_OPERAND(opcode[0]), cpu);
 	/* INR increments an 8-bit register or a location in memory.
 	 * The aux carry flag will be set if the lower 3 bits of the operator
-	 * are set.
+	 * are set.  It's just an ADD of 1, except that the carry flag is left
+	 * alone.
 	 */
+	uint16_t entry = add_table[0][operand][1];
+	cpu->flags = (entry & ALU_FLAGS & ~CARRY_FLAG)
+			| (cpu->flags & (~ALU_FLAGS | CARRY_FLAG));
 	if (GET_DESTINATION_OPERAND(opcode[0]) == OPERAND_MEM)
 	{
-		write8(cpu, cpu->hl, _add(*op_ptr, 1, 0, &cpu->flags));
+		write8(cpu, cpu->hl, entry >> 8);
 		return 10;
 	}
-	*op_ptr = _add(*op_ptr, 1, 0, &cpu->flags);
+	*fetch_operand_ptr(GET_DESTINATION_OPERAND(opcode[0]), cpu) =
+			entry >> 8;
 	return 5;
 }
 
@@ -170,18 +140,23 @@ int dcr(const uint8_t* opcode, struct cpu_state* cpu)
 			"DCR %c\n",
 			get_operand_name(GET_DESTINATION_OPERAND(opcode[0])));
 #endif
-	uint8_t* op_ptr = fetch_operand_ptr(
+	const uint8_t operand = fetch_operand_val(
 			GET_DESTINATION_OPERAND(opcode[0]), cpu);
 	/* DCR decremtns an 8-bit register or a location in memory.
 	 * The aux carry flag will be set iff the lower 4 bits of the operator
-	 * are reset.
+	 * are reset.  We do this by adding 0xff, again leaving the carry flag
+	 * alone.
 	 */
+	uint16_t entry = add_table[0][operand][0xff];
+	cpu->flags = (entry & ALU_FLAGS & ~CARRY_FLAG)
+			| (cpu->flags & (~ALU_FLAGS | CARRY_FLAG));
 	if (GET_DESTINATION_OPERAND(opcode[0]) == OPERAND_MEM)
 	{
-		write8(cpu, cpu->hl, _add(*op_ptr, -1, 0, &cpu->flags));
+		write8(cpu, cpu->hl, entry >> 8);
 		return 10;
 	}
-	*op_ptr = _add(*op_ptr, -1, 0, &cpu->flags);
+	*fetch_operand_ptr(GET_DESTINATION_OPERAND(opcode[0]), cpu) =
+			entry >> 8;
 	return 5;
 }
 
@@ -230,25 +205,9 @@ int daa(const uint8_t* opcode, struct cpu_state* cpu)
 #endif
 
 	(void) opcode;
-	// If the low nibble > 9, OR aux carry is set, add six to the low
-	// nibble.
-	uint8_t working = 0;
-	if ((cpu->a & 0x0f) > 9 || (cpu->flags & AUX_CARRY_FLAG))
-	{ working += 0x06; }
-	// If the carry flag is set, OR if the high nibble is above 9, OR
-	// if the high nibble is equal to nine AND the low nibble is ABOVE
-	// nine, then we add six to the high nibble and set the carry flag.
-	//
-	// Note that we can SET the CF here, but never clear it.  The exerciser
-	// ROM gets cranky if we ever clear it.
-	if (((cpu->a & 0xf0) >= 0x90 && (cpu->a & 0x0f) > 9)
-			|| (cpu->a & 0xf0) > 0x90 || (cpu->flags & CARRY_FLAG))
-	{
-		working += 0x60;
-		cpu->flags |= CARRY_FLAG;
-	}
-
-	working = _add(cpu->a, working, 0, &cpu->flags);
-	cpu->a	= working;
+	// The adjustment depends only on the accumulator and the carry and aux
+	// carry flags; alu_tables.c has the details.
+	cpu->psw = daa_table[DAA_INDEX(cpu->flags)][cpu->a]
+			| (cpu->flags & ~ALU_FLAGS);
 	return 4;
 }
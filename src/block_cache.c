@@ -0,0 +1,215 @@
+#include "block_cache.h"
+
+#include "cpu.h"
+#include "cpu_core.h"
+#include "fused_opcodes.h"
+#include "opcode_array.h"
+#include "opcode_info.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// The most bytes a block can span.  A fused micro-op can be longer than any
+// single opcode.
+#define BLOCK_MAX_BYTES (BLOCK_MAX_OPS * FUSED_MAX_LENGTH)
+
+#define BLOCK_MAX_SIZE \
+	(sizeof(struct block) + BLOCK_MAX_OPS * sizeof(struct micro_op))
+
+_Static_assert(BLOCK_MAX_BYTES <= (1 << CODE_PAGE_SHIFT),
+		"A block must not span more than two code pages.");
+
+struct block_cache* block_cache_create(void)
+{
+	// calloc, so that every block pointer and page flag starts out clear.
+	return calloc(1, sizeof(struct block_cache));
+}
+
+void block_cache_destroy(struct block_cache* cache) { free(cache); }
+
+void block_cache_flush(struct block_cache* cache)
+{
+	memset(cache->blocks, 0, sizeof(cache->blocks));
+	memset(cache->code_pages, 0, sizeof(cache->code_pages));
+	memset(cache->code_bytes, 0, sizeof(cache->code_bytes));
+	cache->used = 0;
+	++cache->generation;
+	++cache->stats.flushes;
+}
+
+static struct block* decode(struct block_cache* cache,
+		const struct cpu_state* cpu,
+		uint16_t start)
+{
+	if (cache->used + BLOCK_MAX_SIZE > BLOCK_CACHE_SIZE)
+		block_cache_flush(cache);
+	struct block* block = (struct block*) (cache->storage + cache->used);
+
+	uint16_t pc	       = start;
+	block->start	       = start;
+	block->count	       = 0;
+	block->cycles	       = 0;
+	block->variable_cycles = 0;
+	block->runs	       = 0;
+	block->native	       = NULL;
+	for (;;)
+	{
+		struct micro_op* op = &block->ops[block->count++];
+		op->opcode	    = cpu->memory + pc;
+		op->cycles	    = 0;
+		op->writes_memory   = 0;
+		// A fused micro-op stands for several opcodes: see
+		// fused_opcodes.h.  Everything but the handler is added up
+		// from theirs.
+		int count = cache->fuse && fused_opcode_starts[*op->opcode]
+					  ? match_fused_opcodes(op->opcode,
+							  MAX_MEMORY - pc,
+							  &op->handler)
+					  : 0;
+		if (count)
+			++cache->stats.fused;
+		else
+		{
+			op->handler = opcodes[cpu->memory[pc]];
+			count	    = 1;
+		}
+		const struct opcode_info* info;
+		uint32_t next = pc;
+		while (count--)
+		{
+			info = &opcode_info[cpu->memory[next]];
+			op->cycles += info->cycles;
+			// IN and OUT may switch banks (see memory_map.h),
+			// which changes memory as much as a write does.
+			op->writes_memory |=
+					opcode_writes_memory(cpu->memory[next])
+					|| info->access == MEM_IO;
+			if (opcode_has_fixed_cycles(cpu->memory[next]))
+				block->cycles += info->cycles;
+			else
+				block->variable_cycles = 1;
+			next += info->length;
+		}
+		op->next_pc	   = next;
+		block->last_opcode = next - info->length;
+		for (uint32_t byte = pc; byte != next; ++byte)
+			cache->code_bytes[(uint16_t) byte / 8] |= 1 << byte % 8;
+		// Stop at anything that changes the flow of control, and at
+		// the top of memory, rather than wrap around.
+		if (info->flow != FLOW_NEXT || block->count == BLOCK_MAX_OPS
+				|| next >= MAX_MEMORY)
+			break;
+		pc = next;
+	}
+
+	// Note down every page the block's code came from: it may run over
+	// into the next one.
+	uint16_t last = block->ops[block->count - 1].next_pc - 1;
+	if (last < start) last = MAX_MEMORY - 1;
+	for (int page = start >> CODE_PAGE_SHIFT;
+			page <= last >> CODE_PAGE_SHIFT;
+			++page)
+		cache->code_pages[page] = 1;
+
+	cache->used += sizeof(struct block)
+		       + block->count * sizeof(struct micro_op);
+	// Keep the next block aligned.
+	cache->used = (cache->used + _Alignof(struct block) - 1)
+		      & ~(_Alignof(struct block) - 1);
+	cache->blocks[start] = block;
+	return block;
+}
+
+void block_cache_invalidate(struct block_cache* cache, uint8_t page)
+{
+	// Blocks starting near the end of the previous page may run over into
+	// this one, so they have to go as well.
+	int first = (page << CODE_PAGE_SHIFT) - (BLOCK_MAX_BYTES - 1);
+	if (first < 0) first = 0;
+	int end = (page + 1) << CODE_PAGE_SHIFT;
+	memset(cache->blocks + first,
+			0,
+			(end - first) * sizeof(*cache->blocks));
+	// Nothing covers this page any more.  (Blocks which ran over from or
+	// into the neighbouring pages are gone too, but their bits there are
+	// left set.  That only costs an unnecessary invalidation later on.)
+	cache->code_pages[page] = 0;
+	memset(cache->code_bytes + ((page << CODE_PAGE_SHIFT) / 8),
+			0,
+			(1 << CODE_PAGE_SHIFT) / 8);
+	++cache->generation;
+	++cache->stats.invalidations;
+}
+
+void block_cache_remapped(void* cache, uint16_t start, uint32_t length)
+{
+	struct block_cache* block_cache = cache;
+	const uint32_t end = (uint32_t) start + length;
+	for (uint32_t page = start >> CODE_PAGE_SHIFT;
+			page < end >> CODE_PAGE_SHIFT;
+			++page)
+		if (block_cache->code_pages[page])
+			block_cache_invalidate(block_cache, page);
+}
+
+struct block* block_cache_get(struct block_cache* cache,
+		const struct cpu_state* cpu,
+		uint16_t pc)
+{
+	struct block* block = cache->blocks[pc];
+	if (block)
+	{
+		++cache->stats.hits;
+		return block;
+	}
+	++cache->stats.misses;
+	return decode(cache, cpu, pc);
+}
+
+int block_cache_run(struct block_cache* cache, struct cpu_state* cpu)
+{
+	return block_cache_execute(
+			cache, cpu, block_cache_get(cache, cpu, cpu->pc));
+}
+
+int block_cache_execute(struct block_cache* cache,
+		struct cpu_state* cpu,
+		const struct block* block)
+{
+	// Blocks are never freed while we're running them: at worst they're
+	// dropped from the cache, and a flush only happens in decode().  So
+	// it's safe to finish the opcode that did the overwriting, then stop.
+	const uint64_t generation  = cache->generation;
+	const struct micro_op* op  = block->ops;
+	const struct micro_op* end = block->ops + block->count;
+	int last_cycles		   = 0;
+	for (; op < end; ++op)
+	{
+#ifdef VERBOSE
+		fprintf(stderr,
+				"0x%4.4x: ",
+				(unsigned) (op->opcode - cpu->memory));
+#endif
+		cpu->pc	    = op->next_pc;
+		last_cycles = op->handler(op->opcode, cpu);
+#ifdef VERBOSE
+		print_registers(cpu);
+#endif
+		if (op->writes_memory && cache->generation != generation)
+		{
+			// Stopping early, so only charge for what we ran.  The
+			// last opcode's cycles come from its handler, since a
+			// fused one may have stopped part way through.
+			int cycles = last_cycles;
+			for (const struct micro_op* ran = block->ops;
+					ran < op;
+					++ran)
+				cycles += ran->cycles;
+			return cycles;
+		}
+	}
+	return block->variable_cycles ? block->cycles + last_cycles
+				      : block->cycles;
+}
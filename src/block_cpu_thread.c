@@ -0,0 +1,309 @@
+#include "block_cache.h"
+#include "cpu.h"
+#include "cpu_core.h"
+#include "cycle_timer.h"
+#include "dynarec.h"
+#include "fused_opcodes.h"
+#include "hw_func_pointers.h"
+#include "idle_loop.h"
+#include "interrupts.h"
+#include "memory_map.h"
+#include "opcode_array.h"
+#include "opcode_size.h"
+#include "recompiled.h"
+#include "scheduler.h"
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+/* The block core runs whole blocks out of the block cache (see block_cache.h)
+ * rather than single opcodes.  Otherwise it's organized like the threaded
+ * core: interrupts, halts and timekeeping are looked at once a chunk's worth
+ * of cycles has elapsed, when a timed event is due, or when an opcode has
+ * changed the interrupt or halt state.  EI, DI and HLT always end a block, so
+ * they're never missed.
+ *
+ * The dynarec core (see dynarec.h) is the same loop, with the blocks run as
+ * translated code, and so is the native core (see recompiled.h), with the
+ * blocks recompiled ahead of time.
+ */
+
+// Runs a single opcode, without going through the cache.
+static int step(struct cpu_state* cpu)
+{
+	const uint8_t* opcode = cpu->memory + cpu->pc;
+#ifdef VERBOSE
+	fprintf(stderr, "0x%4.4x: ", cpu->pc);
+#endif
+	cpu->pc += get_opcode_size(*opcode);
+	int cycles = opcodes[*opcode](opcode, cpu);
+#ifdef VERBOSE
+	print_registers(cpu);
+#endif
+	return cycles;
+}
+
+/* Runs the block at the PC, and then, if it's an idle loop (see idle_loop.h),
+ * runs that until at least the given number of cycles have passed.  The
+ * native core does the same in recompiled_run().  The dynarec doesn't skip
+ * idle loops: it chains its blocks together, so a loop runs in translated
+ * code without coming back here.
+ */
+static int run_block(struct cpu_state* cpu,
+		struct idle_loop* idle,
+		uint64_t now,
+		int cycles_left)
+{
+	const struct block* block =
+			block_cache_get(cpu->block_cache, cpu, cpu->pc);
+	int cycles = block_cache_execute(cpu->block_cache, cpu, block);
+	if (cpu->pc > block->last_opcode) return cycles;
+	int pass = idle_loop_pass(idle, cpu, block->last_opcode, now + cycles);
+	if (pass) cycles += idle_loop_skip(idle, pass, cycles_left - cycles);
+	return cycles;
+}
+
+/* The block cache's statistics, the idle loop cycles skipped, and the
+ * dynarec's statistics if there is one, for the metrics registry.  Like
+ * core_metrics (see cpu_core.h), they're published once a chunk.
+ */
+struct block_metrics
+{
+	uint64_t* hits;
+	uint64_t* misses;
+	uint64_t* invalidations;
+	uint64_t* flushes;
+	uint64_t* fused;
+	uint64_t* idle_skipped;
+	uint64_t* translations;
+	uint64_t* entries;
+	uint64_t* dynarec_flushes;
+};
+
+static struct block_metrics block_metrics_add(
+		struct metrics* metrics, const struct dynarec* dynarec)
+{
+	struct block_metrics block = {0};
+	block.hits	    = metrics_add(metrics,
+			"i8080_block_cache_hits_total",
+			"Blocks run straight from the block cache.",
+			METRIC_COUNTER);
+	block.misses	    = metrics_add(metrics,
+			"i8080_block_cache_misses_total",
+			"Blocks decoded before they could be run.",
+			METRIC_COUNTER);
+	block.invalidations = metrics_add(metrics,
+			"i8080_block_cache_invalidations_total",
+			"Writes to decoded code.",
+			METRIC_COUNTER);
+	block.flushes	    = metrics_add(metrics,
+			"i8080_block_cache_flushes_total",
+			"Times the block cache filled up.",
+			METRIC_COUNTER);
+	block.fused	    = metrics_add(metrics,
+			"i8080_block_cache_fused_total",
+			"Fused micro-ops decoded.",
+			METRIC_COUNTER);
+	block.idle_skipped  = metrics_add(metrics,
+			"i8080_idle_cycles_skipped_total",
+			"Cycles of idle loops charged without being run.",
+			METRIC_COUNTER);
+	if (dynarec)
+	{
+		block.translations    = metrics_add(metrics,
+				"i8080_dynarec_translations_total",
+				"Blocks translated to machine code.",
+				METRIC_COUNTER);
+		block.entries	      = metrics_add(metrics,
+				"i8080_dynarec_entries_total",
+				"Times translated code was entered from C.",
+				METRIC_COUNTER);
+		block.dynarec_flushes = metrics_add(metrics,
+				"i8080_dynarec_flushes_total",
+				"Times the translation buffer filled up.",
+				METRIC_COUNTER);
+	}
+	return block;
+}
+
+static void block_metrics_publish(const struct block_metrics* block,
+		const struct block_cache* cache,
+		const struct idle_loop* idle,
+		const struct dynarec* dynarec)
+{
+	metric_set(block->hits, cache->stats.hits);
+	metric_set(block->misses, cache->stats.misses);
+	metric_set(block->invalidations, cache->stats.invalidations);
+	metric_set(block->flushes, cache->stats.flushes);
+	metric_set(block->fused, cache->stats.fused);
+	metric_set(block->idle_skipped, idle->skipped);
+	if (!dynarec) return;
+	metric_set(block->translations, dynarec->stats.translations);
+	metric_set(block->entries, dynarec->stats.entries);
+	metric_set(block->dynarec_flushes, dynarec->stats.flushes);
+}
+
+static void* block_core(void* resources,
+		struct dynarec* dynarec,
+		const struct recompiled_rom* native)
+{
+	struct cpu_state cpu = cpu_state_from_resources(
+			(struct system_resources*) resources);
+	cpu.block_cache = dynarec ? dynarec->cache : block_cache_create();
+	if (!cpu.block_cache)
+	{
+		perror("Malloc error creating the block cache");
+		exit(1);
+	}
+	// The dynarec does its own fusing, and translates blocks opcode by
+	// opcode, so it needs them unfused.
+	cpu.block_cache->fuse = !dynarec && fuse_opcodes;
+	// Code decoded from a window is gone once it's switched to another
+	// bank.
+	if (cpu.memory_map)
+		memory_map_on_remap(cpu.memory_map,
+				block_cache_remapped,
+				cpu.block_cache);
+
+	// We can remove this assignment if we want to force the user
+	// to hardware reset on CPU boot.
+	cpu.pc = 0;
+	// Cycles executed since we last brought cpu.cycles up to date, and
+	// since we last called cycle_wait().
+	int cycles	= 0;
+	int owed	= 0;
+	const int chunk = cpu.timer->chunk;
+	// The block cores don't count instructions: see cpu_core.h.
+	const struct core_metrics metrics = core_metrics_add(cpu.metrics, 0);
+	const struct block_metrics block_metrics =
+			block_metrics_add(cpu.metrics, dynarec);
+	uint64_t interrupts = 0;
+	// When the next timed event is due: see scheduler.h.
+	uint64_t deadline;
+	struct idle_loop idle = {0};
+	uint8_t rst;
+	int limit;
+	for (;;)
+	{
+		cpu.cycles += cycles;
+		owed += cycles;
+		cycles = 0;
+		// cycle_wait returns 1 if a quit event is pending.
+		if (owed >= chunk)
+		{
+			core_metrics_publish(&metrics, &cpu, 0, interrupts);
+			block_metrics_publish(&block_metrics,
+					cpu.block_cache,
+					&idle,
+					dynarec);
+			if (cycle_wait(owed, &cpu)) break;
+			owed = 0;
+		}
+		deadline = scheduler_run(&cpu);
+		const int state =
+				cpu.interrupt_enable_flag << 1 | cpu.halt_flag;
+		switch (state)
+		{
+		case 4: // Interrupt pending, not halted.
+			// EI takes effect after the opcode following it, so
+			// run exactly one more opcode.
+			--cpu.interrupt_enable_flag;
+			cycles += step(&cpu);
+			break;
+		case 2: // Interrupt enabled, not halted.
+			if (interrupt_pending(cpu.interrupts))
+				goto interrupt_execution;
+			// FALLTHRU
+		case 0: // Interrupt disabled, not halted.
+			// Run blocks until the chunk is up or a timed event's
+			// due, or until an opcode changes the interrupt or halt
+			// state.
+			limit = cycles_until(
+					deadline, cpu.cycles, chunk - owed);
+			do
+			{
+				if (dynarec)
+					cycles += dynarec_run(dynarec,
+							&cpu,
+							limit - cycles);
+				else if (native)
+					cycles += recompiled_run(native,
+							cpu.block_cache,
+							&cpu,
+							&idle,
+							cpu.cycles + cycles,
+							limit - cycles);
+				else
+					cycles += run_block(&cpu,
+							&idle,
+							cpu.cycles + cycles,
+							limit - cycles);
+			} while (cycles < limit
+					&& (cpu.interrupt_enable_flag << 1
+						   | cpu.halt_flag)
+							== state);
+			break;
+		case 5: // Interrupt pending, halted.
+			--cpu.interrupt_enable_flag;
+			// FALLTHRU
+		case 3: // Interrupt enabled, halted.
+			if (interrupt_pending(cpu.interrupts))
+				goto interrupt_execution;
+			// FALLTHRU
+		case 1: // Interrupt disabled, halted.
+			// Sleep until there's an interrupt, reset or quit to
+			// wake up for, or the next timed event's due, and then
+			// catch up on the time it took.
+			cycles += halt_wait(&cpu, deadline - cpu.cycles);
+			break;
+		default: cycles += chunk; break;
+		}
+		continue;
+
+interrupt_execution:
+		rst = interrupt_acknowledge(cpu.interrupts);
+		cpu.halt_flag		  = 0;
+		cpu.interrupt_enable_flag = 0;
+#ifdef VERBOSE
+		fprintf(stderr, "INTRPT: ");
+#endif
+		// We don't advance PC for interrupts, though they can jump us.
+		cycles += interrupt_hook(&rst, &cpu, opcodes[rst]);
+		++interrupts;
+#ifdef VERBOSE
+		print_registers(&cpu);
+#endif
+	}
+
+	if (cpu.memory_map) memory_map_on_remap(cpu.memory_map, NULL, NULL);
+	if (dynarec)
+		dynarec_destroy(dynarec);
+	else
+		block_cache_destroy(cpu.block_cache);
+	return NULL;
+}
+
+void* block_cpu_thread_routine(void* resources)
+{
+	return block_core(resources, NULL, NULL);
+}
+
+void* dynarec_cpu_thread_routine(void* resources)
+{
+	struct dynarec* dynarec = dynarec_create();
+	if (!dynarec)
+	{
+		fprintf(stderr,
+				"The dynarec isn't available here; "
+				"using the block core instead.\n");
+		return block_core(resources, NULL, NULL);
+	}
+	return block_core(resources, dynarec, NULL);
+}
+
+void* native_cpu_thread_routine(void* resources)
+{
+	return block_core(resources, NULL, native_rom);
+}
@@ -119,7 +119,7 @@ int ret(const uint8_t* opcode, struct cpu_state* cpu)
 	// 1. Take the contents the memory at the stack pointer and put it into
 	//    the program counter.
 	// 2. increment the stack pointer by 2
-	cpu->pc = *((uint16_t*) &cpu->memory[cpu->sp]);
+	cpu->pc = read16(cpu, cpu->sp);
 	cpu->sp += 2;
 
 	// RET takes 10 cycles
@@ -143,7 +143,7 @@ int retcond(const uint8_t* opcode, struct cpu_state* cpu)
 	uint8_t conditionMet = evaluate_condition(opcode[0], cpu->psw);
 	if (conditionMet)
 	{
-		cpu->pc = *((uint16_t*) &cpu->memory[cpu->sp]);
+		cpu->pc = read16(cpu, cpu->sp);
 		cpu->sp += 2;
 		return 11;
 	}
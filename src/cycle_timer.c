@@ -1,90 +1,218 @@
 #include "cycle_timer.h"
 
+#include "control.h"
+#include "histogram.h"
+#include "interrupts.h"
+#include "metrics.h"
+#include "pacer.h"
+
 #include <errno.h>
 #include <pthread.h>
+#include <stdint.h>
 #include <stdio.h>
+#include <string.h>
 #include <time.h>
 
-#ifdef UNTHROTTLED
-int cycle_wait(int cycles, struct cpu_state* cpu)
+// Acts on a reset, if one's been asked for, and returns 1 if a quit has.
+static inline int check_control(struct cpu_state* cpu, uint8_t pending)
 {
-	(void) cycles;
-	(void) cpu;
-	return 0;
+	if (!(pending & CONTROL_REQUESTS)) return 0;
+	if (control_take(cpu->control, CONTROL_RESET))
+	{
+		cpu->pc			   = 0;
+		cpu->halt_flag		   = 0;
+		cpu->interrupt_enable_flag = 0;
+		cycle_timer_rebase(cpu->timer);
+	}
+	return !!(control_pending(cpu->control) & CONTROL_QUIT);
 }
-#else // ifndef UNTHROTTLED
-int cycle_wait(int cycles, struct cpu_state* cpu)
+
+// Reports the effective speed every bench_interval cycles, if that's nonzero.
+static inline void benchmark(struct cycle_timer* timer, int cycles)
 {
-	static int count;
-	static struct timespec target;
-#	ifdef BENCHMARK
-	static int bench_count;
-	static struct timespec bench_last;
-#	endif
-	// If we haven't yet initialized the timer, we need to.
-	if (target.tv_sec == 0 && target.tv_nsec == 0)
-	{ clock_gettime(CLOCK_MONOTONIC, &target); }
-	count += cycles;
-#	ifdef BENCHMARK
-	if (bench_last.tv_sec == 0 && bench_last.tv_nsec == 0)
-	{ clock_gettime(CLOCK_MONOTONIC, &bench_last); }
-	bench_count += cycles;
-	if (bench_count >= BENCH_INTERVAL) //~8 million unless overridden
+	if (!timer->bench_interval) return;
+	if (timer->bench_last.tv_sec == 0 && timer->bench_last.tv_nsec == 0)
+	{ clock_gettime(CLOCK_MONOTONIC, &timer->bench_last); }
+	timer->bench_count += cycles;
+	if (timer->bench_count >= timer->bench_interval)
 	{
 		struct timespec new;
 		clock_gettime(CLOCK_MONOTONIC, &new);
-		double elapsed = new.tv_sec;
-		elapsed += (double) new.tv_nsec / 1000000000.0;
-		elapsed -= bench_last.tv_sec;
-		elapsed -= (double) bench_last.tv_nsec / 1000000000.0;
+		const double elapsed = nanoseconds(&timer->bench_last, &new);
 		fprintf(stderr,
 				"Effective speed: %lfMHz\n",
-				(double) bench_count / elapsed / 1000000.0);
-		bench_count = 0;
-		bench_last  = new;
+				timer->bench_count * 1000.0 / elapsed);
+		timer->bench_count = 0;
+		timer->bench_last  = new;
 	}
-#	endif // BENCHMARK
+}
+
+static int unthrottled_wait(int cycles, struct cpu_state* cpu)
+{
+	benchmark(cpu->timer, cycles);
+	// Without the timer, there are no chunks to wait for.
+	return check_control(cpu, control_pending(cpu->control));
+}
+
+static int throttled_wait(int cycles, struct cpu_state* cpu)
+{
+	struct cycle_timer* const timer = cpu->timer;
+	struct pacer* const pacer	= &timer->pacer;
+#ifdef BENCHMARK
+	struct timespec stall_start, stall_end;
+#endif
+	// The pacer is set up here, rather than in cycle_timer_init(), since it
+	// has to be done from the thread that's going to wait.
+	if (!pacer->cycle_time)
+		pacer_init(pacer, cycle_timer_period(timer), timer->chunk);
+	timer->count += cycles;
+	benchmark(timer, cycles);
 	// If a chunk's worth of cycles have elapsed, it's time to sleep.
-	if (count >= CYCLE_CHUNK)
+	if (timer->count >= timer->chunk)
 	{
 
-		pthread_mutex_lock(cpu->reset_quit_lock);
-		if (*cpu->reset_flag)
+#ifdef BENCHMARK
+		clock_gettime(CLOCK_MONOTONIC, &stall_start);
+#endif
+		const uint8_t pending = control_pending(cpu->control);
+		const int quit	      = check_control(cpu, pending);
+#ifdef BENCHMARK
+		clock_gettime(CLOCK_MONOTONIC, &stall_end);
+		histogram_record(&timer->stalls,
+				nanoseconds(&stall_start, &stall_end));
+		if (quit)
+			histogram_print(&timer->stalls,
+					"Reset/quit check stalls",
+					stderr);
+#endif
+		if (quit && timer->bench_interval)
+			histogram_print(&pacer->error, "Pacing error", stderr);
+		if (quit) return 1;
+
+		// In turbo, the cycles just go by.  Coming out of it, we
+		// start timing afresh, rather than sleeping off the lot.
+		if (pending & CONTROL_TURBO)
 		{
-			cpu->pc			   = 0;
-			*cpu->reset_flag	   = 0;
-			cpu->halt_flag		   = 0;
-			cpu->interrupt_enable_flag = 0;
+			timer->turbo = 1;
+			timer->count = 0;
+			return 0;
 		}
-		if (*cpu->quit_flag)
+		if (timer->turbo)
 		{
-			pthread_mutex_unlock(cpu->reset_quit_lock);
-			return 1;
+			timer->turbo = 0;
+			pacer_rebase(pacer);
 		}
-		pthread_mutex_unlock(cpu->reset_quit_lock);
+		// The same goes for a change of rate.
+		const long period = cycle_timer_period(timer);
+		if (period != pacer->cycle_time)
+			pacer_set_cycle_time(pacer, period);
+		// The pacer saves up chunks of its own, and sleeps once it's
+		// got enough: see pacer.h.
+		pacer_wait(pacer, timer->count);
+		timer->count = 0;
+		metric_set(timer->overshoot,
+				pacer->overshoot > 0 ? pacer->overshoot : 0);
+	}
+	return 0;
+}
 
-		// Adjust the target time upward by the amount of time
-		// the elapsed cycle count should have taken.
+void cycle_timer_init(struct cycle_timer* timer,
+		int throttled,
+		long cycle_time,
+		int chunk,
+		uint64_t bench_interval)
+{
+	memset(timer, 0, sizeof(*timer));
+	timer->throttled      = throttled;
+	timer->cycle_time     = cycle_time;
+	timer->chunk	      = chunk;
+	timer->bench_interval = bench_interval;
+	timer->rate	      = RATE_NORMAL;
+	timer->wait	      = throttled ? throttled_wait : unthrottled_wait;
+	cycle_timer_add_metrics(timer, NULL);
+}
 
-		target.tv_nsec += count * CYCLE_TIME;
-		if (target.tv_nsec > 1000000000)
+void cycle_timer_add_metrics(struct cycle_timer* timer, struct metrics* metrics)
+{
+	timer->overshoot = metrics_add(metrics,
+			"i8080_pacer_overshoot_ns",
+			"How late the pacer's sleeps wake, on average.",
+			METRIC_GAUGE);
+	timer->halted	 = metrics_add(metrics,
+			"i8080_halted_ns_total",
+			"Nanoseconds spent halted.",
+			METRIC_COUNTER);
+	timer->interrupt_lock = metrics_add_lock(
+			metrics, "i8080_interrupt_lock", "interrupt lock");
+}
+
+void cycle_timer_rebase(struct cycle_timer* timer)
+{
+	timer->count = 0;
+	timer->turbo = 0;
+	if (timer->pacer.cycle_time) pacer_rebase(&timer->pacer);
+	// The next speed report starts from now, too.
+	timer->bench_count = 0;
+	clock_gettime(CLOCK_MONOTONIC, &timer->bench_last);
+}
+
+int halt_wait(struct cpu_state* cpu, uint64_t cycles_left)
+{
+	// However long the wait, we don't sleep more than HALT_WAIT_LIMIT.
+	const struct cycle_timer* timer = cpu->timer;
+	const long period		= cycle_timer_period(timer);
+	const long limit		= HALT_WAIT_LIMIT / period;
+	long wait			= HALT_WAIT_LIMIT;
+	if (cycles_left < (uint64_t) limit)
+	{
+		// Running flat out, there's no need to wait for the next timed
+		// event: we skip straight to it.
+		if (!timer->throttled
+				|| (control_pending(cpu->control)
+						& CONTROL_TURBO))
+			return cycles_left;
+		wait = cycles_left * period;
+	}
+
+	struct timespec start, now, deadline;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	// The condition goes by the same clock: see interrupts.h.
+	deadline = start;
+	deadline.tv_nsec += wait;
+	while (deadline.tv_nsec >= 1000000000)
+	{
+		deadline.tv_nsec -= 1000000000;
+		++deadline.tv_sec;
+	}
+
+	struct interrupt_controller* ic = cpu->interrupts;
+	int interrupt, control, timeout = 0;
+	metrics_lock(&ic->lock, &timer->interrupt_lock);
+	__atomic_store_n(&ic->sleeping, 1, __ATOMIC_SEQ_CST);
+	for (;;)
+	{
+		interrupt = cpu->interrupt_enable_flag
+			    && __atomic_load_n(
+					    &ic->pending, __ATOMIC_SEQ_CST);
+		control = control_pending(cpu->control) & CONTROL_REQUESTS;
+		if (interrupt || control) break;
+		if (pthread_cond_timedwait(&ic->cond, &ic->lock, &deadline)
+				== ETIMEDOUT)
 		{
-			target.tv_nsec -= 1000000000;
-			++target.tv_sec;
+			timeout = 1;
+			break;
 		}
-		count = 0;
-		// Sleep until we hit the target time, if and only if
-		// that time is in the future.  clock_nanosleep()
-		// will return immediately without suspending execution
-		// if the requested time is in the past.  That should
-		// let us catch up if we fall behind: the return is very quick.
-		while (clock_nanosleep(CLOCK_MONOTONIC,
-				       TIMER_ABSTIME,
-				       &target,
-				       NULL)
-				&& errno == EINTR)
-			;
 	}
-	return 0;
+	__atomic_store_n(&ic->sleeping, 0, __ATOMIC_SEQ_CST);
+	pthread_mutex_unlock(&ic->lock);
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	metric_count(timer->halted, nanoseconds(&start, &now));
+	// Sleeping until a timed event's due, we count exactly up to it, so
+	// that the event runs at the same point in the program every time.
+	if (timeout && wait < HALT_WAIT_LIMIT) return cycles_left;
+	long cycles = nanoseconds(&start, &now) / period;
+	if ((uint64_t) cycles > cycles_left) cycles = cycles_left;
+	if (control && cycles < timer->chunk) cycles = timer->chunk;
+	return cycles;
 }
-#endif	       // ifndef UNTHROTTLED
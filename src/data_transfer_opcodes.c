@@ -103,7 +103,7 @@ int lda(const uint8_t* opcode, struct cpu_state* cpu)
 	// Load content of the memory location specified in the instruction
 	// to register A
 	uint16_t address = *(const uint16_t*) (opcode + 1);
-	cpu->a		 = cpu->memory[address];
+	cpu->a		 = read8(cpu, address);
 
 	return 13;
 }
@@ -139,7 +139,7 @@ int lhld(const uint8_t* opcode, struct cpu_state* cpu)
 	// The content of the memory location specified by the next 2 bytes of
 	// the instruction is loaded to register HL.
 	uint16_t address = IMM16(opcode);
-	cpu->hl		 = *((uint16_t*) &cpu->memory[address]);
+	cpu->hl		 = read16(cpu, address);
 
 	return 16;
 }
@@ -171,7 +171,7 @@ int ldax(const uint8_t* opcode, struct cpu_state* cpu)
 
 	uint16_t* rp = get_register_pair_other(opcode[0], cpu);
 	// load content of the byte at the address found at RP to register A
-	cpu->a = cpu->memory[*rp];
+	cpu->a = read8(cpu, *rp);
 
 	return 7;
 }
@@ -0,0 +1,886 @@
+// For memfd_create().
+#define _GNU_SOURCE
+
+#include "dynarec.h"
+
+#include "alu_tables.h"
+#include "block_cache.h"
+#include "cpu.h"
+#include "lazy_flags.h"
+#include "memory_map.h"
+#include "opcode_info.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+uint8_t dynarec_perf_map = 0;
+
+#if defined(__x86_64__) && defined(__linux__)
+
+#	include <sys/mman.h>
+#	include <unistd.h>
+
+/* Register use in translated code:
+ *
+ * 	rbx	The cpu_state.
+ * 	r12	Cycles left in the budget.  We go back to C once it's gone.
+ * 	r13	The block cache's table of blocks, by start address.
+ * 	r14	The block cache's generation counter.
+ * 	rbp	The generation counter's value when we came in from C.  If
+ * 		they differ after a write, code has been overwritten.
+ * 	r15	The 8080's memory.
+ * 	rax, rcx, rdx, rsi, rdi
+ * 		Scratch.
+ *
+ * All the 8080 registers are reached through rbx with an 8-bit
+ * displacement, so every encoding below is of the form [rbx + disp8].
+ */
+
+enum
+{
+	EAX = 0,
+	ECX = 1,
+	EDX = 2,
+	ESI = 6,
+};
+
+// x86 condition codes, for Jcc.
+enum
+{
+	CC_Z  = 0x4,
+	CC_NZ = 0x5,
+	CC_LE = 0xe,
+};
+
+#	define OFFSET(member) ((uint8_t) offsetof(struct cpu_state, member))
+
+_Static_assert(offsetof(struct cpu_state, block_cache) < 0x80,
+		"cpu_state registers must be reachable with a disp8.");
+
+// The most code a single block can translate to.
+#	define MAX_BLOCK_CODE (4096)
+
+struct emitter
+{
+	uint8_t* p;
+	const struct dynarec* dynarec;
+	// Whether M can be read straight from memory, which it can't if
+	// there's MMIO to look out for (see memory_map.h).
+	int inline_reads;
+};
+
+static void put8(struct emitter* e, uint8_t value) { *e->p++ = value; }
+
+static void put16(struct emitter* e, uint16_t value)
+{
+	memcpy(e->p, &value, 2);
+	e->p += 2;
+}
+
+static void put32(struct emitter* e, uint32_t value)
+{
+	memcpy(e->p, &value, 4);
+	e->p += 4;
+}
+
+static void put64(struct emitter* e, uint64_t value)
+{
+	memcpy(e->p, &value, 8);
+	e->p += 8;
+}
+
+// Fills in a rel32 at the given address, to jump to target.
+static void patch_rel32(uint8_t* at, const uint8_t* target)
+{
+	int32_t rel = target - (at + 4);
+	memcpy(at, &rel, 4);
+}
+
+// movzx reg, byte [rbx + offset]
+static void load8(struct emitter* e, int reg, uint8_t offset)
+{
+	put8(e, 0x0f);
+	put8(e, 0xb6);
+	put8(e, 0x43 | reg << 3);
+	put8(e, offset);
+}
+
+// movzx reg, word [rbx + offset]
+static void load16(struct emitter* e, int reg, uint8_t offset)
+{
+	put8(e, 0x0f);
+	put8(e, 0xb7);
+	put8(e, 0x43 | reg << 3);
+	put8(e, offset);
+}
+
+// mov byte [rbx + offset], reg
+static void store8(struct emitter* e, int reg, uint8_t offset)
+{
+	put8(e, 0x88);
+	put8(e, 0x43 | reg << 3);
+	put8(e, offset);
+}
+
+// mov word [rbx + offset], reg
+static void store16(struct emitter* e, int reg, uint8_t offset)
+{
+	put8(e, 0x66);
+	put8(e, 0x89);
+	put8(e, 0x43 | reg << 3);
+	put8(e, offset);
+}
+
+// mov byte [rbx + offset], value
+static void store8_imm(struct emitter* e, uint8_t offset, uint8_t value)
+{
+	put8(e, 0xc6);
+	put8(e, 0x43);
+	put8(e, offset);
+	put8(e, value);
+}
+
+// mov word [rbx + offset], value
+static void store16_imm(struct emitter* e, uint8_t offset, uint16_t value)
+{
+	put8(e, 0x66);
+	put8(e, 0xc7);
+	put8(e, 0x43);
+	put8(e, offset);
+	put16(e, value);
+}
+
+// movzx reg, byte [r15 + rcx]: reads the 8080 memory at the address in ecx.
+static void load_memory(struct emitter* e, int reg)
+{
+	put8(e, 0x41);
+	put8(e, 0x0f);
+	put8(e, 0xb6);
+	put8(e, 0x04 | reg << 3);
+	put8(e, 0x0f);
+}
+
+// mov reg, imm64
+static void load_pointer(struct emitter* e, int reg, const void* pointer)
+{
+	put8(e, 0x48);
+	put8(e, 0xb8 + reg);
+	put64(e, (uintptr_t) pointer);
+}
+
+// op dst, src, for the 32-bit ALU ops which take ModRM r/m, r.
+enum
+{
+	X86_ADD = 0x01,
+	X86_OR	= 0x09,
+	X86_AND = 0x21,
+	X86_XOR = 0x31,
+};
+
+static void alu_rr(struct emitter* e, uint8_t op, int dst, int src)
+{
+	put8(e, op);
+	put8(e, 0xc0 | src << 3 | dst);
+}
+
+// and reg, value
+static void and_imm(struct emitter* e, int reg, uint32_t value)
+{
+	put8(e, 0x81);
+	put8(e, 0xe0 | reg);
+	put32(e, value);
+}
+
+// shl reg, count
+static void shl_imm(struct emitter* e, int reg, uint8_t count)
+{
+	put8(e, 0xc1);
+	put8(e, 0xe0 | reg);
+	put8(e, count);
+}
+
+// shr reg, count
+static void shr_imm(struct emitter* e, int reg, uint8_t count)
+{
+	put8(e, 0xc1);
+	put8(e, 0xe8 | reg);
+	put8(e, count);
+}
+
+// mov dst, src
+static void mov_rr(struct emitter* e, int dst, int src)
+{
+	put8(e, 0x89);
+	put8(e, 0xc0 | src << 3 | dst);
+}
+
+// sub r12, cycles
+static void charge(struct emitter* e, int cycles)
+{
+	if (!cycles) return;
+	put8(e, 0x49);
+	put8(e, 0x81);
+	put8(e, 0xec);
+	put32(e, cycles);
+}
+
+// jmp target
+static void jmp(struct emitter* e, const uint8_t* target)
+{
+	put8(e, 0xe9);
+	e->p += 4;
+	patch_rel32(e->p - 4, target);
+}
+
+// jcc target
+static void jcc(struct emitter* e, uint8_t condition, const uint8_t* target)
+{
+	put8(e, 0x0f);
+	put8(e, 0x80 | condition);
+	e->p += 4;
+	patch_rel32(e->p - 4, target);
+}
+
+// jcc rel32, to be patched later.  Returns the address of the rel32.
+static uint8_t* jcc_forward(struct emitter* e, uint8_t condition)
+{
+	put8(e, 0x0f);
+	put8(e, 0x80 | condition);
+	e->p += 4;
+	return e->p - 4;
+}
+
+// Calls function(first, second).
+static void call(struct emitter* e,
+		const void* function,
+		const void* first,
+		int second_is_cpu)
+{
+	if (first)
+		load_pointer(e, 7, first); // mov rdi, first
+	else
+	{
+		put8(e, 0x48); // mov rdi, rbx
+		put8(e, 0x89);
+		put8(e, 0xdf);
+	}
+	if (second_is_cpu)
+	{
+		put8(e, 0x48); // mov rsi, rbx
+		put8(e, 0x89);
+		put8(e, 0xde);
+	}
+	load_pointer(e, EAX, function);
+	put8(e, 0xff); // call rax
+	put8(e, 0xd0);
+}
+
+/* Leaves translated code for a known PC: either jumps straight to the
+ * translation of the block there, or, if there isn't one or the budget's
+ * spent, stores the PC and goes back to C.
+ */
+static void chain(struct emitter* e, uint16_t target)
+{
+	put8(e, 0x4d); // test r12, r12
+	put8(e, 0x85);
+	put8(e, 0xe4);
+	uint8_t* out_of_budget = jcc_forward(e, CC_LE);
+	put8(e, 0x49); // mov rax, [r13 + target * 8]
+	put8(e, 0x8b);
+	put8(e, 0x85);
+	put32(e, target * sizeof(struct block*));
+	put8(e, 0x48); // test rax, rax
+	put8(e, 0x85);
+	put8(e, 0xc0);
+	uint8_t* no_block = jcc_forward(e, CC_Z);
+	put8(e, 0x48); // mov rax, [rax + native]
+	put8(e, 0x8b);
+	put8(e, 0x40);
+	put8(e, offsetof(struct block, native));
+	put8(e, 0x48); // test rax, rax
+	put8(e, 0x85);
+	put8(e, 0xc0);
+	uint8_t* no_translation = jcc_forward(e, CC_Z);
+	put8(e, 0xff); // jmp rax
+	put8(e, 0xe0);
+
+	patch_rel32(out_of_budget, e->p);
+	patch_rel32(no_block, e->p);
+	patch_rel32(no_translation, e->p);
+	store16_imm(e, OFFSET(pc), target);
+	jmp(e, e->dynarec->exit);
+}
+
+// As chain(), for when the PC has already been set by a handler.
+static void chain_indirect(struct emitter* e)
+{
+	put8(e, 0x4d); // test r12, r12
+	put8(e, 0x85);
+	put8(e, 0xe4);
+	jcc(e, CC_LE, e->dynarec->exit);
+	load16(e, EAX, OFFSET(pc));
+	put8(e, 0x49); // mov rax, [r13 + rax * 8]
+	put8(e, 0x8b);
+	put8(e, 0x44);
+	put8(e, 0xc5);
+	put8(e, 0x00);
+	put8(e, 0x48); // test rax, rax
+	put8(e, 0x85);
+	put8(e, 0xc0);
+	jcc(e, CC_Z, e->dynarec->exit);
+	put8(e, 0x48); // mov rax, [rax + native]
+	put8(e, 0x8b);
+	put8(e, 0x40);
+	put8(e, offsetof(struct block, native));
+	put8(e, 0x48); // test rax, rax
+	put8(e, 0x85);
+	put8(e, 0xc0);
+	jcc(e, CC_Z, e->dynarec->exit);
+	put8(e, 0xff); // jmp rax
+	put8(e, 0xe0);
+}
+
+// The DDD and SSS fields of the opcode, as cpu_state offsets.  M is 0.
+static uint8_t register_offset(uint8_t field)
+{
+	static const uint8_t offsets[8] = {OFFSET(b),
+			OFFSET(c),
+			OFFSET(d),
+			OFFSET(e),
+			OFFSET(h),
+			OFFSET(l),
+			0,
+			OFFSET(a)};
+	return offsets[field];
+}
+
+static uint8_t pair_offset(uint8_t opcode)
+{
+	static const uint8_t offsets[4] = {
+			OFFSET(bc), OFFSET(de), OFFSET(hl), OFFSET(sp)};
+	return offsets[(opcode >> 4) & 3];
+}
+
+// Loads an ALU operand (register, M, or immediate) into ecx.
+static void load_operand(struct emitter* e, const uint8_t* opcode)
+{
+	if (opcode[0] >= 0xc0)
+	{
+		put8(e, 0xb9); // mov ecx, imm32
+		put32(e, opcode[1]);
+	}
+	else if ((opcode[0] & 7) == 6)
+	{
+		load16(e, ECX, OFFSET(hl));
+		load_memory(e, ECX);
+	}
+	else
+		load8(e, ECX, register_offset(opcode[0] & 7));
+}
+
+// flags = eax | (flags & ~ALU_FLAGS), ignoring eax's high byte.
+static void merge_flags(struct emitter* e)
+{
+	load8(e, EDX, OFFSET(flags));
+	and_imm(e, EDX, (uint8_t) ~ALU_FLAGS);
+	alu_rr(e, X86_OR, EAX, EDX);
+}
+
+/* The ALU opcodes, register, memory and immediate alike.  These work out the
+ * flags in full, so if lazy flags are in use, there's nothing left pending.
+ */
+static void translate_alu(struct emitter* e, const uint8_t* opcode)
+{
+	const int operation = (opcode[0] >> 3) & 7;
+	load_operand(e, opcode);
+	load8(e, EAX, OFFSET(a));
+	switch (operation)
+	{
+	case 0: // ADD
+	case 1: // ADC
+	case 2: // SUB
+	case 3: // SBB
+	case 7: // CMP
+		// eax = carry << 16 | a << 8 | operand, to index the table.
+		shl_imm(e, EAX, 8);
+		alu_rr(e, X86_OR, EAX, ECX);
+		if (operation == 1 || operation == 3)
+		{
+			load8(e, EDX, OFFSET(flags));
+			and_imm(e, EDX, CARRY_FLAG);
+			shl_imm(e, EDX, 16);
+			alu_rr(e, X86_OR, EAX, EDX);
+		}
+		load_pointer(e,
+				EDX,
+				operation == 0 || operation == 1 ? add_table
+								 : sub_table);
+		put8(e, 0x0f); // movzx eax, word [rdx + rax * 2]
+		put8(e, 0xb7);
+		put8(e, 0x04);
+		put8(e, 0x42);
+		merge_flags(e);
+		if (operation == 7)
+			store8(e, EAX, OFFSET(flags));
+		else
+			store16(e, EAX, OFFSET(psw));
+		break;
+	case 4: // ANA
+		// The aux carry is the OR of bit 3 of the operands.
+		mov_rr(e, ESI, EAX);
+		alu_rr(e, X86_OR, ESI, ECX);
+		and_imm(e, ESI, 1 << 3);
+		shl_imm(e, ESI, 1);
+		alu_rr(e, X86_AND, EAX, ECX);
+		goto logical;
+	case 5: // XRA
+		put8(e, 0x31); // xor esi, esi
+		put8(e, 0xf6);
+		alu_rr(e, X86_XOR, EAX, ECX);
+		goto logical;
+	case 6: // ORA
+		put8(e, 0x31); // xor esi, esi
+		put8(e, 0xf6);
+		alu_rr(e, X86_OR, EAX, ECX);
+logical:
+		store8(e, EAX, OFFSET(a));
+		load_pointer(e, EDX, zsp_table);
+		put8(e, 0x0f); // movzx eax, byte [rdx + rax]
+		put8(e, 0xb6);
+		put8(e, 0x04);
+		put8(e, 0x02);
+		alu_rr(e, X86_OR, EAX, ESI);
+		merge_flags(e);
+		store8(e, EAX, OFFSET(flags));
+		break;
+	}
+	store8_imm(e, OFFSET(lazy_op), LAZY_NONE);
+}
+
+// INR and DCR on a register: like ADD 1 or ADD 0xff, but keeping the carry.
+static void translate_inr_dcr(struct emitter* e, uint8_t opcode)
+{
+	const uint8_t reg = register_offset((opcode >> 3) & 7);
+	load8(e, EAX, reg);
+	shl_imm(e, EAX, 8);
+	put8(e, 0x0d); // or eax, imm32
+	put32(e, opcode & 1 ? 0xff : 0x01);
+	load_pointer(e, EDX, add_table);
+	put8(e, 0x0f); // movzx eax, word [rdx + rax * 2]
+	put8(e, 0xb7);
+	put8(e, 0x04);
+	put8(e, 0x42);
+	mov_rr(e, ECX, EAX);
+	shr_imm(e, ECX, 8);
+	store8(e, ECX, reg);
+	and_imm(e, EAX, ALU_FLAGS & ~CARRY_FLAG);
+	load8(e, EDX, OFFSET(flags));
+	and_imm(e, EDX, (uint8_t) (~ALU_FLAGS | CARRY_FLAG));
+	alu_rr(e, X86_OR, EAX, EDX);
+	store8(e, EAX, OFFSET(flags));
+	store8_imm(e, OFFSET(lazy_op), LAZY_NONE);
+}
+
+// Called from translated code before it reads the flags.
+static void materialize(struct cpu_state* cpu) { materialize_flags(cpu); }
+
+// The flag each condition tests, in opcode order: NZ, Z, NC, C, PO, PE, P, M.
+static const uint8_t condition_flags[8] = {ZERO_FLAG,
+		ZERO_FLAG,
+		CARRY_FLAG,
+		CARRY_FLAG,
+		PARITY_FLAG,
+		PARITY_FLAG,
+		SIGN_FLAG,
+		SIGN_FLAG};
+
+// Jcc: the last opcode of its block.
+static void translate_branch(
+		struct emitter* e, const struct block* block, uint8_t condition)
+{
+	const struct micro_op* op = &block->ops[block->count - 1];
+	put8(e, 0x80); // cmp byte [rbx + lazy_op], 0
+	put8(e, 0x7b);
+	put8(e, OFFSET(lazy_op));
+	put8(e, 0x00);
+	put8(e, 0x74); // je past the call
+	uint8_t* skip = e->p++;
+	call(e, (const void*) materialize, NULL, 0);
+	*skip = e->p - (skip + 1);
+
+	charge(e, block->cycles);
+	put8(e, 0xf6); // test byte [rbx + flags], flag
+	put8(e, 0x43);
+	put8(e, OFFSET(flags));
+	put8(e, condition_flags[condition]);
+	// The odd conditions jump when the flag is set.
+	uint8_t* taken = jcc_forward(e, condition & 1 ? CC_NZ : CC_Z);
+	chain(e, op->next_pc);
+	patch_rel32(taken, e->p);
+	chain(e, op->opcode[2] << 8 | op->opcode[1]);
+}
+
+// Translates one opcode other than the last.  Returns 0 if it needs a call.
+static int translate_inline(struct emitter* e, const uint8_t* opcode)
+{
+	const uint8_t op = opcode[0];
+	if (op == 0x00) return 1; // NOP
+	if (op >= 0x40 && op < 0x80 && op != 0x76)
+	{
+		// MOV.  Writes to M need write8(), so they get a call.
+		const uint8_t dst = (op >> 3) & 7, src = op & 7;
+		if (dst == 6 || (src == 6 && !e->inline_reads)) return 0;
+		if (src == 6)
+		{
+			load16(e, ECX, OFFSET(hl));
+			load_memory(e, EAX);
+		}
+		else
+			load8(e, EAX, register_offset(src));
+		store8(e, EAX, register_offset(dst));
+		return 1;
+	}
+	if (op >= 0x80 && op < 0xc0 && (op & 7) == 6 && !e->inline_reads)
+		return 0;
+	if ((op >= 0x80 && op < 0xc0) || (op >= 0xc0 && (op & 7) == 6))
+	{
+		translate_alu(e, opcode);
+		return 1;
+	}
+	if (op < 0x40)
+	{
+		switch (op & 0xf)
+		{
+		case 0x1: // LXI
+			store16_imm(e,
+					pair_offset(op),
+					opcode[2] << 8 | opcode[1]);
+			return 1;
+		case 0x3: // INX
+		case 0xb: // DCX
+			put8(e, 0x66); // inc/dec word [rbx + offset]
+			put8(e, 0xff);
+			put8(e, op & 8 ? 0x4b : 0x43);
+			put8(e, pair_offset(op));
+			return 1;
+		case 0x6: // MVI
+		case 0xe:
+			if (op == 0x36) return 0;
+			store8_imm(e, register_offset(op >> 3), opcode[1]);
+			return 1;
+		case 0x4: // INR
+		case 0x5: // DCR
+		case 0xc:
+		case 0xd:
+			if (op >= 0x34 && op <= 0x35) return 0;
+			translate_inr_dcr(e, op);
+			return 1;
+		}
+	}
+	if (op == 0xeb) // XCHG
+	{
+		load16(e, EAX, OFFSET(de));
+		load16(e, ECX, OFFSET(hl));
+		store16(e, ECX, OFFSET(de));
+		store16(e, EAX, OFFSET(hl));
+		return 1;
+	}
+	return 0;
+}
+
+/* Calls the handler.  Afterwards, if the opcode may have written to memory,
+ * checks whether that write hit code, and if so leaves, charging the cycles
+ * used so far.  The last opcode of a block needn't leave (it's about to
+ * anyway, or to chain through the table, which no longer has the block), so
+ * it just takes note of the new generation.
+ */
+static void translate_call(struct emitter* e,
+		const struct micro_op* op,
+		int cycles_so_far,
+		int last)
+{
+	store16_imm(e, OFFSET(pc), op->next_pc);
+	call(e, (const void*) op->handler, op->opcode, 1);
+	if (!op->writes_memory) return;
+	if (last)
+	{
+		put8(e, 0x49); // mov rbp, [r14]
+		put8(e, 0x8b);
+		put8(e, 0x2e);
+		return;
+	}
+	put8(e, 0x49); // cmp rbp, [r14]
+	put8(e, 0x3b);
+	put8(e, 0x2e);
+	put8(e, 0x74); // je past the exit
+	uint8_t* skip = e->p++;
+	charge(e, cycles_so_far);
+	jmp(e, e->dynarec->exit);
+	*skip = e->p - (skip + 1);
+}
+
+// Translates the end of the block, from its last opcode.
+static void translate_last(struct emitter* e, const struct block* block)
+{
+	const struct micro_op* last = &block->ops[block->count - 1];
+	const struct opcode_info* info = &opcode_info[last->opcode[0]];
+	if (info->flow == FLOW_BRANCH)
+		translate_branch(e, block, (last->opcode[0] >> 3) & 7);
+	else if (last->opcode[0] == 0xc3 || last->opcode[0] == 0xcb)
+	{
+		charge(e, block->cycles);
+		chain(e, last->opcode[2] << 8 | last->opcode[1]);
+	}
+	else if (info->flow == FLOW_NEXT && translate_inline(e, last->opcode))
+	{
+		charge(e, block->cycles);
+		chain(e, last->next_pc);
+	}
+	else
+	{
+		translate_call(e, last, 0, 1);
+		if (block->variable_cycles)
+		{
+			mov_rr(e, EAX, EAX); // Zero the top of rax.
+			put8(e, 0x49);	     // sub r12, rax
+			put8(e, 0x29);
+			put8(e, 0xc4);
+		}
+		charge(e, block->cycles);
+		if (info->flow == FLOW_SYNC)
+			jmp(e, e->dynarec->exit);
+		else if (info->flow == FLOW_NEXT)
+			chain(e, last->next_pc);
+		else
+			chain_indirect(e);
+	}
+}
+
+static void* translate(struct dynarec* dynarec,
+		const struct block* block,
+		int inline_reads)
+{
+	struct emitter e = {
+			dynarec->buffer + dynarec->used, dynarec, inline_reads};
+	uint8_t* const start = e.p;
+	// Where it'll run, in the executable view of the buffer.
+	uint8_t* const code = dynarec->code + (start - dynarec->buffer);
+
+	int cycles = 0;
+	for (int i = 0; i < block->count; ++i)
+	{
+		const struct micro_op* op = &block->ops[i];
+		cycles += op->cycles;
+		if (opcode_info[op->opcode[0]].access == MEM_IO)
+		{
+			// Leave the hardware to the C side: it sees exactly the
+			// state the interpreter would.  Whatever's left of the
+			// block is picked up from there by a new one, which
+			// also takes care of any bank switch.
+			translate_call(&e, op, cycles, 1);
+			charge(&e, cycles);
+			jmp(&e, dynarec->exit);
+			break;
+		}
+		if (i == block->count - 1)
+			translate_last(&e, block);
+		else if (!translate_inline(&e, op->opcode))
+			translate_call(&e, op, cycles, 0);
+	}
+
+	if (e.p - start > MAX_BLOCK_CODE)
+	{
+		fprintf(stderr, "Dynarec: translation overran its space!\n");
+		abort();
+	}
+	dynarec->used += e.p - start;
+	// Keep translations 16-byte aligned, as the host likes.
+	dynarec->used = (dynarec->used + 15) & ~(size_t) 15;
+	++dynarec->stats.translations;
+	if (dynarec->perf_map)
+		fprintf(dynarec->perf_map,
+				"%lx %lx 8080_block_%4.4x\n",
+				(unsigned long) code,
+				(unsigned long) (e.p - start),
+				block->start);
+	return code;
+}
+
+// Writes the entry and exit stubs at the start of the buffer.
+static void write_stubs(struct dynarec* dynarec)
+{
+	struct emitter e = {dynarec->buffer, dynarec, 1};
+
+	// int64_t enter(cpu, budget, blocks, generation, code)
+	dynarec->enter = (void*) dynarec->code;
+	static const uint8_t prologue[] = {
+			0x53,		  // push rbx
+			0x55,		  // push rbp
+			0x41, 0x54,	  // push r12
+			0x41, 0x55,	  // push r13
+			0x41, 0x56,	  // push r14
+			0x41, 0x57,	  // push r15
+			0x48, 0x83, 0xec, 0x08, // sub rsp, 8
+			0x48, 0x89, 0xfb, // mov rbx, rdi
+			0x49, 0x89, 0xf4, // mov r12, rsi
+			0x49, 0x89, 0xd5, // mov r13, rdx
+			0x49, 0x89, 0xce, // mov r14, rcx
+			0x49, 0x8b, 0x2e, // mov rbp, [r14]
+	};
+	memcpy(e.p, prologue, sizeof(prologue));
+	e.p += sizeof(prologue);
+	put8(&e, 0x4c); // mov r15, [rbx + memory]
+	put8(&e, 0x8b);
+	put8(&e, 0x7b);
+	put8(&e, OFFSET(memory));
+	put8(&e, 0x41); // jmp r8
+	put8(&e, 0xff);
+	put8(&e, 0xe0);
+
+	dynarec->exit = e.p;
+	static const uint8_t epilogue[] = {
+			0x4c, 0x89, 0xe0, // mov rax, r12
+			0x48, 0x83, 0xc4, 0x08, // add rsp, 8
+			0x41, 0x5f,	  // pop r15
+			0x41, 0x5e,	  // pop r14
+			0x41, 0x5d,	  // pop r13
+			0x41, 0x5c,	  // pop r12
+			0x5d,		  // pop rbp
+			0x5b,		  // pop rbx
+			0xc3,		  // ret
+	};
+	memcpy(e.p, epilogue, sizeof(epilogue));
+	e.p += sizeof(epilogue);
+	dynarec->used = (e.p - dynarec->buffer + 15) & ~(size_t) 15;
+}
+
+/* The buffer is an anonymous file mapped twice, as memory_map_create() does
+ * with the physical store: once to write translations into, and once to run
+ * them from, so that no page is ever both writable and executable.  The two
+ * views are laid out alike, so a rel32 between two places in one is right for
+ * the other too: translations are written as if they were in the writable
+ * view, and only their entry points are moved over to the executable one.
+ */
+static int map_buffer(struct dynarec* dynarec)
+{
+	const int fd = memfd_create("8080 dynarec", MFD_CLOEXEC);
+	if (fd == -1) return -1;
+	uint8_t* buffer = MAP_FAILED;
+	uint8_t* code	= MAP_FAILED;
+	if (!ftruncate(fd, DYNAREC_BUFFER_SIZE))
+	{
+		buffer = mmap(NULL,
+				DYNAREC_BUFFER_SIZE,
+				PROT_READ | PROT_WRITE,
+				MAP_SHARED,
+				fd,
+				0);
+		code = mmap(NULL,
+				DYNAREC_BUFFER_SIZE,
+				PROT_READ | PROT_EXEC,
+				MAP_SHARED,
+				fd,
+				0);
+	}
+	close(fd);
+	if (buffer == MAP_FAILED || code == MAP_FAILED)
+	{
+		if (buffer != MAP_FAILED) munmap(buffer, DYNAREC_BUFFER_SIZE);
+		if (code != MAP_FAILED) munmap(code, DYNAREC_BUFFER_SIZE);
+		return -1;
+	}
+	dynarec->buffer = buffer;
+	dynarec->code	= code;
+	return 0;
+}
+
+struct dynarec* dynarec_create(void)
+{
+	struct dynarec* dynarec = calloc(1, sizeof(struct dynarec));
+	if (!dynarec) return NULL;
+	dynarec->cache = block_cache_create();
+	if (!dynarec->cache || map_buffer(dynarec))
+	{
+		block_cache_destroy(dynarec->cache);
+		free(dynarec);
+		return NULL;
+	}
+	write_stubs(dynarec);
+	dynarec->hot_runs = DYNAREC_HOT_RUNS;
+
+	// Not being able to write the map isn't worth stopping for.
+	if (dynarec_perf_map)
+	{
+		char name[32];
+		snprintf(name,
+				sizeof(name),
+				"/tmp/perf-%d.map",
+				(int) getpid());
+		dynarec->perf_map = fopen(name, "w");
+	}
+	return dynarec;
+}
+
+void dynarec_destroy(struct dynarec* dynarec)
+{
+	if (!dynarec) return;
+	if (dynarec->perf_map) fclose(dynarec->perf_map);
+	munmap(dynarec->buffer, DYNAREC_BUFFER_SIZE);
+	munmap(dynarec->code, DYNAREC_BUFFER_SIZE);
+	block_cache_destroy(dynarec->cache);
+	free(dynarec);
+}
+
+int dynarec_run(struct dynarec* dynarec, struct cpu_state* cpu, int budget)
+{
+	// Make sure there's room for one more translation before we look the
+	// block up: flushing afterwards would take the block with it.
+	if (dynarec->used + MAX_BLOCK_CODE > DYNAREC_BUFFER_SIZE)
+	{
+		block_cache_flush(dynarec->cache);
+		write_stubs(dynarec);
+		++dynarec->stats.flushes;
+	}
+	struct block* block = block_cache_get(dynarec->cache, cpu, cpu->pc);
+	if (!block->native)
+	{
+		// Most blocks only run a handful of times before they're
+		// overwritten or flushed, and translating costs far more than
+		// decoding did.  Those are better off interpreted.
+		if (block->runs < dynarec->hot_runs)
+		{
+			++block->runs;
+			return block_cache_execute(dynarec->cache, cpu, block);
+		}
+		block->native = translate(dynarec,
+				block,
+				!memory_map_mmio_reads(cpu->memory_map));
+	}
+
+	++dynarec->stats.entries;
+	int64_t left = dynarec->enter(cpu,
+			budget,
+			dynarec->cache->blocks,
+			&dynarec->cache->generation,
+			block->native);
+	return budget - left;
+}
+
+#else // Not x86-64 Linux.
+
+struct dynarec* dynarec_create(void) { return NULL; }
+
+void dynarec_destroy(struct dynarec* dynarec) { (void) dynarec; }
+
+int dynarec_run(struct dynarec* dynarec, struct cpu_state* cpu, int budget)
+{
+	(void) dynarec;
+	(void) cpu;
+	(void) budget;
+	return 0;
+}
+
+#endif
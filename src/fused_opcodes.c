@@ -0,0 +1,166 @@
+#include "fused_opcodes.h"
+
+#include "alu_tables.h"
+#include "cpu.h"
+#include "lazy_flags.h"
+#include "opcode_helpers.h"
+
+#include <stdint.h>
+#include <stdio.h>
+
+/* The fused handlers.  See fused_opcodes.h.  Register fields are worked out
+ * by the preprocessor, as in specialized_opcodes.c.
+ */
+
+#ifdef VERBOSE
+#	define TRACE(...) fprintf(stderr, __VA_ARGS__)
+#else
+#	define TRACE(...)
+#endif
+
+uint8_t fuse_opcodes = 1;
+
+#define REG_B cpu->b
+#define REG_C cpu->c
+#define REG_D cpu->d
+#define REG_E cpu->e
+#define REG_H cpu->h
+#define REG_L cpu->l
+#define REG_A cpu->a
+
+#define HANDLER(name) \
+	static int name(const uint8_t* opcode, struct cpu_state* cpu)
+
+// DCR r; JNZ.  DCR M isn't fused: it writes to memory, so it may be
+// overwriting the JNZ.
+#define DCR_JNZ(reg)                                                       \
+	HANDLER(dcr_##reg##_jnz)                                           \
+	{                                                                  \
+		TRACE("DCR " #reg "; JNZ 0x%4.4x\n", IMM16(opcode + 1));   \
+		uint16_t entry = add_table[0][REG_##reg][0xff];            \
+		REG_##reg      = entry >> 8;                               \
+		cpu->flags     = (entry & ALU_FLAGS & ~CARRY_FLAG)         \
+			     | (cpu->flags & (~ALU_FLAGS | CARRY_FLAG));   \
+		cpu->lazy_op = LAZY_NONE;                                  \
+		if (!(cpu->flags & ZERO_FLAG))                             \
+			cpu->pc = IMM16(opcode + 1);                       \
+		return 15;                                                 \
+	}
+
+DCR_JNZ(B)
+DCR_JNZ(C)
+DCR_JNZ(D)
+DCR_JNZ(E)
+DCR_JNZ(H)
+DCR_JNZ(L)
+DCR_JNZ(A)
+
+// In the order of the DDD field, with nothing for M.
+static int (*const dcr_jnz[8])(const uint8_t*, struct cpu_state*) = {
+		dcr_B_jnz,
+		dcr_C_jnz,
+		dcr_D_jnz,
+		dcr_E_jnz,
+		dcr_H_jnz,
+		dcr_L_jnz,
+		NULL,
+		dcr_A_jnz};
+
+HANDLER(mov_a_m_inx_h)
+{
+	(void) opcode;
+	TRACE("MOV A,M; INX H\n");
+	cpu->a = read8(cpu, cpu->hl);
+	++cpu->hl;
+	return 12;
+}
+
+/* LDAX D; MOV M,A; INX H; INX D.  If the MOV overwrites either of the INXs,
+ * we have to stop after it, with the PC pointing at the INX H, just as the
+ * block cache would between separate opcodes.  The block cache sees the
+ * write to code, and stops running the block.
+ */
+HANDLER(copy_de_to_hl)
+{
+	TRACE("LDAX D; MOV M,A; INX H; INX D\n");
+	cpu->a = read8(cpu, cpu->de);
+	write8(cpu, cpu->hl, cpu->a);
+	if (opcode[2] != 0x23 || opcode[3] != 0x13)
+	{
+		cpu->pc = (opcode - cpu->memory) + 2;
+		return 14;
+	}
+	++cpu->hl;
+	++cpu->de;
+	return 24;
+}
+
+// CPI; JZ and CPI; JNZ.
+#define CPI_JCOND(cond, taken)                                              \
+	HANDLER(cpi_j##cond)                                                \
+	{                                                                   \
+		TRACE("CPI 0x%2.2x; J" #cond " 0x%4.4x\n",                  \
+				opcode[1],                                  \
+				IMM16(opcode + 2));                         \
+		cpu->flags = (uint8_t) sub_table[0][cpu->a][opcode[1]]      \
+			     | (cpu->flags & ~ALU_FLAGS);                   \
+		cpu->lazy_op = LAZY_NONE;                                   \
+		if ((cpu->a == opcode[1]) == (taken))                       \
+			cpu->pc = IMM16(opcode + 2);                        \
+		return 17;                                                  \
+	}
+
+CPI_JCOND(z, 1)
+CPI_JCOND(nz, 0)
+
+const uint8_t fused_opcode_starts[256] = {
+		[0x05] = 1,
+		[0x0d] = 1,
+		[0x15] = 1,
+		[0x1d] = 1,
+		[0x25] = 1,
+		[0x2d] = 1,
+		[0x3d] = 1,
+		[0x7e] = 1,
+		[0x1a] = 1,
+		[0xfe] = 1,
+};
+
+int match_fused_opcodes(const uint8_t* opcode,
+		uint32_t available,
+		int (**handler)(const uint8_t*, struct cpu_state*))
+{
+	switch (opcode[0])
+	{
+	case 0x05: // DCR r
+	case 0x0d:
+	case 0x15:
+	case 0x1d:
+	case 0x25:
+	case 0x2d:
+	case 0x3d:
+		if (available < 4 || opcode[1] != 0xc2) return 0;
+		*handler = dcr_jnz[GET_DESTINATION_OPERAND(opcode[0])];
+		return 2;
+	case 0x7e: // MOV A,M
+		if (available < 2 || opcode[1] != 0x23) return 0;
+		*handler = mov_a_m_inx_h;
+		return 2;
+	case 0x1a: // LDAX D
+		if (available < 4 || opcode[1] != 0x77 || opcode[2] != 0x23
+				|| opcode[3] != 0x13)
+			return 0;
+		*handler = copy_de_to_hl;
+		return 4;
+	case 0xfe: // CPI
+		if (available < 5) return 0;
+		if (opcode[2] == 0xca)
+			*handler = cpi_jz;
+		else if (opcode[2] == 0xc2)
+			*handler = cpi_jnz;
+		else
+			return 0;
+		return 2;
+	default: return 0;
+	}
+}
@@ -0,0 +1,26 @@
+#include "histogram.h"
+
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+
+void histogram_print(const struct histogram* histogram,
+		const char* title,
+		FILE* file)
+{
+	uint64_t total = 0;
+	for (int bucket = 0; bucket < HISTOGRAM_BUCKETS; ++bucket)
+		total += histogram->counts[bucket];
+	fprintf(file, "%s: %" PRIu64 " samples\n", title, total);
+	for (int bucket = 0; bucket < HISTOGRAM_BUCKETS; ++bucket)
+	{
+		const uint64_t count = histogram->counts[bucket];
+		if (!count) continue;
+		fprintf(file,
+				"\t< %14" PRIu64 "ns: %12" PRIu64
+				" (%5.1f%%)\n",
+				UINT64_C(1) << bucket,
+				count,
+				100.0 * count / total);
+	}
+}
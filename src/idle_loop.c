@@ -0,0 +1,104 @@
+#include "idle_loop.h"
+
+#include "cpu.h"
+#include "lazy_flags.h"
+#include "memory_map.h"
+#include "opcode_info.h"
+
+#include <stdint.h>
+
+/* Whether the opcode at pc may read a device (see memory_map.h), whose
+ * handler has to be called for every read: polling a status register is
+ * anything but idle.  LDA and LHLD name their address; anything reading
+ * through a register pair or the stack might be reading any page.
+ */
+static int reads_device(const struct memory_map* map,
+		const uint8_t* memory,
+		uint16_t pc)
+{
+	const uint8_t op     = memory[pc];
+	const uint8_t access = opcode_info[op].access;
+	if (!memory_map_mmio_reads(map)
+			|| (access != MEM_READ && access != MEM_POP))
+		return 0;
+	if (op != 0x3a && op != 0x2a) return 1; // LDA, LHLD
+	const uint16_t address = memory[pc + 2] << 8 | memory[pc + 1];
+	for (int i = 0; i < (op == 0x2a ? 2 : 1); ++i)
+	{
+		const unsigned page = (uint16_t) (address + i) >> PAGE_SHIFT;
+		if (map->type[page] == PAGE_MMIO && map->mmio[page].read)
+			return 1;
+	}
+	return 0;
+}
+
+/* Returns the cycles one pass of the loop from start to the jump at the given
+ * address takes, or 0 if it isn't a loop we can skip: if the jump isn't a
+ * JMP or Jcc back to start, or anything in between could change memory, do
+ * IO, read a device, go anywhere else or change the interrupt state.
+ */
+static int pass_cycles(
+		const struct cpu_state* cpu, uint16_t start, uint16_t jump)
+{
+	const uint8_t* memory = cpu->memory;
+	if (start > jump || jump > MAX_MEMORY - 3) return 0;
+	const uint8_t op = memory[jump];
+	if (op == 0xe9 // PCHL
+			|| (opcode_info[op].flow != FLOW_JUMP
+					&& opcode_info[op].flow != FLOW_BRANCH)
+			|| (memory[jump + 2] << 8 | memory[jump + 1]) != start
+			|| jump - start > IDLE_LOOP_MAX_BYTES)
+		return 0;
+	// Jumps take the same time whether they're taken or not.
+	int cycles = opcode_info[op].cycles;
+	uint16_t pc = start;
+	while (pc < jump)
+	{
+		const struct opcode_info* info = &opcode_info[memory[pc]];
+		if (info->flow != FLOW_NEXT || info->access == MEM_IO
+				|| opcode_writes_memory(memory[pc])
+				|| reads_device(cpu->memory_map, memory, pc))
+			return 0;
+		cycles += info->cycles;
+		pc += info->length;
+	}
+	// The jump has to be where the loop's opcodes actually lead.
+	return pc == jump ? cycles : 0;
+}
+
+int idle_loop_pass(struct idle_loop* loop,
+		const struct cpu_state* cpu,
+		uint16_t jump,
+		uint64_t now)
+{
+	if (jump != loop->jump || cpu->pc != loop->start)
+	{
+		loop->jump   = jump;
+		loop->start  = cpu->pc;
+		loop->cycles = pass_cycles(cpu, cpu->pc, jump);
+		// So the registers saved for the last loop don't count.
+		loop->time = now - 1;
+	}
+	if (!loop->cycles) return 0;
+	const uint16_t psw = cpu->a << 8 | lazy_flags_value(cpu);
+	if (now - loop->time == loop->cycles && loop->bc == cpu->bc
+			&& loop->de == cpu->de && loop->hl == cpu->hl
+			&& loop->sp == cpu->sp && loop->psw == psw
+			&& loop->interrupt_enable_flag
+					== cpu->interrupt_enable_flag)
+	{
+		// An interrupt handler may have rewritten the loop since we
+		// first looked, so check it again before trusting it.
+		loop->cycles = pass_cycles(cpu, cpu->pc, jump);
+		loop->time   = now;
+		return loop->cycles;
+	}
+	loop->bc		    = cpu->bc;
+	loop->de		    = cpu->de;
+	loop->hl		    = cpu->hl;
+	loop->sp		    = cpu->sp;
+	loop->psw		    = psw;
+	loop->interrupt_enable_flag = cpu->interrupt_enable_flag;
+	loop->time		    = now;
+	return 0;
+}
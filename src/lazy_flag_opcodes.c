@@ -0,0 +1,317 @@
+#include "cpu.h"
+#include "lazy_flags.h"
+#include "opcode_array.h"
+#include "opcode_decls.h"
+#include "opcode_helpers.h"
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/* Lazy counterparts of the flag-affecting opcode handlers.  See lazy_flags.h
+ * for the scheme.  Opcodes which set every ALU flag record themselves and
+ * update only the carry flag; opcodes which read the other flags bring the
+ * flag byte up to date and then hand over to the regular handler.
+ */
+
+static inline void record_lazy_op(struct cpu_state* cpu,
+		uint8_t op,
+		uint8_t left,
+		uint8_t right,
+		uint8_t carry)
+{
+	// One store rather than four.  The byte order matches the struct in
+	// cpu.h on a little-endian host, which is all we run on.
+	cpu->lazy_record = (uint32_t) carry << 24 | (uint32_t) right << 16
+			   | (uint32_t) left << 8 | op;
+}
+
+// Sets the carry flag from bit 8 of a 16-bit result.  For subtraction, a
+// borrow wraps the result around, which sets bit 8 just the same.
+static inline void set_carry(struct cpu_state* cpu, uint16_t result)
+{
+	cpu->flags = (cpu->flags & ~CARRY_FLAG) | ((result >> 8) & CARRY_FLAG);
+}
+
+static int lazy_add_adc(const uint8_t* opcode, struct cpu_state* cpu)
+{
+	assert((opcode[0] & 0b11110000) == 0b10000000);
+#ifdef VERBOSE
+	fprintf(stderr,
+			"AD%c %c\n",
+			!(opcode[0] & (1 << 3)) + 'C',
+			get_operand_name(GET_SOURCE_OPERAND(opcode[0])));
+#endif
+	uint8_t operand =
+			fetch_operand_val(GET_SOURCE_OPERAND(opcode[0]), cpu);
+	uint8_t carry	= opcode[0] & (1 << 3) && cpu->flags & CARRY_FLAG;
+	uint16_t result = cpu->a + operand + carry;
+	record_lazy_op(cpu, LAZY_ADD, cpu->a, operand, carry);
+	set_carry(cpu, result);
+	cpu->a = result;
+	// Memory operands take 7 cycles.
+	return GET_SOURCE_OPERAND(opcode[0]) == OPERAND_MEM ? 7 : 4;
+}
+
+static int lazy_adi_aci(const uint8_t* opcode, struct cpu_state* cpu)
+{
+	// ADI is 0xc6 and ACI is 0xce
+	assert((opcode[0] & 0b11110111) == 0b11000110);
+#ifdef VERBOSE
+	fprintf(stderr,
+			"A%cI 0x%2.2x\n",
+			(opcode[0] & 0b00001000 ? 'C' : 'D'),
+			opcode[1]);
+#endif
+	uint8_t carry	= opcode[0] & (1 << 3) && cpu->flags & CARRY_FLAG;
+	uint16_t result = cpu->a + opcode[1] + carry;
+	record_lazy_op(cpu, LAZY_ADD, cpu->a, opcode[1], carry);
+	set_carry(cpu, result);
+	cpu->a = result;
+	return 7;
+}
+
+static int lazy_sub_sbb(const uint8_t* opcode, struct cpu_state* cpu)
+{
+	assert((opcode[0] & 0b11110000) == 0b10010000);
+#ifdef VERBOSE
+	fprintf(stderr,
+			"S%cB %c\n",
+			(opcode[0] & 0b00001000 ? 'B' : 'U'),
+			get_operand_name(GET_SOURCE_OPERAND(opcode[0])));
+#endif
+	uint8_t operand =
+			fetch_operand_val(GET_SOURCE_OPERAND(opcode[0]), cpu);
+	uint8_t borrow	= opcode[0] & (1 << 3) && cpu->flags & CARRY_FLAG;
+	uint16_t result = cpu->a - operand - borrow;
+	record_lazy_op(cpu, LAZY_SUB, cpu->a, operand, borrow);
+	set_carry(cpu, result);
+	cpu->a = result;
+	// Memory operands take 7 cycles.
+	return GET_SOURCE_OPERAND(opcode[0]) == OPERAND_MEM ? 7 : 4;
+}
+
+static int lazy_sui_sbi(const uint8_t* opcode, struct cpu_state* cpu)
+{
+	// SUI is 0xd6 and SBI is 0xde
+	assert((opcode[0] & 0b11110111) == 0b11010110);
+#ifdef VERBOSE
+	fprintf(stderr,
+			"S%cI 0x%2.2x\n",
+			(opcode[0] & 0b00001000 ? 'B' : 'U'),
+			opcode[1]);
+#endif
+	uint8_t borrow	= opcode[0] & (1 << 3) && cpu->flags & CARRY_FLAG;
+	uint16_t result = cpu->a - opcode[1] - borrow;
+	record_lazy_op(cpu, LAZY_SUB, cpu->a, opcode[1], borrow);
+	set_carry(cpu, result);
+	cpu->a = result;
+	return 7;
+}
+
+static int lazy_inr_dcr(const uint8_t* opcode, struct cpu_state* cpu)
+{
+	// INR is 00DDD100 and DCR is 00DDD101
+	assert((opcode[0] & 0b11000110) == 0b00000100);
+#ifdef VERBOSE
+	fprintf(stderr,
+			"%s %c\n",
+			opcode[0] & 1 ? "DCR" : "INR",
+			get_operand_name(GET_DESTINATION_OPERAND(opcode[0])));
+#endif
+	const uint8_t value = fetch_operand_val(
+			GET_DESTINATION_OPERAND(opcode[0]), cpu);
+	// DCR adds 0xff, just like the regular handler does.  Neither touches
+	// the carry flag.
+	uint8_t operand = opcode[0] & 1 ? 0xff : 1;
+	record_lazy_op(cpu, LAZY_ADD, value, operand, 0);
+	if (GET_DESTINATION_OPERAND(opcode[0]) == OPERAND_MEM)
+	{
+		write8(cpu, cpu->hl, value + operand);
+		return 10;
+	}
+	*fetch_operand_ptr(GET_DESTINATION_OPERAND(opcode[0]), cpu) += operand;
+	return 5;
+}
+
+static int lazy_ana(const uint8_t* opcode, struct cpu_state* cpu)
+{
+	assert((opcode[0] & 0b11111000) == 0b10100000);
+	uint8_t source_operand = GET_SOURCE_OPERAND(opcode[0]);
+#ifdef VERBOSE
+	fprintf(stderr, "ANA %c\n", get_operand_name(source_operand));
+#endif
+	uint8_t operand	  = fetch_operand_val(source_operand, cpu);
+	uint8_t aux_carry = ((cpu->a | operand) & (1 << 3)) << 1;
+	cpu->a &= operand;
+	record_lazy_op(cpu, LAZY_LOGIC, cpu->a, aux_carry, 0);
+	cpu->flags &= ~CARRY_FLAG;
+	return source_operand == OPERAND_MEM ? 7 : 4;
+}
+
+static int lazy_ani(const uint8_t* opcode, struct cpu_state* cpu)
+{
+	assert(opcode[0] == 0xE6);
+#ifdef VERBOSE
+	fprintf(stderr, "ANI 0x%2.2x\n", opcode[1]);
+#endif
+	uint8_t aux_carry = ((cpu->a | opcode[1]) & (1 << 3)) << 1;
+	cpu->a &= opcode[1];
+	record_lazy_op(cpu, LAZY_LOGIC, cpu->a, aux_carry, 0);
+	cpu->flags &= ~CARRY_FLAG;
+	return 7;
+}
+
+static int lazy_xra(const uint8_t* opcode, struct cpu_state* cpu)
+{
+	assert((opcode[0] & 0b11111000) == 0b10101000);
+	uint8_t source_operand = GET_SOURCE_OPERAND(opcode[0]);
+#ifdef VERBOSE
+	fprintf(stderr, "XRA %c\n", get_operand_name(source_operand));
+#endif
+	cpu->a ^= fetch_operand_val(source_operand, cpu);
+	record_lazy_op(cpu, LAZY_LOGIC, cpu->a, 0, 0);
+	cpu->flags &= ~CARRY_FLAG;
+	return source_operand == OPERAND_MEM ? 7 : 4;
+}
+
+static int lazy_xri(const uint8_t* opcode, struct cpu_state* cpu)
+{
+	assert(opcode[0] == 0xEE);
+#ifdef VERBOSE
+	fprintf(stderr, "XRI 0x%2.2x\n", opcode[1]);
+#endif
+	cpu->a ^= opcode[1];
+	record_lazy_op(cpu, LAZY_LOGIC, cpu->a, 0, 0);
+	cpu->flags &= ~CARRY_FLAG;
+	return 7;
+}
+
+static int lazy_ora(const uint8_t* opcode, struct cpu_state* cpu)
+{
+	assert((opcode[0] & 0b11111000) == 0b10110000);
+	uint8_t source_operand = GET_SOURCE_OPERAND(opcode[0]);
+#ifdef VERBOSE
+	fprintf(stderr, "ORA %c\n", get_operand_name(source_operand));
+#endif
+	cpu->a |= fetch_operand_val(source_operand, cpu);
+	record_lazy_op(cpu, LAZY_LOGIC, cpu->a, 0, 0);
+	cpu->flags &= ~CARRY_FLAG;
+	return source_operand == OPERAND_MEM ? 7 : 4;
+}
+
+static int lazy_ori(const uint8_t* opcode, struct cpu_state* cpu)
+{
+	assert(opcode[0] == 0xF6);
+#ifdef VERBOSE
+	fprintf(stderr, "ORI 0x%2.2x\n", opcode[1]);
+#endif
+	cpu->a |= opcode[1];
+	record_lazy_op(cpu, LAZY_LOGIC, cpu->a, 0, 0);
+	cpu->flags &= ~CARRY_FLAG;
+	return 7;
+}
+
+static int lazy_cmp(const uint8_t* opcode, struct cpu_state* cpu)
+{
+	assert((opcode[0] & 0b11111000) == 0b10111000);
+	uint8_t source_operand = GET_SOURCE_OPERAND(opcode[0]);
+#ifdef VERBOSE
+	fprintf(stderr, "CMP %c\n", get_operand_name(source_operand));
+#endif
+	uint8_t operand = fetch_operand_val(source_operand, cpu);
+	record_lazy_op(cpu, LAZY_SUB, cpu->a, operand, 0);
+	set_carry(cpu, cpu->a - operand);
+	return source_operand == OPERAND_MEM ? 7 : 4;
+}
+
+static int lazy_cpi(const uint8_t* opcode, struct cpu_state* cpu)
+{
+	assert(opcode[0] == 0xfe);
+#ifdef VERBOSE
+	fprintf(stderr, "CPI 0x%2.2x\n", opcode[1]);
+#endif
+	record_lazy_op(cpu, LAZY_SUB, cpu->a, opcode[1], 0);
+	set_carry(cpu, cpu->a - opcode[1]);
+	return 7;
+}
+
+// Everything else that reads the flags gets them brought up to date first,
+// and is then run as normal.  Opcodes which only touch the carry flag (the
+// rotates, DAD, STC, CMC) don't need to, since it's always current.
+#define MATERIALIZING_HANDLER(name)                                  \
+	static int lazy_##name(                                      \
+			const uint8_t* opcode, struct cpu_state* cpu) \
+	{                                                            \
+		materialize_flags(cpu);                              \
+		return name(opcode, cpu);                            \
+	}
+
+MATERIALIZING_HANDLER(daa)
+// Only installed for PUSH PSW; the other pairs don't need it.
+MATERIALIZING_HANDLER(push)
+
+// The conditional opcodes only need the flags brought up to date if they test
+// something other than the carry flag.
+#define CONDITIONAL_HANDLER(name)                                    \
+	static int lazy_##name(                                      \
+			const uint8_t* opcode, struct cpu_state* cpu) \
+	{                                                            \
+		if ((GET_CONDITION(opcode[0]) & 0b110)               \
+				!= CONDITION_NO_CARRY)               \
+			materialize_flags(cpu);                      \
+		return name(opcode, cpu);                            \
+	}
+
+CONDITIONAL_HANDLER(jcond)
+CONDITIONAL_HANDLER(ccond)
+CONDITIONAL_HANDLER(retcond)
+
+// POP PSW replaces the whole flag byte, so whatever was pending is moot.
+static int lazy_pop_psw(const uint8_t* opcode, struct cpu_state* cpu)
+{
+	cpu->lazy_op = LAZY_NONE;
+	return pop(opcode, cpu);
+}
+
+void install_lazy_flag_opcodes(
+		int (*table[256])(const uint8_t*, struct cpu_state*))
+{
+	static const struct
+	{
+		int (*eager)(const uint8_t*, struct cpu_state*);
+		int (*lazy)(const uint8_t*, struct cpu_state*);
+	} replacements[] = {
+			{add_adc, lazy_add_adc},
+			{adi, lazy_adi_aci},
+			{aci, lazy_adi_aci},
+			{sub_sbb, lazy_sub_sbb},
+			{sui_sbi, lazy_sui_sbi},
+			{inr, lazy_inr_dcr},
+			{dcr, lazy_inr_dcr},
+			{ana, lazy_ana},
+			{ani, lazy_ani},
+			{xra, lazy_xra},
+			{xri, lazy_xri},
+			{ora, lazy_ora},
+			{ori, lazy_ori},
+			{cmp, lazy_cmp},
+			{cpi, lazy_cpi},
+			{jcond, lazy_jcond},
+			{ccond, lazy_ccond},
+			{retcond, lazy_retcond},
+			{daa, lazy_daa},
+	};
+
+	const unsigned count = sizeof(replacements) / sizeof(*replacements);
+	for (int op = 0; op < 256; ++op)
+		for (unsigned i = 0; i < count; ++i)
+			if (generic_opcodes[op] == replacements[i].eager)
+			{
+				table[op] = replacements[i].lazy;
+				break;
+			}
+
+	table[0xf5] = lazy_push;
+	table[0xf1] = lazy_pop_psw;
+}
@@ -19,24 +19,14 @@ int ana(const uint8_t* opcode, struct cpu_state* cpu)
 #endif
 
 	uint8_t operand = fetch_operand_val(source_operand, cpu);
-	// The Aux Carry flag is set by this operation if either operand has a
-	// high-set bit 3. This must be done before assigning cpu->a.
-	cpu->flags = ((1 << 3) & (cpu->a | operand)
-					? cpu->flags | AUX_CARRY_FLAG
-					: cpu->flags & ~AUX_CARRY_FLAG);
-
-	cpu->a &= operand;
-
 	/* ANA affects the carry, aux carry, zero, sign, and parity
-	 * flags depending on the result. The carry flag is always reset. the
-	 * Aux carry flag was already taken care of before overwriting the
-	 * contents of cpu->a.
+	 * flags depending on the result. The carry flag is always reset.
+	 * The Aux Carry flag is set by this operation if either operand has a
+	 * high-set bit 3, so it must be worked out before assigning cpu->a.
 	 */
-	APPLY_ZERO_FLAG(cpu->a, cpu->flags);
-	APPLY_SIGN_FLAG(cpu->a, cpu->flags);
-	APPLY_PARITY_FLAG(cpu->a, cpu->flags);
-	// unconditionally reset the CARRY flags
-	cpu->flags &= ~CARRY_FLAG;
+	uint8_t aux_carry = ((cpu->a | operand) & (1 << 3)) << 1;
+	cpu->a &= operand;
+	cpu->flags = zsp_table[cpu->a] | aux_carry | (cpu->flags & ~ALU_FLAGS);
 
 	// Performing this operation using OPERAND MEM requires 7 cycles, and
 	// it takes 4 cycles when using register operands.
@@ -56,18 +46,12 @@ int ani(const uint8_t* opcode, struct cpu_state* cpu)
 #endif
 
 	uint8_t operand = opcode[1];
-	cpu->flags	= ((1 << 3) & (cpu->a | operand)
-					     ? cpu->flags | AUX_CARRY_FLAG
-					     : cpu->flags & ~AUX_CARRY_FLAG);
+	// See ana() for the aux carry.
+	uint8_t aux_carry = ((cpu->a | operand) & (1 << 3)) << 1;
 
 	// AND immediate
 	cpu->a &= operand;
-
-	APPLY_ZERO_FLAG(cpu->a, cpu->flags);
-	APPLY_SIGN_FLAG(cpu->a, cpu->flags);
-	APPLY_PARITY_FLAG(cpu->a, cpu->flags);
-	// Clear CY and AC flags
-	cpu->flags &= ~CARRY_FLAG;
+	cpu->flags = zsp_table[cpu->a] | aux_carry | (cpu->flags & ~ALU_FLAGS);
 
 	return 7;
 }
@@ -84,11 +68,8 @@ int xra(const uint8_t* opcode, struct cpu_state* cpu)
 
 	cpu->a ^= fetch_operand_val(source_operand, cpu);
 
-	APPLY_ZERO_FLAG(cpu->a, cpu->flags);
-	APPLY_SIGN_FLAG(cpu->a, cpu->flags);
-	APPLY_PARITY_FLAG(cpu->a, cpu->flags);
-	// Clear CY and AC flags
-	cpu->flags &= (~CARRY_FLAG & ~AUX_CARRY_FLAG);
+	// Set Z, S and P from the result, and clear CY and AC flags
+	cpu->flags = zsp_table[cpu->a] | (cpu->flags & ~ALU_FLAGS);
 
 	// If XOR memory, wait 7 cycles. If XOR register, wait 4 cycles
 	return get_operand_name(source_operand) == 'M' ? 7 : 4;
@@ -106,11 +87,8 @@ int xri(const uint8_t* opcode, struct cpu_state* cpu)
 	// Exclusive OR immediate
 	cpu->a ^= opcode[1];
 
-	APPLY_ZERO_FLAG(cpu->a, cpu->flags);
-	APPLY_SIGN_FLAG(cpu->a, cpu->flags);
-	APPLY_PARITY_FLAG(cpu->a, cpu->flags);
-	// Clear CY and AC flags
-	cpu->flags &= (~CARRY_FLAG & ~AUX_CARRY_FLAG);
+	// Set Z, S and P from the result, and clear CY and AC flags
+	cpu->flags = zsp_table[cpu->a] | (cpu->flags & ~ALU_FLAGS);
 
 	return 7;
 }
@@ -132,11 +110,7 @@ int ora(const uint8_t* opcode, struct cpu_state* cpu)
 	/* ORA affects the carry, zero, sign and parity flags depending on the
 	 * result. The carry and aux carry flags are always reset.
 	 */
-	APPLY_ZERO_FLAG(cpu->a, cpu->flags);
-	APPLY_SIGN_FLAG(cpu->a, cpu->flags);
-	APPLY_PARITY_FLAG(cpu->a, cpu->flags);
-	// unconditionally reset the CARRY and AUX CARRY flags
-	cpu->flags &= (~CARRY_FLAG & ~AUX_CARRY_FLAG);
+	cpu->flags = zsp_table[cpu->a] | (cpu->flags & ~ALU_FLAGS);
 
 	// getting an operand from memory takes 7 cycles, using register
 	// operands takes 4 cycles and all are 1-byte instructions
@@ -163,10 +137,7 @@ int ori(const uint8_t* opcode, struct cpu_state* cpu)
 	 * result of the operation. The Carry and Aux Carry flags are
 	 * reset unconditionally
 	 */
-	APPLY_ZERO_FLAG(cpu->a, cpu->flags);
-	APPLY_SIGN_FLAG(cpu->a, cpu->flags);
-	APPLY_PARITY_FLAG(cpu->a, cpu->flags);
-	cpu->flags &= (~CARRY_FLAG & ~AUX_CARRY_FLAG);
+	cpu->flags = zsp_table[cpu->a] | (cpu->flags & ~ALU_FLAGS);
 
 	// ORI always takes 7 cycles and advances the PC by 2
 	return 7;
@@ -176,7 +147,7 @@ int cmp(const uint8_t* opcode, struct cpu_state* cpu)
 {
 	// CMP is 0xB8 - 0xBF, or 0b10111SSS
 	assert((opcode[0] & 0b11111000) == 0b10111000);
-	uint16_t operand =
+	uint8_t operand =
 			fetch_operand_val(GET_SOURCE_OPERAND(opcode[0]), cpu);
 
 #ifdef VERBOSE
@@ -189,10 +160,9 @@ int cmp(const uint8_t* opcode, struct cpu_state* cpu)
 	// Subtract content of register or memory location from the accumulator
 	// The accumulator remains UNCHANGED.
 	// The condition flags are set as a result of the subtraction
-	// Subtraction - take two's complement and then add
-	operand		= (uint8_t) ~operand;
-	uint16_t result = _add(cpu->a, operand, 1, &cpu->flags);
-	APPLY_CARRY_FLAG_INVERTED(result, cpu->flags);
+	// We look up the subtraction and keep only the flags half of it.
+	cpu->flags = (uint8_t) sub_table[0][cpu->a][operand]
+			| (cpu->flags & ~ALU_FLAGS);
 
 	// If CMP memory, wait 7 cycles. If CMP register, wait 4 cycles
 	return get_operand_name(GET_SOURCE_OPERAND(opcode[0])) == 'M' ? 7 : 4;
@@ -214,13 +184,9 @@ int cpi(const uint8_t* opcode, struct cpu_state* cpu)
 	 * of the flags are set normally based upon the result.
 	 */
 
-	// get one's complement of the operand
-	uint16_t operand = opcode[1];
-	operand		 = (uint8_t) ~operand;
-
 	// get the result and set the flags, and then discard the result
-	uint16_t result = _add(cpu->a, operand, 1, &cpu->flags);
-	APPLY_CARRY_FLAG_INVERTED(result, cpu->flags);
+	cpu->flags = (uint8_t) sub_table[0][cpu->a][opcode[1]]
+			| (cpu->flags & ~ALU_FLAGS);
 
 	return 7;
 }
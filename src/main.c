@@ -1,12 +1,22 @@
 #include "cpu.h"
+#include "cycle_timer.h"
+#include "dynarec.h"
+#include "fused_opcodes.h"
 #include "hw_func_pointers.h"
+#include "interrupts.h"
+#include "lazy_flags.h"
+#include "memory_map.h"
+#include "metrics.h"
 #include "opcode_array.h"
 #include "opcode_decls.h"
+#include "recompiled.h"
+#include "scheduler.h"
 
 #include <dlfcn.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <getopt.h>
+#include <inttypes.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -14,33 +24,85 @@
 #include <sys/stat.h>
 #include <unistd.h>
 
-static inline void parse_arguments(
-		int argc, char** argv, char* rom_name, char* hw_lib_name);
+static inline void parse_arguments(int argc,
+		char** argv,
+		const char** rom_name,
+		char** hw_lib_name,
+		void* (**cpu_routine)(void*),
+		uint8_t* lazy_flags,
+		uint8_t* fusion,
+		int* throttled,
+		long* cycle_time,
+		int* rate,
+		int* cycle_chunk,
+		uint64_t* bench_interval,
+		const char** metrics_file,
+		const char** metrics_socket,
+		long* metrics_interval,
+		uint32_t* store_size);
 
-static inline void find_hw_funcs(void* hw_lib_handle, char* hw_lib_name);
+static inline void find_hw_funcs(
+		void* hw_lib_handle, const char* hw_lib_name);
 
 static inline void read_rom_mask(
-		char* rom_name, uint8_t* mask_shift, uint8_t** rom_mask);
+		const char* rom_name, struct memory_map* map);
 
 int main(int argc, char** argv)
 {
 	void* hw_lib_handle;
 	(void) hw_lib_handle;
-	char hw_lib_name[20] = {0};
-	char rom_name[50]    = {0};
+	char* hw_lib_name    = NULL; // Allocated by parse_arguments.
+	const char* rom_name = NULL;
+	void* (*cpu_routine)(void*) = cpu_thread_routine;
+	uint8_t lazy_flags	    = 0;
+#ifdef UNTHROTTLED
+	int throttled = 0;
+#else
+	int throttled = 1;
+#endif
+	long cycle_time = CYCLE_TIME;
+	int rate	= RATE_NORMAL;
+	int cycle_chunk = CYCLE_CHUNK;
+#ifdef BENCHMARK
+	uint64_t bench_interval = BENCH_INTERVAL;
+#else
+	uint64_t bench_interval = 0;
+#endif
+	const char* metrics_file   = NULL;
+	const char* metrics_socket = NULL;
+	long metrics_interval	   = METRICS_INTERVAL;
+	// The physical store's size: by default, whatever the ROM needs.
+	uint32_t store_size = 0;
 	/* Arbitrary block to keep the stack clean-ish.
 	 * Parse the command-line options.
 	 */
 
-	parse_arguments(argc, argv, rom_name, hw_lib_name);
-
-	// Allocate the memory space for the CPU.
-	uint8_t* memory_space = malloc(MAX_MEMORY);
-	if (!memory_space)
-	{
-		perror("Malloc error creating memory for 8080");
-		exit(1);
-	}
+	parse_arguments(argc,
+			argv,
+			&rom_name,
+			&hw_lib_name,
+			&cpu_routine,
+			&lazy_flags,
+			&fuse_opcodes,
+			&throttled,
+			&cycle_time,
+			&rate,
+			&cycle_chunk,
+			&bench_interval,
+			&metrics_file,
+			&metrics_socket,
+			&metrics_interval,
+			&store_size);
+	struct metrics metrics;
+	metrics_init(&metrics);
+	struct cycle_timer timer;
+	cycle_timer_init(&timer,
+			throttled,
+			cycle_time,
+			cycle_chunk,
+			bench_interval);
+	cycle_timer_set_rate(&timer, rate);
+	cycle_timer_add_metrics(&timer, &metrics);
 
 	// Open the file argument.
 	int file = open(rom_name, O_RDONLY);
@@ -50,6 +112,16 @@ int main(int argc, char** argv)
 		exit(1);
 	}
 
+	/* Load the ROM into the CPU's memory space, which starts off as all
+	 * RAM: mapped straight from the file, or with --memory (or a ROM)
+	 * bigger than 64 KB, read into a physical store whose banks the
+	 * hardware can switch in.  See memory_map.h.
+	 */
+	struct memory_map memory_map;
+	uint8_t* memory_space = memory_map_load(&memory_map, file, store_size);
+	if (!memory_space) exit(1);
+	close(file);
+
 	hw_lib_handle = dlopen(hw_lib_name, RTLD_NOW);
 	// dlopen returns NULL on failure.
 	if (!hw_lib_handle)
@@ -61,56 +133,62 @@ int main(int argc, char** argv)
 	}
 
 	find_hw_funcs(hw_lib_handle, hw_lib_name);
+	if (lazy_flags) install_lazy_flag_opcodes(opcodes);
 
-	// Block to avoid these temporary variables taking up stack space.
-	// We'll then read the file into the memory buffer, and then close it.
+	// The ROM's mask, if it has one, marks the ROM; the hardware library
+	// can map devices in as well.
+	read_rom_mask(rom_name, &memory_map);
 
+	// The recompiled ROMs are translated from the first 64 KB alone.
+	if (cpu_routine == native_cpu_thread_routine
+			&& memory_map.store_size > MAX_MEMORY)
 	{
-		ssize_t last_read;
-		uint8_t* buffer	       = memory_space;
-		size_t remaining_space = MAX_MEMORY;
-
-		do
+		fprintf(stderr,
+				"The native core can't run banked memory; "
+				"using the block core instead.\n");
+		cpu_routine = block_cpu_thread_routine;
+	}
+	if (cpu_routine == native_cpu_thread_routine)
+	{
+		native_rom = recompiled_load(rom_name,
+				memory_space,
+				memory_map.type,
+				PAGE_SHIFT);
+		if (!native_rom)
 		{
-			last_read = read(file, buffer, remaining_space);
-			if (last_read == -1)
-			{
-				if (errno == EINTR) continue;
-				perror("Error reading input file");
-				exit(1);
-			}
-			buffer += last_read;
-			remaining_space -= last_read;
-		} while (remaining_space && last_read);
-		close(file);
+			fprintf(stderr, "Using the block core instead.\n");
+			cpu_routine = block_cpu_thread_routine;
+		}
 	}
 
-	uint8_t mask_shift;
-	uint8_t* rom_mask;
-
-	read_rom_mask(rom_name, &mask_shift, &rom_mask);
+	struct interrupt_controller interrupts;
+	interrupt_controller_init(&interrupts);
+	uint8_t control = 0;
+	struct scheduler scheduler;
+	scheduler_init(&scheduler);
 
-	pthread_cond_t interrupt_condition;
-	pthread_cond_init(&interrupt_condition, NULL);
-	pthread_mutex_t interrupt_lock;
-	pthread_mutex_init(&interrupt_lock, NULL);
-	pthread_mutex_t reset_quit_lock;
-	pthread_mutex_init(&reset_quit_lock, NULL);
-	uint8_t reset_flag	 = 0;
-	uint8_t quit_flag	 = 0;
-	uint8_t interrupt_buffer = 0;
-
-	struct system_resources res = {.interrupt_cond = &interrupt_condition,
-			.interrupt_lock		       = &interrupt_lock,
-			.reset_quit_lock	       = &reset_quit_lock,
-			.memory			       = memory_space,
-			.interrupt_buffer	       = &interrupt_buffer,
-			.reset_flag		       = &reset_flag,
-			.quit_flag		       = &quit_flag,
-			.rom_mask		       = rom_mask,
-			.mask_shift		       = mask_shift};
+	struct system_resources res = {.interrupts = &interrupts,
+			.control		   = &control,
+			.memory			   = memory_space,
+			.rom_mask		   = memory_map.type,
+			.mask_shift		   = PAGE_SHIFT,
+			.scheduler		   = &scheduler,
+			.timer			   = &timer,
+			.metrics		   = &metrics,
+			.memory_map		   = &memory_map};
 
 	res.hw_struct = hw_init_struct(&res);
+
+	// The metrics are only exported if there's somewhere to send them.
+	struct metrics_exporter* exporter = NULL;
+	if (metrics_file || metrics_socket)
+	{
+		exporter = metrics_export_start(&metrics,
+				metrics_file,
+				metrics_socket,
+				metrics_interval);
+		if (!exporter) exit(1);
+	}
 	pthread_t front_end_thread;
 
 	// We check to see if the hardware library defines a front_end function:
@@ -126,22 +204,36 @@ int main(int argc, char** argv)
 	}
 
 	// Run the CPU routine in this thread.
-	cpu_thread_routine(&res);
+	cpu_routine(&res);
+	metrics_export_stop(exporter);
 
 	// If we have a front_end, then we'll cancel and join it after
 	// the cpu routine routines.
 	if (front_end) { pthread_join(front_end_thread, NULL); }
 	// Cleanup.
-	free(memory_space);
-	free(rom_mask);
+	memory_map_destroy(&memory_map);
 	hw_destroy_struct(res.hw_struct);
+	interrupt_controller_destroy(&interrupts);
 	dlclose(hw_lib_handle);
+	free(hw_lib_name);
 	exit(0);
 }
 
 const char* const USAGE = "Usage: %s\n"
 			  "\t{-r ROM_FILE|--rom ROM_FILE}\n"
 			  "\t [--hw HARDWARE_NAME|--hardware HARDWARE_NAME]\n"
+			  "\t [--core CORE]\n"
+			  "\t [--flags eager|lazy]\n"
+			  "\t [--fusion on|off]\n"
+			  "\t [--perf-map]\n"
+			  "\t [--speed MHZ|max]\n"
+			  "\t [--rate FACTOR]\n"
+			  "\t [--memory KB]\n"
+			  "\t [--chunk CYCLES]\n"
+			  "\t [--bench-interval CYCLES]\n"
+			  "\t [--metrics FILE]\n"
+			  "\t [--metrics-socket PATH]\n"
+			  "\t [--metrics-interval MS]\n"
 			  "\t[-h|--help]\n\n"
 			  "Options:\n"
 			  "\t-r, --rom\n"
@@ -155,18 +247,180 @@ const char* const USAGE = "Usage: %s\n"
 			  " 'basic',"
 			  " 'cpudiag'.\n"
 			  "\t\tDefaults to 'none' if not specified.\n"
+			  "\t--core\n"
+			  "\t\tThe interpreter core to run the ROM on.\n"
+			  "\t\tAvailable options are:"
+			  " 'switch',"
+			  " 'threaded',"
+			  " 'block',"
+			  " 'dynarec',"
+			  " 'native'.\n"
+			  "\t\tDefaults to 'switch' if not specified.\n"
+			  "\t--flags\n"
+			  "\t\tWhen to work out the condition flags: 'eager'"
+			  " (after\n"
+			  "\t\tevery ALU opcode) or 'lazy' (only when something"
+			  " reads\n"
+			  "\t\tthem).  Defaults to 'eager'.\n"
+			  "\t--fusion\n"
+			  "\t\tWhether the block and native cores run common"
+			  " opcode\n"
+			  "\t\tsequences as single superinstructions: 'on'"
+			  " or 'off'.\n"
+			  "\t\tDefaults to 'on'.\n"
+			  "\t--perf-map\n"
+			  "\t\tHave the dynarec core list its translations in"
+			  "\n"
+			  "\t\t/tmp/perf-<pid>.map, for perf.\n"
+			  "\t--speed\n"
+			  "\t\tThe emulated clock speed in MHz, or 'max' to run"
+			  " as\n"
+			  "\t\tfast as possible.  Defaults to 2.  Tab toggles"
+			  " turbo\n"
+			  "\t\t(full speed) in the Taito hardware sets.\n"
+			  "\t--rate\n"
+			  "\t\tFast-forward or slow motion: run at FACTOR times"
+			  " the\n"
+			  "\t\tspeed, from 0.25 to 16.  Defaults to 1.  The"
+			  " Taito\n"
+			  "\t\thardware sets change it with '-', '=' and"
+			  " Backspace.\n"
+			  "\t--memory\n"
+			  "\t\tThe size of physical memory in KB, from 64 to"
+			  " 65536,\n"
+			  "\t\tfor hardware which switches banks of it into the"
+			  "\n"
+			  "\t\taddress space.  Defaults to the size of the ROM"
+			  " file,\n"
+			  "\t\tor 64 if that's smaller.  A bigger ROM file is"
+			  " loaded\n"
+			  "\t\tinto the banks.\n"
+			  "\t--chunk\n"
+			  "\t\tHow many cycles to run between checks of the"
+			  " clock\n"
+			  "\t\tand of reset and quit requests.  Defaults to"
+			  " 512.\n"
+			  "\t--bench-interval\n"
+			  "\t\tPrint the effective speed every CYCLES cycles,"
+			  " or\n"
+			  "\t\tnever if 0.  Defaults to 0, unless built with\n"
+			  "\t\tBENCHMARKING.\n"
+			  "\t--metrics\n"
+			  "\t\tAppend the runtime metrics to FILE as a line"
+			  " of\n"
+			  "\t\tJSON every interval.\n"
+			  "\t--metrics-socket\n"
+			  "\t\tServe the runtime metrics, in Prometheus' text"
+			  "\n"
+			  "\t\tformat, on a Unix-domain socket at PATH.\n"
+			  "\t--metrics-interval\n"
+			  "\t\tHow often to sample the metrics, in"
+			  " milliseconds.\n"
+			  "\t\tDefaults to 1000.\n"
 			  "\t-h, --help\n"
 			  "\t\tPrint this message.\n";
 
-void parse_arguments(int argc, char** argv, char* rom_name, char* hw_lib_name)
+/* A cycle count for --chunk or --bench-interval: a whole number from min to
+ * max, or we print the usage and exit.
+ */
+static uint64_t parse_cycles(
+		const char* arg, uint64_t min, uint64_t max, char** argv)
+{
+	char* end;
+	errno = 0;
+	const unsigned long long cycles = strtoull(arg, &end, 0);
+	if (!*arg || *end || errno || *arg == '-' || cycles < min
+			|| cycles > max)
+	{
+		fprintf(stderr,
+				"Bad cycle count '%s': expected %" PRIu64
+				" to %" PRIu64 ".\n",
+				arg,
+				min,
+				max);
+		fprintf(stderr, USAGE, *argv);
+		exit(1);
+	}
+	return cycles;
+}
+
+/* A size for --memory, in KB: a whole number from 64 up to MAX_STORE, or we
+ * print the usage and exit.
+ */
+static uint32_t parse_kilobytes(const char* arg, char** argv)
+{
+	char* end;
+	errno = 0;
+	const unsigned long kilobytes = strtoul(arg, &end, 0);
+	if (!*arg || *end || errno || *arg == '-'
+			|| kilobytes < MAX_MEMORY >> 10
+			|| kilobytes > MAX_STORE >> 10)
+	{
+		fprintf(stderr,
+				"Bad memory size '%s': expected %d to %d KB.\n",
+				arg,
+				MAX_MEMORY >> 10,
+				MAX_STORE >> 10);
+		fprintf(stderr, USAGE, *argv);
+		exit(1);
+	}
+	return kilobytes << 10;
+}
+
+/* The path of the hardware library called name, in memory from malloc(), or
+ * we exit.
+ */
+static char* hw_lib_path(const char* name)
+{
+	const size_t size = strlen(name) + sizeof("hw/lib.so");
+	char* path	  = malloc(size);
+	if (!path)
+	{
+		perror("Malloc error naming the hardware library");
+		exit(1);
+	}
+	snprintf(path, size, "hw/lib%s.so", name);
+	return path;
+}
+
+void parse_arguments(int argc,
+		char** argv,
+		const char** rom_name,
+		char** hw_lib_name,
+		void* (**cpu_routine)(void*),
+		uint8_t* lazy_flags,
+		uint8_t* fusion,
+		int* throttled,
+		long* cycle_time,
+		int* rate,
+		int* cycle_chunk,
+		uint64_t* bench_interval,
+		const char** metrics_file,
+		const char** metrics_socket,
+		long* metrics_interval,
+		uint32_t* store_size)
 {
-	char rom_found		   = 0;
-	char hw_found		   = 0;
-	int opt_return		   = 0;
-	int option_index	   = 0;
-	struct option long_opts[5] = {{"rom", required_argument, 0, 'r'},
+	double mhz, factor;
+	char* end;
+	char rom_found		    = 0;
+	char hw_found		    = 0;
+	int opt_return		    = 0;
+	int option_index	    = 0;
+	struct option long_opts[17] = {{"rom", required_argument, 0, 'r'},
 			{"hardware", required_argument, 0, 'H'},
 			{"hw", required_argument, 0, 'H'},
+			{"core", required_argument, 0, 'c'},
+			{"flags", required_argument, 0, 'f'},
+			{"fusion", required_argument, 0, 'u'},
+			{"perf-map", no_argument, 0, 'p'},
+			{"speed", required_argument, 0, 's'},
+			{"rate", required_argument, 0, 'x'},
+			{"memory", required_argument, 0, 'e'},
+			{"chunk", required_argument, 0, 'k'},
+			{"bench-interval", required_argument, 0, 'b'},
+			{"metrics", required_argument, 0, 'm'},
+			{"metrics-socket", required_argument, 0, 'M'},
+			{"metrics-interval", required_argument, 0, 'i'},
 			{"help", no_argument, 0, 'h'},
 			{0}};
 	while ((opt_return = getopt_long(
@@ -184,9 +438,8 @@ void parse_arguments(int argc, char** argv, char* rom_name, char* hw_lib_name)
 				fprintf(stderr, USAGE, *argv);
 				exit(1);
 			}
-			rom_found   = 1;
-			rom_name[0] = 0;
-			strncpy(rom_name, optarg, 49);
+			rom_found = 1;
+			*rom_name = optarg;
 			break;
 		case 'h': printf(USAGE, *argv); exit(0);
 		case 'H':
@@ -198,11 +451,118 @@ void parse_arguments(int argc, char** argv, char* rom_name, char* hw_lib_name)
 				fprintf(stderr, USAGE, *argv);
 				exit(1);
 			}
-			hw_found       = 1;
-			hw_lib_name[0] = 0;
-			strcpy(hw_lib_name, "hw/lib");
-			strncat(hw_lib_name, optarg, 10);
-			strcat(hw_lib_name, ".so");
+			hw_found     = 1;
+			*hw_lib_name = hw_lib_path(optarg);
+			break;
+		case 'c':
+			if (!strcmp(optarg, "switch"))
+				*cpu_routine = cpu_thread_routine;
+			else if (!strcmp(optarg, "threaded"))
+				*cpu_routine = threaded_cpu_thread_routine;
+			else if (!strcmp(optarg, "block"))
+				*cpu_routine = block_cpu_thread_routine;
+			else if (!strcmp(optarg, "dynarec"))
+				*cpu_routine = dynarec_cpu_thread_routine;
+			else if (!strcmp(optarg, "native"))
+				*cpu_routine = native_cpu_thread_routine;
+			else
+			{
+				fprintf(stderr, "Unknown core '%s'.\n", optarg);
+				fprintf(stderr, USAGE, *argv);
+				exit(1);
+			}
+			break;
+		case 'f':
+			if (!strcmp(optarg, "eager"))
+				*lazy_flags = 0;
+			else if (!strcmp(optarg, "lazy"))
+				*lazy_flags = 1;
+			else
+			{
+				fprintf(stderr,
+						"Unknown flag mode '%s'.\n",
+						optarg);
+				fprintf(stderr, USAGE, *argv);
+				exit(1);
+			}
+			break;
+		case 'u':
+			if (!strcmp(optarg, "on"))
+				*fusion = 1;
+			else if (!strcmp(optarg, "off"))
+				*fusion = 0;
+			else
+			{
+				fprintf(stderr,
+						"Unknown fusion setting "
+						"'%s'.\n",
+						optarg);
+				fprintf(stderr, USAGE, *argv);
+				exit(1);
+			}
+			break;
+		case 'p': dynarec_perf_map = 1; break;
+		case 's':
+			if (!strcmp(optarg, "max"))
+			{
+				*throttled = 0;
+				break;
+			}
+			// A cycle is a whole number of nanoseconds, so 1GHz is
+			// as fast as a throttled CPU can go.
+			mhz = strtod(optarg, &end);
+			if (*end || !(mhz > 0) || mhz > 1000)
+			{
+				fprintf(stderr,
+						"Bad speed '%s': expected MHz"
+						" (up to 1000) or 'max'.\n",
+						optarg);
+				fprintf(stderr, USAGE, *argv);
+				exit(1);
+			}
+			*throttled  = 1;
+			*cycle_time = (long) (1000.0 / mhz + 0.5);
+			break;
+		case 'x':
+			factor = strtod(optarg, &end);
+			if (*end || !(factor * RATE_NORMAL >= RATE_MIN)
+					|| factor * RATE_NORMAL > RATE_MAX)
+			{
+				fprintf(stderr,
+						"Bad rate '%s': expected 0.25"
+						" to 16.\n",
+						optarg);
+				fprintf(stderr, USAGE, *argv);
+				exit(1);
+			}
+			*rate = (int) (factor * RATE_NORMAL + 0.5);
+			break;
+		case 'e':
+			*store_size = parse_kilobytes(optarg, argv);
+			break;
+		case 'k':
+			*cycle_chunk = parse_cycles(optarg, 1, 1 << 24, argv);
+			break;
+		case 'b':
+			*bench_interval = parse_cycles(
+					optarg, 0, UINT64_C(1) << 62, argv);
+			break;
+		case 'm': *metrics_file = optarg; break;
+		case 'M': *metrics_socket = optarg; break;
+		case 'i':
+			errno		  = 0;
+			*metrics_interval = strtol(optarg, &end, 0);
+			if (!*optarg || *end || errno || *metrics_interval < 1
+					|| *metrics_interval > 3600000)
+			{
+				fprintf(stderr,
+						"Bad metrics interval '%s':"
+						" expected 1 to 3600000"
+						" milliseconds.\n",
+						optarg);
+				fprintf(stderr, USAGE, *argv);
+				exit(1);
+			}
 			break;
 		case '?': // FALLTHRU
 		default: fprintf(stderr, USAGE, *argv); exit(1);
@@ -214,14 +574,10 @@ void parse_arguments(int argc, char** argv, char* rom_name, char* hw_lib_name)
 		fprintf(stderr, USAGE, *argv);
 		exit(1);
 	}
-	if (!hw_found)
-	{
-		hw_lib_name[0] = 0;
-		strcpy(hw_lib_name, "hw/libnone.so");
-	}
+	if (!hw_found) *hw_lib_name = hw_lib_path("none");
 }
 
-void find_hw_funcs(void* hw_lib_handle, char* hw_lib_name)
+void find_hw_funcs(void* hw_lib_handle, const char* hw_lib_name)
 {
 	// Assign the OUT opcode function defined in the HW lib.
 	opcodes[0xd3] = dlsym(hw_lib_handle, "hw_out");
@@ -289,11 +645,20 @@ void find_hw_funcs(void* hw_lib_handle, char* hw_lib_name)
 	front_end = dlsym(hw_lib_handle, "front_end");
 }
 
-void read_rom_mask(char* rom_name, uint8_t* mask_shift, uint8_t** rom_mask)
+/* A .mask file is a shift, and then a byte for each 1 << shift bytes of
+ * memory, nonzero for ROM.  The shift can't be less than PAGE_SHIFT, since
+ * the memory map can't mark anything smaller than a page.
+ */
+void read_rom_mask(const char* rom_name, struct memory_map* map)
 {
-	char mask_file_name[55] = {0};
-	strncpy(mask_file_name, rom_name, 50);
-	strcat(mask_file_name, ".mask");
+	const size_t size    = strlen(rom_name) + sizeof(".mask");
+	char* mask_file_name = malloc(size);
+	if (!mask_file_name)
+	{
+		perror("Malloc error naming the mask file");
+		exit(1);
+	}
+	snprintf(mask_file_name, size, "%s.mask", rom_name);
 	int fd = open(mask_file_name, O_RDONLY);
 	if (fd == -1)
 	{
@@ -302,27 +667,34 @@ void read_rom_mask(char* rom_name, uint8_t* mask_shift, uint8_t** rom_mask)
 		       " will be vulnerable to corruption"
 		       " by ROM");
 #endif
-		*mask_shift = 16;
-		*rom_mask   = malloc(1);
-		**rom_mask  = 0;
+		free(mask_file_name);
 		return;
 	}
 	ssize_t last_read;
 	size_t remaining_space;
-	if (!read(fd, mask_shift, 1))
+	uint8_t mask_shift;
+	uint8_t mask[PAGES] = {0};
+	if (!read(fd, &mask_shift, 1))
 	{
 		perror("Error reading mask file");
 		exit(1);
 	}
-	else if (*mask_shift > 15)
+	else if (mask_shift > 15)
 	{
 		fprintf(stderr, "Invalid mask file!");
 		exit(1);
 	}
-	*rom_mask = malloc(MAX_MEMORY >> *mask_shift);
-	memset(*rom_mask, 0, MAX_MEMORY >> *mask_shift);
-	remaining_space = MAX_MEMORY >> *mask_shift;
-	uint8_t* buffer = *rom_mask;
+	else if (mask_shift < PAGE_SHIFT)
+	{
+		fprintf(stderr,
+				"Mask file %s is finer than a page: the shift"
+				" must be at least %d.\n",
+				mask_file_name,
+				PAGE_SHIFT);
+		exit(1);
+	}
+	remaining_space = MAX_MEMORY >> mask_shift;
+	uint8_t* buffer = mask;
 	do
 	{
 		last_read = read(fd, buffer, remaining_space);
@@ -336,4 +708,6 @@ void read_rom_mask(char* rom_name, uint8_t* mask_shift, uint8_t** rom_mask)
 		remaining_space -= last_read;
 	} while (remaining_space && last_read);
 	close(fd);
+	free(mask_file_name);
+	memory_map_add_mask(map, mask, mask_shift);
 }
@@ -0,0 +1,162 @@
+// For memfd_create().
+#define _GNU_SOURCE
+
+#include "memory_map.h"
+
+#include "cpu.h"
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* The store is an anonymous file, so that the same memory can be mapped more
+ * than once: all of it at map->store, and a 64 KB view of it, whose windows
+ * memory_map_select_bank() moves about, for the CPU.  memory_map_load()
+ * doesn't make one unless there's more than the CPU can see.
+ */
+uint8_t* memory_map_create(struct memory_map* map, uint32_t store_size)
+{
+	const long host_page = sysconf(_SC_PAGESIZE);
+	if (store_size < MAX_MEMORY) store_size = MAX_MEMORY;
+	store_size = (store_size + host_page - 1) / host_page * host_page;
+
+	const int fd = memfd_create("8080 memory", MFD_CLOEXEC);
+	if (fd == -1)
+	{
+		perror("Error creating the memory store");
+		return NULL;
+	}
+	if (ftruncate(fd, store_size))
+	{
+		perror("Error sizing the memory store");
+		close(fd);
+		return NULL;
+	}
+	uint8_t* store = mmap(NULL,
+			store_size,
+			PROT_READ | PROT_WRITE,
+			MAP_SHARED,
+			fd,
+			0);
+	uint8_t* memory = store == MAP_FAILED ? MAP_FAILED
+					       : mmap(NULL,
+							 MAX_MEMORY,
+							 PROT_READ | PROT_WRITE,
+							 MAP_SHARED,
+							 fd,
+							 0);
+	if (memory == MAP_FAILED)
+	{
+		perror("Error mapping the memory store");
+		if (store != MAP_FAILED) munmap(store, store_size);
+		close(fd);
+		return NULL;
+	}
+
+	memory_map_init(map, memory);
+	map->store_fd	= fd;
+	map->store	= store;
+	map->store_size = store_size;
+	return memory;
+}
+
+// Reads until size bytes are in, or the file runs out.  Returns -1 on error.
+static int read_all(int fd, uint8_t* buffer, size_t size)
+{
+	ssize_t last_read;
+	do
+	{
+		last_read = read(fd, buffer, size);
+		if (last_read == -1)
+		{
+			if (errno == EINTR) continue;
+			return -1;
+		}
+		buffer += last_read;
+		size -= last_read;
+	} while (size && last_read);
+	return 0;
+}
+
+uint8_t* memory_map_load(struct memory_map* map, int rom, uint32_t store_size)
+{
+	struct stat rom_stat;
+	if (fstat(rom, &rom_stat))
+	{
+		perror("Error reading the size of the input file");
+		return NULL;
+	}
+	if (!store_size)
+		store_size = rom_stat.st_size > MAX_STORE
+					     ? MAX_STORE
+					     : (uint32_t) rom_stat.st_size;
+
+	if (store_size > MAX_MEMORY)
+	{
+		uint8_t* memory = memory_map_create(map, store_size);
+		if (memory && read_all(rom, map->store, map->store_size))
+		{
+			perror("Error reading input file");
+			memory_map_destroy(map);
+			return NULL;
+		}
+		return memory;
+	}
+
+	// Zeroed memory, with as many host pages of the image as it takes laid
+	// over the bottom.  The last of those is zeroed past the end of the
+	// file, so the whole image reads just as if it had been read in.
+	uint8_t* memory = mmap(NULL,
+			MAX_MEMORY,
+			PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS,
+			-1,
+			0);
+	if (memory == MAP_FAILED)
+	{
+		perror("Error mapping memory for the 8080");
+		return NULL;
+	}
+	memory_map_init(map, memory);
+	map->store	= memory;
+	map->store_size = MAX_MEMORY;
+
+	const long host_page = sysconf(_SC_PAGESIZE);
+	const uint32_t image = rom_stat.st_size < MAX_MEMORY
+					       ? (uint32_t) rom_stat.st_size
+					       : MAX_MEMORY;
+	const uint32_t mapped = (image + host_page - 1) / host_page * host_page;
+	if (S_ISREG(rom_stat.st_mode))
+	{
+		if (!image
+				|| mmap(memory,
+					   mapped,
+					   PROT_READ | PROT_WRITE,
+					   MAP_PRIVATE | MAP_FIXED,
+					   rom,
+					   0)
+						!= MAP_FAILED)
+			return memory;
+		perror("Error mapping the input file");
+	}
+	// Not a file we can map (a pipe, say), so read it in instead.
+	else if (!read_all(rom, memory, MAX_MEMORY))
+		return memory;
+	else
+		perror("Error reading input file");
+	memory_map_destroy(map);
+	return NULL;
+}
+
+void memory_map_destroy(struct memory_map* map)
+{
+	if (!map->store) return;
+	if (map->memory != map->store) munmap(map->memory, MAX_MEMORY);
+	munmap(map->store, map->store_size);
+	if (map->store_fd != -1) close(map->store_fd);
+	map->store    = NULL;
+	map->store_fd = -1;
+}
@@ -0,0 +1,334 @@
+#include "metrics.h"
+
+#include <errno.h>
+#include <inttypes.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+// How long, in milliseconds, a client gets to send a request before we answer.
+#ifndef METRICS_REQUEST_WAIT
+#	define METRICS_REQUEST_WAIT (50)
+#endif
+
+struct metrics_exporter
+{
+	struct metrics* metrics;
+	long interval;
+	FILE* file;	  // NULL without --metrics.
+	int listener;	  // -1 without --metrics-socket.
+	char* socket_path;
+	int stop[2];	  // A pipe: writing to it stops the thread.
+	pthread_t thread;
+	struct timespec start;
+
+	// For emulated_mhz, the cycle count and time at the last sample.
+	uint64_t* mhz;
+	const uint64_t* cycles; // Found once the CPU thread has added it.
+	uint64_t last_cycles;
+	struct timespec last;
+};
+
+static const char* const TYPE_NAMES[] = {"counter", "gauge"};
+
+static inline double seconds(
+		const struct timespec* start, const struct timespec* end)
+{
+	return (end->tv_sec - start->tv_sec)
+	       + (end->tv_nsec - start->tv_nsec) / 1e9;
+}
+
+// How many of the metrics can be read: those added and filled in.
+static inline int metrics_ready(const struct metrics* metrics)
+{
+	int count = __atomic_load_n(&metrics->count, __ATOMIC_RELAXED);
+	if (count > METRICS_MAX) count = METRICS_MAX;
+	for (int index = 0; index < count; ++index)
+		if (!__atomic_load_n(&metrics->metric[index].ready,
+				    __ATOMIC_ACQUIRE))
+			return index;
+	return count;
+}
+
+// A value as it's exported: a scaled one as a double, otherwise exactly.
+static void write_value(const struct metric* metric, FILE* file)
+{
+	const uint64_t value = metric_read(&metric->value);
+	if (metric->scale == 1.0)
+		fprintf(file, "%" PRIu64, value);
+	else
+		fprintf(file, "%.15g", value * metric->scale);
+}
+
+void metrics_write_json(const struct metrics* metrics, double time, FILE* file)
+{
+	const int count = metrics_ready(metrics);
+	fprintf(file, "{\"time\":%.3f", time);
+	for (int index = 0; index < count; ++index)
+	{
+		fprintf(file, ",\"%s\":", metrics->metric[index].name);
+		write_value(&metrics->metric[index], file);
+	}
+	fputs("}\n", file);
+}
+
+void metrics_write_prometheus(const struct metrics* metrics, FILE* file)
+{
+	const int count = metrics_ready(metrics);
+	for (int index = 0; index < count; ++index)
+	{
+		const struct metric* metric = &metrics->metric[index];
+		fprintf(file,
+				"# HELP %s %s\n# TYPE %s %s\n%s ",
+				metric->name,
+				metric->help,
+				metric->name,
+				TYPE_NAMES[metric->type],
+				metric->name);
+		write_value(metric, file);
+		fputc('\n', file);
+	}
+}
+
+static const uint64_t* metrics_find(
+		const struct metrics* metrics, const char* name)
+{
+	const int count = metrics_ready(metrics);
+	for (int index = 0; index < count; ++index)
+		if (!strcmp(metrics->metric[index].name, name))
+			return &metrics->metric[index].value;
+	return NULL;
+}
+
+static void sample(struct metrics_exporter* exporter)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	if (!exporter->cycles)
+	{
+		exporter->cycles = metrics_find(
+				exporter->metrics, "i8080_cycles_total");
+	}
+	if (exporter->cycles)
+	{
+		const uint64_t cycles = metric_read(exporter->cycles);
+		const double elapsed  = seconds(&exporter->last, &now);
+		if (elapsed > 0)
+			metric_set(exporter->mhz,
+					(cycles - exporter->last_cycles)
+							/ elapsed);
+		exporter->last_cycles = cycles;
+	}
+	exporter->last = now;
+	if (!exporter->file) return;
+	metrics_write_json(exporter->metrics,
+			seconds(&exporter->start, &now),
+			exporter->file);
+	fflush(exporter->file);
+}
+
+/* Answers one client.  Anyone who sends a GET gets an HTTP response, so that
+ * Prometheus can scrape the socket through a proxy; anyone else, say nc -U,
+ * just gets the metrics.
+ */
+static void serve(struct metrics_exporter* exporter)
+{
+	const int client = accept(exporter->listener, NULL, NULL);
+	if (client < 0) return;
+	// A client that won't read doesn't get to hold the exporter up.
+	const struct timeval timeout = {.tv_sec = 1};
+	setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+	char request[4];
+	ssize_t received	= 0;
+	struct pollfd readable = {.fd = client, .events = POLLIN};
+	if (poll(&readable, 1, METRICS_REQUEST_WAIT) > 0)
+		received = recv(client, request, sizeof(request), 0);
+
+	char* text;
+	size_t size;
+	FILE* response = open_memstream(&text, &size);
+	if (response)
+	{
+		if (received == sizeof(request) && !memcmp(request, "GET ", 4))
+			fputs("HTTP/1.0 200 OK\r\n"
+			      "Content-Type: text/plain; version=0.0.4\r\n"
+			      "\r\n",
+					response);
+		metrics_write_prometheus(exporter->metrics, response);
+		fclose(response);
+		for (size_t sent = 0; sent < size;)
+		{
+			const ssize_t last_sent = send(client,
+					text + sent,
+					size - sent,
+					MSG_NOSIGNAL);
+			if (last_sent <= 0) break;
+			sent += last_sent;
+		}
+		free(text);
+	}
+	close(client);
+}
+
+static void* export_thread(void* arg)
+{
+	struct metrics_exporter* exporter = arg;
+	struct pollfd fds[2] = {{.fd = exporter->stop[0], .events = POLLIN},
+			{.fd = exporter->listener, .events = POLLIN}};
+	const nfds_t nfds    = exporter->listener >= 0 ? 2 : 1;
+	struct timespec next = exporter->start, now;
+	for (;;)
+	{
+		next.tv_sec += exporter->interval / 1000;
+		next.tv_nsec += exporter->interval % 1000 * 1000000;
+		if (next.tv_nsec >= 1000000000)
+		{
+			next.tv_nsec -= 1000000000;
+			++next.tv_sec;
+		}
+		// Answer clients until the next sample's due.
+		for (;;)
+		{
+			clock_gettime(CLOCK_MONOTONIC, &now);
+			const double left = seconds(&now, &next);
+			if (left <= 0) break;
+			if (poll(fds, nfds, left * 1000 + 1) < 0
+					&& errno != EINTR)
+				return NULL;
+			if (fds[0].revents) return NULL;
+			if (nfds > 1 && (fds[1].revents & POLLIN))
+				serve(exporter);
+		}
+		sample(exporter);
+		// If we've fallen behind, we don't try to make up the samples.
+		if (seconds(&next, &now) * 1000 > exporter->interval)
+			next = now;
+	}
+}
+
+// Listens on a Unix-domain socket at path, or returns -1 having said why not.
+static int listen_on(const char* path)
+{
+	struct sockaddr_un address = {.sun_family = AF_UNIX};
+	if (strlen(path) >= sizeof(address.sun_path))
+	{
+		fprintf(stderr, "Metrics socket path too long: %s\n", path);
+		return -1;
+	}
+	strcpy(address.sun_path, path);
+	// A socket left behind by an earlier run would be in the way, but
+	// anything else there isn't ours to remove.
+	struct stat existing;
+	if (!stat(path, &existing) && S_ISSOCK(existing.st_mode)) unlink(path);
+
+	const int listener = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (listener < 0)
+	{
+		perror("Error creating metrics socket");
+		return -1;
+	}
+	if (bind(listener, (struct sockaddr*) &address, sizeof(address))
+			|| listen(listener, 8))
+	{
+		fprintf(stderr,
+				"Error listening on metrics socket %s: %s\n",
+				path,
+				strerror(errno));
+		close(listener);
+		return -1;
+	}
+	return listener;
+}
+
+static void exporter_free(struct metrics_exporter* exporter)
+{
+	if (exporter->file) fclose(exporter->file);
+	if (exporter->listener >= 0)
+	{
+		close(exporter->listener);
+		unlink(exporter->socket_path);
+	}
+	if (exporter->stop[0] >= 0) close(exporter->stop[0]);
+	if (exporter->stop[1] >= 0) close(exporter->stop[1]);
+	free(exporter->socket_path);
+	free(exporter);
+}
+
+struct metrics_exporter* metrics_export_start(struct metrics* metrics,
+		const char* file,
+		const char* socket_path,
+		long interval)
+{
+	struct metrics_exporter* exporter = calloc(1, sizeof(*exporter));
+	if (!exporter)
+	{
+		perror("Malloc error creating the metrics exporter");
+		return NULL;
+	}
+	exporter->metrics  = metrics;
+	exporter->interval = interval > 0 ? interval : 1;
+	exporter->listener = -1;
+	exporter->stop[0]  = -1;
+	exporter->stop[1]  = -1;
+	exporter->mhz	   = metrics_add_scaled(metrics,
+			   "i8080_emulated_mhz",
+			   "Emulated clock speed over the last interval (MHz).",
+			   METRIC_GAUGE,
+			   1e-6);
+	clock_gettime(CLOCK_MONOTONIC, &exporter->start);
+	exporter->last = exporter->start;
+
+	if (file && !(exporter->file = fopen(file, "a")))
+	{
+		fprintf(stderr,
+				"Error opening metrics file %s: %s\n",
+				file,
+				strerror(errno));
+		exporter_free(exporter);
+		return NULL;
+	}
+	if (socket_path)
+	{
+		exporter->listener = listen_on(socket_path);
+		if (exporter->listener < 0)
+		{
+			exporter_free(exporter);
+			return NULL;
+		}
+		exporter->socket_path = strdup(socket_path);
+	}
+	if (pipe(exporter->stop)
+			|| pthread_create(&exporter->thread,
+					NULL,
+					export_thread,
+					exporter))
+	{
+		perror("Error starting the metrics exporter");
+		exporter_free(exporter);
+		return NULL;
+	}
+	return exporter;
+}
+
+void metrics_export_stop(struct metrics_exporter* exporter)
+{
+	if (!exporter) return;
+	const char stop = 0;
+	if (write(exporter->stop[1], &stop, 1) != 1)
+	{
+		perror("Error stopping the metrics exporter");
+		return;
+	}
+	pthread_join(exporter->thread, NULL);
+	sample(exporter);
+	exporter_free(exporter);
+}
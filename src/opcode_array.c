@@ -1,4 +1,5 @@
 #include "cpu.h"
+#include "opcode_array.h"
 #include "opcode_decls.h"
 
 #include <stdlib.h>
@@ -32,11 +33,14 @@
  */
 
 /*
- * This is the actual array of opcode functions.  It's a global,
- * with an extern declaration in the accompanying header file.
+ * This is the array of generic opcode functions, each of which decodes its
+ * operands from the opcode byte.  The emulator actually runs the specialized
+ * handlers in specialized_opcodes.c; this table is kept as the reference they
+ * are tested against.
  */
 
-int (*opcodes[256])(const uint8_t* opcode, struct cpu_state* cpu) = {
+int (*const generic_opcodes[256])(
+		const uint8_t* opcode, struct cpu_state* cpu) = {
 		nop,	 // 0x00	NOP
 		lxi,	 // 0x01	LXI	B
 		stax,	 // 0x02	STAX	B
@@ -0,0 +1,99 @@
+#include "opcode_info.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+/* The datasheet's timing and length rules, written in terms of the opcode's
+ * bit fields rather than one opcode at a time, so that the table in
+ * opcode_info.h can be checked against them.  LOW is the SSS field (bits
+ * 0-2) and MID the DDD field (bits 3-5); 6 in either is M.
+ */
+#define LOW(op) ((op) & 7)
+#define MID(op) (((op) >> 3) & 7)
+
+// clang-format off
+#define DATASHEET_CYCLES(op) \
+	((op) < 0x40 ? \
+		(LOW(op) == 0 ? 4 :			/* NOP */ \
+		LOW(op) == 1 ? 10 :			/* LXI, DAD */ \
+		LOW(op) == 2 ? (MID(op) < 4 ? 7 :	/* STAX, LDAX */ \
+			MID(op) < 6 ? 16 : 13) :	/* xHLD, STA, LDA */ \
+		LOW(op) == 3 ? 5 :			/* INX, DCX */ \
+		LOW(op) == 4 || LOW(op) == 5 ?		/* INR, DCR */ \
+			(MID(op) == 6 ? 10 : 5) : \
+		LOW(op) == 6 ?				/* MVI */ \
+			(MID(op) == 6 ? 10 : 7) : \
+		4) :					/* Rotates etc. */ \
+	(op) < 0x80 ? \
+		((op) == 0x76 ? 7 :			/* HLT */ \
+		MID(op) == 6 || LOW(op) == 6 ? 7 : 5) :	/* MOV */ \
+	(op) < 0xc0 ? (LOW(op) == 6 ? 7 : 4) :		/* ALU ops */ \
+	LOW(op) == 0 ? 5 :				/* Rcc */ \
+	LOW(op) == 1 ? \
+		((op) == 0xe9 || (op) == 0xf9 ? 5 :	/* PCHL, SPHL */ \
+		10) :					/* POP, RET */ \
+	LOW(op) == 2 ? 10 :				/* Jcc */ \
+	LOW(op) == 3 ? (MID(op) < 4 ? 10 :		/* JMP, IN, OUT */ \
+		MID(op) == 4 ? 18 : 4) :		/* XTHL, others */ \
+	LOW(op) == 4 ? 11 :				/* Ccc */ \
+	LOW(op) == 5 ? ((op) & 8 ? 17 : 11) :		/* CALL, PUSH */ \
+	LOW(op) == 6 ? 7 :				/* Immediates */ \
+	11)						/* RST */
+
+// Conditional returns and calls take 6 more cycles when the condition holds.
+#define DATASHEET_CYCLES_TAKEN(op) \
+	(DATASHEET_CYCLES(op) \
+	 + ((op) >= 0xc0 && (LOW(op) == 0 || LOW(op) == 4) ? 6 : 0))
+
+#define DATASHEET_LENGTH(op) \
+	((op) < 0x40 ? \
+		(LOW(op) == 1 ? ((op) & 8 ? 1 : 3) :	/* DAD, LXI */ \
+		LOW(op) == 2 ? (MID(op) < 4 ? 1 : 3) :	/* xHLD, STA, LDA */ \
+		LOW(op) == 6 ? 2 : 1) :			/* MVI */ \
+	(op) < 0xc0 ? 1 : \
+	LOW(op) == 2 || LOW(op) == 4 ? 3 :		/* Jcc, Ccc */ \
+	LOW(op) == 3 ? (MID(op) < 2 ? 3 :		/* JMP */ \
+		MID(op) < 4 ? 2 : 1) :			/* OUT, IN */ \
+	LOW(op) == 5 ? ((op) & 8 ? 3 : 1) :		/* CALL, PUSH */ \
+	LOW(op) == 6 ? 2 : 1)				/* Immediates */
+// clang-format on
+
+#define CHECK_ENTRY(op, mnemonic, length, cycles, taken, access, flow) \
+	_Static_assert(length == DATASHEET_LENGTH(op),                 \
+			"Wrong length for " mnemonic);                 \
+	_Static_assert(cycles == DATASHEET_CYCLES(op),                 \
+			"Wrong cycle count for " mnemonic);            \
+	_Static_assert(taken == DATASHEET_CYCLES_TAKEN(op),            \
+			"Wrong taken cycle count for " mnemonic);
+
+OPCODE_INFO_TABLE(CHECK_ENTRY)
+
+int disassemble(const uint8_t* opcode, char* buffer, size_t size)
+{
+	const struct opcode_info* info = &opcode_info[*opcode];
+	// Operands follow a comma if there's already one operand (MVI A,0x3f)
+	// and a space otherwise (JMP 0x18d4).
+	char separator = strchr(info->mnemonic, ' ') ? ',' : ' ';
+	switch (info->length)
+	{
+	case 2:
+		snprintf(buffer,
+				size,
+				"%s%c0x%2.2x",
+				info->mnemonic,
+				separator,
+				opcode[1]);
+		break;
+	case 3:
+		snprintf(buffer,
+				size,
+				"%s%c0x%4.4x",
+				info->mnemonic,
+				separator,
+				opcode[2] << 8 | opcode[1]);
+		break;
+	default: snprintf(buffer, size, "%s", info->mnemonic);
+	}
+	return info->length;
+}
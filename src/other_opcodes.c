@@ -60,7 +60,7 @@ int pop(const uint8_t* opcode, struct cpu_state* cpu)
 #endif
 
 	uint16_t* rp = get_register_pair_pushpop(opcode[0], cpu);
-	*rp	     = *((uint16_t*) &cpu->memory[cpu->sp]);
+	*rp	     = read16(cpu, cpu->sp);
 
 	cpu->sp += 2;
 
@@ -77,7 +77,7 @@ int xthl(const uint8_t* opcode, struct cpu_state* cpu)
 #endif
 
 	// swap the contents of hl and memory[sp]
-	uint16_t temp = *((uint16_t*) &cpu->memory[cpu->sp]);
+	uint16_t temp = read16(cpu, cpu->sp);
 	write16(cpu, cpu->sp, cpu->hl);
 	cpu->hl = temp;
 
@@ -0,0 +1,91 @@
+#include "pacer.h"
+
+#include "histogram.h"
+
+#include <errno.h>
+#include <sys/prctl.h>
+#include <time.h>
+
+static inline void add_nanoseconds(struct timespec* time, long ns)
+{
+	time->tv_nsec += ns;
+	while (time->tv_nsec >= 1000000000)
+	{
+		time->tv_nsec -= 1000000000;
+		++time->tv_sec;
+	}
+	while (time->tv_nsec < 0)
+	{
+		time->tv_nsec += 1000000000;
+		--time->tv_sec;
+	}
+}
+
+void pacer_init(struct pacer* pacer, long cycle_time, int min_chunk)
+{
+	// If we can't have the slack we asked for, the overshoot we measure
+	// will make up for it.
+	prctl(PR_SET_TIMERSLACK, PACER_TIMER_SLACK);
+	*pacer = (struct pacer){.cycle_time = cycle_time,
+			.min_chunk	    = min_chunk,
+			.chunk		    = min_chunk};
+	pacer_rebase(pacer);
+}
+
+void pacer_rebase(struct pacer* pacer)
+{
+	clock_gettime(CLOCK_MONOTONIC, &pacer->target);
+	pacer->count = 0;
+}
+
+void pacer_set_cycle_time(struct pacer* pacer, long cycle_time)
+{
+	// What we know of how late sleeps wake still holds, but the chunk
+	// it calls for is a different number of cycles now.
+	pacer->cycle_time = cycle_time;
+	pacer->chunk	  = pacer_chunk(
+			     pacer->overshoot, cycle_time, pacer->min_chunk);
+	pacer_rebase(pacer);
+}
+
+void pacer_wait(struct pacer* pacer, int cycles)
+{
+	pacer->count += cycles;
+	if (pacer->count < pacer->chunk) return;
+	// Adjust the target time upward by the amount of time the elapsed
+	// cycle count should have taken.
+	add_nanoseconds(&pacer->target, pacer->count * pacer->cycle_time);
+	pacer->count = 0;
+
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	long spin = 2 * pacer->overshoot;
+	if (spin < PACER_SPIN_MIN) spin = PACER_SPIN_MIN;
+	if (spin > PACER_SPIN_MAX) spin = PACER_SPIN_MAX;
+	// Sleep until a little short of the target, if that's still in the
+	// future, and see how late we woke up.
+	if (nanoseconds(&now, &pacer->target) > spin)
+	{
+		struct timespec wake = pacer->target;
+		add_nanoseconds(&wake, -spin);
+		// It returns the error, rather than setting errno.
+		while (clock_nanosleep(CLOCK_MONOTONIC,
+				       TIMER_ABSTIME,
+				       &wake,
+				       NULL)
+				== EINTR)
+			;
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		long late = nanoseconds(&wake, &now);
+		if (late < 0) late = 0;
+		pacer->overshoot += (late - pacer->overshoot) / 8;
+		pacer->chunk = pacer_chunk(pacer->overshoot,
+				pacer->cycle_time,
+				pacer->min_chunk);
+	}
+	// Spin out the rest.  If we're behind, this returns straight away, and
+	// we can catch up.
+	while (nanoseconds(&now, &pacer->target) > 0)
+		clock_gettime(CLOCK_MONOTONIC, &now);
+	histogram_record(&pacer->error, nanoseconds(&pacer->target, &now));
+}
@@ -0,0 +1,113 @@
+#include "recompiled.h"
+
+#include "block_cache.h"
+#include "cpu.h"
+#include "idle_loop.h"
+
+#include <dlfcn.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+const struct recompiled_rom* native_rom;
+
+// Opens the module of the given name, and checks it: see recompiled_load().
+static const struct recompiled_rom* open_module(const char* module_name,
+		const uint8_t* memory,
+		const uint8_t* rom_mask,
+		uint8_t mask_shift)
+{
+	// The module is never closed: its blocks are in use until we exit.
+	void* module = dlopen(module_name, RTLD_NOW);
+	if (!module)
+	{
+		fprintf(stderr,
+				"Error opening recompiled ROM:\n\t%s\n",
+				dlerror());
+		return NULL;
+	}
+	const struct recompiled_rom* rom =
+			dlsym(module, RECOMPILED_ROM_SYMBOL);
+	if (!rom)
+	{
+		fprintf(stderr,
+				"Error finding '" RECOMPILED_ROM_SYMBOL
+				"' in %s:\n\t%s\n",
+				module_name,
+				dlerror());
+		dlclose(module);
+		return NULL;
+	}
+	if (rom->checksum
+			!= recompiled_checksum(memory, rom_mask, mask_shift))
+	{
+		fprintf(stderr,
+				"%s was built from a different ROM, or with a "
+				"different mask.\n",
+				module_name);
+		dlclose(module);
+		return NULL;
+	}
+	return rom;
+}
+
+const struct recompiled_rom* recompiled_load(const char* rom_name,
+		const uint8_t* memory,
+		const uint8_t* rom_mask,
+		uint8_t mask_shift)
+{
+	const char* base_name = strrchr(rom_name, '/');
+	base_name	      = base_name ? base_name + 1 : rom_name;
+	const size_t size     = strlen(base_name) + sizeof("native/lib.so");
+	char* module_name     = malloc(size);
+	if (!module_name)
+	{
+		perror("Malloc error naming the recompiled ROM");
+		return NULL;
+	}
+	snprintf(module_name, size, "native/lib%s.so", base_name);
+	const struct recompiled_rom* rom =
+			open_module(module_name, memory, rom_mask, mask_shift);
+	free(module_name);
+	return rom;
+}
+
+int recompiled_run(const struct recompiled_rom* rom,
+		struct block_cache* cache,
+		struct cpu_state* cpu,
+		struct idle_loop* idle,
+		uint64_t now,
+		int budget)
+{
+	const int state = cpu->interrupt_enable_flag << 1 | cpu->halt_flag;
+	int cycles	= 0;
+	do
+	{
+		const uint16_t start	     = cpu->pc;
+		const recompiled_block block = rom->blocks[start];
+		const struct block* decoded  = NULL;
+		if (block)
+			cycles += block(cpu);
+		else
+		{
+			decoded = block_cache_get(cache, cpu, start);
+			cycles += block_cache_execute(cache, cpu, decoded);
+		}
+		/* A jump back may be an idle loop, as on the block core.  The
+		 * recompiler splits blocks wherever a jump lands, so a
+		 * translated block can only have jumped back if the PC is now
+		 * at or before its start; and then its last opcode is the
+		 * jump, which the block cache can tell us the address of.
+		 */
+		if (cpu->pc > (decoded ? decoded->last_opcode : start))
+			continue;
+		if (!decoded) decoded = block_cache_get(cache, cpu, start);
+		const int pass = idle_loop_pass(
+				idle, cpu, decoded->last_opcode, now + cycles);
+		if (pass) cycles += idle_loop_skip(idle, pass, budget - cycles);
+	} while (cycles < budget
+			&& (cpu->interrupt_enable_flag << 1 | cpu->halt_flag)
+					== state);
+	return cycles;
+}
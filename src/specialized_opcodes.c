@@ -0,0 +1,548 @@
+#include "alu_tables.h"
+#include "cpu.h"
+#include "inline_ops.h"
+#include "opcode_array.h"
+#include "opcode_decls.h"
+#include "opcode_helpers.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+/* Specialized opcode handlers.
+ *
+ * The generic handlers (see opcode_array.c) serve a whole family of opcodes
+ * each, and decode the register or condition fields out of the opcode byte
+ * every time they run.  Here we stamp out one handler per opcode instead,
+ * with all of that worked out by the preprocessor: MOV B,C is just
+ * cpu->b = cpu->c, JNZ tests the zero flag directly, and every handler
+ * returns a constant cycle count.
+ *
+ * SPECIALIZED_OPCODES below lists every opcode.  X() entries are generated
+ * from the macro named by their second argument; G() entries are opcodes
+ * with nothing to decode, which just use the generic handler as-is.  The
+ * generic handlers remain the reference: the tests run both against each
+ * other.
+ */
+
+#ifdef VERBOSE
+#	define TRACE(...) fprintf(stderr, __VA_ARGS__)
+#else
+#	define TRACE(...)
+#endif
+
+// Register operands, as they appear in the DDD and SSS fields.  M is only
+// ever read through REG_M: writes to memory have to go through write8().
+#define REG_B cpu->b
+#define REG_C cpu->c
+#define REG_D cpu->d
+#define REG_E cpu->e
+#define REG_H cpu->h
+#define REG_L cpu->l
+#define REG_M read8(cpu, cpu->hl)
+#define REG_A cpu->a
+
+// Memory operands cost extra cycles.
+#define IS_MEM_B 0
+#define IS_MEM_C 0
+#define IS_MEM_D 0
+#define IS_MEM_E 0
+#define IS_MEM_H 0
+#define IS_MEM_L 0
+#define IS_MEM_M 1
+#define IS_MEM_A 0
+
+// Register pairs, named as in the manual.
+#define PAIR_B	 cpu->bc
+#define PAIR_D	 cpu->de
+#define PAIR_H	 cpu->hl
+#define PAIR_SP	 cpu->sp
+#define PAIR_PSW cpu->psw
+
+// Branch conditions.
+#define MET_NZ (!(cpu->flags & ZERO_FLAG))
+#define MET_Z  (cpu->flags & ZERO_FLAG)
+#define MET_NC (!(cpu->flags & CARRY_FLAG))
+#define MET_C  (cpu->flags & CARRY_FLAG)
+#define MET_PO (!(cpu->flags & PARITY_FLAG))
+#define MET_PE (cpu->flags & PARITY_FLAG)
+#define MET_P  (!(cpu->flags & SIGN_FLAG))
+#define MET_M  (cpu->flags & SIGN_FLAG)
+
+/* The handler templates.  Each expands to one complete handler function. */
+
+#define HANDLER(op) \
+	static int op_##op(const uint8_t* opcode, struct cpu_state* cpu)
+
+#define MOV(op, dst, src)                          \
+	HANDLER(op)                                \
+	{                                          \
+		(void) opcode;                     \
+		TRACE("MOV " #dst "," #src "\n");  \
+		REG_##dst = REG_##src;             \
+		return IS_MEM_##src ? 7 : 5;       \
+	}
+
+#define MOV_TO_M(op, src)                          \
+	HANDLER(op)                                \
+	{                                          \
+		(void) opcode;                     \
+		TRACE("MOV M," #src "\n");         \
+		write8(cpu, cpu->hl, REG_##src);   \
+		return 7;                          \
+	}
+
+#define MVI(op, dst)                                       \
+	HANDLER(op)                                        \
+	{                                                  \
+		TRACE("MVI " #dst " 0x%2.2x\n", opcode[1]); \
+		REG_##dst = opcode[1];                     \
+		return 7;                                  \
+	}
+
+#define MVI_M(op)                                   \
+	HANDLER(op)                                 \
+	{                                           \
+		TRACE("MVI M 0x%2.2x\n", opcode[1]); \
+		write8(cpu, cpu->hl, opcode[1]);    \
+		return 10;                          \
+	}
+
+#define LXI(op, pair)                                            \
+	HANDLER(op)                                              \
+	{                                                        \
+		TRACE("LXI " #pair " 0x%4.4x\n", IMM16(opcode)); \
+		PAIR_##pair = IMM16(opcode);                     \
+		return 10;                                       \
+	}
+
+#define LDAX(op, pair)                                  \
+	HANDLER(op)                                     \
+	{                                               \
+		(void) opcode;                          \
+		TRACE("LDAX " #pair "\n");              \
+		cpu->a = read8(cpu, PAIR_##pair);       \
+		return 7;                               \
+	}
+
+#define STAX(op, pair)                                  \
+	HANDLER(op)                                     \
+	{                                               \
+		(void) opcode;                          \
+		TRACE("STAX " #pair "\n");              \
+		write8(cpu, PAIR_##pair, cpu->a);       \
+		return 7;                               \
+	}
+
+#define INX(op, pair)                    \
+	HANDLER(op)                      \
+	{                                \
+		(void) opcode;           \
+		TRACE("INX " #pair "\n"); \
+		++PAIR_##pair;           \
+		return 5;                \
+	}
+
+#define DCX(op, pair)                    \
+	HANDLER(op)                      \
+	{                                \
+		(void) opcode;           \
+		TRACE("DCX " #pair "\n"); \
+		--PAIR_##pair;           \
+		return 5;                \
+	}
+
+#define DAD(op, pair)                                                  \
+	HANDLER(op)                                                    \
+	{                                                              \
+		(void) opcode;                                         \
+		TRACE("DAD " #pair "\n");                              \
+		uint32_t result = cpu->hl + PAIR_##pair;               \
+		cpu->flags	= (cpu->flags & ~CARRY_FLAG)           \
+			     | ((result >> 16) & CARRY_FLAG);          \
+		cpu->hl = result;                                      \
+		return 10;                                             \
+	}
+
+#define INR(op, reg)                                    \
+	HANDLER(op)                                     \
+	{                                               \
+		(void) opcode;                          \
+		TRACE("INR " #reg "\n");                \
+		REG_##reg = inr_dcr(cpu, REG_##reg, 1); \
+		return 5;                               \
+	}
+
+#define DCR(op, reg)                                       \
+	HANDLER(op)                                        \
+	{                                                  \
+		(void) opcode;                             \
+		TRACE("DCR " #reg "\n");                   \
+		REG_##reg = inr_dcr(cpu, REG_##reg, 0xff); \
+		return 5;                                  \
+	}
+
+#define INR_M(op)                                                   \
+	HANDLER(op)                                                 \
+	{                                                           \
+		(void) opcode;                                      \
+		TRACE("INR M\n");                                   \
+		write8(cpu, cpu->hl, inr_dcr(cpu, REG_M, 1));       \
+		return 10;                                          \
+	}
+
+#define DCR_M(op)                                                   \
+	HANDLER(op)                                                 \
+	{                                                           \
+		(void) opcode;                                      \
+		TRACE("DCR M\n");                                   \
+		write8(cpu, cpu->hl, inr_dcr(cpu, REG_M, 0xff));    \
+		return 10;                                          \
+	}
+
+#define ALU(op, name, src)                          \
+	HANDLER(op)                                 \
+	{                                           \
+		(void) opcode;                      \
+		TRACE(#name " " #src "\n");         \
+		ALU_##name(REG_##src);              \
+		return IS_MEM_##src ? 7 : 4;        \
+	}
+
+#define JCOND(op, cond)                                             \
+	HANDLER(op)                                                 \
+	{                                                           \
+		TRACE("J" #cond " 0x%4.4x\n", IMM16(opcode));       \
+		if (MET_##cond) cpu->pc = IMM16(opcode);            \
+		return 10;                                          \
+	}
+
+#define CCOND(op, cond)                                             \
+	HANDLER(op)                                                 \
+	{                                                           \
+		TRACE("C" #cond " 0x%4.4x\n", IMM16(opcode));       \
+		if (!(MET_##cond)) return 11;                       \
+		push16(cpu, cpu->pc);                               \
+		cpu->pc = IMM16(opcode);                            \
+		return 17;                                          \
+	}
+
+#define RCOND(op, cond)                          \
+	HANDLER(op)                              \
+	{                                        \
+		(void) opcode;                   \
+		TRACE("R" #cond "\n");           \
+		if (!(MET_##cond)) return 5;     \
+		cpu->pc = pop16(cpu);            \
+		return 11;                       \
+	}
+
+#define PUSH(op, pair)                            \
+	HANDLER(op)                               \
+	{                                         \
+		(void) opcode;                    \
+		TRACE("PUSH " #pair "\n");        \
+		push16(cpu, PAIR_##pair);         \
+		return 11;                        \
+	}
+
+// Bits 1, 3 and 5 of the flags have fixed values on the stack; see push().
+#define PUSH_PSW(op)                                                 \
+	HANDLER(op)                                                  \
+	{                                                            \
+		(void) opcode;                                       \
+		TRACE("PUSH PSW\n");                                 \
+		push16(cpu, (cpu->psw | 0b00000010) & ~0b00101000);  \
+		return 11;                                           \
+	}
+
+#define POP(op, pair)                            \
+	HANDLER(op)                              \
+	{                                        \
+		(void) opcode;                   \
+		TRACE("POP " #pair "\n");        \
+		PAIR_##pair = pop16(cpu);        \
+		return 10;                       \
+	}
+
+#define RST(op, vector)                                   \
+	HANDLER(op)                                       \
+	{                                                 \
+		(void) opcode;                            \
+		TRACE("RST 0x%4.4x\n", vector);           \
+		push16(cpu, cpu->pc);                     \
+		cpu->pc = vector;                         \
+		return 11;                                \
+	}
+
+// clang-format off
+#define SPECIALIZED_OPCODES(X, G) \
+	G(0x00, nop) \
+	X(0x01, LXI, B) \
+	X(0x02, STAX, B) \
+	X(0x03, INX, B) \
+	X(0x04, INR, B) \
+	X(0x05, DCR, B) \
+	X(0x06, MVI, B) \
+	G(0x07, rlc) \
+	G(0x08, nop) \
+	X(0x09, DAD, B) \
+	X(0x0a, LDAX, B) \
+	X(0x0b, DCX, B) \
+	X(0x0c, INR, C) \
+	X(0x0d, DCR, C) \
+	X(0x0e, MVI, C) \
+	G(0x0f, rrc) \
+	G(0x10, nop) \
+	X(0x11, LXI, D) \
+	X(0x12, STAX, D) \
+	X(0x13, INX, D) \
+	X(0x14, INR, D) \
+	X(0x15, DCR, D) \
+	X(0x16, MVI, D) \
+	G(0x17, ral) \
+	G(0x18, nop) \
+	X(0x19, DAD, D) \
+	X(0x1a, LDAX, D) \
+	X(0x1b, DCX, D) \
+	X(0x1c, INR, E) \
+	X(0x1d, DCR, E) \
+	X(0x1e, MVI, E) \
+	G(0x1f, rar) \
+	G(0x20, nop) \
+	X(0x21, LXI, H) \
+	G(0x22, shld) \
+	X(0x23, INX, H) \
+	X(0x24, INR, H) \
+	X(0x25, DCR, H) \
+	X(0x26, MVI, H) \
+	G(0x27, daa) \
+	G(0x28, nop) \
+	X(0x29, DAD, H) \
+	G(0x2a, lhld) \
+	X(0x2b, DCX, H) \
+	X(0x2c, INR, L) \
+	X(0x2d, DCR, L) \
+	X(0x2e, MVI, L) \
+	G(0x2f, cma) \
+	G(0x30, nop) \
+	X(0x31, LXI, SP) \
+	G(0x32, sta) \
+	X(0x33, INX, SP) \
+	X(0x34, INR_M) \
+	X(0x35, DCR_M) \
+	X(0x36, MVI_M) \
+	G(0x37, stc) \
+	G(0x38, nop) \
+	X(0x39, DAD, SP) \
+	G(0x3a, lda) \
+	X(0x3b, DCX, SP) \
+	X(0x3c, INR, A) \
+	X(0x3d, DCR, A) \
+	X(0x3e, MVI, A) \
+	G(0x3f, cmc) \
+	X(0x40, MOV, B, B) \
+	X(0x41, MOV, B, C) \
+	X(0x42, MOV, B, D) \
+	X(0x43, MOV, B, E) \
+	X(0x44, MOV, B, H) \
+	X(0x45, MOV, B, L) \
+	X(0x46, MOV, B, M) \
+	X(0x47, MOV, B, A) \
+	X(0x48, MOV, C, B) \
+	X(0x49, MOV, C, C) \
+	X(0x4a, MOV, C, D) \
+	X(0x4b, MOV, C, E) \
+	X(0x4c, MOV, C, H) \
+	X(0x4d, MOV, C, L) \
+	X(0x4e, MOV, C, M) \
+	X(0x4f, MOV, C, A) \
+	X(0x50, MOV, D, B) \
+	X(0x51, MOV, D, C) \
+	X(0x52, MOV, D, D) \
+	X(0x53, MOV, D, E) \
+	X(0x54, MOV, D, H) \
+	X(0x55, MOV, D, L) \
+	X(0x56, MOV, D, M) \
+	X(0x57, MOV, D, A) \
+	X(0x58, MOV, E, B) \
+	X(0x59, MOV, E, C) \
+	X(0x5a, MOV, E, D) \
+	X(0x5b, MOV, E, E) \
+	X(0x5c, MOV, E, H) \
+	X(0x5d, MOV, E, L) \
+	X(0x5e, MOV, E, M) \
+	X(0x5f, MOV, E, A) \
+	X(0x60, MOV, H, B) \
+	X(0x61, MOV, H, C) \
+	X(0x62, MOV, H, D) \
+	X(0x63, MOV, H, E) \
+	X(0x64, MOV, H, H) \
+	X(0x65, MOV, H, L) \
+	X(0x66, MOV, H, M) \
+	X(0x67, MOV, H, A) \
+	X(0x68, MOV, L, B) \
+	X(0x69, MOV, L, C) \
+	X(0x6a, MOV, L, D) \
+	X(0x6b, MOV, L, E) \
+	X(0x6c, MOV, L, H) \
+	X(0x6d, MOV, L, L) \
+	X(0x6e, MOV, L, M) \
+	X(0x6f, MOV, L, A) \
+	X(0x70, MOV_TO_M, B) \
+	X(0x71, MOV_TO_M, C) \
+	X(0x72, MOV_TO_M, D) \
+	X(0x73, MOV_TO_M, E) \
+	X(0x74, MOV_TO_M, H) \
+	X(0x75, MOV_TO_M, L) \
+	G(0x76, hlt) \
+	X(0x77, MOV_TO_M, A) \
+	X(0x78, MOV, A, B) \
+	X(0x79, MOV, A, C) \
+	X(0x7a, MOV, A, D) \
+	X(0x7b, MOV, A, E) \
+	X(0x7c, MOV, A, H) \
+	X(0x7d, MOV, A, L) \
+	X(0x7e, MOV, A, M) \
+	X(0x7f, MOV, A, A) \
+	X(0x80, ALU, ADD, B) \
+	X(0x81, ALU, ADD, C) \
+	X(0x82, ALU, ADD, D) \
+	X(0x83, ALU, ADD, E) \
+	X(0x84, ALU, ADD, H) \
+	X(0x85, ALU, ADD, L) \
+	X(0x86, ALU, ADD, M) \
+	X(0x87, ALU, ADD, A) \
+	X(0x88, ALU, ADC, B) \
+	X(0x89, ALU, ADC, C) \
+	X(0x8a, ALU, ADC, D) \
+	X(0x8b, ALU, ADC, E) \
+	X(0x8c, ALU, ADC, H) \
+	X(0x8d, ALU, ADC, L) \
+	X(0x8e, ALU, ADC, M) \
+	X(0x8f, ALU, ADC, A) \
+	X(0x90, ALU, SUB, B) \
+	X(0x91, ALU, SUB, C) \
+	X(0x92, ALU, SUB, D) \
+	X(0x93, ALU, SUB, E) \
+	X(0x94, ALU, SUB, H) \
+	X(0x95, ALU, SUB, L) \
+	X(0x96, ALU, SUB, M) \
+	X(0x97, ALU, SUB, A) \
+	X(0x98, ALU, SBB, B) \
+	X(0x99, ALU, SBB, C) \
+	X(0x9a, ALU, SBB, D) \
+	X(0x9b, ALU, SBB, E) \
+	X(0x9c, ALU, SBB, H) \
+	X(0x9d, ALU, SBB, L) \
+	X(0x9e, ALU, SBB, M) \
+	X(0x9f, ALU, SBB, A) \
+	X(0xa0, ALU, ANA, B) \
+	X(0xa1, ALU, ANA, C) \
+	X(0xa2, ALU, ANA, D) \
+	X(0xa3, ALU, ANA, E) \
+	X(0xa4, ALU, ANA, H) \
+	X(0xa5, ALU, ANA, L) \
+	X(0xa6, ALU, ANA, M) \
+	X(0xa7, ALU, ANA, A) \
+	X(0xa8, ALU, XRA, B) \
+	X(0xa9, ALU, XRA, C) \
+	X(0xaa, ALU, XRA, D) \
+	X(0xab, ALU, XRA, E) \
+	X(0xac, ALU, XRA, H) \
+	X(0xad, ALU, XRA, L) \
+	X(0xae, ALU, XRA, M) \
+	X(0xaf, ALU, XRA, A) \
+	X(0xb0, ALU, ORA, B) \
+	X(0xb1, ALU, ORA, C) \
+	X(0xb2, ALU, ORA, D) \
+	X(0xb3, ALU, ORA, E) \
+	X(0xb4, ALU, ORA, H) \
+	X(0xb5, ALU, ORA, L) \
+	X(0xb6, ALU, ORA, M) \
+	X(0xb7, ALU, ORA, A) \
+	X(0xb8, ALU, CMP, B) \
+	X(0xb9, ALU, CMP, C) \
+	X(0xba, ALU, CMP, D) \
+	X(0xbb, ALU, CMP, E) \
+	X(0xbc, ALU, CMP, H) \
+	X(0xbd, ALU, CMP, L) \
+	X(0xbe, ALU, CMP, M) \
+	X(0xbf, ALU, CMP, A) \
+	X(0xc0, RCOND, NZ) \
+	X(0xc1, POP, B) \
+	X(0xc2, JCOND, NZ) \
+	G(0xc3, jmp) \
+	X(0xc4, CCOND, NZ) \
+	X(0xc5, PUSH, B) \
+	G(0xc6, adi) \
+	X(0xc7, RST, 0x00) \
+	X(0xc8, RCOND, Z) \
+	G(0xc9, ret) \
+	X(0xca, JCOND, Z) \
+	G(0xcb, jmp) \
+	X(0xcc, CCOND, Z) \
+	G(0xcd, call) \
+	G(0xce, aci) \
+	X(0xcf, RST, 0x08) \
+	X(0xd0, RCOND, NC) \
+	X(0xd1, POP, D) \
+	X(0xd2, JCOND, NC) \
+	G(0xd3, NULL) \
+	X(0xd4, CCOND, NC) \
+	X(0xd5, PUSH, D) \
+	G(0xd6, sui_sbi) \
+	X(0xd7, RST, 0x10) \
+	X(0xd8, RCOND, C) \
+	G(0xd9, ret) \
+	X(0xda, JCOND, C) \
+	G(0xdb, NULL) \
+	X(0xdc, CCOND, C) \
+	G(0xdd, call) \
+	G(0xde, sui_sbi) \
+	X(0xdf, RST, 0x18) \
+	X(0xe0, RCOND, PO) \
+	X(0xe1, POP, H) \
+	X(0xe2, JCOND, PO) \
+	G(0xe3, xthl) \
+	X(0xe4, CCOND, PO) \
+	X(0xe5, PUSH, H) \
+	G(0xe6, ani) \
+	X(0xe7, RST, 0x20) \
+	X(0xe8, RCOND, PE) \
+	G(0xe9, pchl) \
+	X(0xea, JCOND, PE) \
+	G(0xeb, xchg) \
+	X(0xec, CCOND, PE) \
+	G(0xed, call) \
+	G(0xee, xri) \
+	X(0xef, RST, 0x28) \
+	X(0xf0, RCOND, P) \
+	X(0xf1, POP, PSW) \
+	X(0xf2, JCOND, P) \
+	G(0xf3, di) \
+	X(0xf4, CCOND, P) \
+	X(0xf5, PUSH_PSW) \
+	G(0xf6, ori) \
+	X(0xf7, RST, 0x30) \
+	X(0xf8, RCOND, M) \
+	G(0xf9, sphl) \
+	X(0xfa, JCOND, M) \
+	G(0xfb, ei) \
+	X(0xfc, CCOND, M) \
+	G(0xfd, call) \
+	G(0xfe, cpi) \
+	X(0xff, RST, 0x38)
+
+// clang-format on
+
+#define DEFINE_HANDLER(op, kind, ...) kind(op, ##__VA_ARGS__)
+#define NO_HANDLER(op, handler)
+
+SPECIALIZED_OPCODES(DEFINE_HANDLER, NO_HANDLER)
+
+#define SPECIALIZED_ENTRY(op, ...)   [op] = op_##op,
+#define GENERIC_ENTRY(op, handler) [op] = handler,
+
+int (*opcodes[256])(const uint8_t* opcode, struct cpu_state* cpu) = {
+		SPECIALIZED_OPCODES(SPECIALIZED_ENTRY, GENERIC_ENTRY)};
@@ -0,0 +1,278 @@
+#include "cpu.h"
+#include "cpu_core.h"
+#include "cycle_timer.h"
+#include "hw_func_pointers.h"
+#include "idle_loop.h"
+#include "interrupts.h"
+#include "opcode_array.h"
+#include "opcode_info.h"
+#include "opcode_size.h"
+#include "scheduler.h"
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/* The threaded core gives every opcode its own label, and keeps a table of
+ * label addresses (a GCC extension, "labels as values") indexed by opcode.
+ * At the end of each label we fetch the next opcode and jump straight to its
+ * label.  Compared to the switch core, this buys us three things:
+ *
+ * 	- The opcode size, and for most opcodes the cycle count, is a
+ * 	  constant at each label, so there is no table lookup on every
+ * 	  fetch.
+ * 	- Each label has its own indirect jump, which gives the host's branch
+ * 	  predictor a separate history for every opcode, rather than one
+ * 	  unpredictable jump at the top of a loop.
+ * 	- Interrupts, halts and timekeeping are handled in one out-of-line
+ * 	  service routine, which we only enter when a chunk's worth of cycles
+ * 	  has elapsed, when a timed event is due, or when an opcode (EI, DI,
+ * 	  HLT) has changed the interrupt/halt state.  The normal path is a
+ * 	  single compare.
+ *
+ * The handlers themselves are still called through the opcode array, since
+ * IN and OUT are only known once the hardware library has been loaded.
+ */
+
+#ifdef VERBOSE
+#	define TRACE_FETCH()	fprintf(stderr, "0x%4.4x: ", cpu.pc)
+#	define TRACE_EXECUTE() print_registers(&cpu)
+#else
+#	define TRACE_FETCH()
+#	define TRACE_EXECUTE()
+#endif
+
+// Fetch the next opcode and jump to its label, unless it's time to check in
+// with the service routine.
+#define DISPATCH()                                  \
+	do                                          \
+	{                                           \
+		if (cycles >= budget) goto service; \
+		opcode = cpu.memory + cpu.pc;       \
+		TRACE_FETCH();                      \
+		goto* dispatch[*opcode];            \
+	} while (0)
+
+// Most opcodes always take the same number of cycles, and for those we charge
+// the constant from opcode_info.h rather than waiting on the handler.  Only
+// the conditional calls and returns need the handler to tell us.  Counting
+// instructions for the metrics costs an increment of a local.
+#define OPCODE_BODY(op)                                          \
+	cpu.pc += get_opcode_size(op);                           \
+	++instructions;                                          \
+	if (opcode_has_fixed_cycles(op))                         \
+	{                                                        \
+		opcodes[op](opcode, &cpu);                       \
+		cycles += opcode_info[op].cycles;                \
+	}                                                        \
+	else                                                     \
+		cycles += opcodes[op](opcode, &cpu);             \
+	TRACE_EXECUTE();
+
+// A jump back may be an idle loop (see idle_loop.h), so those go by way of
+// idle_check.  The test of the opcode is worked out at compile time.
+#define IDLE_CHECK(op)                                               \
+	if ((opcode_info[op].flow == FLOW_JUMP                       \
+			    || opcode_info[op].flow == FLOW_BRANCH)  \
+			&& (op) != 0xe9 && cpu.pc <= opcode - cpu.memory) \
+		goto idle_check;
+
+// Most opcodes simply execute and move on.
+#define OPCODE_LABEL(op) \
+	op_##op : OPCODE_BODY(op) IDLE_CHECK(op) DISPATCH();
+
+// EI, DI and HLT change the interrupt or halt state, so after them we always
+// drop into the service routine.
+#define SYNC_OPCODE_LABEL(op) \
+	op_##op : OPCODE_BODY(op) budget = 0; DISPATCH();
+
+// IN and OUT may want the time, or add a timed event, so before them we bring
+// the cycle count up to date, and after them we drop into the service routine
+// to pick up any new deadline.
+#define IO_OPCODE_LABEL(op)                           \
+	op_##op : cpu.cycles += cycles;               \
+	owed += cycles;                               \
+	cycles = 0;                                   \
+	OPCODE_BODY(op) budget = 0;                   \
+	DISPATCH();
+
+#define LABEL_ROW(row, label_macro)                                      \
+	label_macro(0x##row##0) label_macro(0x##row##1)                  \
+	label_macro(0x##row##2) label_macro(0x##row##3)                  \
+	label_macro(0x##row##4) label_macro(0x##row##5)                  \
+	label_macro(0x##row##6) label_macro(0x##row##7)                  \
+	label_macro(0x##row##8) label_macro(0x##row##9)                  \
+	label_macro(0x##row##a) label_macro(0x##row##b)                  \
+	label_macro(0x##row##c) label_macro(0x##row##d)                  \
+	label_macro(0x##row##e) label_macro(0x##row##f)
+
+#define LABEL_ADDRESS(op) &&op_##op,
+
+void* threaded_cpu_thread_routine(void* resources)
+{
+	struct cpu_state cpu = cpu_state_from_resources(
+			(struct system_resources*) resources);
+
+	static const void* const dispatch[256] = {
+			LABEL_ROW(0, LABEL_ADDRESS) LABEL_ROW(1, LABEL_ADDRESS)
+			LABEL_ROW(2, LABEL_ADDRESS) LABEL_ROW(3, LABEL_ADDRESS)
+			LABEL_ROW(4, LABEL_ADDRESS) LABEL_ROW(5, LABEL_ADDRESS)
+			LABEL_ROW(6, LABEL_ADDRESS) LABEL_ROW(7, LABEL_ADDRESS)
+			LABEL_ROW(8, LABEL_ADDRESS) LABEL_ROW(9, LABEL_ADDRESS)
+			LABEL_ROW(a, LABEL_ADDRESS) LABEL_ROW(b, LABEL_ADDRESS)
+			LABEL_ROW(c, LABEL_ADDRESS) LABEL_ROW(d, LABEL_ADDRESS)
+			LABEL_ROW(e, LABEL_ADDRESS) LABEL_ROW(f, LABEL_ADDRESS)
+	};
+
+	// We can remove this assignment if we want to force the user
+	// to hardware reset on CPU boot.
+	cpu.pc = 0;
+	const uint8_t* opcode;
+	// Cycles executed since we last entered the service routine, which
+	// brings cpu.cycles up to date, and since we last called cycle_wait().
+	int cycles = 0;
+	int owed   = 0;
+	// When cycles reaches budget, the next dispatch enters the service
+	// routine instead of an opcode.
+	int budget	= 0;
+	const int chunk = cpu.timer->chunk;
+	const struct core_metrics metrics = core_metrics_add(cpu.metrics, 1);
+	uint64_t instructions = 0, interrupts = 0;
+	// When the next timed event is due: see scheduler.h.
+	uint64_t deadline;
+	struct idle_loop idle = {0};
+	int pass;
+	uint8_t rst;
+
+	goto service;
+
+	// Rows 0-6 contain nothing that touches the interrupt state...
+	LABEL_ROW(0, OPCODE_LABEL)
+	LABEL_ROW(1, OPCODE_LABEL)
+	LABEL_ROW(2, OPCODE_LABEL)
+	LABEL_ROW(3, OPCODE_LABEL)
+	LABEL_ROW(4, OPCODE_LABEL)
+	LABEL_ROW(5, OPCODE_LABEL)
+	LABEL_ROW(6, OPCODE_LABEL)
+	// ...but row 7 has HLT in the middle of the MOVs.
+	OPCODE_LABEL(0x70)
+	OPCODE_LABEL(0x71)
+	OPCODE_LABEL(0x72)
+	OPCODE_LABEL(0x73)
+	OPCODE_LABEL(0x74)
+	OPCODE_LABEL(0x75)
+	SYNC_OPCODE_LABEL(0x76) // HLT
+	OPCODE_LABEL(0x77)
+	OPCODE_LABEL(0x78)
+	OPCODE_LABEL(0x79)
+	OPCODE_LABEL(0x7a)
+	OPCODE_LABEL(0x7b)
+	OPCODE_LABEL(0x7c)
+	OPCODE_LABEL(0x7d)
+	OPCODE_LABEL(0x7e)
+	OPCODE_LABEL(0x7f)
+	LABEL_ROW(8, OPCODE_LABEL)
+	LABEL_ROW(9, OPCODE_LABEL)
+	LABEL_ROW(a, OPCODE_LABEL)
+	LABEL_ROW(b, OPCODE_LABEL)
+	LABEL_ROW(c, OPCODE_LABEL)
+	// Row d has OUT and IN.
+	OPCODE_LABEL(0xd0)
+	OPCODE_LABEL(0xd1)
+	OPCODE_LABEL(0xd2)
+	IO_OPCODE_LABEL(0xd3) // OUT
+	OPCODE_LABEL(0xd4)
+	OPCODE_LABEL(0xd5)
+	OPCODE_LABEL(0xd6)
+	OPCODE_LABEL(0xd7)
+	OPCODE_LABEL(0xd8)
+	OPCODE_LABEL(0xd9)
+	OPCODE_LABEL(0xda)
+	IO_OPCODE_LABEL(0xdb) // IN
+	OPCODE_LABEL(0xdc)
+	OPCODE_LABEL(0xdd)
+	OPCODE_LABEL(0xde)
+	OPCODE_LABEL(0xdf)
+	LABEL_ROW(e, OPCODE_LABEL)
+	// And row f has DI and EI.
+	OPCODE_LABEL(0xf0)
+	OPCODE_LABEL(0xf1)
+	OPCODE_LABEL(0xf2)
+	SYNC_OPCODE_LABEL(0xf3) // DI
+	OPCODE_LABEL(0xf4)
+	OPCODE_LABEL(0xf5)
+	OPCODE_LABEL(0xf6)
+	OPCODE_LABEL(0xf7)
+	OPCODE_LABEL(0xf8)
+	OPCODE_LABEL(0xf9)
+	OPCODE_LABEL(0xfa)
+	SYNC_OPCODE_LABEL(0xfb) // EI
+	OPCODE_LABEL(0xfc)
+	OPCODE_LABEL(0xfd)
+	OPCODE_LABEL(0xfe)
+	OPCODE_LABEL(0xff)
+
+idle_check:
+	pass = idle_loop_pass(
+			&idle, &cpu, opcode - cpu.memory, cpu.cycles + cycles);
+	if (pass) cycles += idle_loop_skip(&idle, pass, budget - cycles);
+	DISPATCH();
+
+service:
+	cpu.cycles += cycles;
+	owed += cycles;
+	cycles = 0;
+	// Settle up with the timer once a chunk's worth of cycles is owed.
+	// cycle_wait returns 1 if a quit event is pending.
+	if (owed >= chunk)
+	{
+		core_metrics_publish(&metrics, &cpu, instructions, interrupts);
+		if (cycle_wait(owed, &cpu)) return NULL;
+		owed = 0;
+	}
+	deadline = scheduler_run(&cpu);
+	switch (cpu.interrupt_enable_flag << 1 | cpu.halt_flag)
+	{
+	case 4: // Interrupt pending, not halted.
+		// EI takes effect after the opcode following it, so run
+		// exactly one more opcode and then come back here.
+		--cpu.interrupt_enable_flag;
+		budget = 1;
+		DISPATCH();
+	case 0: // Interrupt disabled, not halted.
+		budget = cycles_until(deadline, cpu.cycles, chunk - owed);
+		DISPATCH();
+	case 5: // Interrupt pending, halted.
+		--cpu.interrupt_enable_flag;
+		// FALLTHRU
+	case 3: // Interrupt enabled, halted.
+		if (interrupt_pending(cpu.interrupts)) goto interrupt_execution;
+		// FALLTHRU
+	case 1: // Interrupt disabled, halted.
+		// Sleep until there's an interrupt, reset or quit to wake up
+		// for, or the next timed event's due, and then catch up on the
+		// time it took.
+		cycles += halt_wait(&cpu, deadline - cpu.cycles);
+		goto service;
+	case 2: // Interrupt enabled, not halted.
+		if (interrupt_pending(cpu.interrupts)) goto interrupt_execution;
+		budget = cycles_until(deadline, cpu.cycles, chunk - owed);
+		DISPATCH();
+	default:
+		cycles += chunk;
+		goto service;
+	}
+
+interrupt_execution:
+	rst			  = interrupt_acknowledge(cpu.interrupts);
+	cpu.halt_flag		  = 0;
+	cpu.interrupt_enable_flag = 0;
+#ifdef VERBOSE
+	fprintf(stderr, "INTRPT: ");
+#endif
+	// We don't advance PC for interrupts, though they can jump us.
+	cycles += interrupt_hook(&rst, &cpu, opcodes[rst]);
+	++interrupts;
+	TRACE_EXECUTE();
+	goto service;
+}
@@ -0,0 +1,132 @@
+extern "C"
+{
+#include "alu_tables.h"
+#include "cpu.h"
+}
+#include "gtest/gtest.h"
+
+/* These tests check every entry of the ALU tables against the 8080's flag
+ * rules, worked out here from scratch rather than with the helpers the tables
+ * are built from.
+ */
+
+static uint8_t zsp(uint8_t value)
+{
+	uint8_t ones = 0;
+	for (int bit = 0; bit < 8; ++bit) ones += (value >> bit) & 1;
+	return (value & 0x80 ? SIGN_FLAG : 0) | (value ? 0 : ZERO_FLAG)
+	       | (ones % 2 ? 0 : PARITY_FLAG);
+}
+
+TEST(AluTables, ZSP)
+{
+	for (int value = 0; value < 256; ++value)
+		ASSERT_EQ(zsp_table[value], zsp(value)) << "value " << value;
+	EXPECT_EQ(zsp_table[0], ZERO_FLAG | PARITY_FLAG);
+	EXPECT_EQ(zsp_table[0x80], SIGN_FLAG);
+	EXPECT_EQ(zsp_table[0x03], PARITY_FLAG);
+}
+
+TEST(AluTables, Add)
+{
+	for (int carry = 0; carry < 2; ++carry)
+		for (int a = 0; a < 256; ++a)
+			for (int b = 0; b < 256; ++b)
+			{
+				int sum	       = a + b + carry;
+				uint8_t result = sum;
+				uint8_t flags  = zsp(result)
+						| (sum > 0xff ? CARRY_FLAG : 0)
+						| ((a & 0xf) + (b & 0xf) + carry
+										> 0xf
+								? AUX_CARRY_FLAG
+								: 0);
+				ASSERT_EQ(add_table[carry][a][b],
+						result << 8 | flags)
+						<< a << " + " << b << " + "
+						<< carry;
+			}
+}
+
+TEST(AluTables, Sub)
+{
+	for (int borrow = 0; borrow < 2; ++borrow)
+		for (int a = 0; a < 256; ++a)
+			for (int b = 0; b < 256; ++b)
+			{
+				uint8_t result = a - b - borrow;
+				// The 8080 subtracts by adding the complement,
+				// so the aux carry is the carry out of bit 3
+				// of that addition.
+				uint8_t flags = zsp(result)
+						| (a < b + borrow ? CARRY_FLAG
+								  : 0)
+						| ((a & 0xf) + (~b & 0xf)
+										+ !borrow
+										> 0xf
+								? AUX_CARRY_FLAG
+								: 0);
+				ASSERT_EQ(sub_table[borrow][a][b],
+						result << 8 | flags)
+						<< a << " - " << b << " - "
+						<< borrow;
+			}
+}
+
+TEST(AluTables, DAA)
+{
+	for (int aux_carry = 0; aux_carry < 2; ++aux_carry)
+		for (int carry = 0; carry < 2; ++carry)
+			for (int a = 0; a < 256; ++a)
+			{
+				uint8_t in_flags =
+						(aux_carry ? AUX_CARRY_FLAG : 0)
+						| (carry ? CARRY_FLAG : 0);
+				int adjust	  = 0;
+				uint8_t out_carry = carry;
+				if ((a & 0xf) > 9 || aux_carry) adjust = 0x06;
+				if (a + adjust > 0x9f || carry)
+				{
+					adjust |= 0x60;
+					out_carry = 1;
+				}
+				uint8_t result = a + adjust;
+				uint8_t flags  = zsp(result)
+						| (out_carry ? CARRY_FLAG : 0)
+						| ((a & 0xf) + (adjust & 0xf)
+										> 0xf
+								? AUX_CARRY_FLAG
+								: 0);
+				ASSERT_EQ(daa_table[DAA_INDEX(in_flags)][a],
+						result << 8 | flags)
+						<< "A " << a << " AC "
+						<< aux_carry << " CY " << carry;
+			}
+	// 0x9a is "100" in BCD after a binary add, and should carry.
+	EXPECT_EQ(daa_table[0][0x9a], ZERO_FLAG | PARITY_FLAG | AUX_CARRY_FLAG
+						      | CARRY_FLAG);
+}
+
+TEST(AluTables, Conditions)
+{
+	// In opcode order: NZ, Z, NC, C, PO, PE, P, M.
+	const uint8_t flag[8] = {ZERO_FLAG,
+			ZERO_FLAG,
+			CARRY_FLAG,
+			CARRY_FLAG,
+			PARITY_FLAG,
+			PARITY_FLAG,
+			SIGN_FLAG,
+			SIGN_FLAG};
+	for (int condition = 0; condition < 8; ++condition)
+		for (int flags = 0; flags < 256; ++flags)
+		{
+			bool set = flags & flag[condition];
+			// The odd numbered conditions test for the flag being
+			// set, the even numbered ones for it being clear.
+			bool expected = condition & 1 ? set : !set;
+			ASSERT_EQ(condition_table[condition][flags], expected)
+					<< "condition " << condition
+					<< " flags " << flags;
+		}
+}
@@ -0,0 +1,192 @@
+extern "C"
+{
+#include "block_cache.h"
+#include "cpu.h"
+#include "opcode_array.h"
+#include "opcode_size.h"
+}
+#include "gtest/gtest.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+class BlockCache : public ::testing::Test
+{
+      protected:
+	// Two spare bytes, so operands of an opcode at 0xffff can be read.
+	std::vector<uint8_t> memory = std::vector<uint8_t>(0x10002);
+	uint8_t rom_mask[1]	    = {0};
+	struct block_cache* cache;
+
+	void SetUp() override
+	{
+		cache = block_cache_create();
+		ASSERT_NE(cache, nullptr);
+	}
+	void TearDown() override { block_cache_destroy(cache); }
+
+	// Runs blocks until the CPU halts.
+	void run(struct cpu_state* cpu)
+	{
+		for (int i = 0; i < 1000 && !cpu->halt_flag; ++i)
+			block_cache_run(cache, cpu);
+		ASSERT_TRUE(cpu->halt_flag);
+	}
+};
+
+// Stands in for IN and OUT, since there's no hardware library to handle them.
+static int no_io(const uint8_t* opcode, struct cpu_state* cpu)
+{
+	(void) opcode;
+	(void) cpu;
+	return 10;
+}
+
+/* Runs the same random program a block at a time through the cache, and an
+ * opcode at a time through the opcode array, and checks the two agree after
+ * every block.  Random code writes all over memory, itself included, so this
+ * gives invalidation a good workout too.
+ */
+TEST_F(BlockCache, MatchesStepping)
+{
+	srand(8080);
+	for (auto& byte : memory) byte = rand();
+	// Random code will write IN and OUT opcodes sooner or later.
+	auto in = opcodes[0xdb], out = opcodes[0xd3];
+	opcodes[0xdb] = opcodes[0xd3] = no_io;
+	std::vector<uint8_t> step_memory = memory;
+
+	struct cpu_state cpu
+	{
+		.memory = memory.data(), .rom_mask = rom_mask, .mask_shift = 16,
+		.block_cache = cache,
+	};
+	struct cpu_state stepped
+	{
+		.memory = step_memory.data(), .rom_mask = rom_mask,
+		.mask_shift = 16,
+	};
+
+	for (int block = 0; block < 20000; ++block)
+	{
+		// Random code tends to end up going round in a tight loop, so
+		// every so often we jump somewhere else.
+		if (block % 16 == 0) cpu.pc = stepped.pc = rand();
+		int cycles	   = block_cache_run(cache, &cpu);
+		int stepped_cycles = 0;
+		while (stepped_cycles < cycles)
+		{
+			const uint8_t* opcode = stepped.memory + stepped.pc;
+			stepped.pc += get_opcode_size(*opcode);
+			stepped_cycles += opcodes[*opcode](opcode, &stepped);
+		}
+		ASSERT_EQ(cycles, stepped_cycles) << "block " << block;
+		ASSERT_EQ(cpu.pc, stepped.pc) << "block " << block;
+		ASSERT_EQ(cpu.psw, stepped.psw) << "block " << block;
+		ASSERT_EQ(cpu.bc, stepped.bc) << "block " << block;
+		ASSERT_EQ(cpu.de, stepped.de) << "block " << block;
+		ASSERT_EQ(cpu.hl, stepped.hl) << "block " << block;
+		ASSERT_EQ(cpu.sp, stepped.sp) << "block " << block;
+	}
+	opcodes[0xdb] = in;
+	opcodes[0xd3] = out;
+	EXPECT_EQ(memory, step_memory);
+	EXPECT_GT(cache->stats.hits, 0u);
+	EXPECT_GT(cache->stats.invalidations, 0u);
+}
+
+TEST_F(BlockCache, Loop)
+{
+	const uint8_t program[] = {
+			0x06, 0x0a,	  // 0x00	MVI B, 10
+			0x3c,		  // 0x02	INR A
+			0x05,		  // 0x03	DCR B
+			0xc2, 0x02, 0x00, // 0x04	JNZ 0x0002
+			0x76,		  // 0x07	HLT
+	};
+	memcpy(memory.data(), program, sizeof(program));
+	struct cpu_state cpu
+	{
+		.memory = memory.data(), .rom_mask = rom_mask, .mask_shift = 16,
+		.block_cache = cache,
+	};
+	run(&cpu);
+	EXPECT_EQ(cpu.a, 10);
+	EXPECT_EQ(cpu.b, 0);
+	// The first trip decodes the whole thing as one block; the loop body
+	// is decoded on the second trip and then reused.
+	EXPECT_EQ(cache->stats.misses, 3u);
+	EXPECT_EQ(cache->stats.hits, 8u);
+	EXPECT_EQ(cache->stats.invalidations, 0u);
+}
+
+TEST_F(BlockCache, OverwritesOwnBlock)
+{
+	const uint8_t program[] = {
+			0x21, 0x07, 0x00, // 0x00	LXI H, 0x0007
+			0x36, 0x3c,	  // 0x03	MVI M, 0x3c (INR A)
+			0x00,		  // 0x05	NOP
+			0x00,		  // 0x06	NOP
+			0x00,		  // 0x07	NOP, soon to be INR A
+			0x76,		  // 0x08	HLT
+	};
+	memcpy(memory.data(), program, sizeof(program));
+	struct cpu_state cpu
+	{
+		.memory = memory.data(), .rom_mask = rom_mask, .mask_shift = 16,
+		.block_cache = cache,
+	};
+	EXPECT_EQ(block_cache_run(cache, &cpu), 10 + 10);
+	EXPECT_EQ(cpu.pc, 0x0005);
+	run(&cpu);
+	EXPECT_EQ(cpu.a, 1);
+	EXPECT_EQ(cache->stats.invalidations, 1u);
+	EXPECT_EQ(cache->stats.misses, 2u);
+}
+
+TEST_F(BlockCache, WritesToROMDoNotInvalidate)
+{
+	const uint8_t program[] = {
+			0x21, 0x07, 0x00, // 0x00	LXI H, 0x0007
+			0x36, 0x3c,	  // 0x03	MVI M, 0x3c
+			0x00,		  // 0x05	NOP
+			0x00,		  // 0x06	NOP
+			0x00,		  // 0x07	NOP
+			0x76,		  // 0x08	HLT
+	};
+	memcpy(memory.data(), program, sizeof(program));
+	rom_mask[0] = 1;
+	struct cpu_state cpu
+	{
+		.memory = memory.data(), .rom_mask = rom_mask, .mask_shift = 16,
+		.block_cache = cache,
+	};
+	run(&cpu);
+	EXPECT_EQ(cpu.a, 0);
+	EXPECT_EQ(cache->stats.invalidations, 0u);
+	EXPECT_EQ(cache->stats.misses, 1u);
+}
+
+TEST_F(BlockCache, InvalidatePage)
+{
+	memory[0x00fe] = 0x00; // NOP
+	memory[0x00ff] = 0x00; // NOP
+	memory[0x0100] = 0xc3; // JMP 0x0000
+	struct cpu_state cpu
+	{
+		.memory = memory.data(), .rom_mask = rom_mask, .mask_shift = 16,
+		.block_cache = cache,
+	};
+	cpu.pc = 0x00fe;
+	block_cache_run(cache, &cpu);
+	EXPECT_NE(cache->blocks[0x00fe], nullptr);
+	EXPECT_EQ(cache->code_pages[0], 1);
+	EXPECT_EQ(cache->code_pages[1], 1);
+
+	// The block starts on page 0, but runs into page 1.
+	block_cache_invalidate(cache, 1);
+	EXPECT_EQ(cache->blocks[0x00fe], nullptr);
+	EXPECT_EQ(cache->code_pages[1], 0);
+	EXPECT_EQ(cache->stats.invalidations, 1u);
+}
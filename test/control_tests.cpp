@@ -0,0 +1,178 @@
+extern "C"
+{
+#include "control.h"
+#include "cpu.h"
+#include "cycle_timer.h"
+}
+#include "gtest/gtest.h"
+
+#include <chrono>
+#include <thread>
+
+TEST(Control, TakeReset)
+{
+	uint8_t control = 0;
+	EXPECT_EQ(control_pending(&control), 0);
+	control_request(&control, CONTROL_RESET);
+	EXPECT_EQ(control_pending(&control), CONTROL_RESET);
+	EXPECT_EQ(control_take(&control, CONTROL_RESET), CONTROL_RESET);
+	EXPECT_EQ(control_take(&control, CONTROL_RESET), 0);
+	EXPECT_EQ(control_pending(&control), 0);
+}
+
+// Once asked for, a quit stays asked for.
+TEST(Control, QuitStays)
+{
+	uint8_t control = 0;
+	control_request(&control, CONTROL_QUIT | CONTROL_RESET);
+	EXPECT_EQ(control_take(&control, CONTROL_QUIT | CONTROL_RESET),
+			CONTROL_RESET);
+	EXPECT_EQ(control_pending(&control), CONTROL_QUIT);
+}
+
+// Turbo is a switch, not a request: taking requests leaves it alone.
+TEST(Control, TurboToggles)
+{
+	uint8_t control = 0;
+	control_toggle(&control, CONTROL_TURBO);
+	EXPECT_EQ(control_pending(&control), CONTROL_TURBO);
+	EXPECT_EQ(control_pending(&control) & CONTROL_REQUESTS, 0);
+	control_request(&control, CONTROL_RESET);
+	EXPECT_EQ(control_take(&control, CONTROL_RESET), CONTROL_RESET);
+	EXPECT_EQ(control_pending(&control), CONTROL_TURBO);
+	control_toggle(&control, CONTROL_TURBO);
+	EXPECT_EQ(control_pending(&control), 0);
+}
+
+// Runs the given number of 2MHz chunks, and returns how long they took.
+static double time_chunks(struct cpu_state* cpu, int chunks)
+{
+	const auto start = std::chrono::steady_clock::now();
+	for (int i = 0; i < chunks; ++i)
+		EXPECT_EQ(cycle_wait(CYCLE_CHUNK, cpu), 0);
+	const std::chrono::duration<double> elapsed =
+			std::chrono::steady_clock::now() - start;
+	return elapsed.count();
+}
+
+// A second's worth of them.
+static double second_of_chunks(struct cpu_state* cpu)
+{
+	return time_chunks(cpu, 2000000 / CYCLE_CHUNK);
+}
+
+// cycle_wait acts on the control word once it's owed a chunk.
+TEST(Control, CycleWait)
+{
+	uint8_t control = CONTROL_RESET;
+	struct cycle_timer timer;
+	cycle_timer_init(&timer, 1, CYCLE_TIME, CYCLE_CHUNK, 0);
+	struct cpu_state cpu
+	{
+		.control = &control, .pc = 0x1234, .halt_flag = 1,
+		.interrupt_enable_flag = 1, .timer = &timer,
+	};
+	EXPECT_EQ(cycle_wait(CYCLE_CHUNK, &cpu), 0);
+	EXPECT_EQ(cpu.pc, 0);
+	EXPECT_EQ(cpu.halt_flag, 0);
+	EXPECT_EQ(cpu.interrupt_enable_flag, 0);
+	EXPECT_EQ(control, 0);
+
+	control_request(&control, CONTROL_QUIT);
+	EXPECT_EQ(cycle_wait(CYCLE_CHUNK, &cpu), 1);
+	EXPECT_EQ(cycle_wait(CYCLE_CHUNK, &cpu), 1);
+}
+
+// In turbo, a throttled cycle_wait doesn't sleep, and it doesn't try to make
+// up for lost time afterwards either.
+TEST(Control, Turbo)
+{
+	uint8_t control = CONTROL_TURBO;
+	struct cycle_timer timer;
+	cycle_timer_init(&timer, 1, CYCLE_TIME, CYCLE_CHUNK, 0);
+	struct cpu_state cpu
+	{
+		.control = &control, .pc = 0x1234, .timer = &timer,
+	};
+	EXPECT_LT(second_of_chunks(&cpu), 0.5);
+	EXPECT_EQ(cpu.pc, 0x1234);
+	control_toggle(&control, CONTROL_TURBO);
+	EXPECT_EQ(cycle_wait(CYCLE_CHUNK, &cpu), 0);
+	const auto start = std::chrono::steady_clock::now();
+	EXPECT_EQ(cycle_wait(CYCLE_CHUNK * 100, &cpu), 0);
+	const std::chrono::duration<double> elapsed =
+			std::chrono::steady_clock::now() - start;
+	EXPECT_GE(elapsed.count(), CYCLE_CHUNK * 100 * CYCLE_TIME / 2e9);
+}
+
+// Unthrottled, cycle_wait never sleeps, but still acts on requests.
+TEST(Control, Unthrottled)
+{
+	uint8_t control = 0;
+	struct cycle_timer timer;
+	cycle_timer_init(&timer, 0, CYCLE_TIME, CYCLE_CHUNK, 0);
+	struct cpu_state cpu
+	{
+		.control = &control, .pc = 0x1234, .timer = &timer,
+	};
+	EXPECT_LT(second_of_chunks(&cpu), 0.5);
+	EXPECT_EQ(cpu.pc, 0x1234);
+	control_request(&control, CONTROL_RESET);
+	EXPECT_EQ(cycle_wait(1, &cpu), 0);
+	EXPECT_EQ(cpu.pc, 0);
+	control_request(&control, CONTROL_QUIT);
+	EXPECT_EQ(cycle_wait(1, &cpu), 1);
+}
+
+// Each machine keeps its own time.  Having fallen 300ms behind, one catches
+// up by running the next 200ms without sleeping, but another that's rebased
+// runs them at the proper speed.  A reset rebases too.
+TEST(Control, Rebase)
+{
+	uint8_t control[2] = {};
+	struct cycle_timer timer[2];
+	struct cpu_state cpu[2] = {{.control = &control[0], .timer = &timer[0]},
+			{.control = &control[1], .timer = &timer[1]}};
+	for (int i = 0; i < 2; ++i)
+	{
+		cycle_timer_init(&timer[i], 1, CYCLE_TIME, CYCLE_CHUNK, 0);
+		EXPECT_EQ(cycle_wait(CYCLE_CHUNK, &cpu[i]), 0);
+	}
+	std::this_thread::sleep_for(std::chrono::milliseconds(300));
+	const int chunks = 400000 / CYCLE_CHUNK;
+	EXPECT_LT(time_chunks(&cpu[0], chunks), 0.1);
+	cycle_timer_rebase(&timer[1]);
+	EXPECT_GE(time_chunks(&cpu[1], chunks), 0.15);
+
+	std::this_thread::sleep_for(std::chrono::milliseconds(300));
+	control_request(&control[0], CONTROL_RESET);
+	EXPECT_GE(time_chunks(&cpu[0], chunks), 0.15);
+}
+
+// Fast-forward and slow motion: a throttled CPU runs its chunks at the rate
+// it's set to, from the next one, within RATE_MIN and RATE_MAX.
+TEST(Control, Rate)
+{
+	uint8_t control = 0;
+	struct cycle_timer timer;
+	cycle_timer_init(&timer, 1, CYCLE_TIME, CYCLE_CHUNK, 0);
+	struct cpu_state cpu
+	{
+		.control = &control, .timer = &timer,
+	};
+	EXPECT_EQ(cycle_timer_rate(&timer), RATE_NORMAL);
+	cycle_timer_set_rate(&timer, 400);
+	EXPECT_EQ(cycle_wait(CYCLE_CHUNK, &cpu), 0);
+	const double fast = second_of_chunks(&cpu);
+	EXPECT_GE(fast, 0.2);
+	EXPECT_LT(fast, 0.4);
+
+	cycle_timer_set_rate(&timer, 50);
+	EXPECT_EQ(cycle_wait(CYCLE_CHUNK, &cpu), 0);
+	EXPECT_GE(time_chunks(&cpu, 200000 / CYCLE_CHUNK), 0.18);
+
+	cycle_timer_set_rate(&timer, 0);
+	EXPECT_EQ(cycle_timer_rate(&timer), RATE_MIN);
+	cycle_timer_set_rate(&timer, RATE_MAX * 2);
+	EXPECT_EQ(cycle_timer_rate(&timer), RATE_MAX);
+}
@@ -0,0 +1,134 @@
+#ifndef CORE_HARNESS
+#define CORE_HARNESS
+
+extern "C"
+{
+#include "control.h"
+#include "cpu.h"
+#include "cycle_timer.h"
+#include "hw_func_pointers.h"
+#include "interrupts.h"
+#include "memory_map.h"
+#include "metrics.h"
+#include "scheduler.h"
+}
+#include "gtest/gtest.h"
+
+#include <cstring>
+#include <vector>
+
+/* For the tests which run a whole core, the one they're parameterized on, up
+ * to the point where the program, the hardware or a timed event asks it to
+ * quit.  The fixture has everything a core needs apart from memory; a test
+ * sets up whatever it's testing (a memory map, timed events, metrics) and
+ * calls run_core().
+ */
+
+// The interrupt hook, since there's no hardware library to provide one.
+static inline int pass_through(const uint8_t* opcode,
+		struct cpu_state* cpu,
+		int (*op_func)(const uint8_t*, struct cpu_state*))
+{
+	return op_func(opcode, cpu);
+}
+
+class CoreHarness : public ::testing::TestWithParam<void* (*) (void*)>
+{
+      protected:
+	uint8_t control = 0;
+	struct interrupt_controller interrupts;
+	struct scheduler scheduler;
+	struct cycle_timer timer;
+
+	void SetUp() override
+	{
+		interrupt_controller_init(&interrupts);
+		interrupt_hook = pass_through;
+		scheduler_init(&scheduler);
+		// Unthrottled, so the tests take no longer than they must.
+		cycle_timer_init(&timer, 0, CYCLE_TIME, CYCLE_CHUNK, 0);
+	}
+	void TearDown() override { interrupt_controller_destroy(&interrupts); }
+
+	/* Runs the core on memory, whose ROM map marks, if there's a map, and
+	 * which is all RAM if not.
+	 */
+	void run_core(uint8_t* memory,
+			struct memory_map* map  = NULL,
+			struct metrics* metrics = NULL)
+	{
+		uint8_t* const rom_mask	 = map ? map->type : &no_rom;
+		const uint8_t mask_shift = map ? PAGE_SHIFT : 16;
+		struct system_resources res = {.interrupts = &interrupts,
+				.control		   = &control,
+				.memory			   = memory,
+				.rom_mask		   = rom_mask,
+				.mask_shift		   = mask_shift,
+				.scheduler		   = &scheduler,
+				.timer			   = &timer,
+				.metrics		   = metrics,
+				.memory_map		   = map};
+		GetParam()(&res);
+	}
+
+      private:
+	uint8_t no_rom = 0;
+};
+
+/* A program interrupted by an event every INTERRUPT_PERIOD cycles, as the
+ * taito library raises its video interrupts.  RST 1 counts itself in B and
+ * goes back to what it was doing; the event logs when it ran, and asks to
+ * quit after INTERRUPT_EVENTS of them.
+ */
+#define INTERRUPT_PERIOD (1000)
+#define INTERRUPT_EVENTS (50)
+
+struct timer_log
+{
+	std::vector<uint64_t> times;
+	std::vector<uint8_t> taken; // B, which counts the interrupts taken.
+};
+
+class PeriodicInterrupts : public CoreHarness
+{
+      protected:
+	uint8_t memory[MAX_MEMORY] = {};
+	struct timer_log events;
+
+	void run(const uint8_t* program,
+			size_t size,
+			struct metrics* metrics = NULL)
+	{
+		const uint8_t rst1[] = {0x04, 0xfb, 0xc9}; // INR B; EI; RET
+		std::memcpy(memory, program, size);
+		std::memcpy(memory + 0x08, rst1, sizeof(rst1));
+		scheduler_init(&scheduler);
+		scheduler_add(&scheduler, INTERRUPT_PERIOD, interrupt, &events);
+		run_core(memory, NULL, metrics);
+	}
+
+      private:
+	static uint64_t interrupt(
+			struct cpu_state* cpu, void* data, uint64_t when)
+	{
+		struct timer_log* log = (struct timer_log*) data;
+		log->times.push_back(cpu->cycles);
+		log->taken.push_back(cpu->b);
+		if (log->times.size() >= INTERRUPT_EVENTS)
+		{
+			control_request(cpu->control, CONTROL_QUIT);
+			return 0;
+		}
+		interrupt_raise(cpu->interrupts, 1);
+		return when + INTERRUPT_PERIOD;
+	}
+};
+
+// Every core which runs without a recompiled ROM.
+#define CORE_ROUTINES                                   \
+	::testing::Values(cpu_thread_routine,           \
+			threaded_cpu_thread_routine,    \
+			block_cpu_thread_routine,       \
+			dynarec_cpu_thread_routine)
+
+#endif
@@ -0,0 +1,311 @@
+extern "C"
+{
+#include "block_cache.h"
+#include "cpu.h"
+#include "dynarec.h"
+#include "lazy_flags.h"
+#include "opcode_array.h"
+#include "opcode_size.h"
+}
+#include "gtest/gtest.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+class Dynarec : public ::testing::Test
+{
+      protected:
+	// Two spare bytes, so operands of an opcode at 0xffff can be read.
+	std::vector<uint8_t> memory = std::vector<uint8_t>(0x10002);
+	uint8_t rom_mask[1]	    = {0};
+	struct dynarec* dynarec;
+
+	void SetUp() override
+	{
+		dynarec = dynarec_create();
+#if !defined(__x86_64__) || !defined(__linux__)
+		GTEST_SKIP() << "The dynarec is x86-64 Linux only.";
+#endif
+		ASSERT_NE(dynarec, nullptr);
+		// Translate everything, so that's what gets tested.
+		dynarec->hot_runs = 0;
+	}
+	void TearDown() override { dynarec_destroy(dynarec); }
+
+	// Runs translated code until the CPU halts.
+	void run(struct cpu_state* cpu)
+	{
+		for (int i = 0; i < 1000 && !cpu->halt_flag; ++i)
+			dynarec_run(dynarec, cpu, 1000);
+		ASSERT_TRUE(cpu->halt_flag);
+	}
+
+	void matches_stepping(bool lazy);
+};
+
+// Stands in for IN and OUT, since there's no hardware library to handle them.
+static int no_io(const uint8_t* opcode, struct cpu_state* cpu)
+{
+	(void) opcode;
+	(void) cpu;
+	return 10;
+}
+
+/* Runs the same random program through the dynarec, with a random budget
+ * each time, and an opcode at a time through the opcode array, and checks
+ * the two agree every time the dynarec comes back.  As with the block cache
+ * test, random code overwrites itself all the time, so this covers leaving
+ * translated code after a write to code as well.
+ */
+void Dynarec::matches_stepping(bool lazy)
+{
+	srand(8080);
+	for (auto& byte : memory) byte = rand();
+	int (*saved[256])(const uint8_t*, struct cpu_state*);
+	memcpy(saved, opcodes, sizeof(saved));
+	// Random code will write IN and OUT opcodes sooner or later.
+	opcodes[0xdb] = opcodes[0xd3] = no_io;
+	if (lazy) install_lazy_flag_opcodes(opcodes);
+	std::vector<uint8_t> step_memory = memory;
+
+	struct cpu_state cpu
+	{
+		.memory = memory.data(), .rom_mask = rom_mask, .mask_shift = 16,
+		.block_cache = dynarec->cache,
+	};
+	struct cpu_state stepped
+	{
+		.memory = step_memory.data(), .rom_mask = rom_mask,
+		.mask_shift = 16,
+	};
+
+	for (int run = 0; run < 20000; ++run)
+	{
+		// Random code tends to end up going round in a tight loop, so
+		// every so often we jump somewhere else.
+		if (run % 16 == 0) cpu.pc = stepped.pc = rand();
+		int cycles = dynarec_run(dynarec, &cpu, rand() % 200 + 1);
+		int stepped_cycles = 0;
+		while (stepped_cycles < cycles)
+		{
+			const uint8_t* opcode = stepped.memory + stepped.pc;
+			stepped.pc += get_opcode_size(*opcode);
+			stepped_cycles += opcodes[*opcode](opcode, &stepped);
+		}
+		materialize_flags(&cpu);
+		materialize_flags(&stepped);
+		ASSERT_EQ(cycles, stepped_cycles) << "run " << run;
+		ASSERT_EQ(cpu.pc, stepped.pc) << "run " << run;
+		ASSERT_EQ(cpu.psw, stepped.psw) << "run " << run;
+		ASSERT_EQ(cpu.bc, stepped.bc) << "run " << run;
+		ASSERT_EQ(cpu.de, stepped.de) << "run " << run;
+		ASSERT_EQ(cpu.hl, stepped.hl) << "run " << run;
+		ASSERT_EQ(cpu.sp, stepped.sp) << "run " << run;
+	}
+	memcpy(opcodes, saved, sizeof(saved));
+	EXPECT_EQ(memory, step_memory);
+	EXPECT_GT(dynarec->stats.translations, 0u);
+	EXPECT_GT(dynarec->cache->stats.invalidations, 0u);
+}
+
+TEST_F(Dynarec, MatchesStepping) { matches_stepping(false); }
+
+TEST_F(Dynarec, MatchesSteppingLazy) { matches_stepping(true); }
+
+TEST_F(Dynarec, Loop)
+{
+	const uint8_t program[] = {
+			0x06, 0x0a,	  // 0x00	MVI B, 10
+			0x3c,		  // 0x02	INR A
+			0x05,		  // 0x03	DCR B
+			0xc2, 0x02, 0x00, // 0x04	JNZ 0x0002
+			0x76,		  // 0x07	HLT
+	};
+	memcpy(memory.data(), program, sizeof(program));
+	struct cpu_state cpu
+	{
+		.memory = memory.data(), .rom_mask = rom_mask, .mask_shift = 16,
+		.block_cache = dynarec->cache,
+	};
+	int cycles = 0;
+	for (int i = 0; i < 10 && !cpu.halt_flag; ++i)
+		cycles += dynarec_run(dynarec, &cpu, 1000);
+	EXPECT_TRUE(cpu.halt_flag);
+	EXPECT_EQ(cycles, 7 + 10 * (5 + 5 + 10) + 7);
+	EXPECT_EQ(cpu.a, 10);
+	EXPECT_EQ(cpu.b, 0);
+	// We come back to C whenever the next block hasn't been translated yet,
+	// but once the loop body has been, it jumps straight back to itself.
+	EXPECT_EQ(dynarec->stats.translations, 3u);
+	EXPECT_EQ(dynarec->stats.entries, 3u);
+}
+
+TEST_F(Dynarec, InterpretsColdBlocks)
+{
+	const uint8_t program[] = {
+			0x3c,		  // 0x00	INR A
+			0xc3, 0x00, 0x00, // 0x01	JMP 0x0000
+	};
+	memcpy(memory.data(), program, sizeof(program));
+	struct cpu_state cpu
+	{
+		.memory = memory.data(), .rom_mask = rom_mask, .mask_shift = 16,
+		.block_cache = dynarec->cache,
+	};
+	dynarec->hot_runs = 3;
+	for (int i = 0; i < 3; ++i)
+		EXPECT_EQ(dynarec_run(dynarec, &cpu, 100), 15);
+	EXPECT_EQ(dynarec->stats.translations, 0u);
+	EXPECT_EQ(dynarec_run(dynarec, &cpu, 100), 105);
+	EXPECT_EQ(dynarec->stats.translations, 1u);
+	EXPECT_EQ(cpu.a, 10);
+}
+
+TEST_F(Dynarec, StopsWhenBudgetIsSpent)
+{
+	const uint8_t program[] = {
+			0x3c,		  // 0x00	INR A
+			0xc3, 0x00, 0x00, // 0x01	JMP 0x0000
+	};
+	memcpy(memory.data(), program, sizeof(program));
+	struct cpu_state cpu
+	{
+		.memory = memory.data(), .rom_mask = rom_mask, .mask_shift = 16,
+		.block_cache = dynarec->cache,
+	};
+	// Each trip is 15 cycles; we finish the trip which spends the budget.
+	EXPECT_EQ(dynarec_run(dynarec, &cpu, 100), 105);
+	EXPECT_EQ(cpu.a, 7);
+	EXPECT_EQ(cpu.pc, 0x0000);
+}
+
+TEST_F(Dynarec, OverwritesOwnBlock)
+{
+	const uint8_t program[] = {
+			0x21, 0x07, 0x00, // 0x00	LXI H, 0x0007
+			0x36, 0x3c,	  // 0x03	MVI M, 0x3c (INR A)
+			0x00,		  // 0x05	NOP
+			0x00,		  // 0x06	NOP
+			0x00,		  // 0x07	NOP, soon to be INR A
+			0x76,		  // 0x08	HLT
+	};
+	memcpy(memory.data(), program, sizeof(program));
+	struct cpu_state cpu
+	{
+		.memory = memory.data(), .rom_mask = rom_mask, .mask_shift = 16,
+		.block_cache = dynarec->cache,
+	};
+	EXPECT_EQ(dynarec_run(dynarec, &cpu, 1000), 10 + 10);
+	EXPECT_EQ(cpu.pc, 0x0005);
+	run(&cpu);
+	EXPECT_EQ(cpu.a, 1);
+	EXPECT_EQ(dynarec->cache->stats.invalidations, 1u);
+	EXPECT_EQ(dynarec->stats.translations, 2u);
+}
+
+TEST_F(Dynarec, LeavesForIO)
+{
+	const uint8_t program[] = {
+			0x3c,		  // 0x00	INR A
+			0xd3, 0x01,	  // 0x01	OUT 1
+			0x3c,		  // 0x03	INR A
+			0x76,		  // 0x04	HLT
+	};
+	memcpy(memory.data(), program, sizeof(program));
+	auto out      = opcodes[0xd3];
+	opcodes[0xd3] = no_io;
+	struct cpu_state cpu
+	{
+		.memory = memory.data(), .rom_mask = rom_mask, .mask_shift = 16,
+		.block_cache = dynarec->cache,
+	};
+	EXPECT_EQ(dynarec_run(dynarec, &cpu, 1000), 5 + 10);
+	EXPECT_EQ(cpu.pc, 0x0003);
+	EXPECT_EQ(cpu.a, 1);
+	run(&cpu);
+	opcodes[0xd3] = out;
+	EXPECT_EQ(cpu.a, 2);
+}
+
+// The permissions /proc/self/maps gives the mapping holding address.
+static std::string permissions(const void* address)
+{
+	FILE* maps = fopen("/proc/self/maps", "r");
+	if (!maps) return "";
+	unsigned long start, end;
+	char perms[5];
+	std::string found;
+	while (fscanf(maps, "%lx-%lx %4s%*[^\n]", &start, &end, perms) == 3)
+	{
+		if ((uintptr_t) address >= start && (uintptr_t) address < end)
+			found = perms;
+	}
+	fclose(maps);
+	return found;
+}
+
+TEST_F(Dynarec, NeverWritableAndExecutable)
+{
+	const uint8_t program[] = {
+			0x3c, // 0x00	INR A
+			0x76, // 0x01	HLT
+	};
+	memcpy(memory.data(), program, sizeof(program));
+	struct cpu_state cpu
+	{
+		.memory = memory.data(), .rom_mask = rom_mask, .mask_shift = 16,
+		.block_cache = dynarec->cache,
+	};
+	run(&cpu);
+	EXPECT_EQ(cpu.a, 1);
+	const struct block* block = dynarec->cache->blocks[0x0000];
+	ASSERT_NE(block, nullptr);
+	ASSERT_NE(block->native, nullptr);
+
+	// It's run from the executable view, and written through the other.
+	const uint8_t* native = (const uint8_t*) block->native;
+	EXPECT_GE(native, dynarec->code);
+	EXPECT_LT(native, dynarec->code + DYNAREC_BUFFER_SIZE);
+	EXPECT_EQ(permissions(native).substr(0, 3), "r-x");
+	EXPECT_EQ(permissions(dynarec->buffer).substr(0, 3), "rw-");
+}
+
+TEST_F(Dynarec, PerfMap)
+{
+	const std::string name
+			= "/tmp/perf-" + std::to_string(getpid()) + ".map";
+	// Off by default.
+	EXPECT_EQ(dynarec->perf_map, nullptr);
+
+	unlink(name.c_str());
+	dynarec_perf_map = 1;
+	struct dynarec* mapped = dynarec_create();
+	dynarec_perf_map = 0;
+	ASSERT_NE(mapped, nullptr);
+	EXPECT_NE(mapped->perf_map, nullptr);
+	mapped->hot_runs = 0;
+	const uint8_t program[] = {
+			0x3c, // 0x00	INR A
+			0x76, // 0x01	HLT
+	};
+	memcpy(memory.data(), program, sizeof(program));
+	struct cpu_state cpu
+	{
+		.memory = memory.data(), .rom_mask = rom_mask, .mask_shift = 16,
+		.block_cache = mapped->cache,
+	};
+	dynarec_run(mapped, &cpu, 1000);
+	dynarec_destroy(mapped);
+
+	FILE* map = fopen(name.c_str(), "r");
+	ASSERT_NE(map, nullptr);
+	char line[128] = {0};
+	EXPECT_NE(fgets(line, sizeof(line), map), nullptr);
+	fclose(map);
+	unlink(name.c_str());
+	EXPECT_NE(strstr(line, "8080_block_0000"), nullptr) << line;
+}
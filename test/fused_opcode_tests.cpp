@@ -0,0 +1,230 @@
+extern "C"
+{
+#include "block_cache.h"
+#include "cpu.h"
+#include "fused_opcodes.h"
+#include "lazy_flags.h"
+#include "opcode_array.h"
+#include "opcode_size.h"
+}
+#include "gtest/gtest.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+class FusedOpcodes : public ::testing::Test
+{
+      protected:
+	// Two spare bytes, so operands of an opcode at 0xffff can be read.
+	std::vector<uint8_t> memory = std::vector<uint8_t>(0x10002);
+	uint8_t rom_mask[1]	    = {0};
+	struct block_cache* cache;
+
+	void SetUp() override
+	{
+		cache = block_cache_create();
+		ASSERT_NE(cache, nullptr);
+		cache->fuse = 1;
+	}
+	void TearDown() override { block_cache_destroy(cache); }
+
+	/* Runs what's in memory from 0 to a HLT through the cache, and again
+	 * an opcode at a time through the opcode array, and checks the two
+	 * agree at every block boundary.
+	 */
+	void compare_with_stepping()
+	{
+		std::vector<uint8_t> step_memory = memory;
+		struct cpu_state cpu
+		{
+			.memory = memory.data(), .rom_mask = rom_mask,
+			.mask_shift = 16, .block_cache = cache,
+		};
+		struct cpu_state stepped
+		{
+			.memory = step_memory.data(), .rom_mask = rom_mask,
+			.mask_shift = 16,
+		};
+		for (int block = 0; block < 10000 && !cpu.halt_flag; ++block)
+		{
+			int cycles	   = block_cache_run(cache, &cpu);
+			int stepped_cycles = 0;
+			while (stepped_cycles < cycles)
+			{
+				const uint8_t* opcode =
+						stepped.memory + stepped.pc;
+				stepped.pc += get_opcode_size(*opcode);
+				stepped_cycles += opcodes[*opcode](
+						opcode, &stepped);
+			}
+			ASSERT_EQ(cycles, stepped_cycles) << "block " << block;
+			ASSERT_EQ(cpu.pc, stepped.pc) << "block " << block;
+			ASSERT_EQ(cpu.a, stepped.a) << "block " << block;
+			ASSERT_EQ(lazy_flags_value(&cpu),
+					lazy_flags_value(&stepped))
+					<< "block " << block;
+			ASSERT_EQ(cpu.bc, stepped.bc) << "block " << block;
+			ASSERT_EQ(cpu.de, stepped.de) << "block " << block;
+			ASSERT_EQ(cpu.hl, stepped.hl) << "block " << block;
+		}
+		EXPECT_TRUE(cpu.halt_flag);
+		EXPECT_EQ(memory, step_memory);
+	}
+};
+
+// Every kind of fused sequence, in loops.
+static const uint8_t program[] = {
+		0x11, 0x00, 0x10, // 0x00	LXI D, 0x1000
+		0x21, 0x00, 0x20, // 0x03	LXI H, 0x2000
+		0x06, 0x10,	  // 0x06	MVI B, 16
+		0x1a,		  // 0x08	LDAX D
+		0x77,		  // 0x09	MOV M,A
+		0x23,		  // 0x0a	INX H
+		0x13,		  // 0x0b	INX D
+		0x05,		  // 0x0c	DCR B
+		0xc2, 0x08, 0x00, // 0x0d	JNZ 0x0008
+		0x21, 0x00, 0x20, // 0x10	LXI H, 0x2000
+		0x0e, 0x10,	  // 0x13	MVI C, 16
+		0x7e,		  // 0x15	MOV A,M
+		0x23,		  // 0x16	INX H
+		0xfe, 0x0b,	  // 0x17	CPI 0x0b
+		0xca, 0x21, 0x00, // 0x19	JZ 0x0021
+		0x0d,		  // 0x1c	DCR C
+		0xc2, 0x15, 0x00, // 0x1d	JNZ 0x0015
+		0x76,		  // 0x20	HLT
+		0xfe, 0x0c,	  // 0x21	CPI 0x0c
+		0xc2, 0x15, 0x00, // 0x23	JNZ 0x0015
+		0x76,		  // 0x26	HLT
+};
+
+TEST_F(FusedOpcodes, MatchesStepping)
+{
+	memcpy(memory.data(), program, sizeof(program));
+	for (int i = 0; i < 16; ++i) memory[0x1000 + i] = i;
+	compare_with_stepping();
+	// The copy, both DCR; JNZs, MOV A,M; INX H, and both CPIs.  The loops
+	// are entered by falling into them, so the first four are decoded
+	// twice: once in the block leading up to the loop, once in the loop.
+	EXPECT_EQ(cache->stats.fused, 10u);
+	EXPECT_EQ(memory[0x200f], 0x0f);
+}
+
+TEST_F(FusedOpcodes, MatchesSteppingLazy)
+{
+	auto eager = std::vector<int (*)(const uint8_t*, struct cpu_state*)>(
+			opcodes, opcodes + 256);
+	install_lazy_flag_opcodes(opcodes);
+	memcpy(memory.data(), program, sizeof(program));
+	for (int i = 0; i < 16; ++i) memory[0x1000 + i] = i;
+	compare_with_stepping();
+	std::copy(eager.begin(), eager.end(), opcodes);
+	EXPECT_EQ(cache->stats.fused, 10u);
+}
+
+TEST_F(FusedOpcodes, Off)
+{
+	cache->fuse = 0;
+	memcpy(memory.data(), program, sizeof(program));
+	compare_with_stepping();
+	EXPECT_EQ(cache->stats.fused, 0u);
+}
+
+TEST_F(FusedOpcodes, NotAtTheTopOfMemory)
+{
+	int (*handler)(const uint8_t*, struct cpu_state*) = nullptr;
+	const uint8_t cpi_jz[] = {0xfe, 0x00, 0xca, 0x00, 0x00};
+	EXPECT_EQ(match_fused_opcodes(cpi_jz, 5, &handler), 2);
+	EXPECT_NE(handler, nullptr);
+	EXPECT_EQ(match_fused_opcodes(cpi_jz, 4, &handler), 0);
+}
+
+// The copy's MOV M,A overwrites its own INX D with INR A.
+TEST_F(FusedOpcodes, CopyOverwritesItself)
+{
+	const uint8_t copy[] = {
+			0x11, 0x00, 0x10, // 0x00	LXI D, 0x1000
+			0x21, 0x0b, 0x00, // 0x03	LXI H, 0x000b
+			0x00,		  // 0x06	NOP
+			0x00,		  // 0x07	NOP
+			0x1a,		  // 0x08	LDAX D
+			0x77,		  // 0x09	MOV M,A
+			0x23,		  // 0x0a	INX H
+			0x13,		  // 0x0b	INX D, soon to be INR A
+			0x76,		  // 0x0c	HLT
+	};
+	memcpy(memory.data(), copy, sizeof(copy));
+	memory[0x1000] = 0x3c;
+	compare_with_stepping();
+	EXPECT_EQ(cache->stats.invalidations, 1u);
+	EXPECT_EQ(memory[0x000b], 0x3c);
+}
+
+// Stands in for IN and OUT, since there's no hardware library to handle them.
+static int no_io(const uint8_t* opcode, struct cpu_state* cpu)
+{
+	(void) opcode;
+	(void) cpu;
+	return 10;
+}
+
+/* As BlockCache.MatchesStepping, on random code with plenty of fusable
+ * sequences planted in it.
+ */
+TEST_F(FusedOpcodes, MatchesSteppingRandom)
+{
+	static const std::vector<std::vector<uint8_t>> sequences = {
+			{0x05, 0xc2}, // DCR B; JNZ
+			{0x3d, 0xc2}, // DCR A; JNZ
+			{0x7e, 0x23}, // MOV A,M; INX H
+			{0x1a, 0x77, 0x23, 0x13},
+			{0xfe, 0x00, 0xca},
+			{0xfe, 0x00, 0xc2},
+	};
+	srand(8085);
+	for (auto& byte : memory) byte = rand();
+	for (int i = 0; i < 4000; ++i)
+	{
+		const auto& sequence = sequences[rand() % sequences.size()];
+		uint16_t at	     = rand() & 0xfff0;
+		std::copy(sequence.begin(), sequence.end(), &memory[at]);
+	}
+	auto in = opcodes[0xdb], out = opcodes[0xd3];
+	opcodes[0xdb] = opcodes[0xd3] = no_io;
+	std::vector<uint8_t> step_memory = memory;
+
+	struct cpu_state cpu
+	{
+		.memory = memory.data(), .rom_mask = rom_mask, .mask_shift = 16,
+		.block_cache = cache,
+	};
+	struct cpu_state stepped
+	{
+		.memory = step_memory.data(), .rom_mask = rom_mask,
+		.mask_shift = 16,
+	};
+
+	for (int block = 0; block < 20000; ++block)
+	{
+		if (block % 16 == 0) cpu.pc = stepped.pc = rand() & 0xfff0;
+		int cycles	   = block_cache_run(cache, &cpu);
+		int stepped_cycles = 0;
+		while (stepped_cycles < cycles)
+		{
+			const uint8_t* opcode = stepped.memory + stepped.pc;
+			stepped.pc += get_opcode_size(*opcode);
+			stepped_cycles += opcodes[*opcode](opcode, &stepped);
+		}
+		ASSERT_EQ(cycles, stepped_cycles) << "block " << block;
+		ASSERT_EQ(cpu.pc, stepped.pc) << "block " << block;
+		ASSERT_EQ(cpu.psw, stepped.psw) << "block " << block;
+		ASSERT_EQ(cpu.bc, stepped.bc) << "block " << block;
+		ASSERT_EQ(cpu.de, stepped.de) << "block " << block;
+		ASSERT_EQ(cpu.hl, stepped.hl) << "block " << block;
+		ASSERT_EQ(cpu.sp, stepped.sp) << "block " << block;
+	}
+	opcodes[0xdb] = in;
+	opcodes[0xd3] = out;
+	EXPECT_EQ(memory, step_memory);
+	EXPECT_GT(cache->stats.fused, 0u);
+}
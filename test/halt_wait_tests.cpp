@@ -0,0 +1,103 @@
+extern "C"
+{
+#include "control.h"
+#include "cpu.h"
+#include "cycle_timer.h"
+#include "interrupts.h"
+}
+#include "gtest/gtest.h"
+
+#include <chrono>
+#include <thread>
+
+class HaltWait : public ::testing::Test
+{
+      protected:
+	struct interrupt_controller interrupts;
+	uint8_t control = 0;
+	struct cycle_timer timer;
+	struct cpu_state cpu
+	{
+		.interrupts = &interrupts, .control = &control, .halt_flag = 1,
+		.timer = &timer,
+	};
+
+	void SetUp() override
+	{
+		interrupt_controller_init(&interrupts);
+		cycle_timer_init(&timer, 1, CYCLE_TIME, CYCLE_CHUNK, 0);
+	}
+	void TearDown() override { interrupt_controller_destroy(&interrupts); }
+
+	// After 20ms, raises RST 1, as the front end would.
+	static void interrupt_later(HaltWait* test)
+	{
+		std::this_thread::sleep_for(std::chrono::milliseconds(20));
+		interrupt_raise(&test->interrupts, 1);
+	}
+	// Or asks to quit.
+	static void quit_later(HaltWait* test)
+	{
+		std::this_thread::sleep_for(std::chrono::milliseconds(20));
+		control_request(&test->control, CONTROL_QUIT);
+		interrupt_wake(&test->interrupts);
+	}
+};
+
+TEST_F(HaltWait, WakesForAnInterrupt)
+{
+	cpu.interrupt_enable_flag = 1;
+	std::thread front_end	  = std::thread(interrupt_later, this);
+	int cycles		  = halt_wait(&cpu, UINT64_MAX);
+	front_end.join();
+	EXPECT_TRUE(interrupt_pending(&interrupts));
+	// About 20ms passed, and the CPU should have been charged for it.
+	EXPECT_GE(cycles, 20000000 / CYCLE_TIME);
+	EXPECT_LT(cycles, HALT_WAIT_LIMIT / CYCLE_TIME);
+}
+
+TEST_F(HaltWait, WakesForQuit)
+{
+	std::thread front_end = std::thread(quit_later, this);
+	int cycles	      = halt_wait(&cpu, UINT64_MAX);
+	front_end.join();
+	EXPECT_GE(cycles, CYCLE_CHUNK);
+	EXPECT_LT(cycles, HALT_WAIT_LIMIT / CYCLE_TIME);
+}
+
+// A reset that's already pending is acted on straight away, with a chunk's
+// worth of cycles so that cycle_wait sees it.
+TEST_F(HaltWait, ResetPending)
+{
+	control = CONTROL_RESET;
+	EXPECT_EQ(halt_wait(&cpu, UINT64_MAX), CYCLE_CHUNK);
+}
+
+// With interrupts disabled, an interrupt doesn't wake the CPU.
+TEST_F(HaltWait, InterruptsDisabled)
+{
+	interrupt_raise(&interrupts, 1);
+	int cycles = halt_wait(&cpu, UINT64_MAX);
+	EXPECT_GE(cycles, HALT_WAIT_LIMIT / CYCLE_TIME);
+}
+
+// Halted until a timed event, the CPU is charged exactly up to it.
+TEST_F(HaltWait, UntilTimer)
+{
+	const auto start = std::chrono::steady_clock::now();
+	EXPECT_EQ(halt_wait(&cpu, 20000), 20000);
+	const std::chrono::duration<double> elapsed =
+			std::chrono::steady_clock::now() - start;
+	EXPECT_GE(elapsed.count(), 20000 * CYCLE_TIME / 1e9);
+}
+
+// Unthrottled, it doesn't wait for the event at all.
+TEST_F(HaltWait, UntilTimerUnthrottled)
+{
+	cycle_timer_init(&timer, 0, CYCLE_TIME, CYCLE_CHUNK, 0);
+	const auto start = std::chrono::steady_clock::now();
+	EXPECT_EQ(halt_wait(&cpu, 20000), 20000);
+	const std::chrono::duration<double> elapsed =
+			std::chrono::steady_clock::now() - start;
+	EXPECT_LT(elapsed.count(), 20000 * CYCLE_TIME / 1e9);
+}
@@ -0,0 +1,31 @@
+extern "C"
+{
+#include "histogram.h"
+}
+#include "gtest/gtest.h"
+
+TEST(Histogram, Buckets)
+{
+	struct histogram histogram = {};
+	histogram_record(&histogram, 0);
+	histogram_record(&histogram, 1);
+	histogram_record(&histogram, 2);
+	histogram_record(&histogram, 3);
+	histogram_record(&histogram, 1000);
+	histogram_record(&histogram, 1023);
+	histogram_record(&histogram, 1024);
+	EXPECT_EQ(histogram.counts[0], 1u);
+	EXPECT_EQ(histogram.counts[1], 1u);
+	EXPECT_EQ(histogram.counts[2], 2u);
+	EXPECT_EQ(histogram.counts[10], 2u);
+	EXPECT_EQ(histogram.counts[11], 1u);
+}
+
+// Anything too long for the others goes in the last bucket.
+TEST(Histogram, Overflow)
+{
+	struct histogram histogram = {};
+	histogram_record(&histogram, UINT64_MAX);
+	histogram_record(&histogram, UINT64_C(1) << HISTOGRAM_BUCKETS);
+	EXPECT_EQ(histogram.counts[HISTOGRAM_BUCKETS - 1], 2u);
+}
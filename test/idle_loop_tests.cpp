@@ -0,0 +1,188 @@
+extern "C"
+{
+#include "cpu.h"
+#include "idle_loop.h"
+#include "memory_map.h"
+}
+#include "gtest/gtest.h"
+
+#include <cstring>
+#include <vector>
+
+class IdleLoop : public ::testing::Test
+{
+      protected:
+	std::vector<uint8_t> memory = std::vector<uint8_t>(0x10002);
+	struct cpu_state cpu
+	{
+		.memory = memory.data(), .mask_shift = 16,
+	};
+	struct idle_loop idle = {};
+
+	void load(const uint8_t* code, size_t size)
+	{
+		memcpy(memory.data() + 0x100, code, size);
+		cpu.pc = 0x100;
+	}
+};
+
+// The loop Space Invaders waits for the screen interrupts in.
+static const uint8_t wait_loop[] = {
+		0x3a, 0xc0, 0x20, // 0x100	LDA 0x20c0
+		0xa7,		  // 0x103	ANA A
+		0xc2, 0x00, 0x01, // 0x104	JNZ 0x0100
+};
+
+TEST_F(IdleLoop, Detected)
+{
+	load(wait_loop, sizeof(wait_loop));
+	memory[0x20c0] = 1;
+	cpu.a	       = 1;
+	EXPECT_EQ(idle_loop_pass(&idle, &cpu, 0x104, 1000), 0);
+	// LDA, ANA A and JNZ.
+	EXPECT_EQ(idle_loop_pass(&idle, &cpu, 0x104, 1027), 27);
+	EXPECT_EQ(idle_loop_pass(&idle, &cpu, 0x104, 1054), 27);
+}
+
+TEST_F(IdleLoop, SkipsWholePasses)
+{
+	load(wait_loop, sizeof(wait_loop));
+	EXPECT_EQ(idle_loop_pass(&idle, &cpu, 0x104, 0), 0);
+	int pass = idle_loop_pass(&idle, &cpu, 0x104, 27);
+	ASSERT_EQ(pass, 27);
+	EXPECT_EQ(idle_loop_skip(&idle, pass, 100), 108);
+	EXPECT_EQ(idle_loop_skip(&idle, pass, 0), 0);
+	EXPECT_EQ(idle.skipped, 108u);
+	// Carrying on from the end of the skip, it's still idle.
+	EXPECT_EQ(idle_loop_pass(&idle, &cpu, 0x104, 27 + 108 + 27), 27);
+}
+
+TEST_F(IdleLoop, NeedsConsecutivePasses)
+{
+	load(wait_loop, sizeof(wait_loop));
+	EXPECT_EQ(idle_loop_pass(&idle, &cpu, 0x104, 0), 0);
+	// Something else, such as an interrupt, ran in between.
+	EXPECT_EQ(idle_loop_pass(&idle, &cpu, 0x104, 38), 0);
+	EXPECT_EQ(idle_loop_pass(&idle, &cpu, 0x104, 65), 27);
+}
+
+TEST_F(IdleLoop, NeedsTheSameState)
+{
+	load(wait_loop, sizeof(wait_loop));
+	EXPECT_EQ(idle_loop_pass(&idle, &cpu, 0x104, 0), 0);
+	cpu.a = 2;
+	EXPECT_EQ(idle_loop_pass(&idle, &cpu, 0x104, 27), 0);
+	cpu.interrupt_enable_flag = 1;
+	EXPECT_EQ(idle_loop_pass(&idle, &cpu, 0x104, 54), 0);
+	EXPECT_EQ(idle_loop_pass(&idle, &cpu, 0x104, 81), 27);
+}
+
+// A delay loop changes B every pass, so it's never idle.
+TEST_F(IdleLoop, CountingLoop)
+{
+	const uint8_t delay[] = {
+			0x05,		  // 0x100	DCR B
+			0xc2, 0x00, 0x01, // 0x101	JNZ 0x0100
+	};
+	load(delay, sizeof(delay));
+	for (int pass = 0; pass < 8; ++pass)
+	{
+		--cpu.b;
+		EXPECT_EQ(idle_loop_pass(&idle, &cpu, 0x101, pass * 15), 0);
+	}
+}
+
+TEST_F(IdleLoop, SideEffects)
+{
+	const std::vector<std::vector<uint8_t>> loops = {
+			// STA 0x2000
+			{0x32, 0x00, 0x20, 0xc3, 0x00, 0x01},
+			// IN 1; ANI 1
+			{0xdb, 0x01, 0xe6, 0x01, 0xca, 0x00, 0x01},
+			// PUSH B; POP B
+			{0xc5, 0xc1, 0xc3, 0x00, 0x01},
+			// EI
+			{0xfb, 0xc3, 0x00, 0x01},
+			// CALL 0x0200
+			{0xcd, 0x00, 0x02, 0xc3, 0x00, 0x01},
+	};
+	for (const auto& loop : loops)
+	{
+		load(loop.data(), loop.size());
+		uint16_t jump = 0x100 + loop.size() - 3;
+		EXPECT_EQ(idle_loop_pass(&idle, &cpu, jump, 0), 0);
+		EXPECT_EQ(idle_loop_pass(&idle, &cpu, jump, idle.cycles), 0)
+				<< "loop at " << &loop - loops.data();
+	}
+}
+
+static uint8_t status_read(void* data, uint16_t address)
+{
+	(void) data;
+	(void) address;
+	return 0;
+}
+
+// Reading a device polls it, and each poll has to reach it.
+TEST_F(IdleLoop, ReadsDevice)
+{
+	struct memory_map map;
+	memory_map_init(&map, memory.data());
+	memory_map_add_mmio(&map, 0x2000, 0x100, status_read, NULL, NULL);
+	struct cpu_state polling
+	{
+		.memory = memory.data(), .pc = 0x100, .mask_shift = 16,
+		.memory_map = &map,
+	};
+	const std::vector<std::vector<uint8_t>> loops = {
+			// LDA 0x20c0
+			{0x3a, 0xc0, 0x20, 0xa7, 0xc2, 0x00, 0x01},
+			// LHLD 0x1fff, of which 0x2000 is the device's
+			{0x2a, 0xff, 0x1f, 0x7c, 0xa7, 0xc2, 0x00, 0x01},
+			// MOV A,M, which might be anywhere
+			{0x7e, 0xa7, 0xc2, 0x00, 0x01},
+	};
+	for (const auto& loop : loops)
+	{
+		load(loop.data(), loop.size());
+		uint16_t jump = 0x100 + loop.size() - 3;
+		EXPECT_EQ(idle_loop_pass(&idle, &polling, jump, 0), 0);
+		EXPECT_EQ(idle_loop_pass(&idle, &polling, jump, idle.cycles), 0)
+				<< "loop at " << &loop - loops.data();
+	}
+
+	// But memory that isn't the device's is just memory.
+	const uint8_t ram_loop[] = {0x3a, 0xc0, 0x30, 0xa7, 0xc2, 0x00, 0x01};
+	load(ram_loop, sizeof(ram_loop));
+	EXPECT_EQ(idle_loop_pass(&idle, &polling, 0x104, 1000), 0);
+	EXPECT_EQ(idle_loop_pass(&idle, &polling, 0x104, 1027), 27);
+	// And without a device to read, so is M.
+	memory_map_set(&map, 0x2000, 0x100, PAGE_RAM);
+	const uint8_t m_loop[] = {0x7e, 0xa7, 0xc2, 0x00, 0x01};
+	load(m_loop, sizeof(m_loop));
+	EXPECT_EQ(idle_loop_pass(&idle, &polling, 0x102, 2000), 0);
+	EXPECT_EQ(idle_loop_pass(&idle, &polling, 0x102, 2021), 21);
+}
+
+TEST_F(IdleLoop, JumpsElsewhere)
+{
+	load(wait_loop, sizeof(wait_loop));
+	// The jump has to lead back to where we are.
+	cpu.pc = 0x103;
+	EXPECT_EQ(idle_loop_pass(&idle, &cpu, 0x104, 0), 0);
+	EXPECT_EQ(idle_loop_pass(&idle, &cpu, 0x104, 10), 0);
+	// And has to be a jump.
+	memory[0x104] = 0xcd;
+	cpu.pc	      = 0x100;
+	EXPECT_EQ(idle_loop_pass(&idle, &cpu, 0x104, 0), 0);
+	EXPECT_EQ(idle_loop_pass(&idle, &cpu, 0x104, 34), 0);
+}
+
+TEST_F(IdleLoop, Rewritten)
+{
+	load(wait_loop, sizeof(wait_loop));
+	EXPECT_EQ(idle_loop_pass(&idle, &cpu, 0x104, 0), 0);
+	// An interrupt handler turns the ANA A into a STAX B.
+	memory[0x103] = 0x02;
+	EXPECT_EQ(idle_loop_pass(&idle, &cpu, 0x104, 27), 0);
+}
@@ -0,0 +1,84 @@
+extern "C"
+{
+#include "interrupts.h"
+}
+#include "gtest/gtest.h"
+
+#include <thread>
+#include <vector>
+
+class Interrupts : public ::testing::Test
+{
+      protected:
+	struct interrupt_controller interrupts;
+
+	void SetUp() override { interrupt_controller_init(&interrupts); }
+	void TearDown() override { interrupt_controller_destroy(&interrupts); }
+};
+
+TEST_F(Interrupts, NoneWaiting)
+{
+	EXPECT_FALSE(interrupt_pending(&interrupts));
+	EXPECT_EQ(interrupt_acknowledge(&interrupts), 0);
+}
+
+TEST_F(Interrupts, RstOpcodes)
+{
+	for (uint8_t vector = 0; vector < 8; ++vector)
+	{
+		interrupt_raise(&interrupts, vector);
+		EXPECT_TRUE(interrupt_pending(&interrupts));
+		EXPECT_EQ(interrupt_acknowledge(&interrupts),
+				0xc7 | vector << 3);
+		EXPECT_FALSE(interrupt_pending(&interrupts));
+	}
+	interrupt_raise_opcode(&interrupts, 0xd7);
+	EXPECT_EQ(interrupt_acknowledge(&interrupts), 0xd7);
+}
+
+// RST 0 goes first, RST 7 last, whatever order they were raised in.
+TEST_F(Interrupts, Priority)
+{
+	interrupt_raise(&interrupts, 7);
+	interrupt_raise(&interrupts, 2);
+	interrupt_raise(&interrupts, 5);
+	interrupt_raise(&interrupts, 1);
+	EXPECT_EQ(interrupt_acknowledge(&interrupts), 0xcf); // RST 1
+	interrupt_raise(&interrupts, 0);
+	EXPECT_EQ(interrupt_acknowledge(&interrupts), 0xc7); // RST 0
+	EXPECT_EQ(interrupt_acknowledge(&interrupts), 0xd7); // RST 2
+	EXPECT_EQ(interrupt_acknowledge(&interrupts), 0xef); // RST 5
+	EXPECT_EQ(interrupt_acknowledge(&interrupts), 0xff); // RST 7
+	EXPECT_EQ(interrupt_acknowledge(&interrupts), 0);
+}
+
+// Raising an interrupt that's already waiting doesn't queue a second one.
+TEST_F(Interrupts, RaisedTwice)
+{
+	interrupt_raise(&interrupts, 1);
+	interrupt_raise(&interrupts, 1);
+	EXPECT_EQ(interrupt_acknowledge(&interrupts), 0xcf);
+	EXPECT_EQ(interrupt_acknowledge(&interrupts), 0);
+}
+
+static void raise_many(struct interrupt_controller* interrupts, uint8_t vector)
+{
+	for (int i = 0; i < 100000; ++i) interrupt_raise(interrupts, vector);
+}
+
+// Producers on several threads, while the CPU takes them: nothing is lost.
+TEST_F(Interrupts, ManyProducers)
+{
+	std::vector<std::thread> producers;
+	for (uint8_t vector = 0; vector < 8; ++vector)
+		producers.emplace_back(raise_many, &interrupts, vector);
+	uint8_t seen = 0;
+	for (int i = 0; i < 1000; ++i)
+		if (uint8_t rst = interrupt_acknowledge(&interrupts))
+			seen |= 1 << (rst >> 3 & 7);
+	for (auto& producer : producers) producer.join();
+	while (uint8_t rst = interrupt_acknowledge(&interrupts))
+		seen |= 1 << (rst >> 3 & 7);
+	EXPECT_EQ(seen, 0xff);
+	EXPECT_FALSE(interrupt_pending(&interrupts));
+}
@@ -0,0 +1,576 @@
+extern "C"
+{
+#include "control.h"
+#include "cpu.h"
+#include "cycle_timer.h"
+#include "memory_map.h"
+#include "opcode_array.h"
+#include "scheduler.h"
+}
+#include "core_harness.h"
+#include "gtest/gtest.h"
+
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <vector>
+
+// A device with one register at the start of each page it's given, which
+// counts its reads, and keeps the last value written.
+struct device
+{
+	int reads;
+	int writes;
+	uint16_t address;
+	uint8_t value;
+	uint8_t* control; // Asks to quit after QUIT_AFTER writes, if set.
+};
+
+#define QUIT_AFTER (1000)
+
+static uint8_t device_read(void* data, uint16_t address)
+{
+	struct device* dev = (struct device*) data;
+	dev->address	   = address;
+	return (uint8_t) ++dev->reads;
+}
+
+static void device_write(void* data, uint16_t address, uint8_t value)
+{
+	struct device* dev = (struct device*) data;
+	dev->address	   = address;
+	dev->value	   = value;
+	if (++dev->writes == QUIT_AFTER && dev->control)
+		control_request(dev->control, CONTROL_QUIT);
+}
+
+TEST(MemoryMap, Pages)
+{
+	std::vector<uint8_t> memory(MAX_MEMORY, 0x55);
+	struct memory_map map;
+	memory_map_init(&map, memory.data());
+	memory_map_set(&map, 0x0000, 0x2000, PAGE_ROM);
+	memory_map_set(&map, 0x4000, 0x100, PAGE_UNMAPPED);
+	EXPECT_EQ(map.type[0x1f], PAGE_ROM);
+	EXPECT_EQ(map.type[0x20], PAGE_RAM);
+	EXPECT_EQ(map.type[0x40], PAGE_UNMAPPED);
+	EXPECT_EQ(memory[0x4000], UNMAPPED_BYTE);
+	EXPECT_EQ(memory[0x40ff], UNMAPPED_BYTE);
+	EXPECT_EQ(memory[0x4100], 0x55);
+
+	struct device dev = {};
+	memory_map_add_mmio(&map, 0x6000, 0x200, device_read, NULL, &dev);
+	EXPECT_EQ(map.type[0x61], PAGE_MMIO);
+	EXPECT_TRUE(memory_map_mmio_reads(&map));
+	// Write-only devices don't make reads any slower.
+	memory_map_add_mmio(&map, 0x6000, 0x200, NULL, device_write, &dev);
+	EXPECT_FALSE(memory_map_mmio_reads(&map));
+	memory_map_set(&map, 0x6000, 0x200, PAGE_RAM);
+	EXPECT_EQ(map.mmio[0x60].write, nullptr);
+	EXPECT_FALSE(memory_map_mmio_reads(NULL));
+}
+
+// A .mask is just one way of marking ROM, a page or more at a time.
+TEST(MemoryMap, Mask)
+{
+	std::vector<uint8_t> memory(MAX_MEMORY);
+	struct memory_map map;
+	memory_map_init(&map, memory.data());
+	uint8_t mask[MAX_MEMORY >> 11] = {1, 0, 1};
+	EXPECT_EQ(memory_map_add_mask(&map, mask, 11), 0);
+	EXPECT_EQ(map.type[0x00], PAGE_ROM);
+	EXPECT_EQ(map.type[0x07], PAGE_ROM);
+	EXPECT_EQ(map.type[0x08], PAGE_RAM);
+	EXPECT_EQ(map.type[0x10], PAGE_ROM);
+	EXPECT_EQ(map.type[0x18], PAGE_RAM);
+	EXPECT_EQ(memory_map_add_mask(&map, mask, 7), -1);
+}
+
+static uint16_t remapped_start;
+static uint32_t remapped_length;
+
+static void note_remap(void* data, uint16_t start, uint32_t length)
+{
+	++*(int*) data;
+	remapped_start	= start;
+	remapped_length = length;
+}
+
+// Banks: a window onto a store bigger than the address space.
+TEST(MemoryMap, Banks)
+{
+	const long host_page = sysconf(_SC_PAGESIZE);
+	if (host_page > 0x1000) GTEST_SKIP();
+	struct memory_map map;
+	uint8_t* memory = memory_map_create(&map, 0x20000);
+	ASSERT_NE(memory, nullptr);
+	EXPECT_EQ(map.store_size, 0x20000u);
+	for (uint32_t bank = 0; bank < 0x20; ++bank)
+		map.store[bank * 0x1000] = bank;
+
+	// Misaligned windows, and windows that don't fit, are refused.
+	EXPECT_EQ(memory_map_add_window(&map, 0x1800, 0x1000), -1);
+	EXPECT_EQ(memory_map_add_window(&map, 0x2000, 0x4000), -1);
+	EXPECT_EQ(memory_map_add_window(&map, 0xf000, 0x2000), -1);
+	const int window = memory_map_add_window(&map, 0x3000, 0x1000);
+	ASSERT_EQ(window, 0);
+	EXPECT_EQ(memory_map_bank(&map, window), 3);
+	EXPECT_EQ(memory[0x3000], 3);
+
+	int remaps = 0;
+	memory_map_on_remap(&map, note_remap, &remaps);
+	ASSERT_EQ(memory_map_select_bank(&map, window, 0x1a), 0);
+	EXPECT_EQ(memory[0x3000], 0x1a);
+	EXPECT_EQ(remaps, 1);
+	EXPECT_EQ(remapped_start, 0x3000);
+	EXPECT_EQ(remapped_length, 0x1000u);
+	// Writes go to the bank, and stay there when it's switched out.
+	memory[0x3001] = 0x55;
+	EXPECT_EQ(map.store[0x1a001], 0x55);
+	ASSERT_EQ(memory_map_select_bank(&map, window, 3), 0);
+	EXPECT_EQ(memory[0x3001], 0);
+	EXPECT_EQ(remaps, 2);
+	// The rest of memory isn't touched.
+	EXPECT_EQ(memory[0x4000], 4);
+	// Switching to the bank it's showing does nothing.
+	ASSERT_EQ(memory_map_select_bank(&map, window, 3), 0);
+	EXPECT_EQ(remaps, 2);
+	EXPECT_EQ(memory_map_select_bank(&map, window, 0x20), -1);
+	EXPECT_EQ(memory_map_select_bank(&map, 1, 0), -1);
+	EXPECT_EQ(memory_map_bank(&map, window), 3);
+	memory_map_destroy(&map);
+
+	// Without a store, there's no banking.
+	std::vector<uint8_t> flat(MAX_MEMORY);
+	memory_map_init(&map, flat.data());
+	EXPECT_EQ(memory_map_add_window(&map, 0x3000, 0x1000), -1);
+}
+
+// Writes a ROM of size bytes, each the low byte of its address plus its bank.
+static std::string write_rom(size_t size)
+{
+	char path[] = "/tmp/8080_memory_map_test_XXXXXX";
+	const int fd = mkstemp(path);
+	std::vector<uint8_t> rom(size);
+	for (size_t i = 0; i < size; ++i)
+		rom[i] = (uint8_t) (i + (i >> 12));
+	if (write(fd, rom.data(), size) != (ssize_t) size) path[0] = 0;
+	close(fd);
+	return path;
+}
+
+// A ROM that fits in 64 KB is mapped from the file, copy-on-write.
+TEST(MemoryMap, LoadMapped)
+{
+	const std::string path = write_rom(5000);
+	ASSERT_NE(path, "");
+	int fd = open(path.c_str(), O_RDONLY);
+	struct memory_map map;
+	uint8_t* memory = memory_map_load(&map, fd, 0);
+	close(fd);
+	ASSERT_NE(memory, nullptr);
+	EXPECT_EQ(map.store_fd, -1);
+	EXPECT_EQ(map.store, memory);
+	EXPECT_EQ(memory[4999], (uint8_t) (4999 + 1));
+	EXPECT_EQ(memory[5000], 0);
+	EXPECT_EQ(memory[0xffff], 0);
+	// Nothing to bank.
+	EXPECT_EQ(memory_map_add_window(&map, 0x1000, 0x1000), -1);
+
+	// Writes stay in memory, and never reach the file.
+	memory[0]      = 0xaa;
+	memory[0xffff] = 0xbb;
+	memory_map_destroy(&map);
+	fd = open(path.c_str(), O_RDONLY);
+	uint8_t first = 0xff;
+	EXPECT_EQ(read(fd, &first, 1), 1);
+	EXPECT_EQ(first, 0);
+	close(fd);
+	unlink(path.c_str());
+}
+
+// A pipe can't be mapped, so it's read.
+TEST(MemoryMap, LoadPipe)
+{
+	int fds[2];
+	ASSERT_EQ(pipe(fds), 0);
+	const uint8_t rom[] = {0x3e, 0x42, 0x76};
+	ASSERT_EQ(write(fds[1], rom, sizeof(rom)), (ssize_t) sizeof(rom));
+	close(fds[1]);
+	struct memory_map map;
+	uint8_t* memory = memory_map_load(&map, fds[0], 0);
+	close(fds[0]);
+	ASSERT_NE(memory, nullptr);
+	EXPECT_EQ(memory[1], 0x42);
+	EXPECT_EQ(memory[3], 0);
+	memory_map_destroy(&map);
+}
+
+// A bigger one goes into a store, with the rest in the banks.
+TEST(MemoryMap, LoadBanked)
+{
+	if (sysconf(_SC_PAGESIZE) > 0x1000) GTEST_SKIP();
+	const std::string path = write_rom(0x18000);
+	ASSERT_NE(path, "");
+	const int fd = open(path.c_str(), O_RDONLY);
+	struct memory_map map;
+	uint8_t* memory = memory_map_load(&map, fd, 0);
+	close(fd);
+	unlink(path.c_str());
+	ASSERT_NE(memory, nullptr);
+	EXPECT_NE(map.store_fd, -1);
+	EXPECT_EQ(map.store_size, 0x18000u);
+	EXPECT_EQ(memory[0x1001], (uint8_t) (1 + 1));
+	const int window = memory_map_add_window(&map, 0x1000, 0x1000);
+	ASSERT_EQ(memory_map_select_bank(&map, window, 0x17), 0);
+	EXPECT_EQ(memory[0x1001], (uint8_t) (1 + 0x17));
+	EXPECT_EQ(memory_map_select_bank(&map, window, 0x18), -1);
+	memory_map_destroy(&map);
+}
+
+// The dirty bitmap: nothing's marked until something asks, and taking it
+// clears it.
+TEST(MemoryMap, Dirty)
+{
+	if (sysconf(_SC_PAGESIZE) > 0x1000) GTEST_SKIP();
+	struct memory_map map;
+	ASSERT_NE(memory_map_create(&map, 0x20000), nullptr);
+	const int window = memory_map_add_window(&map, 0x3000, 0x1000);
+	memory_map_mark_dirty(&map, 0x0000, 0x100);
+	EXPECT_EQ(memory_map_take_dirty(&map, NULL), 0);
+
+	memory_map_track_dirty(&map, 1);
+	EXPECT_TRUE(memory_map_tracking(&map));
+	memory_map_mark_dirty(&map, 0x40ff, 2);
+	memory_map_note_write(&map, 0xffff);
+	EXPECT_TRUE(memory_map_page_dirty(&map, 0x40));
+	EXPECT_TRUE(memory_map_page_dirty(&map, 0x41));
+	EXPECT_FALSE(memory_map_page_dirty(&map, 0x42));
+	uint64_t dirty[DIRTY_WORDS];
+	EXPECT_EQ(memory_map_take_dirty(&map, dirty), 3);
+	EXPECT_EQ(dirty[1], (uint64_t) 3);
+	EXPECT_EQ(dirty[3], (uint64_t) 1 << 63);
+	EXPECT_FALSE(memory_map_page_dirty(&map, 0x40));
+	EXPECT_EQ(memory_map_take_dirty(&map, NULL), 0);
+
+	// What the CPU sees of a window changes with its bank.
+	ASSERT_EQ(memory_map_select_bank(&map, window, 0x10), 0);
+	EXPECT_EQ(memory_map_take_dirty(&map, dirty), 0x10);
+	EXPECT_EQ(dirty[0], (uint64_t) 0xffff << 0x30);
+
+	memory_map_track_dirty(&map, 0);
+	EXPECT_FALSE(memory_map_tracking(&map));
+	EXPECT_FALSE(memory_map_tracking(NULL));
+	memory_map_mark_dirty(&map, 0x0000, 0x100);
+	EXPECT_EQ(memory_map_take_dirty(&map, NULL), 0);
+	memory_map_destroy(&map);
+}
+
+// The opcodes that touch memory, on each kind of page, through both sets of
+// handlers.
+class MemoryMapOpcodes
+    : public ::testing::TestWithParam<int (*const*) (
+		      const uint8_t*, struct cpu_state*)>
+{
+      protected:
+	std::vector<uint8_t> memory = std::vector<uint8_t>(MAX_MEMORY);
+	struct memory_map map;
+	struct device dev = {};
+
+	void SetUp() override
+	{
+		memory_map_init(&map, memory.data());
+		memory_map_set(&map, 0x0000, 0x1000, PAGE_ROM);
+		memory_map_set(&map, 0x1000, 0x1000, PAGE_UNMAPPED);
+		memory_map_add_mmio(&map,
+				0x2000,
+				0x100,
+				device_read,
+				device_write,
+				&dev);
+	}
+
+	int run(struct cpu_state* cpu, std::vector<uint8_t> opcode)
+	{
+		return GetParam()[opcode[0]](opcode.data(), cpu);
+	}
+};
+
+TEST_P(MemoryMapOpcodes, Reads)
+{
+	struct cpu_state cpu
+	{
+		.memory = memory.data(), .rom_mask = map.type, .hl = 0x2010,
+		.mask_shift = PAGE_SHIFT, .memory_map = &map,
+	};
+	run(&cpu, {0x7e}); // MOV A,M
+	EXPECT_EQ(cpu.a, 1);
+	EXPECT_EQ(dev.address, 0x2010);
+	run(&cpu, {0x86}); // ADD M
+	EXPECT_EQ(cpu.a, 3);
+	run(&cpu, {0x3a, 0x20, 0x20}); // LDA 0x2020
+	EXPECT_EQ(cpu.a, 3);
+	EXPECT_EQ(dev.address, 0x2020);
+	cpu.sp = 0x20fe;
+	run(&cpu, {0xc1}); // POP B
+	EXPECT_EQ(cpu.bc, 0x0504);
+	EXPECT_EQ(dev.address, 0x20ff);
+
+	cpu.hl = 0x1234;
+	run(&cpu, {0x7e}); // MOV A,M
+	EXPECT_EQ(cpu.a, UNMAPPED_BYTE);
+	EXPECT_EQ(dev.reads, 5);
+}
+
+TEST_P(MemoryMapOpcodes, Writes)
+{
+	memory[0x0100] = 0x12;
+	memory[0x3000] = 0x12;
+	struct cpu_state cpu
+	{
+		.memory = memory.data(), .rom_mask = map.type, .hl = 0x0100,
+		.mask_shift = PAGE_SHIFT, .memory_map = &map,
+	};
+	cpu.a = 0x99;
+	run(&cpu, {0x77}); // MOV M,A
+	EXPECT_EQ(memory[0x0100], 0x12);
+	cpu.hl = 0x1000;
+	run(&cpu, {0x77}); // MOV M,A
+	EXPECT_EQ(memory[0x1000], UNMAPPED_BYTE);
+	cpu.hl = 0x3000;
+	run(&cpu, {0x34}); // INR M
+	EXPECT_EQ(memory[0x3000], 0x13);
+	EXPECT_EQ(dev.writes, 0);
+
+	run(&cpu, {0x32, 0x40, 0x20}); // STA 0x2040
+	EXPECT_EQ(dev.address, 0x2040);
+	EXPECT_EQ(dev.value, 0x99);
+	// INR M reads the device, and writes back one more.
+	cpu.hl = 0x2041;
+	run(&cpu, {0x34});
+	EXPECT_EQ(dev.reads, 1);
+	EXPECT_EQ(dev.value, 2);
+	// The device keeps nothing in the backing store unless it wants to.
+	EXPECT_EQ(memory[0x2040], 0);
+	EXPECT_EQ(dev.writes, 2);
+}
+
+// Every way of storing marks its pages, but only what's actually written.
+TEST_P(MemoryMapOpcodes, Dirty)
+{
+	struct cpu_state cpu
+	{
+		.memory = memory.data(), .rom_mask = map.type, .sp = 0x4000,
+		.pc = 0x0123, .hl = 0x0100, .mask_shift = PAGE_SHIFT,
+		.memory_map = &map,
+	};
+	run(&cpu, {0x77}); // MOV M,A, untracked
+	cpu.hl = 0x3000;
+	run(&cpu, {0x77});
+	EXPECT_EQ(memory_map_take_dirty(&map, NULL), 0);
+
+	memory_map_track_dirty(&map, 1);
+	cpu.hl = 0x0100;
+	run(&cpu, {0x77});		// MOV M,A, to ROM
+	run(&cpu, {0x32, 0x00, 0x10}); // STA 0x1000, unmapped
+	EXPECT_EQ(memory_map_take_dirty(&map, NULL), 0);
+
+	cpu.hl = 0x3000;
+	run(&cpu, {0x36, 0x01});	// MVI M,1
+	run(&cpu, {0x32, 0x00, 0x50}); // STA 0x5000
+	run(&cpu, {0x22, 0xff, 0x60}); // SHLD 0x60ff, across two pages
+	run(&cpu, {0xe5});		// PUSH H
+	run(&cpu, {0xcd, 0x00, 0x00}); // CALL 0x0000
+	run(&cpu, {0x32, 0x80, 0x20}); // STA 0x2080, MMIO
+	// Including the stack, 0x3ffc to 0x3fff.
+	for (unsigned page : {0x20, 0x30, 0x3f, 0x50, 0x60, 0x61})
+		EXPECT_TRUE(memory_map_page_dirty(&map, page)) << page;
+	EXPECT_EQ(memory_map_take_dirty(&map, NULL), 6);
+}
+
+INSTANTIATE_TEST_SUITE_P(Handlers,
+		MemoryMapOpcodes,
+		::testing::Values(opcodes, generic_opcodes));
+
+/* And the cores, which mustn't read M inline when there's a device to read.
+ * The loop runs long enough for the dynarec to translate it.
+ */
+class MemoryMapCores : public CoreHarness
+{
+};
+
+TEST_P(MemoryMapCores, Devices)
+{
+	std::vector<uint8_t> memory(MAX_MEMORY);
+	const uint8_t program[] = {
+			0x21, 0x00, 0x80, // LXI H, 0x8000
+			0x7e,		  // MOV A,M
+			0x86,		  // ADD M
+			0x32, 0x01, 0x80, // STA 0x8001
+			0xc3, 0x03, 0x00, // JMP 0x0003
+	};
+	std::memcpy(memory.data(), program, sizeof(program));
+
+	struct device dev = {.control = &control};
+	struct memory_map map;
+	memory_map_init(&map, memory.data());
+	memory_map_set(&map, 0x0000, 0x100, PAGE_ROM);
+	memory_map_add_mmio(&map,
+			0x8000,
+			0x100,
+			device_read,
+			device_write,
+			&dev);
+	run_core(memory.data(), &map);
+
+	// Each pass reads twice, and writes the sum: 1 + 2, 3 + 4, ...  The
+	// CPU may have stopped partway through one.
+	EXPECT_GE(dev.writes, QUIT_AFTER);
+	EXPECT_GE(dev.reads, 2 * dev.writes);
+	EXPECT_LE(dev.reads, 2 * dev.writes + 2);
+	EXPECT_EQ(dev.value, (uint8_t) (4 * dev.writes - 1));
+	EXPECT_EQ(memory[0x8001], 0);
+}
+
+INSTANTIATE_TEST_SUITE_P(Cores, MemoryMapCores, CORE_ROUTINES);
+
+/* A loop polling a device's status register has to read it every pass, not
+ * be skipped over as idle (see idle_loop.h).  It's stopped by an event after
+ * POLL_CYCLES, by which time it should have read the register once every 30
+ * cycles, give or take the chunk the cores run on to before they stop.
+ */
+#define POLL_CYCLES (300000)
+
+static uint8_t status_read(void* data, uint16_t address)
+{
+	(void) address;
+	++*(int*) data;
+	return 0; // Never ready.
+}
+
+static uint64_t stop_polling(struct cpu_state* cpu, void* data, uint64_t when)
+{
+	(void) data;
+	(void) when;
+	control_request(cpu->control, CONTROL_QUIT);
+	return 0;
+}
+
+TEST_P(MemoryMapCores, Polling)
+{
+	std::vector<uint8_t> memory(MAX_MEMORY);
+	const uint8_t program[] = {
+			0x3a, 0x00, 0x80, // LDA 0x8000
+			0xe6, 0x01,	  // ANI 0x01
+			0xca, 0x00, 0x00, // JZ 0x0000
+	};
+	std::memcpy(memory.data(), program, sizeof(program));
+
+	int reads = 0;
+	struct memory_map map;
+	memory_map_init(&map, memory.data());
+	memory_map_add_mmio(&map, 0x8000, 0x100, status_read, NULL, &reads);
+	scheduler_add(&scheduler, POLL_CYCLES, stop_polling, NULL);
+	run_core(memory.data(), &map);
+
+	EXPECT_GE(reads, POLL_CYCLES / 30);
+	EXPECT_LE(reads, (POLL_CYCLES + CYCLE_CHUNK) / 30 + 1);
+}
+
+/* And the cores, whose stores all have to be seen, inline or not.  STA to the
+ * device stops the CPU.
+ */
+TEST_P(MemoryMapCores, Dirty)
+{
+	std::vector<uint8_t> memory(MAX_MEMORY);
+	const uint8_t program[] = {
+			0x31, 0x00, 0xa0, // LXI SP, 0xa000
+			0x21, 0x34, 0x12, // LXI H, 0x1234
+			0x77,		  // MOV M,A
+			0x22, 0x00, 0x90, // SHLD 0x9000
+			0xcd, 0x10, 0x00, // CALL 0x0010
+			0xc3, 0x03, 0x00, // JMP 0x0003
+			0x00,		  // NOP
+			0xe5,		  // PUSH H
+			0xe1,		  // POP H
+			0x32, 0x01, 0x80, // STA 0x8001
+			0xc9,		  // RET
+	};
+	std::memcpy(memory.data(), program, sizeof(program));
+
+	struct device dev = {.control = &control};
+	struct memory_map map;
+	memory_map_init(&map, memory.data());
+	memory_map_set(&map, 0x0000, 0x100, PAGE_ROM);
+	memory_map_add_mmio(&map, 0x8000, 0x100, NULL, device_write, &dev);
+	memory_map_track_dirty(&map, 1);
+	run_core(memory.data(), &map);
+
+	EXPECT_GE(dev.writes, QUIT_AFTER);
+	for (unsigned page : {0x12, 0x80, 0x90, 0x9f})
+		EXPECT_TRUE(memory_map_page_dirty(&map, page)) << page;
+	EXPECT_EQ(memory_map_take_dirty(&map, NULL), 4);
+	EXPECT_EQ(memory[0x9000], 0x34);
+}
+
+/* And a bank switch partway through a block, to code the cores (and the
+ * block cache, and the dynarec) have already seen.  Bank 1 of the window at
+ * 0x1000 switches to bank 0x14, and then increments C, which is what's there;
+ * bank 0x14 switches back, and increments B.  So going into bank 0x14, B and
+ * C are the same, and coming back, C is one ahead.
+ */
+#define SWITCHES (1000)
+
+static int switches;
+static int stale; // Times B or C was incremented from the wrong bank.
+static int bank_out(const uint8_t* opcode, struct cpu_state* cpu)
+{
+	(void) opcode;
+	if ((uint8_t) (cpu->c - cpu->b) != (cpu->a == 0x14 ? 0 : 1)) ++stale;
+	memory_map_select_bank(cpu->memory_map, 0, cpu->a);
+	if (++switches == SWITCHES) control_request(cpu->control, CONTROL_QUIT);
+	return 10;
+}
+
+TEST_P(MemoryMapCores, Banks)
+{
+	if (sysconf(_SC_PAGESIZE) > 0x1000) GTEST_SKIP();
+	struct memory_map map;
+	uint8_t* memory = memory_map_create(&map, 0x20000);
+	ASSERT_NE(memory, nullptr);
+	const uint8_t program[] = {
+			0xc3, 0x00, 0x10, // JMP 0x1000
+	};
+	const uint8_t bank_1[] = {
+			0x3e, 0x14,	  // MVI A, 0x14
+			0xd3, 0x00,	  // OUT 0
+			0x04,		  // INR B
+			0xc3, 0x00, 0x00, // JMP 0x0000
+	};
+	const uint8_t bank_14[] = {
+			0x3e, 0x01,	  // MVI A, 0x01
+			0xd3, 0x00,	  // OUT 0
+			0x0c,		  // INR C
+			0xc3, 0x00, 0x00, // JMP 0x0000
+	};
+	std::memcpy(map.store, program, sizeof(program));
+	std::memcpy(map.store + 0x1000, bank_1, sizeof(bank_1));
+	std::memcpy(map.store + 0x14000, bank_14, sizeof(bank_14));
+	ASSERT_EQ(memory_map_add_window(&map, 0x1000, 0x1000), 0);
+
+	int (*const out)(const uint8_t*, struct cpu_state*) = opcodes[0xd3];
+	opcodes[0xd3]					    = bank_out;
+	switches					    = 0;
+	stale						    = 0;
+	run_core(memory, &map);
+	opcodes[0xd3] = out;
+
+	// Nothing's left holding on to the map.
+	EXPECT_EQ(map.remapped, nullptr);
+	// The cores only see the quit request once a chunk.
+	EXPECT_GE(switches, SWITCHES);
+	EXPECT_EQ(stale, 0);
+	EXPECT_EQ(memory_map_bank(&map, 0), switches % 2 ? 0x14 : 1);
+	memory_map_destroy(&map);
+}
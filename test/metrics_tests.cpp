@@ -0,0 +1,295 @@
+extern "C"
+{
+#include "cpu.h"
+#include "metrics.h"
+}
+#include "core_harness.h"
+#include "gtest/gtest.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// The registry, written out in either format.
+static std::string prometheus(const struct metrics* metrics)
+{
+	char* text;
+	size_t size;
+	FILE* file = open_memstream(&text, &size);
+	metrics_write_prometheus(metrics, file);
+	fclose(file);
+	std::string result(text, size);
+	free(text);
+	return result;
+}
+
+static std::string json(const struct metrics* metrics, double time)
+{
+	char* text;
+	size_t size;
+	FILE* file = open_memstream(&text, &size);
+	metrics_write_json(metrics, time, file);
+	fclose(file);
+	std::string result(text, size);
+	free(text);
+	return result;
+}
+
+class Metrics : public ::testing::Test
+{
+      protected:
+	struct metrics metrics;
+
+	void SetUp() override { metrics_init(&metrics); }
+};
+
+TEST_F(Metrics, Prometheus)
+{
+	uint64_t* total = metrics_add(
+			&metrics, "test_total", "A counter.", METRIC_COUNTER);
+	uint64_t* level = metrics_add(
+			&metrics, "test_level", "A gauge.", METRIC_GAUGE);
+	metric_count(total, 3);
+	metric_count(total, 4);
+	metric_set(level, 12);
+	metric_set(level, 5);
+	EXPECT_EQ(metric_read(total), 7u);
+	EXPECT_EQ(prometheus(&metrics),
+			"# HELP test_total A counter.\n"
+			"# TYPE test_total counter\n"
+			"test_total 7\n"
+			"# HELP test_level A gauge.\n"
+			"# TYPE test_level gauge\n"
+			"test_level 5\n");
+}
+
+// Scaled values come out as decimals, and the rest exactly.
+TEST_F(Metrics, Json)
+{
+	metric_set(metrics_add(&metrics, "big", "", METRIC_COUNTER),
+			UINT64_MAX);
+	metric_set(metrics_add_scaled(&metrics, "mhz", "", METRIC_GAUGE, 1e-6),
+			1996800);
+	EXPECT_EQ(json(&metrics, 1.5),
+			"{\"time\":1.500,\"big\":18446744073709551615,"
+			"\"mhz\":1.9968}\n");
+}
+
+// Past METRICS_MAX, or without a registry, metrics still have somewhere to
+// go, but aren't exported.
+TEST_F(Metrics, Full)
+{
+	for (int i = 0; i < METRICS_MAX; ++i)
+		metrics_add(&metrics, "fill", "", METRIC_COUNTER);
+	uint64_t* extra = metrics_add(&metrics, "extra", "", METRIC_COUNTER);
+	ASSERT_NE(extra, nullptr);
+	metric_count(extra, 1);
+	EXPECT_EQ(prometheus(&metrics).find("extra"), std::string::npos);
+	uint64_t* none = metrics_add(NULL, "none", "", METRIC_COUNTER);
+	ASSERT_NE(none, nullptr);
+	metric_count(none, 1);
+}
+
+static void* hold_lock(void* lock)
+{
+	pthread_mutex_lock((pthread_mutex_t*) lock);
+	usleep(20000);
+	pthread_mutex_unlock((pthread_mutex_t*) lock);
+	return NULL;
+}
+
+TEST_F(Metrics, LockWaits)
+{
+	const struct lock_metrics waits =
+			metrics_add_lock(&metrics, "test_lock", "test lock");
+	pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+	// Uncontended, there's nothing to count.
+	metrics_lock(&lock, &waits);
+	pthread_mutex_unlock(&lock);
+	EXPECT_EQ(metric_read(waits.waits), 0u);
+	EXPECT_EQ(metric_read(waits.nanoseconds), 0u);
+
+	pthread_t holder;
+	pthread_create(&holder, NULL, hold_lock, &lock);
+	while (!pthread_mutex_trylock(&lock))
+	{
+		pthread_mutex_unlock(&lock);
+		sched_yield();
+	}
+	metrics_lock(&lock, &waits);
+	pthread_mutex_unlock(&lock);
+	pthread_join(holder, NULL);
+	EXPECT_EQ(metric_read(waits.waits), 1u);
+	EXPECT_GT(metric_read(waits.nanoseconds), 1000000u);
+	EXPECT_NE(prometheus(&metrics).find("test_lock_wait_ns_total"),
+			std::string::npos);
+}
+
+// Connects to the exporter's socket, sends request, and reads the lot.
+static std::string scrape(const char* path, const char* request)
+{
+	struct sockaddr_un address = {};
+	address.sun_family	   = AF_UNIX;
+	strcpy(address.sun_path, path);
+	const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (connect(fd, (struct sockaddr*) &address, sizeof(address)))
+	{
+		close(fd);
+		return "";
+	}
+	if (*request) send(fd, request, strlen(request), MSG_NOSIGNAL);
+	std::string response;
+	char buffer[256];
+	ssize_t got;
+	while ((got = read(fd, buffer, sizeof(buffer))) > 0)
+		response.append(buffer, got);
+	close(fd);
+	return response;
+}
+
+TEST_F(Metrics, Socket)
+{
+	const std::string path =
+			"/tmp/8080_metrics_test_" + std::to_string(getpid());
+	metric_set(metrics_add(&metrics, "test_total", "", METRIC_COUNTER),
+			42);
+	struct metrics_exporter* exporter = metrics_export_start(
+			&metrics, NULL, path.c_str(), 1000);
+	ASSERT_NE(exporter, nullptr);
+
+	// Anything but a GET just gets the metrics.
+	std::string response = scrape(path.c_str(), "");
+	EXPECT_EQ(response.find("HTTP"), std::string::npos);
+	EXPECT_NE(response.find("\ntest_total 42\n"), std::string::npos);
+	EXPECT_NE(response.find("# TYPE i8080_emulated_mhz gauge\n"),
+			std::string::npos);
+	response = scrape(path.c_str(), "GET /metrics HTTP/1.0\r\n\r\n");
+	EXPECT_EQ(response.find("HTTP/1.0 200 OK\r\n"), 0u);
+	EXPECT_NE(response.find("\ntest_total 42\n"), std::string::npos);
+
+	metrics_export_stop(exporter);
+	struct stat gone;
+	EXPECT_NE(stat(path.c_str(), &gone), 0);
+}
+
+// A line of JSON every interval, and a last one on stopping.
+TEST_F(Metrics, File)
+{
+	char path[] = "/tmp/8080_metrics_test_XXXXXX";
+	const int fd = mkstemp(path);
+	ASSERT_GE(fd, 0);
+	close(fd);
+	metric_set(metrics_add(&metrics, "test_total", "", METRIC_COUNTER),
+			5);
+	struct metrics_exporter* exporter =
+			metrics_export_start(&metrics, path, NULL, 10);
+	ASSERT_NE(exporter, nullptr);
+	usleep(55000);
+	metrics_export_stop(exporter);
+
+	std::ifstream file(path);
+	std::string line;
+	int lines = 0;
+	while (std::getline(file, line))
+	{
+		++lines;
+		EXPECT_EQ(line.find("{\"time\":"), 0u);
+		EXPECT_NE(line.find(",\"test_total\":5"), std::string::npos);
+		EXPECT_EQ(line.back(), '}');
+	}
+	EXPECT_GE(lines, 3);
+	unlink(path);
+}
+
+/* And the cores, which publish their counts as they run.  The interrupts
+ * from PeriodicInterrupts give them some to count.
+ */
+class CoreMetrics : public PeriodicInterrupts
+{
+      protected:
+	struct metrics metrics;
+
+	void SetUp() override
+	{
+		PeriodicInterrupts::SetUp();
+		metrics_init(&metrics);
+	}
+};
+
+TEST_P(CoreMetrics, Published)
+{
+	const uint8_t program[] = {
+			0x31, 0x00, 0x20, // LXI SP, 0x2000
+			0xfb,		  // EI
+			0x3c,		  // INR A
+			0xc3, 0x04, 0x00, // JMP 0x0004
+	};
+	run(program, sizeof(program), &metrics);
+
+	const std::string text = prometheus(&metrics);
+	// The last event asks to quit instead of raising another.
+	const std::string taken = std::to_string(INTERRUPT_EVENTS - 1);
+	EXPECT_NE(text.find("\ni8080_interrupts_total " + taken + "\n"),
+			std::string::npos);
+	const size_t cycles = text.find("\ni8080_cycles_total ");
+	ASSERT_NE(cycles, std::string::npos);
+	EXPECT_GE(strtoull(text.c_str() + cycles + 20, NULL, 10),
+			(uint64_t) INTERRUPT_EVENTS * INTERRUPT_PERIOD);
+	// Only the switch and threaded cores count instructions.
+	const size_t instructions = text.find("\ni8080_instructions_total ");
+	if (GetParam() == cpu_thread_routine
+			|| GetParam() == threaded_cpu_thread_routine)
+	{
+		ASSERT_NE(instructions, std::string::npos);
+		// INR A and JMP take 15 cycles between them.
+		EXPECT_GE(strtoull(text.c_str() + instructions + 26, NULL, 10),
+				INTERRUPT_EVENTS * INTERRUPT_PERIOD / 15u);
+	}
+	else
+		EXPECT_EQ(instructions, std::string::npos);
+}
+
+// The block cores publish their block cache's statistics, and the dynarec its.
+TEST_P(CoreMetrics, BlockStatistics)
+{
+	const uint8_t program[] = {
+			0x31, 0x00, 0x20, // LXI SP, 0x2000
+			0xfb,		  // EI
+			0x3c,		  // INR A
+			0xc3, 0x04, 0x00, // JMP 0x0004
+	};
+	run(program, sizeof(program), &metrics);
+
+	const std::string text = prometheus(&metrics);
+	const size_t hits = text.find("\ni8080_block_cache_hits_total ");
+	const size_t entries = text.find("\ni8080_dynarec_entries_total ");
+	if (GetParam() == cpu_thread_routine
+			|| GetParam() == threaded_cpu_thread_routine)
+	{
+		EXPECT_EQ(hits, std::string::npos);
+		EXPECT_EQ(entries, std::string::npos);
+		return;
+	}
+	ASSERT_NE(hits, std::string::npos);
+	// The loop's block is decoded once, and then run from the cache.
+	EXPECT_GT(strtoull(text.c_str() + hits + 30, NULL, 10), 0u);
+	EXPECT_NE(text.find("\ni8080_idle_cycles_skipped_total "),
+			std::string::npos);
+#if defined(__x86_64__) && defined(__linux__)
+	if (GetParam() == dynarec_cpu_thread_routine)
+	{
+		ASSERT_NE(entries, std::string::npos);
+		EXPECT_GT(strtoull(text.c_str() + entries + 29, NULL, 10), 0u);
+		return;
+	}
+#endif
+	EXPECT_EQ(entries, std::string::npos);
+}
+
+INSTANTIATE_TEST_SUITE_P(Cores, CoreMetrics, CORE_ROUTINES);
@@ -0,0 +1,85 @@
+extern "C"
+{
+#include "cpu.h"
+#include "opcode_array.h"
+#include "opcode_info.h"
+}
+#include "gtest/gtest.h"
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+// Every handler should charge what the table says, both when a condition is
+// met and when it isn't.
+TEST(OpcodeInfo, HandlerCycles)
+{
+	std::vector<uint8_t> memory(0x10002);
+	uint8_t rom_mask[1] = {0};
+	for (int op = 0; op < 256; ++op)
+	{
+		// IN and OUT are left to the hardware library.
+		if (!opcodes[op]) continue;
+		int cycles[2];
+		// Every condition holds with one of these flag bytes, and fails
+		// with the other.
+		const uint8_t flags[2] = {0x00, 0xff};
+		for (int i = 0; i < 2; ++i)
+		{
+			struct cpu_state cpu
+			{
+				.memory = memory.data(), .rom_mask = rom_mask,
+				.mask_shift = 16,
+			};
+			cpu.flags	  = flags[i];
+			cpu.sp		  = 0x8000;
+			const uint8_t opcode[3] = {(uint8_t) op, 0, 0};
+			cycles[i]	  = opcodes[op](opcode, &cpu);
+			ASSERT_EQ(cycles[i], generic_opcodes[op](opcode, &cpu))
+					<< opcode_info[op].mnemonic;
+		}
+		EXPECT_EQ(std::min(cycles[0], cycles[1]),
+				opcode_info[op].cycles)
+				<< opcode_info[op].mnemonic;
+		EXPECT_EQ(std::max(cycles[0], cycles[1]),
+				opcode_info[op].cycles_taken)
+				<< opcode_info[op].mnemonic;
+	}
+}
+
+TEST(OpcodeInfo, Classes)
+{
+	EXPECT_EQ(opcode_info[0x7e].access, MEM_READ);	   // MOV A,M
+	EXPECT_EQ(opcode_info[0x77].access, MEM_WRITE);	   // MOV M,A
+	EXPECT_EQ(opcode_info[0x34].access, MEM_MODIFY);   // INR M
+	EXPECT_EQ(opcode_info[0xe3].access, MEM_EXCHANGE); // XTHL
+	EXPECT_EQ(opcode_info[0xdb].access, MEM_IO);	   // IN
+	EXPECT_TRUE(opcode_writes_memory(0xcd));	   // CALL
+	EXPECT_FALSE(opcode_writes_memory(0xc9));	   // RET
+	EXPECT_EQ(opcode_info[0xc2].flow, FLOW_BRANCH);	   // JNZ
+	EXPECT_EQ(opcode_info[0xe9].flow, FLOW_JUMP);	   // PCHL
+	EXPECT_EQ(opcode_info[0xff].flow, FLOW_CALL);	   // RST 7
+	EXPECT_EQ(opcode_info[0x76].flow, FLOW_SYNC);	   // HLT
+	EXPECT_TRUE(opcode_has_fixed_cycles(0xc2));
+	EXPECT_FALSE(opcode_has_fixed_cycles(0xc4)); // CNZ
+}
+
+TEST(OpcodeInfo, Disassemble)
+{
+	char buffer[16];
+	const uint8_t mvi[] = {0x3e, 0x3f};
+	EXPECT_EQ(disassemble(mvi, buffer, sizeof(buffer)), 2);
+	EXPECT_EQ(std::string(buffer), "MVI A,0x3f");
+	const uint8_t jmp[] = {0xc3, 0xd4, 0x18};
+	EXPECT_EQ(disassemble(jmp, buffer, sizeof(buffer)), 3);
+	EXPECT_EQ(std::string(buffer), "JMP 0x18d4");
+	const uint8_t lxi[] = {0x31, 0x00, 0x24};
+	EXPECT_EQ(disassemble(lxi, buffer, sizeof(buffer)), 3);
+	EXPECT_EQ(std::string(buffer), "LXI SP,0x2400");
+	const uint8_t mov[] = {0x70};
+	EXPECT_EQ(disassemble(mov, buffer, sizeof(buffer)), 1);
+	EXPECT_EQ(std::string(buffer), "MOV M,B");
+	// Too small a buffer just truncates.
+	EXPECT_EQ(disassemble(lxi, buffer, 4), 3);
+	EXPECT_EQ(std::string(buffer), "LXI");
+}
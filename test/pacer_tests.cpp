@@ -0,0 +1,110 @@
+extern "C"
+{
+#include "pacer.h"
+}
+#include "gtest/gtest.h"
+
+#include <chrono>
+#include <csignal>
+#include <ctime>
+#include <sys/time.h>
+
+// Sleeps that can be trusted get the smallest chunk; others, longer ones.
+TEST(Pacer, Chunk)
+{
+	EXPECT_EQ(pacer_chunk(0, 500, 512), 512);
+	EXPECT_EQ(pacer_chunk(10000, 500, 512), 512);
+	EXPECT_EQ(pacer_chunk(100000, 500, 512), 3200);
+	EXPECT_EQ(pacer_chunk(100000000, 500, 512), PACER_SLEEP_MAX / 500);
+	EXPECT_EQ(pacer_chunk(100000000, 500, 100000), 100000);
+}
+
+// A tenth of a second's worth of 2MHz chunks takes a tenth of a second.
+TEST(Pacer, KeepsTime)
+{
+	struct pacer pacer;
+	pacer_init(&pacer, 500, 512);
+	const auto start = std::chrono::steady_clock::now();
+	for (int i = 0; i < 200000 / 512; ++i) pacer_wait(&pacer, 512);
+	const std::chrono::duration<double> elapsed =
+			std::chrono::steady_clock::now() - start;
+	// The last few hundred cycles may still be saved up.
+	EXPECT_GT(elapsed.count(), 0.09);
+	EXPECT_LT(elapsed.count(), 0.2);
+	EXPECT_GE(pacer.chunk, 512);
+	EXPECT_LE(pacer.chunk, PACER_SLEEP_MAX / 500);
+
+	// Every wait is recorded, and with the spin at the end, most of them
+	// finish within a few microseconds of their targets.
+	uint64_t total = 0, close = 0;
+	for (int bucket = 0; bucket < HISTOGRAM_BUCKETS; ++bucket)
+	{
+		total += pacer.error.counts[bucket];
+		if (bucket <= 13) close += pacer.error.counts[bucket];
+	}
+	EXPECT_GT(total, 0u);
+	EXPECT_GT(close * 2, total);
+}
+
+// A pacer that's fallen behind doesn't wait until it's caught up.
+TEST(Pacer, CatchesUp)
+{
+	struct pacer pacer;
+	pacer_init(&pacer, 500, 512);
+	struct timespec pause = {0, 50000000};
+	nanosleep(&pause, NULL);
+	const auto start = std::chrono::steady_clock::now();
+	for (int i = 0; i < 50000 / 512; ++i) pacer_wait(&pacer, 512);
+	const std::chrono::duration<double> elapsed =
+			std::chrono::steady_clock::now() - start;
+	EXPECT_LT(elapsed.count(), 0.02);
+}
+
+// After a rebase, the time gone by before it doesn't count.
+TEST(Pacer, Rebase)
+{
+	struct pacer pacer;
+	pacer_init(&pacer, 500, 512);
+	struct timespec pause = {0, 50000000};
+	nanosleep(&pause, NULL);
+	pacer_rebase(&pacer);
+	const auto start = std::chrono::steady_clock::now();
+	for (int i = 0; i < 20000 / 512; ++i) pacer_wait(&pacer, 512);
+	const std::chrono::duration<double> elapsed =
+			std::chrono::steady_clock::now() - start;
+	EXPECT_GT(elapsed.count(), 0.009);
+}
+
+static void ignore_alarm(int signal)
+{
+	(void) signal;
+}
+
+// A signal cutting a sleep short means sleeping again, not spinning.
+TEST(Pacer, Interrupted)
+{
+	struct sigaction alarm = {}, old_alarm;
+	alarm.sa_handler       = ignore_alarm;
+	sigaction(SIGALRM, &alarm, &old_alarm);
+	struct itimerval every = {{0, 200}, {0, 200}}, old_every;
+	setitimer(ITIMER_REAL, &every, &old_every);
+
+	struct pacer pacer;
+	pacer_init(&pacer, 500, 512);
+	struct timespec cpu_start, cpu_end;
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu_start);
+	const auto start = std::chrono::steady_clock::now();
+	// 2 ms waits, each interrupted several times.
+	for (int i = 0; i < 50; ++i) pacer_wait(&pacer, 4000);
+	const std::chrono::duration<double> elapsed =
+			std::chrono::steady_clock::now() - start;
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu_end);
+
+	setitimer(ITIMER_REAL, &old_every, NULL);
+	sigaction(SIGALRM, &old_alarm, NULL);
+	const double cpu = (cpu_end.tv_sec - cpu_start.tv_sec)
+			   + (cpu_end.tv_nsec - cpu_start.tv_nsec) / 1e9;
+	EXPECT_GT(elapsed.count(), 0.09);
+	// Waking up for each signal costs a little, but nothing like spinning.
+	EXPECT_LT(cpu, elapsed.count() / 4);
+}
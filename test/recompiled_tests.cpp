@@ -0,0 +1,156 @@
+extern "C"
+{
+#include "block_cache.h"
+#include "cpu.h"
+#include "opcode_array.h"
+#include "opcode_size.h"
+#include "recompiled.h"
+}
+#include "gtest/gtest.h"
+
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+// Runs against the Space Invaders module the build makes, in native/.
+class Recompiled : public ::testing::Test
+{
+      protected:
+	// Two spare bytes, so operands of an opcode at 0xffff can be read.
+	std::vector<uint8_t> memory = std::vector<uint8_t>(0x10002);
+	std::vector<uint8_t> rom_mask;
+	uint8_t mask_shift = 16;
+	struct block_cache* cache;
+
+	void SetUp() override
+	{
+		FILE* rom = fopen("roms/invaders_cv", "rb");
+		ASSERT_NE(rom, nullptr);
+		ASSERT_GT(fread(memory.data(), 1, MAX_MEMORY, rom), 0u);
+		fclose(rom);
+		FILE* mask = fopen("roms/invaders_cv.mask", "rb");
+		ASSERT_NE(mask, nullptr);
+		ASSERT_EQ(fread(&mask_shift, 1, 1, mask), 1u);
+		rom_mask.resize(MAX_MEMORY >> mask_shift);
+		ASSERT_GT(fread(rom_mask.data(), 1, rom_mask.size(), mask), 0u);
+		fclose(mask);
+		cache = block_cache_create();
+		ASSERT_NE(cache, nullptr);
+	}
+	void TearDown() override { block_cache_destroy(cache); }
+
+	const struct recompiled_rom* load()
+	{
+		return recompiled_load("roms/invaders_cv",
+				memory.data(),
+				rom_mask.data(),
+				mask_shift);
+	}
+};
+
+// Stands in for IN and OUT, since there's no hardware library to handle them.
+static int no_io(const uint8_t* opcode, struct cpu_state* cpu)
+{
+	(void) opcode;
+	(void) cpu;
+	return 10;
+}
+
+TEST_F(Recompiled, Loads)
+{
+	const struct recompiled_rom* rom = load();
+	ASSERT_NE(rom, nullptr);
+	EXPECT_GT(rom->block_count, 0u);
+	// Reset and the two interrupt vectors the game uses.
+	EXPECT_NE(rom->blocks[0x0000], nullptr);
+	EXPECT_NE(rom->blocks[0x0008], nullptr);
+	EXPECT_NE(rom->blocks[0x0010], nullptr);
+	// Nothing in RAM.
+	EXPECT_EQ(rom->blocks[0x2000], nullptr);
+}
+
+TEST_F(Recompiled, RejectsADifferentROM)
+{
+	memory[0x0100] ^= 0xff;
+	EXPECT_EQ(load(), nullptr);
+}
+
+/* Runs the game's attract mode on the recompiled ROM and on the interpreter
+ * side by side, with the two screen interrupts every half frame, and checks
+ * the two agree every time the recompiled code comes back.
+ */
+TEST_F(Recompiled, MatchesStepping)
+{
+	const struct recompiled_rom* rom = load();
+	ASSERT_NE(rom, nullptr);
+	auto in = opcodes[0xdb], out = opcodes[0xd3];
+	opcodes[0xdb] = opcodes[0xd3] = no_io;
+	std::vector<uint8_t> step_memory = memory;
+
+	struct cpu_state cpu
+	{
+		.memory = memory.data(), .rom_mask = rom_mask.data(),
+		.mask_shift = mask_shift, .block_cache = cache,
+	};
+	struct cpu_state stepped
+	{
+		.memory = step_memory.data(), .rom_mask = rom_mask.data(),
+		.mask_shift = mask_shift,
+	};
+
+	// Skipping an idle loop leaves the registers just as running it would.
+	struct idle_loop idle = {};
+	uint64_t now	      = 0;
+
+	// Half a frame at 2MHz and 60Hz.
+	const int half_frame = 2000000 / 120;
+	uint8_t interrupt    = 0xcf; // RST 1, then RST 2, and so on.
+	for (int run = 0; run < 200; ++run)
+	{
+		int cycles = 0;
+		while (cycles < half_frame && !cpu.halt_flag)
+		{
+			int ran = recompiled_run(rom,
+					cache,
+					&cpu,
+					&idle,
+					now,
+					half_frame);
+			int stepped_cycles = 0;
+			while (stepped_cycles < ran)
+			{
+				const uint8_t* opcode =
+						stepped.memory + stepped.pc;
+				stepped.pc += get_opcode_size(*opcode);
+				stepped_cycles += opcodes[*opcode](
+						opcode, &stepped);
+			}
+			ASSERT_EQ(ran, stepped_cycles) << "run " << run;
+			ASSERT_EQ(cpu.pc, stepped.pc) << "run " << run;
+			ASSERT_EQ(cpu.psw, stepped.psw) << "run " << run;
+			ASSERT_EQ(cpu.bc, stepped.bc) << "run " << run;
+			ASSERT_EQ(cpu.de, stepped.de) << "run " << run;
+			ASSERT_EQ(cpu.hl, stepped.hl) << "run " << run;
+			ASSERT_EQ(cpu.sp, stepped.sp) << "run " << run;
+			ASSERT_EQ(cpu.interrupt_enable_flag,
+					stepped.interrupt_enable_flag);
+			cycles += ran;
+			now += ran;
+		}
+		// Interrupts, when the game has them enabled.  We don't bother
+		// with EI's delay, since both sides get the same treatment.
+		for (struct cpu_state* state : {&cpu, &stepped})
+		{
+			if (!state->interrupt_enable_flag) continue;
+			state->interrupt_enable_flag = 0;
+			state->halt_flag	     = 0;
+			opcodes[interrupt](&interrupt, state);
+		}
+		interrupt ^= 0xcf ^ 0xd7;
+	}
+	opcodes[0xdb] = in;
+	opcodes[0xd3] = out;
+	EXPECT_EQ(memory, step_memory);
+	// The game waits for its interrupts in a loop.
+	EXPECT_GT(idle.skipped, 0u);
+}
@@ -0,0 +1,280 @@
+extern "C"
+{
+#include "control.h"
+#include "cpu.h"
+#include "cycle_timer.h"
+#include "interrupts.h"
+#include "opcode_array.h"
+#include "scheduler.h"
+}
+#include "core_harness.h"
+#include "gtest/gtest.h"
+
+#include <cstring>
+#include <vector>
+
+// Each callback records which event it was and when it ran.
+struct call
+{
+	int event;
+	uint64_t when;
+	uint64_t now;
+};
+static std::vector<call> calls;
+
+static uint64_t record(struct cpu_state* cpu, void* data, uint64_t when)
+{
+	calls.push_back({(int) (intptr_t) data, when, cpu->cycles});
+	return 0;
+}
+
+class Scheduler : public ::testing::Test
+{
+      protected:
+	struct scheduler scheduler;
+	struct cpu_state cpu
+	{
+		.scheduler = &scheduler
+	};
+
+	void SetUp() override
+	{
+		scheduler_init(&scheduler);
+		calls.clear();
+	}
+
+	// Runs the clock up to now.
+	uint64_t run(uint64_t now)
+	{
+		cpu.cycles = now;
+		return scheduler_run(&cpu);
+	}
+};
+
+TEST_F(Scheduler, Empty)
+{
+	EXPECT_EQ(scheduler_next(&scheduler), UINT64_MAX);
+	EXPECT_EQ(run(1000), UINT64_MAX);
+	EXPECT_TRUE(calls.empty());
+}
+
+// However they're added, events run in order of time, and then of adding.
+TEST_F(Scheduler, Order)
+{
+	const uint64_t times[] = {50, 10, 40, 10, 30, 20, 50, 0, 30};
+	for (int i = 0; i < 9; ++i)
+		scheduler_add(&scheduler,
+				times[i],
+				record,
+				(void*) (intptr_t) i);
+	EXPECT_EQ(scheduler_next(&scheduler), 0u);
+	EXPECT_EQ(run(25), 30u);
+	EXPECT_EQ(run(100), UINT64_MAX);
+	const int order[] = {7, 1, 3, 5, 4, 8, 2, 0, 6};
+	ASSERT_EQ(calls.size(), 9u);
+	for (int i = 0; i < 9; ++i)
+	{
+		EXPECT_EQ(calls[i].event, order[i]);
+		EXPECT_EQ(calls[i].when, times[order[i]]);
+	}
+	// Events are called back with the clock as it is, not as it was.
+	EXPECT_EQ(calls[3].now, 25u);
+	EXPECT_EQ(calls[4].now, 100u);
+}
+
+TEST_F(Scheduler, Cancel)
+{
+	int ids[8];
+	for (int i = 0; i < 8; ++i)
+		ids[i] = scheduler_add(&scheduler,
+				100 - i * 10,
+				record,
+				(void*) (intptr_t) i);
+	EXPECT_TRUE(scheduler_cancel(&scheduler, ids[7]));
+	EXPECT_TRUE(scheduler_cancel(&scheduler, ids[2]));
+	EXPECT_TRUE(scheduler_cancel(&scheduler, ids[4]));
+	EXPECT_FALSE(scheduler_cancel(&scheduler, ids[4]));
+	EXPECT_FALSE(scheduler_cancel(&scheduler, -1));
+	EXPECT_EQ(scheduler_next(&scheduler), 40u);
+	run(1000);
+	const int order[] = {6, 5, 3, 1, 0};
+	ASSERT_EQ(calls.size(), 5u);
+	for (int i = 0; i < 5; ++i) EXPECT_EQ(calls[i].event, order[i]);
+	// Once it's run, there's nothing to cancel.
+	EXPECT_FALSE(scheduler_cancel(&scheduler, ids[0]));
+}
+
+TEST_F(Scheduler, Full)
+{
+	for (int i = 0; i < SCHEDULER_EVENTS; ++i)
+		EXPECT_GE(scheduler_add(&scheduler, i, record, NULL), 0);
+	EXPECT_EQ(scheduler_add(&scheduler, 0, record, NULL), -1);
+	run(SCHEDULER_EVENTS);
+	EXPECT_EQ(calls.size(), (size_t) SCHEDULER_EVENTS);
+	EXPECT_GE(scheduler_add(&scheduler, 0, record, NULL), 0);
+}
+
+// A periodic event comes back every period, however late it's called.
+static uint64_t every_100(struct cpu_state* cpu, void* data, uint64_t when)
+{
+	record(cpu, data, when);
+	return calls.size() < 5 ? when + 100 : 0;
+}
+
+TEST_F(Scheduler, Periodic)
+{
+	scheduler_add(&scheduler, 100, every_100, NULL);
+	EXPECT_EQ(run(99), 100u);
+	EXPECT_EQ(run(107), 200u);
+	// Far enough behind, it's called back until it's caught up.
+	EXPECT_EQ(run(350), 400u);
+	EXPECT_EQ(run(1000), UINT64_MAX);
+	ASSERT_EQ(calls.size(), 5u);
+	for (int i = 0; i < 5; ++i) EXPECT_EQ(calls[i].when, 100u * (i + 1));
+}
+
+// An event can cancel itself from its callback.
+static int cancel_id;
+static uint64_t cancel(struct cpu_state* cpu, void* data, uint64_t when)
+{
+	record(cpu, data, when);
+	EXPECT_TRUE(scheduler_cancel(cpu->scheduler, cancel_id));
+	return when + 100;
+}
+
+TEST_F(Scheduler, CancelFromCallback)
+{
+	cancel_id = scheduler_add(&scheduler, 10, cancel, (void*) 1);
+	run(10);
+	scheduler_add(&scheduler, 20, record, (void*) 2);
+	cancel_id = scheduler_add(&scheduler, 20, cancel, (void*) 3);
+	run(1000);
+	ASSERT_EQ(calls.size(), 3u);
+	EXPECT_EQ(calls[0].event, 1);
+	EXPECT_EQ(calls[1].event, 2);
+	EXPECT_EQ(calls[2].event, 3);
+	EXPECT_EQ(scheduler_next(&scheduler), UINT64_MAX);
+}
+
+// And the cores, which have to run each event on time, and so take each
+// interrupt it raises (see PeriodicInterrupts).
+class TimedEvents : public PeriodicInterrupts
+{
+      protected:
+	void check(uint64_t late)
+	{
+		ASSERT_EQ(events.times.size(), (size_t) INTERRUPT_EVENTS);
+		for (int i = 0; i < INTERRUPT_EVENTS; ++i)
+		{
+			const uint64_t due =
+					(uint64_t) (i + 1) * INTERRUPT_PERIOD;
+			EXPECT_GE(events.times[i], due);
+			EXPECT_LE(events.times[i], due + late);
+			// Every interrupt raised so far has been taken.
+			EXPECT_EQ(events.taken[i], i);
+		}
+	}
+};
+
+// A busy CPU is stopped for the event within an opcode or two of its time.
+TEST_P(TimedEvents, Running)
+{
+	const uint8_t program[] = {
+			0x31, 0x00, 0x20, // LXI SP, 0x2000
+			0xfb,		  // EI
+			0x3c,		  // INR A
+			0xc3, 0x04, 0x00, // JMP 0x0004
+	};
+	run(program, sizeof(program));
+	check(32);
+	const std::vector<uint64_t> first = events.times;
+	// And it's the same every time.
+	control = 0;
+	events	= timer_log{};
+	run(program, sizeof(program));
+	EXPECT_EQ(events.times, first);
+}
+
+// So is one that's sitting in an idle loop, which the cores skip through.
+TEST_P(TimedEvents, Idle)
+{
+	const uint8_t program[] = {
+			0x31, 0x00, 0x20, // LXI SP, 0x2000
+			0xfb,		  // EI
+			0xc3, 0x04, 0x00, // JMP 0x0004
+	};
+	run(program, sizeof(program));
+	check(32);
+}
+
+// Unthrottled, a halted CPU skips straight to the event.
+TEST_P(TimedEvents, Halted)
+{
+	const uint8_t program[] = {
+			0x31, 0x00, 0x20, // LXI SP, 0x2000
+			0xfb,		  // EI
+			0x76,		  // HLT
+			0xc3, 0x03, 0x00, // JMP 0x0003
+	};
+	run(program, sizeof(program));
+	check(0);
+}
+
+// An OUT can add an event, which the switch and threaded cores notice straight
+// away: here, one that sets port 0's latch, which IN reads, 100 cycles on.
+static uint8_t latch;
+static uint8_t loops; // B, as IN first sees the latch set.
+static uint64_t set_latch(struct cpu_state* cpu, void* data, uint64_t when)
+{
+	(void) cpu;
+	(void) data;
+	(void) when;
+	latch = 1;
+	return 0;
+}
+static int test_out(const uint8_t* opcode, struct cpu_state* cpu)
+{
+	(void) opcode;
+	latch = 0;
+	scheduler_add(cpu->scheduler, cpu->cycles + 100, set_latch, NULL);
+	return 10;
+}
+static int test_in(const uint8_t* opcode, struct cpu_state* cpu)
+{
+	(void) opcode;
+	cpu->a = latch;
+	if (!latch) return 10;
+	loops = cpu->b;
+	control_request(cpu->control, CONTROL_QUIT);
+	return 10;
+}
+
+TEST_P(TimedEvents, AddedByOut)
+{
+	if (GetParam() != cpu_thread_routine
+			&& GetParam() != threaded_cpu_thread_routine)
+		GTEST_SKIP();
+	int (*const in)(const uint8_t*, struct cpu_state*)  = opcodes[0xdb];
+	int (*const out)(const uint8_t*, struct cpu_state*) = opcodes[0xd3];
+	opcodes[0xdb]					    = test_in;
+	opcodes[0xd3]					    = test_out;
+	const uint8_t program[] = {
+			0xd3, 0x00,	  // OUT 0
+			0x06, 0x00,	  // MVI B, 0
+			0x04,		  // INR B
+			0xdb, 0x00,	  // IN 0
+			0xb7,		  // ORA A
+			0xca, 0x04, 0x00, // JZ 0x0004
+			0x76,		  // HLT
+	};
+	std::memcpy(memory, program, sizeof(program));
+	run_core(memory);
+	opcodes[0xdb] = in;
+	opcodes[0xd3] = out;
+	// OUT and MVI take 17 cycles, and each time round the loop 29, so the
+	// event, due at 100, runs at 104, after the third JZ, and the fourth
+	// IN sees it.
+	EXPECT_EQ(loops, 4);
+}
+
+INSTANTIATE_TEST_SUITE_P(Cores, TimedEvents, CORE_ROUTINES);
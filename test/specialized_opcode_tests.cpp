@@ -0,0 +1,97 @@
+extern "C"
+{
+#include "cpu.h"
+#include "opcode_array.h"
+}
+#include "gtest/gtest.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+/* Every specialized handler is run against its generic counterpart from lots
+ * of random starting states, and the two have to agree on everything: the
+ * registers, the flags, memory, and the cycle count.
+ */
+TEST(SpecializedOpcodes, MatchesGeneric)
+{
+	// Two spare bytes, so operands of an opcode at 0xffff can be read.
+	std::vector<uint8_t> pristine(0x10002), generic_memory, special_memory;
+	srand(8080);
+	for (auto& byte : pristine) byte = rand();
+	generic_memory = special_memory = pristine;
+	// Some of memory is ROM, so writes to it have to be dropped.
+	uint8_t rom_mask[256];
+	for (auto& byte : rom_mask) byte = rand() % 4 == 0;
+
+	for (int op = 0; op < 256; ++op)
+	{
+		// IN and OUT are left to the hardware library.
+		if (!generic_opcodes[op])
+		{
+			EXPECT_EQ(opcodes[op], nullptr) << "opcode " << op;
+			continue;
+		}
+		for (int trial = 0; trial < 500; ++trial)
+		{
+			struct cpu_state generic
+			{
+				.memory = generic_memory.data(),
+				.rom_mask = rom_mask, .mask_shift = 8,
+			};
+			struct cpu_state special
+			{
+				.memory = special_memory.data(),
+				.rom_mask = rom_mask, .mask_shift = 8,
+			};
+			special.psw = generic.psw = rand();
+			special.bc = generic.bc = rand();
+			special.de = generic.de = rand();
+			special.hl = generic.hl = rand();
+			special.sp = generic.sp = rand();
+			special.pc = generic.pc = rand();
+
+			uint8_t opcode[3] = {(uint8_t) op,
+					(uint8_t) rand(),
+					(uint8_t) rand()};
+			int generic_cycles =
+					generic_opcodes[op](opcode, &generic);
+			int special_cycles = opcodes[op](opcode, &special);
+
+			ASSERT_EQ(generic_cycles, special_cycles)
+					<< "opcode " << op;
+			ASSERT_EQ(generic.psw, special.psw) << "opcode " << op;
+			ASSERT_EQ(generic.bc, special.bc) << "opcode " << op;
+			ASSERT_EQ(generic.de, special.de) << "opcode " << op;
+			ASSERT_EQ(generic.hl, special.hl) << "opcode " << op;
+			ASSERT_EQ(generic.sp, special.sp) << "opcode " << op;
+			ASSERT_EQ(generic.pc, special.pc) << "opcode " << op;
+			ASSERT_EQ(generic.halt_flag, special.halt_flag)
+					<< "opcode " << op;
+			ASSERT_EQ(generic.interrupt_enable_flag,
+					special.interrupt_enable_flag)
+					<< "opcode " << op;
+			ASSERT_EQ(generic_memory, special_memory)
+					<< "opcode " << op;
+			if (generic_memory != pristine)
+				generic_memory = special_memory = pristine;
+		}
+	}
+}
+
+TEST(SpecializedOpcodes, Cycles)
+{
+	std::vector<uint8_t> memory(0x10002);
+	uint8_t rom_mask[1] = {0};
+	struct cpu_state cpu
+	{
+		.memory = memory.data(), .rom_mask = rom_mask, .mask_shift = 16,
+	};
+	const uint8_t mov_b_c[] = {0x41}, mov_b_m[] = {0x46}, add_m[] = {0x86},
+		      sub_m[]	= {0x96}, jz[] = {0xca, 0, 0};
+	EXPECT_EQ(opcodes[0x41](mov_b_c, &cpu), 5);
+	EXPECT_EQ(opcodes[0x46](mov_b_m, &cpu), 7);
+	EXPECT_EQ(opcodes[0x86](add_m, &cpu), 7);
+	EXPECT_EQ(opcodes[0x96](sub_m, &cpu), 7);
+	EXPECT_EQ(opcodes[0xca](jz, &cpu), 10);
+}
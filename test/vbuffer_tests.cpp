@@ -0,0 +1,96 @@
+extern "C"
+{
+#include "taito_struct.h"
+}
+#include "gtest/gtest.h"
+
+#include <cstring>
+#include <pthread.h>
+
+// The three buffers, as create_taito_struct sets them up.
+class VBuffer : public ::testing::Test
+{
+      protected:
+	uint8_t buffers[VBUFFERS * VBUFFER_SIZE] = {};
+	struct taito_struct tstruct
+	{
+		.vbuffer = buffers, .vbuffer_write = 0, .vbuffer_latest = 2,
+	};
+	uint8_t reading = 1;
+
+	// Writes a frame full of its own number, and publishes it.
+	void finish()
+	{
+		memset(vbuffer_for_writing(&tstruct),
+				(uint8_t) (tstruct.frames + 1),
+				VBUFFER_SIZE);
+		vbuffer_publish(&tstruct);
+	}
+};
+
+TEST_F(VBuffer, Take)
+{
+	EXPECT_FALSE(vbuffer_take(&tstruct, &reading));
+	EXPECT_EQ(reading, 1);
+	finish();
+	ASSERT_TRUE(vbuffer_take(&tstruct, &reading));
+	EXPECT_EQ(reading, 0);
+	EXPECT_EQ(tstruct.vbuffer_frame[reading], 1u);
+	EXPECT_EQ(buffers[reading * VBUFFER_SIZE], 1);
+	// Once taken, it isn't new any more.
+	EXPECT_FALSE(vbuffer_take(&tstruct, &reading));
+	EXPECT_EQ(reading, 0);
+}
+
+// Frames finished while the front end's busy replace one another, and the
+// CPU thread never touches the buffer being drawn.
+TEST_F(VBuffer, Latest)
+{
+	for (int i = 0; i < 5; ++i)
+	{
+		finish();
+		EXPECT_NE(tstruct.vbuffer_write, reading);
+	}
+	ASSERT_TRUE(vbuffer_take(&tstruct, &reading));
+	EXPECT_EQ(tstruct.vbuffer_frame[reading], 5u);
+	EXPECT_EQ(buffers[reading * VBUFFER_SIZE], 5);
+	finish();
+	EXPECT_EQ(buffers[reading * VBUFFER_SIZE], 5);
+	ASSERT_TRUE(vbuffer_take(&tstruct, &reading));
+	EXPECT_EQ(tstruct.vbuffer_frame[reading], 6u);
+}
+
+#define FRAMES (20000)
+
+static void* produce(void* arg)
+{
+	struct taito_struct* tstruct = (struct taito_struct*) arg;
+	for (int i = 0; i < FRAMES; ++i)
+	{
+		memset(vbuffer_for_writing(tstruct),
+				(uint8_t) (tstruct->frames + 1),
+				VBUFFER_SIZE);
+		vbuffer_publish(tstruct);
+	}
+	return NULL;
+}
+
+// With both sides going flat out, every frame taken is whole, and newer than
+// the last.
+TEST_F(VBuffer, Threads)
+{
+	pthread_t producer;
+	pthread_create(&producer, NULL, produce, &tstruct);
+	uint64_t last = 0;
+	while (last < FRAMES)
+	{
+		if (!vbuffer_take(&tstruct, &reading)) continue;
+		const uint64_t frame = tstruct.vbuffer_frame[reading];
+		ASSERT_GT(frame, last);
+		const uint8_t* buffer = buffers + reading * VBUFFER_SIZE;
+		for (int i = 0; i < VBUFFER_SIZE; ++i)
+			ASSERT_EQ(buffer[i], (uint8_t) frame);
+		last = frame;
+	}
+	pthread_join(producer, NULL);
+}
@@ -0,0 +1,481 @@
+#include "cpu.h"
+#include "opcode_info.h"
+#include "recompiled.h"
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Translates a write-protected ROM into C, for the native core: see
+ * recompiled.h.
+ *
+ * Usage: recompile ROM_FILE OUTPUT_FILE
+ *
+ * The ROM's mask is read from ROM_FILE.mask, as the emulator does; only the
+ * protected parts of memory are translated, since anything else might change
+ * under us.
+ *
+ * We find the code by following the control flow from the reset and RST
+ * vectors (the RSTs being where interrupts go).  Jump and call targets are
+ * followed, and so is the code after a call or conditional branch, on the
+ * assumption that calls return.  That may lead us to decode data as code
+ * now and again, which is harmless: the block is only ever run if execution
+ * really does get there.  What we can't follow (PCHL, and returns to
+ * addresses we didn't see a call for) is left to the block cache at run time.
+ *
+ * Every address which control can reach other than by running off the end of
+ * the previous opcode starts a block.  Blocks run until the next opcode which
+ * changes the flow of control, or until they reach the start of another
+ * block.
+ */
+
+static uint8_t memory[MAX_MEMORY + 2];
+static uint8_t rom_mask[MAX_MEMORY];
+static uint8_t mask_shift;
+
+// Whether we've decoded an opcode starting at each address.
+static uint8_t decoded[MAX_MEMORY];
+// Whether a block starts at each address.
+static uint8_t leader[MAX_MEMORY];
+
+static uint16_t worklist[MAX_MEMORY];
+static int worklist_size;
+
+static const char* const registers[8] = {"cpu->b",
+		"cpu->c",
+		"cpu->d",
+		"cpu->e",
+		"cpu->h",
+		"cpu->l",
+		"read8(cpu, cpu->hl)",
+		"cpu->a"};
+
+static const char* const pairs[4] = {
+		"cpu->bc", "cpu->de", "cpu->hl", "cpu->sp"};
+
+static const char* const alu_operations[8] = {"ALU_ADD",
+		"ALU_ADC",
+		"ALU_SUB",
+		"ALU_SBB",
+		"ALU_ANA",
+		"ALU_XRA",
+		"ALU_ORA",
+		"ALU_CMP"};
+
+// Returns the number of bytes read.
+static size_t load(const char* name, uint8_t* buffer, size_t size)
+{
+	FILE* file = fopen(name, "rb");
+	if (!file)
+	{
+		fprintf(stderr,
+				"Error opening %s: %s\n",
+				name,
+				strerror(errno));
+		exit(1);
+	}
+	size_t read = fread(buffer, 1, size, file);
+	if (ferror(file))
+	{
+		fprintf(stderr, "Error reading %s\n", name);
+		exit(1);
+	}
+	fclose(file);
+	return read;
+}
+
+// Reads the mask in, expanded so it can be indexed by address >> mask_shift.
+static void load_mask(const char* rom_name)
+{
+	const size_t size = strlen(rom_name) + sizeof(".mask");
+	char* mask_name	  = malloc(size);
+	if (!mask_name)
+	{
+		fprintf(stderr, "Out of memory naming the mask file\n");
+		exit(1);
+	}
+	snprintf(mask_name, size, "%s.mask", rom_name);
+	uint8_t contents[1 + MAX_MEMORY] = {0};
+	if (!load(mask_name, contents, sizeof(contents)) || contents[0] > 15)
+	{
+		fprintf(stderr, "Invalid mask file %s!\n", mask_name);
+		exit(1);
+	}
+	free(mask_name);
+	mask_shift = contents[0];
+	memcpy(rom_mask, contents + 1, MAX_MEMORY >> mask_shift);
+}
+
+// Whether the given range of memory is all write-protected, and so safe to
+// translate.
+static int in_rom(uint32_t address, uint32_t length)
+{
+	for (uint32_t byte = address; byte < address + length; ++byte)
+		if (byte >= MAX_MEMORY || !rom_mask[byte >> mask_shift])
+			return 0;
+	return 1;
+}
+
+static void add_leader(uint32_t address)
+{
+	if (address >= MAX_MEMORY || leader[address] || !in_rom(address, 1))
+		return;
+	leader[address]		  = 1;
+	worklist[worklist_size++] = address;
+}
+
+static uint16_t target(uint16_t address)
+{
+	return memory[address + 2] << 8 | memory[address + 1];
+}
+
+// Follows the code from the given address until the flow of control leaves
+// it, noting down every block start along the way.
+static void trace(uint16_t start)
+{
+	uint32_t pc = start;
+	while (pc < MAX_MEMORY && !decoded[pc])
+	{
+		const uint8_t op	       = memory[pc];
+		const struct opcode_info* info = &opcode_info[op];
+		if (!in_rom(pc, info->length)) return;
+		decoded[pc]	     = 1;
+		const uint32_t next = pc + info->length;
+		switch (info->flow)
+		{
+		case FLOW_NEXT: pc = next; continue;
+		case FLOW_JUMP:
+			if (op != 0xe9) add_leader(target(pc)); // Not PCHL.
+			return;
+		case FLOW_BRANCH:
+			add_leader(target(pc));
+			add_leader(next);
+			return;
+		case FLOW_CALL:
+			// RSTs are the only one-byte calls.
+			add_leader(info->length == 1 ? op & 0x38 : target(pc));
+			add_leader(next);
+			return;
+		case FLOW_RETURN:
+			if (op != 0xc9 && op != 0xd9) add_leader(next);
+			return;
+		case FLOW_SYNC: add_leader(next); return;
+		}
+	}
+}
+
+/* Writes out the C for one opcode.  Constant cycle counts are added to
+ * *cycles; ones that come from a handler are added to the generated code's
+ * cycles variable.  Returns 1 if the opcode ends the block, in which case
+ * it's written the return statement too.
+ */
+static int translate(FILE* out, uint16_t pc, int* cycles)
+{
+	const uint8_t op	       = memory[pc];
+	const struct opcode_info* info = &opcode_info[op];
+	const uint16_t next	       = pc + info->length;
+	const uint8_t high = op >> 6, mid = (op >> 3) & 7, low = op & 7;
+	const uint8_t pair = (op >> 4) & 3;
+	const uint8_t imm8 = memory[pc + 1];
+
+	*cycles += info->cycles;
+	if (op == 0x00) return 0;
+	if (high == 1 && op != 0x76)
+	{
+		if (mid == 6)
+			fprintf(out,
+					"\twrite8(cpu, cpu->hl, %s);\n",
+					registers[low]);
+		else
+			fprintf(out,
+					"\t%s = %s;\n",
+					registers[mid],
+					registers[low]);
+		return 0;
+	}
+	if (high == 2 || (high == 3 && low == 6))
+	{
+		if (high == 3)
+			fprintf(out,
+					"\t%s(0x%2.2x);\n",
+					alu_operations[mid],
+					imm8);
+		else
+			fprintf(out,
+					"\t%s(%s);\n",
+					alu_operations[mid],
+					registers[low]);
+		return 0;
+	}
+	if (high == 0)
+	{
+		switch (low)
+		{
+		case 1:
+			if (op & 8)
+				fprintf(out, "\tdad(cpu, %s);\n", pairs[pair]);
+			else
+				fprintf(out,
+						"\t%s = 0x%4.4x;\n",
+						pairs[pair],
+						target(pc));
+			return 0;
+		case 2:
+			if (op == 0x0a || op == 0x1a) // LDAX
+				fprintf(out,
+						"\tcpu->a = read8(cpu, %s);\n",
+						pairs[pair]);
+			else if (op == 0x02 || op == 0x12) // STAX
+				fprintf(out,
+						"\twrite8(cpu, %s, cpu->a);\n",
+						pairs[pair]);
+			else if (op == 0x3a) // LDA
+				fprintf(out,
+						"\tcpu->a = "
+						"read8(cpu, 0x%4.4x);\n",
+						target(pc));
+			else if (op == 0x32) // STA
+				fprintf(out,
+						"\twrite8(cpu, 0x%4.4x, "
+						"cpu->a);\n",
+						target(pc));
+			else
+				break;
+			return 0;
+		case 3:
+			fprintf(out,
+					"\t%s%s;\n",
+					op & 8 ? "--" : "++",
+					pairs[pair]);
+			return 0;
+		case 4:
+		case 5:
+			if (mid == 6)
+				fprintf(out,
+						"\twrite8(cpu, cpu->hl, "
+						"inr_dcr(cpu, %s, 0x%2.2x));\n",
+						registers[mid],
+						low == 4 ? 0x01 : 0xff);
+			else
+				fprintf(out,
+						"\t%s = "
+						"inr_dcr(cpu, %s, 0x%2.2x);\n",
+						registers[mid],
+						registers[mid],
+						low == 4 ? 0x01 : 0xff);
+			return 0;
+		case 6:
+			if (mid == 6)
+				fprintf(out,
+						"\twrite8(cpu, cpu->hl, "
+						"0x%2.2x);\n",
+						imm8);
+			else
+				fprintf(out,
+						"\t%s = 0x%2.2x;\n",
+						registers[mid],
+						imm8);
+			return 0;
+		}
+	}
+	if (op == 0xeb)
+	{
+		fprintf(out, "\txchg_de_hl(cpu);\n");
+		return 0;
+	}
+	if (high == 3 && low == 5 && pair != 3 && !(op & 8)) // PUSH.
+	{
+		fprintf(out, "\tpush16(cpu, %s);\n", pairs[pair]);
+		return 0;
+	}
+	if (high == 3 && low == 1 && pair != 3 && !(op & 8)) // POP.
+	{
+		fprintf(out, "\t%s = pop16(cpu);\n", pairs[pair]);
+		return 0;
+	}
+
+	switch (info->flow)
+	{
+	case FLOW_JUMP:
+		if (op == 0xe9) break; // PCHL.
+		fprintf(out,
+				"\tcpu->pc = 0x%4.4x;\n"
+				"\treturn cycles + %d;\n",
+				target(pc),
+				*cycles);
+		return 1;
+	case FLOW_BRANCH:
+		fprintf(out,
+				"\tcpu->pc = MET(%d) ? 0x%4.4x : 0x%4.4x;\n"
+				"\treturn cycles + %d;\n",
+				mid,
+				target(pc),
+				next,
+				*cycles);
+		return 1;
+	case FLOW_CALL:
+		if (op == 0xcd || op == 0xdd || op == 0xed || op == 0xfd
+				|| info->length == 1)
+		{
+			fprintf(out,
+					"\tpush16(cpu, 0x%4.4x);\n"
+					"\tcpu->pc = 0x%4.4x;\n"
+					"\treturn cycles + %d;\n",
+					next,
+					info->length == 1 ? op & 0x38
+							   : target(pc),
+					*cycles);
+			return 1;
+		}
+		fprintf(out,
+				"\tif (MET(%d))\n"
+				"\t{\n"
+				"\t\tpush16(cpu, 0x%4.4x);\n"
+				"\t\tcpu->pc = 0x%4.4x;\n"
+				"\t\treturn cycles + %d;\n"
+				"\t}\n"
+				"\tcpu->pc = 0x%4.4x;\n"
+				"\treturn cycles + %d;\n",
+				mid,
+				next,
+				target(pc),
+				*cycles - info->cycles + info->cycles_taken,
+				next,
+				*cycles);
+		return 1;
+	case FLOW_RETURN:
+		if (op == 0xc9 || op == 0xd9)
+		{
+			fprintf(out,
+					"\tcpu->pc = pop16(cpu);\n"
+					"\treturn cycles + %d;\n",
+					*cycles);
+			return 1;
+		}
+		fprintf(out,
+				"\tif (MET(%d))\n"
+				"\t{\n"
+				"\t\tcpu->pc = pop16(cpu);\n"
+				"\t\treturn cycles + %d;\n"
+				"\t}\n"
+				"\tcpu->pc = 0x%4.4x;\n"
+				"\treturn cycles + %d;\n",
+				mid,
+				*cycles - info->cycles + info->cycles_taken,
+				next,
+				*cycles);
+		return 1;
+	default: break;
+	}
+
+	// Everything else goes to its handler, with the PC already moved on,
+	// as the interpreter would have it.
+	*cycles -= info->cycles;
+	fprintf(out,
+			"\tcpu->pc = 0x%4.4x;\n"
+			"\tcycles += CALL_HANDLER(0x%2.2x, 0x%4.4x);\n",
+			next,
+			op,
+			pc);
+	if (info->flow == FLOW_NEXT) return 0;
+	fprintf(out, "\treturn cycles + %d;\n", *cycles);
+	return 1;
+}
+
+static void translate_block(FILE* out, uint16_t start)
+{
+	fprintf(out,
+			"static int block_%4.4x(struct cpu_state* cpu)\n"
+			"{\n"
+			"\tint cycles = 0;\n",
+			start);
+	int constant_cycles = 0;
+	uint32_t pc	    = start;
+	for (;;)
+	{
+		const uint8_t length = opcode_info[memory[pc]].length;
+		char text[32];
+		disassemble(memory + pc, text, sizeof(text));
+		fprintf(out, "\t// 0x%4.4x\t%s\n", (unsigned) pc, text);
+		if (translate(out, pc, &constant_cycles)) break;
+		pc += length;
+		// We stop short of the next block, and of anything we can't
+		// translate.
+		if (pc >= MAX_MEMORY || leader[pc] || !decoded[pc])
+		{
+			fprintf(out,
+					"\tcpu->pc = 0x%4.4x;\n"
+					"\treturn cycles + %d;\n",
+					(uint16_t) pc,
+					constant_cycles);
+			break;
+		}
+	}
+	fprintf(out, "}\n\n");
+}
+
+int main(int argc, char** argv)
+{
+	if (argc != 3)
+	{
+		fprintf(stderr, "Usage: %s ROM_FILE OUTPUT_FILE\n", *argv);
+		return 1;
+	}
+	load(argv[1], memory, MAX_MEMORY);
+	load_mask(argv[1]);
+
+	// Reset, and the RSTs, which is where interrupts go.
+	for (int vector = 0; vector < 0x40; vector += 8) add_leader(vector);
+	while (worklist_size) trace(worklist[--worklist_size]);
+
+	FILE* out = fopen(argv[2], "w");
+	if (!out)
+	{
+		fprintf(stderr,
+				"Error opening %s: %s\n",
+				argv[2],
+				strerror(errno));
+		return 1;
+	}
+	const char* rom_name = strrchr(argv[1], '/');
+	rom_name	     = rom_name ? rom_name + 1 : argv[1];
+	fprintf(out,
+			"/* Generated by tools/recompile.c from %s.  "
+			"Do not edit. */\n\n"
+			"#include \"recompiled_ops.h\"\n\n",
+			rom_name);
+
+	int block_count = 0;
+	for (uint32_t address = 0; address < MAX_MEMORY; ++address)
+		if (leader[address] && decoded[address])
+		{
+			translate_block(out, address);
+			++block_count;
+		}
+
+	fprintf(out, "static const recompiled_block blocks[MAX_MEMORY] = {\n");
+	for (uint32_t address = 0; address < MAX_MEMORY; ++address)
+		if (leader[address] && decoded[address])
+			fprintf(out,
+					"\t[0x%4.4x] = block_%4.4x,\n",
+					address,
+					address);
+	fprintf(out,
+			"};\n\n"
+			"const struct recompiled_rom %s = {\n"
+			"\t.checksum = 0x%8.8x,\n"
+			"\t.block_count = %d,\n"
+			"\t.blocks = blocks,\n"
+			"};\n",
+			RECOMPILED_ROM_SYMBOL,
+			recompiled_checksum(memory, rom_mask, mask_shift),
+			block_count);
+	if (fclose(out))
+	{
+		fprintf(stderr, "Error writing %s\n", argv[2]);
+		return 1;
+	}
+	return 0;
+}